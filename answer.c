@@ -0,0 +1,560 @@
+/******************************************************************************
+*     File Name           :     answer.c                                      *
+*     Description         :     Queries answered the way tsl asks them, from  *
+*                                 the planner, a server or a timetable, and   *
+*                                 printed as they complete.                   *
+******************************************************************************/
+#include <poll.h>               // poll
+#include <time.h>               // time, localtime_r
+#include "answer.h"
+#include "uring.h"
+#include "server.h"
+#include "pool.h"
+/*****************************************************************************/
+/* Scratch space of a thread answering from the timetable */
+typedef struct tt_worker {
+	tt_search *search;
+	triplist tl;
+	tsl_buf strings;
+	tsl_writer text;			// Journeys printed in the current window.
+	tsl_metrics *metrics;		// Timings of its queries, NULL for none.
+} tt_worker;
+typedef struct tt_answer {
+	int worker;					// Thread whose text holds the journeys.
+	int off, len;				// Where in the text they were printed.
+	int status;					// Number of journeys or an error number.
+} tt_answer;
+typedef struct tt_batch {
+	const tsl_output *out;
+	const query *queries;		// Queries of the current window.
+	tt_worker *workers;
+	tt_answer *answers;
+	int when;
+} tt_batch;
+/*****************************************************************************/
+int parse_when(const char *arg) {
+	time_t now = time(NULL);
+	struct tm tm;
+	int h, m, n = -1;
+	localtime_r(&now, &tm);
+	if(!strcmp(arg, "now")) {
+		h = tm.tm_hour;
+		m = tm.tm_min;
+	} else if(sscanf(arg, "%2d:%2d%n", &h, &m, &n) != 2 || arg[n]
+			|| h < 0 || h > 23 || m < 0 || m > 59) {
+		return -1;
+	}
+	return (now+tm.tm_gmtoff)/(24*60*60)*24*60 + h*60 + m;
+}
+/*****************************************************************************/
+static void record(tsl_output *out, tsl_timing *t, int status) {
+	timing_end(t);
+	if(out->metrics) {
+		metrics_add(out->metrics, t, status);
+	}
+}
+/*****************************************************************************/
+static int show(tsl_output *out, tsl_timing *t, const char *origin,
+		const char *dest, const tsl_result *r) {
+	/* Trips are chosen and ordered on their decoded times alone, into
+	 * space kept for the next result */
+	int i, len, retval = E_SUCCESS, *selected;
+	long bytes = out->writer.bytes;
+	out->selected.len = 0;
+	if(buf_reserve(&out->selected, sizeof(int)*r->trips_len)) {
+		return E_UNKNOWN;
+	}
+	selected = (int*)out->selected.data;
+	len = select_trips(r->trips, r->trips_len, &out->filter, out->order,
+			selected);
+	timing_lap(t, STAGE_SELECT);
+	if(len >= 0) {
+		retval = writer_result(&out->writer, origin, dest, r->strings,
+				r->trips, r->edges, selected, len);
+		timing_lap(t, STAGE_OUTPUT);
+	}
+	t->bytes_out += out->writer.bytes - bytes;
+	t->trips = r->trips_len;
+	for(i = 0; i < r->trips_len; i++) {
+		t->edges += r->trips[i].edges_len;
+	}
+	return retval ? retval : len;
+}
+/*****************************************************************************/
+static int pick(const int *marks, const int *from, int len, int mark,
+		int *picked) {
+	int i, n = 0;
+	for(i = 0; i < len; i++) {
+		if(marks[i] == mark) {
+			picked[n++] = from ? from[i] : i;
+		}
+	}
+	return n;
+}
+/*****************************************************************************/
+static int show_changes(tsl_output *out, tsl_timing *t, tsl_watch *w,
+		const char *origin, const char *dest, const tsl_result *r) {
+	/* The first result is printed whole, later ones only where the trips
+	 * printed differ from the last ones. A binary record has no marks, so
+	 * it is the whole result again */
+	static const int kinds[] = {TRIP_CHANGED, TRIP_ADDED};
+	const trip_block *tb = w->last;
+	int i, len, n, retval = E_SUCCESS, *selected, *marks, *old_marks, *picked;
+	int old_len = tb ? tb->trips_len : 0, changes;
+	long bytes = out->writer.bytes;
+	out->selected.len = 0;
+	if(buf_reserve(&out->selected, sizeof(int)*(3*r->trips_len+2*old_len))) {
+		return E_UNKNOWN;
+	}
+	selected = (int*)out->selected.data;
+	marks = selected+r->trips_len;
+	old_marks = marks+r->trips_len;
+	picked = old_marks+old_len;
+	if((len = select_trips(r->trips, r->trips_len, &out->filter, out->order,
+			selected)) < 0) {
+		return len;
+	}
+	timing_lap(t, STAGE_SELECT);
+	changes = diff_trips(tb, old_marks, r->strings, r->trips, r->edges,
+			selected, len, marks);
+	if(!tb || (changes && out->writer.format == WRITE_BINARY)) {
+		retval = writer_result(&out->writer, origin, dest, r->strings,
+				r->trips, r->edges, selected, len);
+	} else if(changes) {
+		out->writer.change = TRIP_REMOVED;
+		n = pick(old_marks, NULL, old_len, TRIP_REMOVED, picked);
+		if(n) {
+			retval = writer_result(&out->writer, origin, dest,
+					TRIP_BLOCK_POOL(tb), TRIP_BLOCK_TRIPS(tb),
+					TRIP_BLOCK_EDGES(tb), picked, n);
+		}
+		for(i = 0; !retval && i < 2; i++) {
+			out->writer.change = kinds[i];
+			if((n = pick(marks, selected, len, kinds[i], picked))) {
+				retval = writer_result(&out->writer, origin, dest, r->strings,
+						r->trips, r->edges, picked, n);
+			}
+		}
+		out->writer.change = TRIP_SAME;
+	}
+	timing_lap(t, STAGE_OUTPUT);
+	/* The next fetch is only conditional once the diff base is current */
+	if(!retval && (!tb || changes)) {
+		retval = tsl_watch_keep(w, r, selected, len);
+	} else if(!retval) {
+		tsl_watch_validate(w);
+	}
+	t->bytes_out += out->writer.bytes - bytes;
+	t->trips = r->trips_len;
+	for(i = 0; i < r->trips_len; i++) {
+		t->edges += r->trips[i].edges_len;
+	}
+	return retval ? retval : len;
+}
+/*****************************************************************************/
+static void revalidate(tsl_client *client, tsl_output *out,
+		const char *origin, const char *dest) {
+	/* The stale result is already printed, so the refresh is left to a
+	 * child that does not hold on to the output */
+	tsl_result result;
+	writer_flush(&out->writer);
+	fflush(stdout);
+	if(fork() == 0) {
+		close(STDOUT_FILENO);
+		close(STDERR_FILENO);
+		client->priority = PRIORITY_REFRESH;
+		tsl_fetch(client, origin, dest, &result);
+		_exit(0);
+	}
+}
+/*****************************************************************************/
+int tsl_follow(tsl_output *out, tsl_client *client, const char *origin,
+		const char *dest, int interval, int stop_fd) {
+	struct pollfd pfd = {stop_fd, POLLIN, 0};
+	char origin_id[MESSAGE_SIZE], dest_id[MESSAGE_SIZE];
+	tsl_result result;
+	tsl_watch w;
+	int retval = E_SUCCESS;
+
+	if(out->sites) {
+		if(tsl_resolve(out, origin, origin_id)
+				|| tsl_resolve(out, dest, dest_id)) {
+			return E_STATION;
+		}
+		origin = origin_id;
+		dest = dest_id;
+	}
+	tsl_watch_init(&w);
+	do {
+		timing_begin(&out->timing);
+		if((retval = tsl_watch_fetch(client, &w, origin, dest, &result)) > 0) {
+			retval = show_changes(out, &out->timing, &w, origin, dest,
+					&result);
+		}
+		record(out, &out->timing, retval);
+		if(retval < 0) {
+			fprintf(stderr, "tsl: %s -> %s failed (%d)\n", origin, dest,
+					retval);
+		}
+		writer_flush(&out->writer);
+	} while(!poll(&pfd, 1, interval*1000));
+	tsl_watch_free(&w);
+	return retval;
+}
+/*****************************************************************************/
+static void print_result(void *arg, const query *q, char *js, int len,
+		tsl_timing *t) {
+	tsl_output *out = arg;
+	tsl_result result;
+	if(len >= 0) {
+		len = scan_response(out->cache, &out->tl, t, q->origin, q->dest, &js,
+				len);
+	}
+	if(len >= 0) {
+		result = (tsl_result){js, out->tl.trips, out->tl.trips_len,
+				out->tl.edges, 0};
+		len = show(out, t, q->origin, q->dest, &result);
+	}
+	if(len < 0) {
+		writer_result(&out->writer, q->origin, q->dest, NULL, NULL, NULL,
+				NULL, len);
+	}
+	/* Results are streamed to whoever reads them as they complete */
+	writer_flush(&out->writer);
+	record(out, t, len);
+	if(len < 0) {
+		fprintf(stderr, "tsl: %s -> %s failed (%d)\n", q->origin, q->dest, len);
+	}
+}
+/*****************************************************************************/
+static int ask_timetable(tsl_output *out, const char *origin,
+		const char *dest) {
+	/* Journeys leave after -a, or now */
+	tsl_result result;
+	int len, when = out->filter.depart_after >= 0 ? out->filter.depart_after
+			: parse_when("now");
+	len = timetable_query(out->tt, origin, dest, when, &out->tl, &out->strings);
+	timing_lap(&out->timing, STAGE_SEARCH);
+	if(len >= 0) {
+		result = (tsl_result){out->strings.data, out->tl.trips,
+				out->tl.trips_len, out->tl.edges, 0};
+		len = show(out, &out->timing, origin, dest, &result);
+	}
+	record(out, &out->timing, len);
+	return len;
+}
+/*****************************************************************************/
+static void answer_task(void *arg, int worker, int task) {
+	tt_batch *b = arg;
+	tt_worker *w = &b->workers[worker];
+	tt_answer *a = &b->answers[task];
+	const query *q = &b->queries[task];
+	int len, selected[TT_JOURNEYS];
+	tsl_timing t;
+	timing_begin(&t);
+	len = tt_search_query(w->search, q->origin, q->dest, b->when, &w->tl,
+			&w->strings);
+	timing_lap(&t, STAGE_SEARCH);
+	if(len >= 0) {
+		t.trips = w->tl.trips_len;
+		t.edges = w->tl.edges_len;
+		len = select_trips(w->tl.trips, w->tl.trips_len, &b->out->filter,
+				b->out->order, selected);
+		timing_lap(&t, STAGE_SELECT);
+	}
+	a->worker = worker;
+	a->off = w->text.buf.len;
+	if(writer_result(&w->text, q->origin, q->dest, w->strings.data,
+			w->tl.trips, w->tl.edges, selected, len)) {
+		w->text.buf.len = a->off;
+		len = len < 0 ? len : E_UNKNOWN;
+	}
+	a->len = w->text.buf.len - a->off;
+	a->status = len;
+	if(w->metrics) {
+		timing_lap(&t, STAGE_OUTPUT);
+		t.bytes_out = a->len;
+		timing_end(&t);
+		metrics_add(w->metrics, &t, len);
+	}
+}
+/*****************************************************************************/
+static int timetable_batch(tsl_output *out, const query *queries,
+		int num_queries) {
+	/* Windows of queries are searched in parallel, then printed in the
+	 * order they were asked from what each thread printed to memory */
+	tt_batch b = {out, queries, NULL, NULL, 0};
+	int threads = out->threads;
+	tsl_pool *pool = pool_new(threads);
+	tt_answer *a;
+	tt_worker *w;
+	int i, n, start, failed = 0, retval = E_SUCCESS;
+	b.when = out->filter.depart_after >= 0 ? out->filter.depart_after
+			: parse_when("now");
+	b.workers = calloc(threads, sizeof(tt_worker));
+	b.answers = malloc(sizeof(tt_answer)*POOL_WINDOW);
+	if(!pool || !b.workers || !b.answers) {
+		retval = E_UNKNOWN;
+	}
+	for(i = 0; !retval && i < threads; i++) {
+		w = &b.workers[i];
+		triplist_init(&w->tl);
+		buf_init(&w->strings);
+		if(!(w->search = tt_search_new(out->tt))
+				|| writer_init(&w->text, -1, out->writer.format)) {
+			retval = E_UNKNOWN;
+		}
+		if(out->metrics && !retval) {
+			if(!(w->metrics = malloc(sizeof(tsl_metrics)))) {
+				retval = E_UNKNOWN;
+			} else {
+				metrics_init(w->metrics);
+			}
+		}
+		w->text.headers = out->writer.headers;
+	}
+	for(start = 0; !retval && start < num_queries; start += POOL_WINDOW) {
+		n = num_queries-start < POOL_WINDOW ? num_queries-start : POOL_WINDOW;
+		b.queries = queries+start;
+		for(i = 0; i < threads; i++) {
+			b.workers[i].text.buf.len = 0;
+		}
+		pool_run(pool, n, answer_task, &b);
+		for(i = 0; i < n; i++) {
+			a = &b.answers[i];
+			writer_put(&out->writer, b.workers[a->worker].text.buf.data+a->off,
+					a->len);
+			if(a->status < 0) {
+				writer_flush(&out->writer);
+				fprintf(stderr, "tsl: %s -> %s failed (%d)\n",
+						b.queries[i].origin, b.queries[i].dest, a->status);
+				failed++;
+			}
+		}
+		writer_flush(&out->writer);
+	}
+	for(i = 0; b.workers && i < threads; i++) {
+		w = &b.workers[i];
+		if(w->search) {
+			tt_search_free(w->search);
+		}
+		if(w->metrics) {
+			metrics_merge(out->metrics, w->metrics);
+			free(w->metrics);
+		}
+		writer_free(&w->text);
+		triplist_free(&w->tl);
+		buf_free(&w->strings);
+	}
+	free(b.workers);
+	free(b.answers);
+	if(pool) {
+		pool_free(pool);
+	}
+	return retval ? retval : failed ? -1 : 0;
+}
+/*****************************************************************************/
+int tsl_output_init(tsl_output *out, int fd, int format) {
+	memset(out, 0, sizeof(*out));
+	out->order = TRIP_ORDER_NONE;
+	out->max_inflight = BATCH_INFLIGHT;
+	out->threads = sysconf(_SC_NPROCESSORS_ONLN);
+	trip_filter_init(&out->filter);
+	triplist_init(&out->tl);
+	buf_init(&out->strings);
+	buf_init(&out->selected);
+	return writer_init(&out->writer, fd, format);
+}
+/*****************************************************************************/
+void tsl_output_free(tsl_output *out) {
+	writer_flush(&out->writer);
+	writer_free(&out->writer);
+	if(out->metrics) {
+		metrics_print(stderr, out->metrics);
+		free(out->metrics);
+		if(out->sched) {
+			sched_print(stderr, out->sched);
+		}
+	}
+	if(out->sched) {
+		sched_free(out->sched);
+	}
+	triplist_free(&out->tl);
+	buf_free(&out->strings);
+	buf_free(&out->selected);
+	if(out->tt) {
+		timetable_close(out->tt);
+	}
+	if(out->sites) {
+		site_close(out->sites);
+	}
+}
+/*****************************************************************************/
+int tsl_resolve(const tsl_output *out, const char *text, char *name) {
+	/* The planner is asked for site ids, the timetable for names, and
+	 * what was meant is suggested when it is not clear */
+	site match, matches[SITE_MATCHES];
+	int i, len;
+	if(!site_resolve(out->sites, text, &match)) {
+		snprintf(name, MESSAGE_SIZE, "%s", out->tt ? match.name : match.id);
+		return E_SUCCESS;
+	}
+	len = site_complete(out->sites, text, matches, SITE_MATCHES);
+	fprintf(stderr, "tsl: %s: no single station of that name%s\n", text,
+			len > 0 ? ", did you mean" : "");
+	for(i = 0; i < len; i++) {
+		fprintf(stderr, "    %s\n", matches[i].name);
+	}
+	return E_STATION;
+}
+/*****************************************************************************/
+int tsl_resolve_queries(const tsl_output *out, query *queries,
+		int num_queries) {
+	/* Queries that can not be resolved are dropped before any is sent */
+	char origin[MESSAGE_SIZE], dest[MESSAGE_SIZE];
+	int i, len = 0;
+	for(i = 0; i < num_queries; i++) {
+		if(tsl_resolve(out, queries[i].origin, origin)
+				|| tsl_resolve(out, queries[i].dest, dest)) {
+			free(queries[i].origin);
+			free(queries[i].dest);
+			continue;
+		}
+		free(queries[i].origin);
+		free(queries[i].dest);
+		queries[len].origin = strdup(origin);
+		queries[len].dest = strdup(dest);
+		if(!queries[len].origin || !queries[len].dest) {
+			free(queries[len].origin);
+			free(queries[len].dest);
+			continue;
+		}
+		len++;
+	}
+	return len;
+}
+/*****************************************************************************/
+int tsl_ask(tsl_output *out, tsl_client *client, const char *origin,
+		const char *dest) {
+	char origin_id[MESSAGE_SIZE], dest_id[MESSAGE_SIZE];
+	tsl_result result;
+	int retval;
+
+	if(out->sites) {
+		if(tsl_resolve(out, origin, origin_id)
+				|| tsl_resolve(out, dest, dest_id)) {
+			return E_STATION;
+		}
+		origin = origin_id;
+		dest = dest_id;
+	}
+	if(out->server) {
+		query q = {(char*)origin, (char*)dest};
+		writer_flush(&out->writer);
+		return query_server(out->server, &q, 1, 0);
+	}
+	timing_begin(&out->timing);
+	if(out->tt) {
+		return ask_timetable(out, origin, dest);
+	}
+	/* Cached trips are printed from the cache, stale ones refreshed after */
+	retval = tsl_query(client, origin, dest, &result);
+	if(retval >= 0) {
+		retval = show(out, &out->timing, origin, dest, &result);
+	}
+	record(out, &out->timing, retval);
+	if(retval >= 0 && result.stale) {
+		revalidate(client, out, origin, dest);
+	}
+	return retval;
+}
+/*****************************************************************************/
+int tsl_ask_file(tsl_output *out, tsl_client *client, const char *path) {
+	FILE *in = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	query *queries, *misses;
+	tsl_result result;
+	int i, len, retval, num_queries, num_misses = 0, dropped = 0;
+
+	if(!in) {
+		perror(path);
+		return E_UNKNOWN;
+	}
+	out->writer.headers = 1;
+	num_queries = read_queries(in, &queries);
+	if(in != stdin) {
+		fclose(in);
+	}
+	if(num_queries < 0) {
+		return num_queries;
+	}
+	if(out->sites) {
+		dropped = num_queries;
+		num_queries = tsl_resolve_queries(out, queries, num_queries);
+		dropped -= num_queries;
+	}
+	if(out->server) {
+		writer_flush(&out->writer);
+		retval = query_server(out->server, queries, num_queries, 1);
+		free_queries(queries, num_queries);
+		return retval || dropped ? -1 : 0;
+	}
+	if(out->tt) {
+		retval = timetable_batch(out, queries, num_queries);
+		free_queries(queries, num_queries);
+		return retval ? retval : dropped ? -1 : 0;
+	}
+	if(!(misses = malloc(sizeof(query)*(num_queries+1)))) {
+		free_queries(queries, num_queries);
+		return E_UNKNOWN;
+	}
+	/* Fresh entries are printed right away, stale ones are fetched again */
+	for(i = 0; i < num_queries; i++) {
+		timing_begin(&out->timing);
+		if(tsl_lookup(client, queries[i].origin, queries[i].dest, &result)
+				== CACHE_FRESH) {
+			if((len = show(out, &out->timing, queries[i].origin,
+					queries[i].dest, &result)) < 0) {
+				writer_result(&out->writer, queries[i].origin, queries[i].dest,
+						NULL, NULL, NULL, NULL, len);
+			}
+			record(out, &out->timing, len);
+		} else {
+			misses[num_misses++] = queries[i];
+		}
+	}
+	writer_flush(&out->writer);
+#ifdef TSL_URING
+	if(out->uring) {
+		retval = run_batch_uring(misses, num_misses, &client->config,
+				out->max_inflight, print_result, out);
+	} else
+#endif
+	retval = run_batch(misses, num_misses, &client->config, out->max_inflight,
+			print_result, out);
+	free(misses);
+	free_queries(queries, num_queries);
+	return retval || dropped ? -1 : 0;
+}
+/*****************************************************************************/
+int tsl_complete(tsl_output *out, const char *text) {
+	/* Type-ahead, printed through the writer like any result */
+	site matches[SITE_MATCHES];
+	char line[MESSAGE_SIZE];
+	int i, n, len, retval = E_SUCCESS;
+	if(!out->sites) {
+		return E_STATION;
+	}
+	if((len = site_complete(out->sites, text, matches, SITE_MATCHES)) < 0) {
+		return len;
+	}
+	for(i = 0; !retval && i < len; i++) {
+		n = snprintf(line, sizeof(line), "%s\t%s\n", matches[i].name,
+				matches[i].id);
+		retval = writer_put(&out->writer, line, n < (int)sizeof(line) ? n
+				: (int)sizeof(line)-1);
+	}
+	if(!retval) {
+		retval = writer_flush(&out->writer);
+	}
+	return retval ? retval : len;
+}
@@ -0,0 +1,189 @@
+/******************************************************************************
+*     File Name           :     answer.h                                      *
+*     Description         :     Queries answered the way tsl asks them, from  *
+*                                 the planner, a server or a timetable, and   *
+*                                 printed as they complete.                   *
+******************************************************************************/
+#ifndef ANSWER_H
+#define ANSWER_H
+#include "client.h"             // tsl_client, tsl_result
+#include "batch.h"              // query
+#include "timetable.h"          // timetable
+#include "sites.h"              // site_index
+#include "writer.h"             // tsl_writer
+/******************************************************************************
+* Struct: tsl_output                                                          *
+* ------------------                                                          *
+*   Where and how results are printed, and what answers the queries. Set the  *
+*   fields after tsl_output_init, everything it points to is freed with       *
+*   tsl_output_free but the cache.                                            *
+*                                                                             *
+*   tl, strings, selected: Trips, their strings and the indexes of those      *
+*                          printed, reused by every result.                   *
+*   cache: Where results of the planner are stored, NULL for none.            *
+*   filter: Trips that are printed.                                           *
+*   order: An enum trip_order they are printed in.                            *
+*   tt: Timetable that answers queries offline, NULL for the planner.         *
+*   sites: Index names are resolved with before they are asked, NULL to ask   *
+*          them as typed.                                                     *
+*   server: Socket of a server that is asked instead, NULL for none.          *
+*   writer: Where results are printed.                                        *
+*   timing: Timing of the query being answered.                               *
+*   metrics: Timings of all queries, NULL for none.                           *
+*   sched: Scheduler of the requests, printed with the metrics, or NULL.      *
+*   max_inflight: Largest number of concurrent queries of a batch.            *
+*   uring: Batches are sent with io_uring instead of epoll.                   *
+*   threads: Threads that search the timetable for a batch.                   *
+******************************************************************************/
+typedef struct tsl_output {
+	triplist tl; tsl_buf strings; tsl_buf selected;
+	const tsl_cache *cache;
+	trip_filter filter; int order;
+	timetable *tt;
+	site_index *sites;
+	const char *server;
+	tsl_writer writer;
+	tsl_timing timing;
+	tsl_metrics *metrics;
+	tsl_sched *sched;
+	int max_inflight; int uring; int threads;
+} tsl_output;
+/******************************************************************************
+* Function: parse_when                                                        *
+* --------------------                                                        *
+*   Reads a time of today in the minutes of station_ref.when, as -a and -r    *
+*   take it.                                                                  *
+*                                                                             *
+*   arg: "HH:MM" or "now".                                                    *
+*                                                                             *
+*   Returns: Minutes since the epoch in local time.                           *
+*            -1 when arg is not a time.                                       *
+******************************************************************************/
+int parse_when(const char *arg);
+/******************************************************************************
+* Function: tsl_output_init                                                   *
+* -------------------------                                                   *
+*   Initializes an output that prints every trip, as the planner orders them, *
+*   and asks the planner without a cache.                                     *
+*                                                                             *
+*   out: Pointer to the output.                                               *
+*   fd: Where results are written.                                            *
+*   format: An enum writer_format.                                            *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int tsl_output_init(tsl_output *out, int fd, int format);
+/******************************************************************************
+* Function: tsl_output_free                                                   *
+* -------------------------                                                   *
+*   Writes out what is buffered, prints the metrics and the scheduler to      *
+*   stderr when there are metrics, and frees the output.                      *
+*                                                                             *
+*   out: Pointer to the output.                                               *
+******************************************************************************/
+void tsl_output_free(tsl_output *out);
+/******************************************************************************
+* Function: tsl_resolve                                                       *
+* ---------------------                                                       *
+*   Resolves a name with the sites of an output, to the id the planner takes  *
+*   or to the name the timetable knows. When it is not clear which site is    *
+*   meant the closest ones are suggested on stderr.                           *
+*                                                                             *
+*   out: Output whose sites are used.                                         *
+*   text: The name as typed.                                                  *
+*   name: Buffer of MESSAGE_SIZE bytes where the resolved name is stored.     *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_STATION when no single site is meant.                          *
+******************************************************************************/
+int tsl_resolve(const tsl_output *out, const char *text, char *name);
+/******************************************************************************
+* Function: tsl_resolve_queries                                               *
+* -----------------------------                                               *
+*   Resolves the names of queries in place, queries that can not be resolved  *
+*   are freed and dropped.                                                    *
+*                                                                             *
+*   out: Output whose sites are used.                                         *
+*   queries: Array of queries read by read_queries.                           *
+*   num_queries: Number of queries in the array.                              *
+*                                                                             *
+*   Returns: Number of queries left at the start of the array.                *
+******************************************************************************/
+int tsl_resolve_queries(const tsl_output *out, query *queries,
+		int num_queries);
+/******************************************************************************
+* Function: tsl_ask                                                           *
+* -----------------                                                           *
+*   Answers one query and prints it. Names are resolved first when there are  *
+*   sites. A stale result of the cache is printed and then refreshed by a     *
+*   child process, so the answer does not wait for the planner.               *
+*                                                                             *
+*   out: Output the query is answered and printed with.                       *
+*   client: Client the planner is asked with.                                 *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*                                                                             *
+*   Returns: Number of trips printed, 0 when a server printed them.           *
+*            E_STATION when a name can not be resolved.                       *
+*            Any error number of tsl_query, timetable_query or query_server.  *
+******************************************************************************/
+int tsl_ask(tsl_output *out, tsl_client *client, const char *origin,
+		const char *dest);
+/******************************************************************************
+* Function: tsl_follow                                                        *
+* --------------------                                                        *
+*   Asks the planner the same query every interval over the kept-alive        *
+*   connection. The first result is printed whole, later ones only where the  *
+*   trips printed differ. A failed query is reported on stderr and asked      *
+*   again at the next tick.                                                   *
+*                                                                             *
+*   out: Output the results are printed with.                                 *
+*   client: Client the planner is asked with.                                 *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*   interval: Seconds between queries.                                        *
+*   stop_fd: Descriptor that becomes readable when to stop, it is not read.   *
+*                                                                             *
+*   Returns: Number of trips of the last result.                              *
+*            E_STATION when a name can not be resolved.                       *
+*            The error number of the last query when it failed.               *
+******************************************************************************/
+int tsl_follow(tsl_output *out, tsl_client *client, const char *origin,
+		const char *dest, int interval, int stop_fd);
+/******************************************************************************
+* Function: tsl_ask_file                                                      *
+* ----------------------                                                      *
+*   Answers a batch of queries, read as read_queries reads them, and prints   *
+*   each result led by its header. Fresh results of the cache are             *
+*   printed first, the rest as the planner answers them. A timetable is       *
+*   searched by out->threads threads and its results printed in the order     *
+*   they were asked.                                                          *
+*                                                                             *
+*   out: Output the queries are answered and printed with.                    *
+*   client: Client whose configuration the batch is sent with.                *
+*   path: File of the queries, "-" for stdin.                                 *
+*                                                                             *
+*   Returns: E_SUCCESS when every query was answered.                         *
+*            E_UNKNOWN when a query failed or could not be resolved, or the   *
+*            file can not be read.                                            *
+*            Any error number of read_queries.                                *
+******************************************************************************/
+int tsl_ask_file(tsl_output *out, tsl_client *client, const char *path);
+/******************************************************************************
+* Function: tsl_complete                                                      *
+* ----------------------                                                      *
+*   Prints the sites of what has been typed so far, one "<name>\t<id>" per    *
+*   line, as site_complete finds them.                                        *
+*                                                                             *
+*   out: Output whose sites are searched and writer is printed to.            *
+*   text: What has been typed.                                                *
+*                                                                             *
+*   Returns: Number of sites printed.                                         *
+*            E_STATION when there are no sites or text does not fit a key.    *
+*            E_SEND when the writer can not write them.                       *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int tsl_complete(tsl_output *out, const char *text);
+/*****************************************************************************/
+#endif /* ANSWER_H */
@@ -0,0 +1,679 @@
+/******************************************************************************
+*     File Name           :     batch.c                                       *
+*     Description         :     Runs many queries concurrently on an epoll    *
+*                                 event loop.                                 *
+******************************************************************************/
+#include <errno.h>              // errno
+#include <ctype.h>              // isspace
+#include <poll.h>               // poll
+#include <sys/epoll.h>          // epoll_create1, epoll_ctl, epoll_wait
+#include "batch.h"
+/*****************************************************************************/
+#define BATCH_EVENTS 64 		// Events handled per epoll_wait
+#define BATCH_READ 16384 		// Bytes read at a time outside the body
+/* Slot states */
+enum {
+	B_IDLE,						// No query.
+	B_RESOLVING,				// Waiting for the address of the server.
+	B_CONNECTING,				// Waiting for connect to finish.
+	B_SENDING,					// Writing the request.
+	B_RECEIVING					// Reading the response.
+};
+/*****************************************************************************/
+typedef struct slot {
+	tsl_conn conn;				// Kept-alive connection of the slot.
+	int state;					// See slot states.
+	const query *q;				// Query being served, NULL when idle.
+	int priority;				// Priority the query was submitted at.
+	int attempts;				// Times the query has been sent.
+	int reused;					// Request went out on a kept-alive socket.
+	int tried;					// Addresses tried by the connect.
+	int racing;					// Connects in flight.
+	int race_fd[DNS_ADDRS];		// Sockets of the connects in flight.
+	int race_addr[DNS_ADDRS];	// Addresses they connect to.
+	int64_t race_next;			// ms when the next address starts, 0 for none.
+	int sent;					// Bytes of the request written.
+	int request_len;			// Length of the request.
+	char request[MESSAGE_SIZE];	// The http GET request.
+	tsl_buf body;				// Decoded body, reused by every query.
+	http_parser parser;			// Parser of the response.
+	tsl_timing timing;			// Timing of the query.
+} slot;
+/*****************************************************************************/
+struct batch {
+	int epfd;					// The epoll instance.
+	slot *slots;				// Connections, max_inflight of them.
+	int max_inflight;			// Number of slots.
+	sched_queue queue;			// Queries waiting for a slot or a retry.
+	int busy;					// Slots serving a query.
+	int pending;				// Queries submitted and not done.
+	int failed;					// Number of failed queries.
+	batch_fn done;				// Result callback.
+	void *arg;					// Argument of the callback.
+	tsl_config config;			// Server and key of the requests.
+	dns_lookup lookup;			// Resolution of the server, fd -1 when none.
+	dns_answer addrs;			// Addresses of the server, shared by the slots.
+	int addr;					// Address connected to first, the last that worked.
+	int waiting;				// Slots with a next address to start.
+};
+/*****************************************************************************/
+static void slot_next(batch *b, slot *s);
+/*****************************************************************************/
+int parse_query(char *line, query *q) {
+	/* Tab separated names may contain spaces */
+	char *sep = strchr(line, '\t'), *end;
+	for(end = line+strlen(line); end > line && isspace((unsigned char)end[-1]); end--);
+	*end = '\0';
+	while(isspace((unsigned char)*line)) {
+		line++;
+	}
+	if(!*line || *line == '#') {
+		return 0;
+	}
+	if(!sep) {
+		for(sep = line; *sep && !isspace((unsigned char)*sep); sep++);
+	}
+	if(!*sep) {
+		return 0;
+	}
+	*sep++ = '\0';
+	while(isspace((unsigned char)*sep)) {
+		sep++;
+	}
+	if(!*sep || !(q->origin = strdup(line))) {
+		return 0;
+	}
+	if(!(q->dest = strdup(sep))) {
+		free(q->origin);
+		return 0;
+	}
+	return 1;
+}
+/*****************************************************************************/
+int read_queries(FILE *in, query **queries) {
+	char line[MESSAGE_SIZE];
+	int len = 0, cap = 0;
+	query q, *new_queries;
+	*queries = NULL;
+	while(fgets(line, sizeof(line), in)) {
+		if(!parse_query(line, &q)) {
+			continue;
+		}
+		if(len == cap) {
+			cap = cap ? cap*2 : 16;
+			if(!(new_queries = realloc(*queries, sizeof(query)*cap))) {
+				free(q.origin);
+				free(q.dest);
+				free_queries(*queries, len);
+				*queries = NULL;
+				return E_UNKNOWN;
+			}
+			*queries = new_queries;
+		}
+		(*queries)[len++] = q;
+	}
+	return len;
+}
+/*****************************************************************************/
+void free_queries(query *queries, int num_queries) {
+	int i;
+	for(i = 0; i < num_queries; i++) {
+		free(queries[i].origin);
+		free(queries[i].dest);
+	}
+	free(queries);
+}
+/*****************************************************************************/
+static int watch(batch *b, slot *s, int events, int op) {
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = s;
+	return epoll_ctl(b->epfd, op, s->conn.fd, &ev);
+}
+/*****************************************************************************/
+static void race_wait(batch *b, slot *s, int64_t next) {
+	/* Slots are only looked through for a timer while one has it */
+	b->waiting += (next != 0) - (s->race_next != 0);
+	s->race_next = next;
+}
+/*****************************************************************************/
+static void race_close(batch *b, slot *s, int i) {
+	/* The last connect in flight takes the place of the one closed */
+	epoll_ctl(b->epfd, EPOLL_CTL_DEL, s->race_fd[i], NULL);
+	close(s->race_fd[i]);
+	s->race_fd[i] = s->race_fd[--s->racing];
+	s->race_addr[i] = s->race_addr[s->racing];
+}
+/*****************************************************************************/
+static void drop(batch *b, slot *s) {
+	while(s->racing) {
+		race_close(b, s, 0);
+	}
+	race_wait(b, s, 0);
+	if(s->conn.fd >= 0) {
+		epoll_ctl(b->epfd, EPOLL_CTL_DEL, s->conn.fd, NULL);
+		conn_close(&s->conn);
+	}
+}
+/*****************************************************************************/
+static int slot_connect(batch *b, slot *s) {
+	/* Starts the next address, in turn from the one that worked last when
+	 * the slot began, as another slot may change that one meanwhile. The
+	 * one after is started alongside when this has not connected within
+	 * DNS_HAPPY ms, or at once when it fails */
+	struct epoll_event ev;
+	const dns_addr *a;
+	int fd, i;
+	if(!s->tried) {
+		s->conn.addr = b->addr;
+	}
+	ev.events = EPOLLOUT;
+	ev.data.ptr = s;
+	while(s->tried < b->addrs.len) {
+		i = (s->conn.addr+s->tried++) % b->addrs.len;
+		a = &b->addrs.addrs[i];
+		fd = socket(a->u.sa.sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if(fd >= 0 && (!connect(fd, &a->u.sa, a->len) || errno == EINPROGRESS)
+				&& !epoll_ctl(b->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+			s->race_fd[s->racing] = fd;
+			s->race_addr[s->racing++] = i;
+			break;
+		}
+		if(fd >= 0) {
+			close(fd);
+		}
+	}
+	race_wait(b, s, s->tried < b->addrs.len
+			? metrics_now()/1000000 + DNS_HAPPY : 0);
+	if(!s->racing) {
+		return E_CONNECT;
+	}
+	s->state = B_CONNECTING;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int slot_race(batch *b, slot *s) {
+	/* The first connect to finish wins and the rest are closed, one that
+	 * failed makes way for the next address */
+	struct pollfd fds[DNS_ADDRS];
+	int err, i, n = s->racing, failed = 0;
+	socklen_t err_len;
+	for(i = 0; i < n; i++) {
+		fds[i].fd = s->race_fd[i];
+		fds[i].events = POLLOUT;
+	}
+	if(poll(fds, n, 0) <= 0) {
+		return E_SUCCESS;
+	}
+	/* Closing moves the last connect into the place, so go backwards */
+	for(i = n-1; i >= 0; i--) {
+		if(!fds[i].revents) {
+			continue;
+		}
+		err_len = sizeof(err);
+		if(s->conn.fd < 0 && !getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err,
+				&err_len) && !err) {
+			s->conn.fd = s->race_fd[i];
+			s->conn.addr = s->race_addr[i];
+			s->race_fd[i] = s->race_fd[--s->racing];
+			s->race_addr[i] = s->race_addr[s->racing];
+		} else if(s->conn.fd < 0) {
+			race_close(b, s, i);
+			failed = 1;
+		}
+	}
+	if(s->conn.fd >= 0) {
+		while(s->racing) {
+			race_close(b, s, 0);
+		}
+		race_wait(b, s, 0);
+		return 1;
+	}
+	if(failed && (s->tried < b->addrs.len || !s->racing)) {
+		return slot_connect(b, s);
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int slot_resolve(batch *b, slot *s) {
+	/* New connections share one lookup of the server, watched by the event
+	 * loop, and connect when it is answered */
+	struct epoll_event ev;
+	int retval;
+	if(b->addrs.len && b->addrs.expires > metrics_now()/1000000) {
+		return slot_connect(b, s);
+	}
+	s->state = B_RESOLVING;
+	if(b->lookup.fd >= 0) {
+		return E_SUCCESS;
+	}
+	retval = dns_lookup_start(&b->lookup, b->config.server, b->config.port,
+			&b->config.dns);
+	if(retval > 0) {
+		b->addrs = b->lookup.answer;
+		b->addr = 0;
+		timing_lap(&s->timing, STAGE_DNS);
+		return slot_connect(b, s);
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = &b->lookup;
+	if(retval == 0 && epoll_ctl(b->epfd, EPOLL_CTL_ADD, b->lookup.fd, &ev)) {
+		dns_lookup_free(&b->lookup);
+		retval = E_RESOLVE;
+	}
+	return retval;
+}
+/*****************************************************************************/
+static int slot_start(batch *b, slot *s) {
+	/* Sends the request of the slot, connecting first if needed */
+	s->sent = 0;
+	s->reused = s->conn.fd >= 0;
+	http_parser_init(&s->parser, &s->body);
+	if(s->reused) {
+		s->state = B_SENDING;
+		return watch(b, s, EPOLLOUT, EPOLL_CTL_MOD) ? E_SEND : E_SUCCESS;
+	}
+	s->tried = 0;
+	return slot_resolve(b, s);
+}
+/*****************************************************************************/
+static void report(batch *b, slot *s, const query *q, char *js,
+		int retval) {
+	b->pending--;
+	if(retval < 0) {
+		b->failed++;
+	}
+	b->done(b->arg, q, retval < 0 ? NULL : js, retval, &s->timing);
+}
+/*****************************************************************************/
+static int requeue(batch *b, slot *s, int retval, int status) {
+	/* A failure that may pass is queued again for after its backoff
+	 * instead of reported */
+	sched_entry e;
+	int wait = sched_done(b->config.sched, retval, status, s->attempts);
+	if(wait < 0) {
+		return 0;
+	}
+	e.item = s->q;
+	e.priority = s->priority;
+	e.attempts = s->attempts;
+	e.ready = metrics_now()/1000000 + wait;
+	return !sched_push(&b->queue, &e);
+}
+/*****************************************************************************/
+static void slot_finish(batch *b, slot *s, int retval) {
+	const query *q = s->q;
+	int status = 0, retried;
+	http_parser_free(&s->parser);
+	if(retval < 0 || s->parser.close) {
+		drop(b, s);
+	}
+	if(retval >= 0) {
+		s->conn.requests++;
+		s->conn.status = s->parser.status;
+		status = s->parser.status;
+		if(status/100 != 2) {
+			retval = E_STATUS;
+		}
+		timing_lap(&s->timing, STAGE_BODY);
+	}
+	s->timing.bytes_in += s->parser.received;
+	s->timing.body_bytes = s->body.len;
+	retried = requeue(b, s, retval, status);
+	s->q = NULL;
+	b->busy--;
+	if(!retried) {
+		report(b, s, q, s->body.data, retval);
+	}
+	slot_next(b, s);
+}
+/*****************************************************************************/
+static void slot_fail(batch *b, slot *s, int retval) {
+	/* A kept-alive socket may have been closed by the server while idle,
+	 * that shows up as nothing received and is retried once */
+	if(s->reused && !s->parser.received
+			&& (retval == E_SEND || retval == E_RECEIVE)) {
+		http_parser_free(&s->parser);
+		drop(b, s);
+		if((retval = slot_start(b, s)) == E_SUCCESS) {
+			return;
+		}
+	}
+	slot_finish(b, s, retval);
+}
+/*****************************************************************************/
+static void slot_next(batch *b, slot *s) {
+	/* Queries the open breaker fails are reported at once, the callback
+	 * may have submitted more or taken this slot already */
+	sched_entry e;
+	const query *q;
+	int popped, retval;
+	while(!s->q && (popped = sched_pop(b->config.sched, &b->queue, &e))) {
+		q = s->q = e.item;
+		b->busy++;
+		s->priority = e.priority;
+		s->attempts = e.attempts+1;
+		timing_begin(&s->timing);
+		if(popped < 0) {
+			retval = popped;
+		} else if((s->request_len = format_request(s->request, &b->config,
+				q->origin, q->dest)) < 0) {
+			sched_cancel(b->config.sched);
+			retval = s->request_len;
+		} else if((retval = slot_start(b, s)) == E_SUCCESS) {
+			return;
+		} else if(requeue(b, s, retval, 0)) {
+			s->q = NULL;
+			b->busy--;
+			continue;
+		}
+		s->q = NULL;
+		b->busy--;
+		report(b, s, q, NULL, retval);
+	}
+	if(!s->q) {
+		/* An idle kept-alive connection is only watched for being closed */
+		s->state = B_IDLE;
+		if(s->conn.fd >= 0 && watch(b, s, EPOLLIN, EPOLL_CTL_MOD)) {
+			drop(b, s);
+		}
+	}
+}
+/*****************************************************************************/
+static void slot_send(batch *b, slot *s) {
+	int retval;
+	while(s->sent < s->request_len) {
+		retval = send(s->conn.fd, s->request+s->sent, s->request_len-s->sent,
+				MSG_NOSIGNAL);
+		if(retval < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK) {
+				slot_fail(b, s, E_SEND);
+			}
+			return;
+		}
+		s->sent += retval;
+	}
+	s->state = B_RECEIVING;
+	if(watch(b, s, EPOLLIN, EPOLL_CTL_MOD)) {
+		slot_fail(b, s, E_RECEIVE);
+	}
+}
+/*****************************************************************************/
+static void slot_receive(batch *b, slot *s) {
+	char raw[BATCH_READ], *dst;
+	int n, space, retval;
+	while(1) {
+		if((space = http_parser_space(&s->parser, &dst)) < 0) {
+			slot_finish(b, s, space);
+			return;
+		}
+		if(space > 0) {
+			n = read(s->conn.fd, dst, space);
+		} else {
+			n = read(s->conn.fd, raw, sizeof(raw));
+		}
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK) {
+				slot_fail(b, s, E_RECEIVE);
+			}
+			return;
+		}
+		if(n > 0 && !s->parser.received) {
+			timing_lap(&s->timing, STAGE_FIRST_BYTE);
+		}
+		if(n == 0) {
+			retval = http_parser_eof(&s->parser);
+		} else if(space > 0) {
+			retval = http_parser_commit(&s->parser, n);
+		} else {
+			retval = http_parser_feed(&s->parser, raw, n);
+		}
+		if(retval < 0) {
+			slot_fail(b, s, retval);
+			return;
+		}
+		if(retval > 0) {
+			slot_finish(b, s, s->body.len);
+			return;
+		}
+	}
+}
+/*****************************************************************************/
+static void slot_event(batch *b, slot *s) {
+	int err;
+	switch(s->state) {
+		case B_IDLE:
+			drop(b, s);
+			return;
+		case B_RESOLVING:
+			return;
+		case B_CONNECTING:
+			if((err = slot_race(b, s)) <= 0) {
+				if(err < 0) {
+					slot_finish(b, s, err);
+				}
+				return;
+			}
+			b->addr = s->conn.addr;
+			timing_lap(&s->timing, STAGE_CONNECT);
+			s->state = B_SENDING;
+			slot_send(b, s);
+			return;
+		case B_SENDING:
+			slot_send(b, s);
+			return;
+		case B_RECEIVING:
+			slot_receive(b, s);
+			return;
+	}
+}
+/*****************************************************************************/
+static void lookup_event(batch *b) {
+	/* Slots waiting for the address connect, or fail, once it is known */
+	slot *s;
+	int i, err, retval = dns_lookup_step(&b->lookup);
+	if(retval == 0) {
+		return;
+	}
+	epoll_ctl(b->epfd, EPOLL_CTL_DEL, b->lookup.fd, NULL);
+	dns_lookup_free(&b->lookup);
+	if(retval > 0) {
+		b->addrs = b->lookup.answer;
+		b->addr = 0;
+	}
+	for(i = 0; i < b->max_inflight; i++) {
+		s = &b->slots[i];
+		if(!s->q || s->state != B_RESOLVING) {
+			continue;
+		}
+		timing_lap(&s->timing, STAGE_DNS);
+		if((err = retval < 0 ? retval : slot_connect(b, s)) < 0) {
+			slot_finish(b, s, err);
+		}
+	}
+}
+/*****************************************************************************/
+batch *batch_new(const tsl_config *config, int max_inflight, batch_fn done,
+		void *arg) {
+	batch *b;
+	int i;
+	if(max_inflight < 1) {
+		max_inflight = 1;
+	}
+	if(!(b = calloc(1, sizeof(batch)))) {
+		return NULL;
+	}
+	if((b->epfd = epoll_create1(0)) < 0
+			|| !(b->slots = calloc(max_inflight, sizeof(slot)))) {
+		if(b->epfd >= 0) {
+			close(b->epfd);
+		}
+		free(b);
+		return NULL;
+	}
+	b->max_inflight = max_inflight;
+	b->done = done;
+	b->arg = arg;
+	b->config = *config;
+	b->lookup.fd = -1;
+	sched_queue_init(&b->queue);
+	for(i = 0; i < max_inflight; i++) {
+		conn_init(&b->slots[i].conn, b->config.server, b->config.port,
+				&b->config.dns);
+		buf_init(&b->slots[i].body);
+	}
+	return b;
+}
+/*****************************************************************************/
+static void slots_fill(batch *b) {
+	/* Once an idle slot finds nothing it may send, none of the rest will */
+	int i;
+	for(i = 0; i < b->max_inflight; i++) {
+		if(!b->slots[i].q) {
+			slot_next(b, &b->slots[i]);
+			if(!b->slots[i].q) {
+				return;
+			}
+		}
+	}
+}
+/*****************************************************************************/
+int batch_submit(batch *b, const query *q, int priority) {
+	sched_entry e = {q, priority, 0, 0};
+	if(sched_push(&b->queue, &e)) {
+		return E_UNKNOWN;
+	}
+	b->pending++;
+	slots_fill(b);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+int batch_raise(batch *b, const query *q, int priority) {
+	/* A query already in a slot keeps the priority for its retries */
+	int i;
+	for(i = 0; i < b->max_inflight; i++) {
+		if(b->slots[i].q == q && b->slots[i].priority > priority) {
+			b->slots[i].priority = priority;
+		}
+	}
+	return sched_raise(&b->queue, q, priority);
+}
+/*****************************************************************************/
+int batch_fd(const batch *b) {
+	return b->epfd;
+}
+/*****************************************************************************/
+int batch_pending(const batch *b) {
+	return b->pending;
+}
+/*****************************************************************************/
+int batch_timeout(const batch *b) {
+	/* Nothing held back can be sent before a slot is free, and a slot that
+	 * frees looks for it anyway */
+	int due = b->busy < b->max_inflight ? sched_timeout(&b->queue) : -1;
+	int64_t now = b->waiting ? metrics_now()/1000000 : 0;
+	int i, next;
+	if(b->lookup.fd >= 0 && ((next = dns_lookup_timeout(&b->lookup)) < due
+			|| due < 0)) {
+		due = next;
+	}
+	/* Slow connects get the next address alongside */
+	for(i = 0; b->waiting && i < b->max_inflight; i++) {
+		if(b->slots[i].state == B_CONNECTING && b->slots[i].race_next) {
+			next = b->slots[i].race_next > now ? b->slots[i].race_next-now : 0;
+			if(next < due || due < 0) {
+				due = next;
+			}
+		}
+	}
+	return due;
+}
+/*****************************************************************************/
+int batch_dispatch(batch *b, int timeout) {
+	struct epoll_event events[BATCH_EVENTS];
+	int i, n, due = batch_timeout(b);
+	if(due >= 0 && (timeout < 0 || due < timeout)) {
+		timeout = due;
+	}
+	if((n = epoll_wait(b->epfd, events, BATCH_EVENTS, timeout)) < 0) {
+		return errno == EINTR ? 0 : E_UNKNOWN;
+	}
+	for(i = 0; i < n; i++) {
+		if(events[i].data.ptr == &b->lookup) {
+			lookup_event(b);
+		} else {
+			slot_event(b, events[i].data.ptr);
+		}
+	}
+	/* Queries of a lookup are sent again when they go unanswered, */
+	if(b->lookup.fd >= 0 && !dns_lookup_timeout(&b->lookup)) {
+		lookup_event(b);
+	}
+	/* connects that have not finished in DNS_HAPPY ms race the next address, */
+	for(i = 0; b->waiting && i < b->max_inflight; i++) {
+		if(b->slots[i].state == B_CONNECTING && b->slots[i].race_next
+				&& b->slots[i].race_next <= metrics_now()/1000000) {
+			slot_connect(b, &b->slots[i]);
+		}
+	}
+	/* and queries held back by the scheduler are sent once they may be */
+	if(b->busy < b->max_inflight && !sched_timeout(&b->queue)) {
+		slots_fill(b);
+	}
+	return n;
+}
+/*****************************************************************************/
+void batch_free(batch *b) {
+	int i;
+	for(i = 0; i < b->max_inflight; i++) {
+		if(b->slots[i].q) {
+			http_parser_free(&b->slots[i].parser);
+		}
+		drop(b, &b->slots[i]);
+		buf_free(&b->slots[i].body);
+	}
+	dns_lookup_free(&b->lookup);
+	free(b->slots);
+	sched_queue_free(&b->queue);
+	close(b->epfd);
+	free(b);
+}
+/*****************************************************************************/
+int run_batch(const query *queries, int num_queries,
+		const tsl_config *config, int max_inflight, batch_fn done, void *arg) {
+	batch *b;
+	int i, failed;
+
+	if(num_queries <= 0) {
+		return 0;
+	}
+	if(max_inflight > num_queries) {
+		max_inflight = num_queries;
+	}
+	if(!(b = batch_new(config, max_inflight, done, arg))) {
+		return E_UNKNOWN;
+	}
+	for(i = 0; i < num_queries; i++) {
+		if(batch_submit(b, &queries[i], PRIORITY_BATCH)) {
+			batch_free(b);
+			return E_UNKNOWN;
+		}
+	}
+	while(batch_pending(b) > 0) {
+		if(batch_dispatch(b, -1) < 0) {
+			b->failed += batch_pending(b);
+			break;
+		}
+	}
+
+	failed = b->failed;
+	batch_free(b);
+	return failed;
+}
+/*****************************************************************************/
@@ -0,0 +1,192 @@
+/******************************************************************************
+*     File Name           :     batch.h                                       *
+*     Description         :     Runs many queries concurrently on an epoll    *
+*                                 event loop.                                 *
+******************************************************************************/
+#ifndef BATCH_H
+#define BATCH_H
+#include <stdio.h>              // FILE
+#include "tsl.h"                // tsl_conn, tsl_buf, http_parser
+/*****************************************************************************/
+#define BATCH_INFLIGHT 8 		// Default number of concurrent queries
+/******************************************************************************
+* Struct: query                                                               *
+* -------------                                                               *
+*   An origin and destination pair to look up.                                *
+*                                                                             *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+******************************************************************************/
+typedef struct query {char *origin; char *dest;} query;
+/******************************************************************************
+* Function: batch_fn                                                          *
+* ------------------                                                          *
+*   Called once for every query when its response is complete.                *
+*                                                                             *
+*   arg: Argument given to run_batch.                                         *
+*   q: The query.                                                             *
+*   js: Decoded body of the response, valid until the callback returns.       *
+*   len: Length of the body, or an error number when the query failed.        *
+*   t: Timing of the query from when it was sent, with its connect, first     *
+*      byte and body lapped. The callback may lap further stages.             *
+******************************************************************************/
+typedef void (*batch_fn)(void *arg, const query *q, char *js, int len,
+		tsl_timing *t);
+/******************************************************************************
+* Struct: batch                                                               *
+* -------------                                                               *
+*   Queries in flight on a set of kept-alive non-blocking connections, driven *
+*   by an epoll instance of its own.                                          *
+******************************************************************************/
+typedef struct batch batch;
+/******************************************************************************
+* Function: parse_query                                                       *
+* ---------------------                                                       *
+*   Splits a line into origin and destination, separated by a tab or by       *
+*   spaces. Names containing spaces must be separated by a tab.               *
+*                                                                             *
+*   line: The line, it is modified.                                           *
+*   q: Set to copies of the names, free them with free.                       *
+*                                                                             *
+*   Returns: 1 if a query was found, 0 for empty, comment and bad lines.      *
+******************************************************************************/
+int parse_query(char *line, query *q);
+/******************************************************************************
+* Function: read_queries                                                      *
+* ----------------------                                                      *
+*   Reads one query per line, origin and destination separated by a tab or    *
+*   by spaces. Empty lines and lines starting with '#' are skipped.           *
+*                                                                             *
+*   in: File to read from.                                                    *
+*   queries: Set to an array of queries, free with free_queries.              *
+*                                                                             *
+*   Returns: Number of queries read.                                          *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int read_queries(FILE *in, query **queries);
+/******************************************************************************
+* Function: free_queries                                                      *
+* ----------------------                                                      *
+*   Frees queries read by read_queries.                                       *
+*                                                                             *
+*   queries: Array of queries.                                                *
+*   num_queries: Number of queries in the array.                              *
+******************************************************************************/
+void free_queries(query *queries, int num_queries);
+/******************************************************************************
+* Function: batch_new                                                         *
+* -------------------                                                         *
+*   Creates an empty batch. Connections are opened as queries are submitted   *
+*   and kept alive until batch_free, so later queries find them warm.         *
+*                                                                             *
+*   config: Server and key the queries go to, copied.                         *
+*   max_inflight: Largest number of concurrent connections.                   *
+*   done: Called with the result of every query.                              *
+*   arg: Passed on to done.                                                   *
+*                                                                             *
+*   Returns: The batch, NULL when memory runs out.                            *
+******************************************************************************/
+batch *batch_new(const tsl_config *config, int max_inflight, batch_fn done,
+		void *arg);
+/******************************************************************************
+* Function: batch_submit                                                      *
+* ----------------------                                                      *
+*   Queues a query, it is sent at once if a connection is free and the        *
+*   scheduler of the configuration lets it through. Queries that fail in a    *
+*   way that may pass are sent again before done is called. The callback may  *
+*   submit more queries.                                                      *
+*                                                                             *
+*   b: The batch.                                                             *
+*   q: The query, must stay valid until done is called for it.                *
+*   priority: An enum sched_priority, lower ones are sent first.              *
+*                                                                             *
+*   Returns: E_SUCCESS or E_UNKNOWN when memory runs out.                     *
+******************************************************************************/
+int batch_submit(batch *b, const query *q, int priority);
+/******************************************************************************
+* Function: batch_raise                                                       *
+* ---------------------                                                       *
+*   Sends a submitted query sooner, at a lower priority.                      *
+*                                                                             *
+*   b: The batch.                                                             *
+*   q: The query.                                                             *
+*   priority: The new priority, nothing is done unless it is lower.           *
+*                                                                             *
+*   Returns: E_SUCCESS or E_UNKNOWN when memory runs out.                     *
+******************************************************************************/
+int batch_raise(batch *b, const query *q, int priority);
+/******************************************************************************
+* Function: batch_fd                                                          *
+* ------------------                                                          *
+*   The epoll descriptor of the batch. It becomes readable when               *
+*   batch_dispatch has work, so it can be waited on along with other          *
+*   descriptors.                                                              *
+*                                                                             *
+*   b: The batch.                                                             *
+******************************************************************************/
+int batch_fd(const batch *b);
+/******************************************************************************
+* Function: batch_timeout                                                     *
+* -----------------------                                                     *
+*   A lookup of the server has to be driven on time even when no answer       *
+*   comes, a slow connect joined by the next address after DNS_HAPPY ms, and  *
+*   queries held back by the scheduler sent when they may be, so a loop       *
+*   waiting on batch_fd waits no longer than this.                            *
+*                                                                             *
+*   b: The batch.                                                             *
+*                                                                             *
+*   Returns: ms until batch_dispatch has to be called, -1 for no limit.       *
+******************************************************************************/
+int batch_timeout(const batch *b);
+/******************************************************************************
+* Function: batch_pending                                                     *
+* -----------------------                                                     *
+*   b: The batch.                                                             *
+*                                                                             *
+*   Returns: Number of queries submitted that are not done yet.               *
+******************************************************************************/
+int batch_pending(const batch *b);
+/******************************************************************************
+* Function: batch_dispatch                                                    *
+* ------------------------                                                    *
+*   Waits for and handles network events, calling done for every query        *
+*   that completes.                                                           *
+*                                                                             *
+*   b: The batch.                                                             *
+*   timeout: Milliseconds to wait, -1 to block, 0 to only handle what is      *
+*            ready.                                                           *
+*                                                                             *
+*   Returns: Number of events handled.                                        *
+*            E_UNKNOWN when waiting fails.                                    *
+******************************************************************************/
+int batch_dispatch(batch *b, int timeout);
+/******************************************************************************
+* Function: batch_free                                                        *
+* --------------------                                                        *
+*   Closes the connections of a batch and frees it. Queries still in flight   *
+*   are dropped without calling done.                                         *
+*                                                                             *
+*   b: The batch.                                                             *
+******************************************************************************/
+void batch_free(batch *b);
+/******************************************************************************
+* Function: run_batch                                                         *
+* -------------------                                                         *
+*   Sends all queries with at most max_inflight of them outstanding at once,  *
+*   each on its own kept-alive non-blocking connection, and reports results   *
+*   in the order they complete.                                               *
+*                                                                             *
+*   queries: Array of queries.                                                *
+*   num_queries: Number of queries in the array.                              *
+*   config: Server and key the queries go to, copied.                         *
+*   max_inflight: Largest number of concurrent connections.                   *
+*   done: Called with the result of every query.                              *
+*   arg: Passed on to done.                                                   *
+*                                                                             *
+*   Returns: Number of queries that failed.                                   *
+*            E_UNKNOWN when the event loop can not be set up.                 *
+******************************************************************************/
+int run_batch(const query *queries, int num_queries,
+		const tsl_config *config, int max_inflight, batch_fn done, void *arg);
+/*****************************************************************************/
+#endif /* BATCH_H */
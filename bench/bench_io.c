@@ -0,0 +1,191 @@
+/******************************************************************************
+*     File Name           :     bench_io.c                                    *
+*     Description         :     Compares the blocking request path, the       *
+*                                 epoll event loop and the io_uring engine    *
+*                                 against a local mock server.                *
+******************************************************************************/
+#include <errno.h>              // errno
+#include <signal.h>             // kill, SIGTERM
+#include <sys/resource.h>       // getrusage
+#include <sys/epoll.h>          // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/wait.h>           // waitpid
+#include <time.h>               // clock_gettime
+#include "../tsl.h"             // tsl_conn, http_exchange
+#include "../batch.h"           // run_batch
+#include "../uring.h"           // run_batch_uring
+/*****************************************************************************/
+#define BENCH_IP "127.0.0.1"
+#define BENCH_PORT 18090
+#define BENCH_QUERIES 5000
+#define BENCH_BODY 4096 		// Bytes of the response body
+/*****************************************************************************/
+static const tsl_config config = {BENCH_IP, BENCH_PORT, BENCH_IP, ""};
+/*****************************************************************************/
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+/*****************************************************************************/
+static double cpu(void) {
+	/* Time spent by this process only, the server runs in a child */
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6
+			+ ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+}
+/*****************************************************************************/
+int format_request(char *request, const tsl_config *config,
+		const char *origin, const char *dest) {
+	/* Stands in for the one in client.c, the mock does not look at it */
+	int len = snprintf(request, MESSAGE_SIZE,
+			"GET /bench?origin=%s&dest=%s HTTP/1.1\r\n"
+			"Host: %s\r\n\r\n", origin, dest, config->host);
+	return len < MESSAGE_SIZE ? len : E_SEND;
+}
+/*****************************************************************************/
+static void serve(int listen_fd, const char *response, int response_len) {
+	/* Answers every request seen on every connection with the same
+	 * kept-alive response. Requests are found by their blank line, which
+	 * may be split over several reads, so the match is kept per socket */
+	struct epoll_event ev, events[64];
+	static unsigned char matched[65536];
+	char buf[16384];
+	int epfd = epoll_create1(0), i, j, n, fd, sent, retval;
+	ev.events = EPOLLIN;
+	ev.data.fd = listen_fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+	while((n = epoll_wait(epfd, events, 64, -1)) >= 0 || errno == EINTR) {
+		for(i = 0; i < n; i++) {
+			if((fd = events[i].data.fd) == listen_fd) {
+				if((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+					matched[fd] = 0;
+					ev.data.fd = fd;
+					epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+				}
+				continue;
+			}
+			if((retval = read(fd, buf, sizeof(buf))) <= 0) {
+				close(fd);
+				continue;
+			}
+			for(j = 0; j < retval; j++) {
+				matched[fd] = buf[j] == "\r\n\r\n"[matched[fd]] ? matched[fd]+1
+						: buf[j] == '\r';
+				if(matched[fd] < 4) {
+					continue;
+				}
+				matched[fd] = 0;
+				for(sent = 0; sent < response_len; sent += retval) {
+					if((retval = send(fd, response+sent, response_len-sent,
+							MSG_NOSIGNAL)) < 0) {
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+/*****************************************************************************/
+static pid_t start_server(void) {
+	char response[BENCH_BODY+256];
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET, SOCK_STREAM, 0), on = 1, len;
+	pid_t pid;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(BENCH_IP);
+	addr.sin_port = htons(BENCH_PORT);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr))
+			|| listen(fd, 1024)) {
+		perror("bench_io: listen");
+		return -1;
+	}
+	len = sprintf(response, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+			"Content-Length: %d\r\n\r\n", BENCH_BODY);
+	memset(response+len, ' ', BENCH_BODY);
+	if((pid = fork()) == 0) {
+		serve(fd, response, len+BENCH_BODY);
+		_exit(0);
+	}
+	close(fd);
+	return pid;
+}
+/*****************************************************************************/
+static void count_result(void *arg, const query *q, char *js, int len,
+		tsl_timing *t) {
+	*(long*)arg += len;
+}
+/*****************************************************************************/
+static void report(const char *name, int inflight, double secs,
+		double cpu_secs, int n) {
+	printf("%-8s %4d in flight %8.1f us/query %8.1f us cpu/query %10.0f queries/s\n",
+			name, inflight, secs/n*1e6, cpu_secs/n*1e6, n/secs);
+}
+/*****************************************************************************/
+static int run_blocking(const query *queries, int n) {
+	/* The path of get_request(): one kept-alive connection, one query
+	 * at a time */
+	char request[MESSAGE_SIZE];
+	tsl_conn conn;
+	tsl_buf body;
+	int i, len, failed = 0;
+	conn_init(&conn, BENCH_IP, BENCH_PORT, NULL);
+	buf_init(&body);
+	for(i = 0; i < n; i++) {
+		len = format_request(request, &config, queries[i].origin,
+				queries[i].dest);
+		failed += http_exchange(&conn, request, len, &body) != BENCH_BODY;
+	}
+	conn_close(&conn);
+	buf_free(&body);
+	return failed;
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	static const int inflight[] = {1, 8, 64, 256};
+	int n = argc > 1 ? atoi(argv[1]) : BENCH_QUERIES, i, failed;
+	query *queries = calloc(n, sizeof(query));
+	long bytes;
+	double t, c;
+	pid_t server;
+
+	if(!queries || (server = start_server()) < 0) {
+		return 1;
+	}
+	for(i = 0; i < n; i++) {
+		queries[i].origin = "Odenplan";
+		queries[i].dest = "Slussen";
+	}
+	/* Let the server reach its event loop */
+	usleep(100000);
+
+	t = now();
+	c = cpu();
+	failed = run_blocking(queries, n);
+	report("blocking", 1, now()-t, cpu()-c, n);
+	for(i = 0; i < (int)(sizeof(inflight)/sizeof(*inflight)); i++) {
+		bytes = 0;
+		t = now();
+		c = cpu();
+		failed += run_batch(queries, n, &config, inflight[i],
+				count_result, &bytes);
+		report("epoll", inflight[i], now()-t, cpu()-c, n);
+#ifdef TSL_URING
+		bytes = 0;
+		t = now();
+		c = cpu();
+		failed += run_batch_uring(queries, n, &config, inflight[i], count_result, &bytes);
+		report("uring", inflight[i], now()-t, cpu()-c, n);
+#endif
+	}
+
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	free(queries);
+	if(failed) {
+		fprintf(stderr, "bench_io: %d queries failed\n", failed);
+	}
+	return failed != 0;
+}
@@ -0,0 +1,174 @@
+/******************************************************************************
+*     File Name           :     bench_parse.c                                 *
+*     Description         :     Compares nx_json_parse with one calloc per    *
+*                                 node against nx_json_parse_arena, its       *
+*                                 structural scanners, scan_trips,            *
+*                                 pack_triplist and select_trips.             *
+******************************************************************************/
+#include <stdio.h>              // printf, fopen
+#include <stdlib.h>             // malloc, free
+#include <string.h>             // memcpy
+#include <time.h>               // clock_gettime
+#include "../nxjson/nxjson.h"   // json parser
+#include "../triplist.h"        // scan_trips
+/*****************************************************************************/
+#define ITERATIONS 200
+static const struct {const char *name; nx_json_scan mode;} modes[] = {
+	{"arena", NX_JSON_SCAN_BYTES}, {"scalar", NX_JSON_SCAN_SCALAR},
+	{"sse", NX_JSON_SCAN_SSE}, {"avx2", NX_JSON_SCAN_AVX2}
+};
+/*****************************************************************************/
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+/*****************************************************************************/
+static char *read_file(const char *path, long *len) {
+	FILE *f = fopen(path, "rb");
+	char *buf;
+	if(!f) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(*len + 1);
+	if(fread(buf, 1, *len, f) != (size_t)*len) {
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	buf[*len] = '\0';
+	fclose(f);
+	return buf;
+}
+/*****************************************************************************/
+static void report(const char *name, double secs, long len, int iterations) {
+	printf("%-8s %10.1f us/parse %10.1f MB/s\n", name,
+			secs/iterations*1e6, (double)len*iterations/secs/1e6);
+}
+/*****************************************************************************/
+static int walk_trips(const nx_json *jsmap) {
+	/* Same access pattern as extract_trips()/extract_trip() */
+	const nx_json *js_trips = nx_json_get(nx_json_get(jsmap, "TripList"), "Trip");
+	int i, j, n = 0;
+	for(i = 0; i < js_trips->length; i++) {
+		const nx_json *js_trip = nx_json_item(js_trips, i);
+		const nx_json *js_legs = nx_json_get(nx_json_get(js_trip, "LegList"), "Leg");
+		n += nx_json_get(js_trip, "dur")->text_value != NULL;
+		for(j = 0; j < js_legs->length; j++) {
+			n += nx_json_get(nx_json_item(js_legs, j), "name")->text_value != NULL;
+		}
+	}
+	return n;
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	long len;
+	int i, iterations = argc > 2 ? atoi(argv[2]) : ITERATIONS;
+	char *js, *scratch;
+	double t;
+	nx_json_arena arena;
+	unsigned int m;
+
+	if(argc < 2 || !(js = read_file(argv[1], &len))) {
+		fprintf(stderr, "bench_parse <response.json> [iterations]\n");
+		return -1;
+	}
+	scratch = malloc(len + 1);
+	printf("%s: %ld bytes, %d iterations\n", argv[1], len, iterations);
+
+	/* Parsing is destructive, so every iteration starts from a fresh copy */
+	nx_json_scan_mode = NX_JSON_SCAN_BYTES;
+	t = now();
+	for(i = 0; i < iterations; i++) {
+		memcpy(scratch, js, len + 1);
+		const nx_json *jsmap = nx_json_parse(scratch, 0);
+		if(!jsmap) {
+			return -1;
+		}
+		nx_json_free(jsmap);
+	}
+	report("calloc", now() - t, len, iterations);
+
+	/* Arena allocation with each way of finding structure */
+	nx_json_arena_init(&arena, 0);
+	for(m = 0; m < sizeof(modes)/sizeof(modes[0]); m++) {
+		nx_json_scan_mode = modes[m].mode;
+		t = now();
+		for(i = 0; i < iterations; i++) {
+			memcpy(scratch, js, len + 1);
+			if(!nx_json_parse_arena(scratch, 0, &arena)) {
+				return -1;
+			}
+			nx_json_arena_reset(&arena);
+		}
+		report(modes[m].name, now() - t, len, iterations);
+	}
+	nx_json_scan_mode = NX_JSON_SCAN_AUTO;
+
+	triplist tl;
+	triplist_init(&tl);
+	t = now();
+	for(i = 0; i < iterations; i++) {
+		memcpy(scratch, js, len + 1);
+		if(scan_trips(scratch, len, &tl) < 0) {
+			return -1;
+		}
+	}
+	report("scan", now() - t, len, iterations);
+
+	/* Pack the last scan, then check it as a mapped cache entry would be */
+	trip_block *tb = NULL;
+	t = now();
+	for(i = 0; i < iterations; i++) {
+		free(tb);
+		if(!(tb = pack_triplist(scratch, &tl))) {
+			return -1;
+		}
+	}
+	report("pack", now() - t, len, iterations);
+	t = now();
+	for(i = 0; i < iterations; i++) {
+		if(check_trip_block(tb, tb->size)) {
+			return -1;
+		}
+	}
+	t = now() - t;
+	printf("%-8s %10.1f us/check %10d bytes packed\n", "check",
+			t/iterations*1e6, tb->size);
+	free(tb);
+
+	/* Order by departure and keep trips of few legs, no strings touched */
+	trip_filter filter;
+	int *selected = malloc(sizeof(int)*(tl.trips_len+1)), num_selected = 0;
+	trip_filter_init(&filter);
+	filter.max_legs = 3;
+	t = now();
+	for(i = 0; i < iterations; i++) {
+		num_selected = select_trips(tl.trips, tl.trips_len, &filter,
+				TRIP_ORDER_DEPART, selected);
+	}
+	t = now() - t;
+	printf("%-8s %10.1f us/select %9d of %d trips\n", "select",
+			t/iterations*1e6, num_selected, tl.trips_len);
+	free(selected);
+	triplist_free(&tl);
+
+	/* Walk the trips of one tree, the first walk builds the indexes */
+	memcpy(scratch, js, len + 1);
+	const nx_json *jsmap = nx_json_parse_arena(scratch, 0, &arena);
+	t = now();
+	for(i = 0; i < iterations; i++) {
+		walk_trips(jsmap);
+	}
+	t = now() - t;
+	printf("%-8s %10.1f us/walk\n", "lookup", t/iterations*1e6);
+	nx_json_arena_destroy(&arena);
+
+	free(scratch);
+	free(js);
+	return 0;
+}
+/*****************************************************************************/
@@ -0,0 +1,133 @@
+/******************************************************************************
+*     File Name           :     bench_route.c                                 *
+*     Description         :     Times timetable_import, timetable_open and    *
+*                                 timetable_query on a GTFS feed, and how     *
+*                                 batches of queries scale over threads.      *
+******************************************************************************/
+#include <stdio.h>              // printf
+#include <stdlib.h>             // atoi
+#include <time.h>               // clock_gettime
+#include <unistd.h>             // sysconf
+#include "../timetable.h"       // timetable
+#include "../pool.h"            // tsl_pool
+/*****************************************************************************/
+#define QUERIES 200
+#define BATCH_QUERIES 2000 		// Queries of a batch run by the pool
+static const char *stations[] = {
+	"Duvbo", "Sundbyberg", "Solna", "Karlberg", "Stockholm City",
+	"T-Centralen", "Östermalmstorg", "Stadion", "Tekniska högskolan",
+	"Universitetet", "Odenplan", "Hötorget", "Rådmansgatan", "Gärdet",
+	"Slussen", "Medborgarplatsen", "Skanstull", "Gullmarsplan", "Årstaberg",
+	"Älvsjö", "Södertälje centrum", "Märsta", "Uppsala C", "Bålsta"
+};
+#define NUM_STATIONS (int)(sizeof(stations)/sizeof(stations[0]))
+/*****************************************************************************/
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+/*****************************************************************************/
+typedef struct worker {tt_search *search; triplist tl; tsl_buf strings;} worker;
+typedef struct batch {worker *workers; int journeys[BATCH_QUERIES];} batch;
+/*****************************************************************************/
+static void query_task(void *arg, int self, int task) {
+	batch *b = arg;
+	worker *w = &b->workers[self];
+	b->journeys[task] = tt_search_query(w->search,
+			stations[task % NUM_STATIONS],
+			stations[(task*7 + 3) % NUM_STATIONS], 6*60 + task*5 % (16*60),
+			&w->tl, &w->strings);
+}
+/*****************************************************************************/
+static double run_pool(const timetable *tt, int threads, int *journeys) {
+	/* Each run starts with fresh scratch space, so the first queries of
+	 * every thread pay for growing it */
+	static batch b;
+	tsl_pool *pool = pool_new(threads);
+	double start, secs = -1;
+	int i;
+	if(!pool || !(b.workers = calloc(threads, sizeof(worker)))) {
+		return secs;
+	}
+	for(i = 0; i < threads; i++) {
+		b.workers[i].search = tt_search_new(tt);
+		triplist_init(&b.workers[i].tl);
+		buf_init(&b.workers[i].strings);
+	}
+	start = now();
+	pool_run(pool, BATCH_QUERIES, query_task, &b);
+	secs = now() - start;
+	for(i = 0, *journeys = 0; i < BATCH_QUERIES; i++) {
+		*journeys += b.journeys[i] > 0 ? b.journeys[i] : 0;
+	}
+	for(i = 0; i < threads; i++) {
+		tt_search_free(b.workers[i].search);
+		triplist_free(&b.workers[i].tl);
+		buf_free(&b.workers[i].strings);
+	}
+	free(b.workers);
+	pool_free(pool);
+	return secs;
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	const char *dir = argc > 1 ? argv[1] : "bench/data/gtfs";
+	const char *path = argc > 2 ? argv[2] : "bench/data/timetable.bin";
+	int cpus = argc > 3 ? atoi(argv[3]) : sysconf(_SC_NPROCESSORS_ONLN);
+	double start, secs, worst = 0, base = 0;
+	int i, len, journeys = 0, failed = 0, threads;
+	timetable *tt;
+	triplist tl;
+	tsl_buf strings;
+
+	start = now();
+	if(timetable_import(dir, path)) {
+		fprintf(stderr, "bench_route: can not import %s\n", dir);
+		return 1;
+	}
+	printf("%-8s %10.1f ms\n", "import", (now() - start)*1e3);
+	start = now();
+	if(!(tt = timetable_open(path))) {
+		fprintf(stderr, "bench_route: can not open %s\n", path);
+		return 1;
+	}
+	printf("%-8s %10.1f us\n", "open", (now() - start)*1e6);
+	triplist_init(&tl);
+	buf_init(&strings);
+	secs = 0;
+	for(i = 0; i < QUERIES; i++) {
+		/* Every pair of names, leaving through the day */
+		const char *origin = stations[i % NUM_STATIONS];
+		const char *dest = stations[(i*7 + 3) % NUM_STATIONS];
+		double t;
+		start = now();
+		len = timetable_query(tt, origin, dest, 6*60 + i*5 % (16*60), &tl,
+				&strings);
+		t = now() - start;
+		secs += t;
+		worst = t > worst ? t : worst;
+		if(len < 0) {
+			failed++;
+		} else {
+			journeys += len;
+		}
+	}
+	printf("%-8s %10.1f us/query %8.1f us worst %6.2f journeys/query "
+			"%d failed\n", "query", secs/QUERIES*1e6, worst*1e6,
+			(double)journeys/QUERIES, failed);
+	triplist_free(&tl);
+	buf_free(&strings);
+	/* The same batch on 1 to cpus threads */
+	for(threads = 1; threads <= cpus; threads++) {
+		if((secs = run_pool(tt, threads, &journeys)) < 0) {
+			fprintf(stderr, "bench_route: can not start %d threads\n", threads);
+			break;
+		}
+		base = threads == 1 ? secs : base;
+		printf("%-8s %2d threads %10.0f queries/s %6.2fx %d journeys\n",
+				"pool", threads, BATCH_QUERIES/secs, base/secs, journeys);
+	}
+	timetable_close(tt);
+	return 0;
+}
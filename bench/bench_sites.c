@@ -0,0 +1,98 @@
+/******************************************************************************
+*     File Name           :     bench_sites.c                                 *
+*     Description         :     Times site_complete and site_resolve on an    *
+*                                 index of generated site names.              *
+******************************************************************************/
+#include <stdio.h>              // printf, fopen
+#include <stdlib.h>             // atoi
+#include <time.h>               // clock_gettime
+#include "../sites.h"           // site_index
+/*****************************************************************************/
+#define LOOKUPS 2000
+static const char *parts[] = {
+	"Duvbo", "Sundbyberg", "Solna", "Karlberg", "Stockholm", "Östermalm",
+	"Stadion", "Tekniska", "Odenplan", "Hötorget", "Rådmansgatan", "Gärdet",
+	"Slussen", "Skanstull", "Gullmarsplan", "Årsta", "Älvsjö", "Södertälje",
+	"Märsta", "Uppsala", "Bålsta", "Täby", "Lidingö", "Nacka", "Huddinge"
+};
+static const char *kinds[] = {
+	"centrum", "station", "torg", "skola", "kyrka", "gård", "backe", "strand"
+};
+#define NUM_PARTS (int)(sizeof(parts)/sizeof(parts[0]))
+#define NUM_KINDS (int)(sizeof(kinds)/sizeof(kinds[0]))
+/*****************************************************************************/
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+/*****************************************************************************/
+static void site_name(int i, char *name, size_t size) {
+	snprintf(name, size, "%s%s %s %d", parts[i % NUM_PARTS],
+			i/NUM_PARTS % 2 ? "s" : "", kinds[i/NUM_PARTS/2 % NUM_KINDS],
+			i/NUM_PARTS/2/NUM_KINDS + 1);
+}
+/*****************************************************************************/
+static void report(const char *name, double secs, int found) {
+	printf("%-8s %10.2f us/lookup %6.2f found/lookup\n", name,
+			secs/LOOKUPS*1e6, (double)found/LOOKUPS);
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	const char *list = argc > 1 ? argv[1] : "bench/data/sites.txt";
+	const char *path = argc > 2 ? argv[2] : "bench/data/sites.idx";
+	int num_sites = argc > 3 ? atoi(argv[3]) : 6000;
+	site matches[SITE_MATCHES], match;
+	char name[SITE_KEY_SIZE];
+	site_index *index;
+	int i, len, found;
+	double start;
+	FILE *f = fopen(list, "w");
+
+	if(!f) {
+		perror(list);
+		return 1;
+	}
+	for(i = 0; i < num_sites; i++) {
+		site_name(i, name, sizeof(name));
+		fprintf(f, "%d;%s\n", 9000+i, name);
+	}
+	fclose(f);
+	start = now();
+	if((len = site_import(list, path)) < 0 || !(index = site_open(path))) {
+		fprintf(stderr, "bench_sites: can not import %s\n", list);
+		return 1;
+	}
+	printf("%-8s %10.1f ms %d sites\n", "import", (now() - start)*1e3, len);
+	/* Type-ahead of the first letters of names */
+	start = now();
+	for(i = 0, found = 0; i < LOOKUPS; i++) {
+		site_name(i*7919 % num_sites, name, sizeof(name));
+		name[2 + i%4] = '\0';
+		found += site_complete(index, name, matches, SITE_MATCHES);
+	}
+	report("prefix", now() - start, found);
+	/* Whole names, without accents and in upper case */
+	start = now();
+	for(i = 0, found = 0; i < LOOKUPS; i++) {
+		site_name(i*7919 % num_sites, name, sizeof(name));
+		for(len = 0; name[len]; len++) {
+			name[len] = name[len] >= 'a' && name[len] <= 'z'
+					? name[len]-'a'+'A' : name[len];
+		}
+		found += !site_resolve(index, name, &match);
+	}
+	report("exact", now() - start, found);
+	/* Names with a letter missing */
+	start = now();
+	for(i = 0, found = 0; i < LOOKUPS; i++) {
+		site_name(i*7919 % num_sites, name, sizeof(name));
+		for(len = 1; name[len]; len++) {
+			name[len] = name[len+1];
+		}
+		found += !site_resolve(index, name, &match);
+	}
+	report("typo", now() - start, found);
+	site_close(index);
+	return 0;
+}
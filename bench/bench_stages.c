@@ -0,0 +1,175 @@
+/******************************************************************************
+*     File Name           :     bench_stages.c                                *
+*     Description         :     Times every stage of a query against          *
+*                                 mock_sl replaying each response of a        *
+*                                 corpus, one json object per stage.          *
+******************************************************************************/
+#include <signal.h>             // kill, SIGTERM
+#include <sys/wait.h>           // waitpid
+#include "../client.h"          // get_request, extract_js, extract_trips
+#include "../triplist.h"        // scan_trips
+#include "../metrics.h"         // tsl_hist, hist_percentile
+/*****************************************************************************/
+#define BENCH_IP "127.0.0.1"
+#define BENCH_PORT 18091
+#define BENCH_BYTES (64L << 20)	// Bytes run through each stage per response
+#define BENCH_MIN 20 			// Fewest iterations per response
+#define BENCH_MAX 2000 			// Most iterations per response
+/*****************************************************************************/
+/* Stages in the order a query runs them */
+enum bench_stage {
+	BENCH_FETCH,				// get_request, over a kept-alive connection.
+	BENCH_EXTRACT,				// extract_js.
+	BENCH_PARSE,				// nx_json_parse.
+	BENCH_TRIPS,				// extract_trips and free_trips.
+	BENCH_SCAN,					// scan_trips, what replaced the two above.
+	BENCH_STAGES
+};
+static const char *stage_names[BENCH_STAGES] = {
+	"fetch", "extract", "parse", "trips", "scan"
+};
+/*****************************************************************************/
+static pid_t start_mock(const char *mock, const char *path) {
+	/* Started for each response and waited for until it accepts */
+	struct sockaddr_in addr;
+	char port[16];
+	pid_t pid;
+	int i, fd;
+	snprintf(port, sizeof(port), "%d", BENCH_PORT);
+	if((pid = fork()) == 0) {
+		execl(mock, mock, "-p", port, path, (char*)NULL);
+		_exit(1);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(BENCH_IP);
+	addr.sin_port = htons(BENCH_PORT);
+	for(i = 0; pid > 0 && i < 200; i++) {
+		if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+			break;
+		}
+		if(!connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+			close(fd);
+			return pid;
+		}
+		close(fd);
+		usleep(10000);
+	}
+	fprintf(stderr, "bench_stages: %s did not start\n", mock);
+	return -1;
+}
+/*****************************************************************************/
+static void stop_mock(pid_t pid) {
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+/*****************************************************************************/
+static void report(const char *path, int stage, long bytes,
+		const tsl_hist *h) {
+	printf("{\"corpus\":\"%s\",\"stage\":\"%s\",\"bytes\":%ld,"
+			"\"count\":%llu,\"mb_s\":%.1f,\"mean_us\":%.2f,\"p50_us\":%.2f,"
+			"\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}\n", path,
+			stage_names[stage], bytes, (unsigned long long)h->count,
+			(double)bytes*h->count/h->sum*1e3, (double)h->sum/h->count/1e3,
+			hist_percentile(h, 50)/1e3, hist_percentile(h, 90)/1e3,
+			hist_percentile(h, 99)/1e3, h->max/1e3);
+}
+/*****************************************************************************/
+static int run(const char *mock, const char *path) {
+	/* Every stage runs on what the one before produced, from a fresh copy
+	 * when it is destructive, with only the call itself timed */
+	tsl_hist hists[BENCH_STAGES];
+	const nx_json *jsmap;
+	tsl_config config;
+	tsl_client client;
+	triplist tl;
+	trip *trips;
+	char *js, *copy = NULL;
+	int i, n, len, iterations, retval = -1;
+	int64_t t;
+	pid_t pid;
+
+	if((pid = start_mock(mock, path)) < 0) {
+		return -1;
+	}
+	memset(hists, 0, sizeof(hists));
+	tsl_config_init(&config);
+	config.server = BENCH_IP;
+	config.port = BENCH_PORT;
+	tsl_client_init(&client, &config, NULL);
+	triplist_init(&tl);
+	for(i = 0, iterations = BENCH_MIN; i < iterations; i++) {
+		t = metrics_now();
+		len = get_request(&client, &js, ORIGIN_ID, DEST_ID);
+		hist_add(&hists[BENCH_FETCH], metrics_now()-t);
+		if(len < 0) {
+			fprintf(stderr, "bench_stages: %s: request failed (%d)\n", path,
+					len);
+			goto out;
+		}
+		if(!i) {
+			/* Sized on the first response, so every one gets as many
+			 * bytes through it */
+			iterations = BENCH_BYTES/len;
+			iterations = iterations < BENCH_MIN ? BENCH_MIN
+					: iterations > BENCH_MAX ? BENCH_MAX : iterations;
+			if(!(copy = malloc(len+1))) {
+				goto out;
+			}
+		}
+		t = metrics_now();
+		len = extract_js(&js, len);
+		hist_add(&hists[BENCH_EXTRACT], metrics_now()-t);
+		if(len < 0) {
+			fprintf(stderr, "bench_stages: %s: no json\n", path);
+			goto out;
+		}
+		memcpy(copy, js, len);
+		copy[len] = '\0';
+		t = metrics_now();
+		jsmap = nx_json_parse(copy, 0);
+		hist_add(&hists[BENCH_PARSE], metrics_now()-t);
+		if(!jsmap) {
+			fprintf(stderr, "bench_stages: %s: json does not parse\n", path);
+			goto out;
+		}
+		t = metrics_now();
+		n = extract_trips(jsmap, &trips);
+		free_trips(trips, n);
+		hist_add(&hists[BENCH_TRIPS], metrics_now()-t);
+		nx_json_free(jsmap);
+		memcpy(copy, js, len);
+		copy[len] = '\0';
+		t = metrics_now();
+		n = scan_trips(copy, len, &tl);
+		hist_add(&hists[BENCH_SCAN], metrics_now()-t);
+		if(n < 0) {
+			fprintf(stderr, "bench_stages: %s: no trips\n", path);
+			goto out;
+		}
+	}
+	for(i = 0; i < BENCH_STAGES; i++) {
+		report(path, i, i == BENCH_FETCH ? client.response.len : len,
+				&hists[i]);
+	}
+	retval = 0;
+out:
+	free(copy);
+	triplist_free(&tl);
+	tsl_client_free(&client);
+	stop_mock(pid);
+	return retval;
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	int i, failed = 0;
+	if(argc < 3) {
+		fprintf(stderr, "bench_stages <mock_sl> <response.json>...\n");
+		return 1;
+	}
+	for(i = 2; i < argc; i++) {
+		failed += run(argv[1], argv[i]) != 0;
+		fflush(stdout);
+	}
+	return failed != 0;
+}
@@ -0,0 +1,97 @@
+/******************************************************************************
+*     File Name           :     bench_write.c                                 *
+*     Description         :     Compares print_selection on stdio against     *
+*                                 writer_result in text, NDJSON and binary.   *
+******************************************************************************/
+#include <fcntl.h>              // open
+#include <stdio.h>              // printf, fopen
+#include <stdlib.h>             // malloc, free
+#include <time.h>               // clock_gettime
+#include "../writer.h"          // tsl_writer
+/*****************************************************************************/
+#define ITERATIONS 200
+/*****************************************************************************/
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+/*****************************************************************************/
+static char *read_file(const char *path, long *len) {
+	FILE *f = fopen(path, "rb");
+	char *buf;
+	if(!f) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(*len + 1);
+	if(fread(buf, 1, *len, f) != (size_t)*len) {
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	buf[*len] = '\0';
+	fclose(f);
+	return buf;
+}
+/*****************************************************************************/
+static void report(const char *name, double secs, long bytes) {
+	printf("%-8s %10.1f us/result %10.1f MB/s\n", name,
+			secs/ITERATIONS*1e6, (double)bytes/secs/1e6);
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	static const char *names[] = {"text", "ndjson", "binary"};
+	const char *path = argc > 1 ? argv[1] : "bench/data/triplist_large.json";
+	int i, format, fd = open("/dev/null", O_WRONLY);
+	FILE *out = fopen("/dev/null", "w");
+	long len, bytes[WRITE_BINARY+1];
+	double start;
+	tsl_writer w;
+	triplist tl;
+	char *js;
+
+	if(!(js = read_file(path, &len)) || fd < 0 || !out) {
+		fprintf(stderr, "bench_write: can not read %s\n", path);
+		return 1;
+	}
+	triplist_init(&tl);
+	if(scan_trips(js, len, &tl) < 0) {
+		fprintf(stderr, "bench_write: %s has no trips\n", path);
+		return 1;
+	}
+	printf("%d trips, %d edges\n", tl.trips_len, tl.edges_len);
+	/* Sizes of one result, the text is the same for both ways */
+	for(format = WRITE_TEXT; format <= WRITE_BINARY; format++) {
+		writer_init(&w, -1, format);
+		writer_result(&w, "Duvbo", "Universitetet", js, tl.trips, tl.edges,
+				NULL, tl.trips_len);
+		bytes[format] = (long)w.buf.len*ITERATIONS;
+		writer_free(&w);
+	}
+	/* A formatted fprintf per line, as the text was printed before */
+	start = now();
+	for(i = 0; i < ITERATIONS; i++) {
+		print_selection(out, js, tl.trips, tl.edges, NULL, tl.trips_len);
+	}
+	fflush(out);
+	report("stdio", now() - start, bytes[WRITE_TEXT]);
+	for(format = WRITE_TEXT; format <= WRITE_BINARY; format++) {
+		writer_init(&w, fd, format);
+		start = now();
+		for(i = 0; i < ITERATIONS; i++) {
+			writer_result(&w, "Duvbo", "Universitetet", js, tl.trips, tl.edges,
+					NULL, tl.trips_len);
+		}
+		writer_flush(&w);
+		report(names[format], now() - start, bytes[format]);
+		writer_free(&w);
+	}
+	triplist_free(&tl);
+	free(js);
+	fclose(out);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,115 @@
+/******************************************************************************
+*     File Name           :     gen_gtfs.c                                    *
+*     Description         :     Writes a GTFS feed of lines running all day   *
+*                                 between random stops, for benchmarking.     *
+******************************************************************************/
+#include <stdio.h>              // fopen, fprintf
+#include <stdlib.h>             // atoi
+/*****************************************************************************/
+static const char *stations[] = {
+	"Duvbo", "Sundbyberg", "Solna", "Karlberg", "Stockholm City",
+	"T-Centralen", "Östermalmstorg", "Stadion", "Tekniska högskolan",
+	"Universitetet", "Odenplan", "Hötorget", "Rådmansgatan", "Gärdet",
+	"Slussen", "Medborgarplatsen", "Skanstull", "Gullmarsplan", "Årstaberg",
+	"Älvsjö", "Södertälje centrum", "Märsta", "Uppsala C", "Bålsta"
+};
+#define NUM_STATIONS (int)(sizeof(stations)/sizeof(stations[0]))
+#define LINE_STOPS 20 			// Stops visited by a line
+#define PLATFORMS 2 			// Stop ids of every name
+#define HEADWAY 15 				// Minutes between departures
+/*****************************************************************************/
+static unsigned int seed = 12345;
+static int next_rand(int mod) {
+	seed = seed*1103515245 + 12345;
+	return (int)((seed >> 16) % (unsigned int)mod);
+}
+/*****************************************************************************/
+static FILE *open_file(const char *dir, const char *name, const char *header) {
+	char path[4096];
+	FILE *f;
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if(!(f = fopen(path, "w"))) {
+		perror(path);
+		return NULL;
+	}
+	fprintf(f, "%s\n", header);
+	return f;
+}
+/*****************************************************************************/
+static void print_name(FILE *f, int st) {
+	/* Some names need quoting, as in real feeds */
+	if(st < NUM_STATIONS) {
+		fprintf(f, "%s", stations[st]);
+	} else if(st % 7 == 0) {
+		fprintf(f, "\"Hållplats %d, norra\"", st);
+	} else {
+		fprintf(f, "Hållplats %d", st);
+	}
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	const char *dir = argc > 1 ? argv[1] : "bench/data/gtfs";
+	int num_stops = argc > 2 ? atoi(argv[2]) : 1000;
+	int num_lines = argc > 3 ? atoi(argv[3]) : 60;
+	int i, j, d, t, trip = 0, stops[LINE_STOPS];
+	FILE *f, *trips;
+
+	if(num_stops < LINE_STOPS) {
+		fprintf(stderr, "gen_gtfs: at least %d stops\n", LINE_STOPS);
+		return 1;
+	}
+	if(!(f = open_file(dir, "stops.txt",
+			"stop_id,stop_name,stop_lat,stop_lon"))) {
+		return 1;
+	}
+	for(i = 0; i < num_stops; i++) {
+		for(j = 0; j < PLATFORMS; j++) {
+			fprintf(f, "%d,", i*PLATFORMS + j);
+			print_name(f, i);
+			fprintf(f, ",59.%06d,18.%06d\n", next_rand(1000000),
+					next_rand(1000000));
+		}
+	}
+	fclose(f);
+	if(!(f = open_file(dir, "routes.txt",
+			"route_id,route_short_name,route_long_name,route_type"))) {
+		return 1;
+	}
+	for(i = 0; i < num_lines; i++) {
+		fprintf(f, "%d,%d,,%d\n", i, i+1, i % 5 ? 3 : 1);
+	}
+	fclose(f);
+	/* Every line runs both ways from 05:00 to past midnight */
+	trips = open_file(dir, "trips.txt", "route_id,service_id,trip_id");
+	if(!trips || !(f = open_file(dir, "stop_times.txt", "trip_id,arrival_time,"
+			"departure_time,stop_id,stop_sequence"))) {
+		return 1;
+	}
+	for(i = 0; i < num_lines; i++) {
+		for(j = 0; j < LINE_STOPS; j++) {
+			stops[j] = next_rand(num_stops)*PLATFORMS + next_rand(PLATFORMS);
+		}
+		for(d = 0; d < 2; d++) {
+			for(t = 5*60 + next_rand(HEADWAY); t < 25*60; t += HEADWAY) {
+				fprintf(trips, "%d,daily,%d\n", i, trip);
+				for(j = 0; j < LINE_STOPS; j++) {
+					int min = t + j*2;
+					fprintf(f, "%d,%02d:%02d:00,%02d:%02d:30,%d,%d\n", trip,
+							min/60, min%60, min/60, min%60,
+							stops[d ? LINE_STOPS-1-j : j], j+1);
+				}
+				trip++;
+			}
+		}
+	}
+	fclose(trips);
+	fclose(f);
+	/* A walk between the first two named stations */
+	if(!(f = open_file(dir, "transfers.txt",
+			"from_stop_id,to_stop_id,transfer_type,min_transfer_time"))) {
+		return 1;
+	}
+	fprintf(f, "0,%d,2,300\n%d,0,2,300\n", PLATFORMS, PLATFORMS);
+	fclose(f);
+	return 0;
+}
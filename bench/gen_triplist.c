@@ -0,0 +1,95 @@
+/******************************************************************************
+*     File Name           :     gen_triplist.c                                *
+*     Description         :     Writes a TripList response shaped like the    *
+*                                 travelplannerv2 reply, for benchmarking.    *
+******************************************************************************/
+#include <stdio.h>              // printf
+#include <stdlib.h>             // atoi
+/*****************************************************************************/
+static const char *stations[] = {
+	"Duvbo", "Sundbyberg", "Solna", "Karlberg", "Stockholm City",
+	"T-Centralen", "Östermalmstorg", "Stadion", "Tekniska högskolan",
+	"Universitetet", "Odenplan", "Hötorget", "Rådmansgatan", "Gärdet",
+	"Slussen", "Medborgarplatsen", "Skanstull", "Gullmarsplan", "Årstaberg",
+	"Älvsjö", "Södertälje centrum", "Märsta", "Uppsala C", "Bålsta"
+};
+static const char *types[] = {
+	"pendeltåg 35", "pendeltåg 36", "tunnelbanans röda linje 14",
+	"tunnelbanans gröna linje 17", "buss 4", "buss 515", "Gång"
+};
+#define NUM_STATIONS (int)(sizeof(stations)/sizeof(stations[0]))
+#define NUM_TYPES (int)(sizeof(types)/sizeof(types[0]))
+/*****************************************************************************/
+static unsigned int seed = 12345;
+static int next_rand(int mod) {
+	seed = seed*1103515245 + 12345;
+	return (int)((seed >> 16) % (unsigned int)mod);
+}
+/*****************************************************************************/
+static void print_station(const char *key, int st, int min) {
+	printf("\"%s\":{\"name\":\"%s\",\"type\":\"ST\",\"id\":\"4001%05d\","
+			"\"lon\":\"17.%06d\",\"lat\":\"59.%06d\",\"routeIdx\":\"%d\","
+			"\"time\":\"%02d:%02d\",\"date\":\"2016-06-16\",\"track\":\"%d\","
+			"\"rtTime\":\"%02d:%02d\",\"rtDate\":\"2016-06-16\"}",
+			key, stations[st], st*37, next_rand(1000000), next_rand(1000000),
+			next_rand(40), (min/60)%24, min%60, next_rand(4)+1,
+			(min/60)%24, min%60);
+}
+/*****************************************************************************/
+static void print_notes(int depth) {
+	/* Notes nested depth deep, which a parser has to walk whole */
+	int i;
+	printf(",\"Notes\":");
+	for(i = 0; i < depth; i++) {
+		printf("{\"Note\":[");
+	}
+	printf("\"%d\"", depth);
+	for(i = 0; i < depth; i++) {
+		printf("]}");
+	}
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	int num_trips = argc > 1 ? atoi(argv[1]) : 500;
+	int max_legs = argc > 2 ? atoi(argv[2]) : 5;
+	int depth = argc > 3 ? atoi(argv[3]) : 0;
+	int i, j;
+
+	printf("{\"TripList\":{\"noNamespaceSchemaLocation\":"
+			"\"http://api.sl.se/api/v1/xsd/trip.xsd\","
+			"\"servertime\":\"14:10\",\"serverdate\":\"2016-06-16\","
+			"\"Trip\":[");
+	for(i = 0; i < num_trips; i++) {
+		int legs = next_rand(max_legs) + 1;
+		int min = 8*60 + i*3;
+		int dur = 0;
+		printf("%s{\"dur\":\"%d\",\"chg\":\"%d\",\"co2\":\"0.%d\","
+				"\"LegList\":{\"Leg\":%s", i ? "," : "",
+				legs*11, legs-1, next_rand(9), legs > 1 ? "[" : "");
+		for(j = 0; j < legs; j++) {
+			int st = next_rand(NUM_STATIONS), type = next_rand(NUM_TYPES);
+			int len = next_rand(15) + 2;
+			printf("%s{\"idx\":\"%d\",\"name\":\"%s\",\"type\":\"%s\","
+					"\"dir\":\"%s\",\"line\":\"%d\",", j ? "," : "", j,
+					types[type], type == NUM_TYPES-1 ? "WALK" : "TRAIN",
+					stations[(st+5)%NUM_STATIONS], next_rand(60));
+			print_station("Origin", st, min + dur);
+			dur += len;
+			printf(",");
+			print_station("Destination", (st+1)%NUM_STATIONS, min + dur);
+			printf(",\"JourneyDetailRef\":{\"ref\":\"ref%%3D%d%%7C%d\"},"
+					"\"GeometryRef\":{\"ref\":\"ref%%3D%d\"}}",
+					next_rand(100000), next_rand(100000), next_rand(100000));
+		}
+		printf("%s},\"PriceInfo\":{\"TariffZones\":{\"$\":\"A\"},"
+				"\"TariffRemark\":{\"$\":\"2 biljett\"}}",
+				legs > 1 ? "]" : "");
+		if(depth > 0) {
+			print_notes(depth);
+		}
+		printf("}");
+	}
+	printf("]}}\n");
+	return 0;
+}
+/*****************************************************************************/
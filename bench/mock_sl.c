@@ -0,0 +1,244 @@
+/******************************************************************************
+*     File Name           :     mock_sl.c                                     *
+*     Description         :     Local stand-in for the travel planner that    *
+*                                 replays recorded TripList responses.        *
+******************************************************************************/
+#include <arpa/inet.h>          // inet_addr, htons
+#include <netinet/in.h>         // struct sockaddr_in
+#include <netinet/tcp.h>        // TCP_NODELAY
+#include <pthread.h>            // pthread_create
+#include <stdio.h>              // printf, fopen
+#include <stdlib.h>             // malloc, free, atoi
+#include <string.h>             // memcpy, strlen, strstr
+#include <sys/socket.h>         // socket, bind, listen, accept, send
+#include <time.h>               // nanosleep
+#include <unistd.h>             // getopt, read, close
+#include <zlib.h>               // deflateInit2
+/*****************************************************************************/
+#define MOCK_IP "127.0.0.1"
+#define MOCK_PORT 18080 		// Port of the test builds of tsl
+#define MOCK_READ 16384 		// Bytes of requests read at a time
+/*****************************************************************************/
+typedef struct response {
+	char *body;					// Bytes sent, gzipped with -z.
+	long len;					// Length of body.
+} response;
+/*****************************************************************************/
+static response *responses;		// Replayed in turn, one per request.
+static int num_responses;
+static unsigned long next_response;
+static int latency_ms;			// Delay before each response.
+static int chunk_size;			// Chunked encoding with pieces this big.
+static int chunk_ms;			// Delay between the chunks.
+static int gzipped;				// Bodies are sent gzipped.
+static int close_each;			// Connection closed after each response.
+/*****************************************************************************/
+static void usage(void) {
+	printf("mock_sl [-p <port>] [-l <ms>] [-c <bytes>] [-t <ms>] [-z] [-x]\n"
+			"        <response.json>...\n");
+}
+/*****************************************************************************/
+static void sleep_ms(int ms) {
+	struct timespec ts = {ms/1000, (ms%1000)*1000000L};
+	if(ms > 0) {
+		nanosleep(&ts, NULL);
+	}
+}
+/*****************************************************************************/
+static int gzip(response *r) {
+	/* Compressed once at start, as the planner would send it */
+	z_stream z;
+	char *out;
+	memset(&z, 0, sizeof(z));
+	if(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8,
+			Z_DEFAULT_STRATEGY) != Z_OK) {
+		return -1;
+	}
+	if(!(out = malloc(deflateBound(&z, r->len)))) {
+		deflateEnd(&z);
+		return -1;
+	}
+	z.next_in = (unsigned char*)r->body;
+	z.avail_in = r->len;
+	z.next_out = (unsigned char*)out;
+	z.avail_out = deflateBound(&z, r->len);
+	deflate(&z, Z_FINISH);
+	free(r->body);
+	r->body = out;
+	r->len = z.total_out;
+	deflateEnd(&z);
+	return 0;
+}
+/*****************************************************************************/
+static int load(const char *path, response *r) {
+	FILE *f = fopen(path, "rb");
+	if(!f) {
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	r->len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if(!(r->body = malloc(r->len+1))
+			|| fread(r->body, 1, r->len, f) != (size_t)r->len) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return gzipped ? gzip(r) : 0;
+}
+/*****************************************************************************/
+static int send_all(int fd, const char *data, long len) {
+	long sent, n;
+	for(sent = 0; sent < len; sent += n) {
+		if((n = send(fd, data+sent, len-sent, MSG_NOSIGNAL)) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+/*****************************************************************************/
+static int respond(int fd, const char *request) {
+	/* Each response has an ETag of its own, one the request already has
+	 * is answered with 304 and no body */
+	unsigned long index = __atomic_fetch_add(&next_response, 1,
+			__ATOMIC_RELAXED) % num_responses;
+	const response *r = &responses[index];
+	char head[256], etag[32];
+	long off, n;
+	int len;
+	sleep_ms(latency_ms);
+	snprintf(etag, sizeof(etag), "\"r%lu-%ld\"", index, r->len);
+	if(strstr(request, etag)) {
+		len = snprintf(head, sizeof(head), "HTTP/1.1 304 Not Modified\r\n"
+				"ETag: %s\r\n%s\r\n", etag,
+				close_each ? "Connection: close\r\n" : "");
+		return send_all(fd, head, len);
+	}
+	len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\n"
+			"Content-Type: application/json\r\nETag: %s\r\n%s%s", etag,
+			gzipped ? "Content-Encoding: gzip\r\n" : "",
+			close_each ? "Connection: close\r\n" : "");
+	if(!chunk_size) {
+		len += snprintf(head+len, sizeof(head)-len,
+				"Content-Length: %ld\r\n\r\n", r->len);
+		return send_all(fd, head, len) || send_all(fd, r->body, r->len);
+	}
+	len += snprintf(head+len, sizeof(head)-len,
+			"Transfer-Encoding: chunked\r\n\r\n");
+	if(send_all(fd, head, len)) {
+		return -1;
+	}
+	for(off = 0; off < r->len; off += n) {
+		n = r->len-off < chunk_size ? r->len-off : chunk_size;
+		len = snprintf(head, sizeof(head), "%lx\r\n", n);
+		if(send_all(fd, head, len) || send_all(fd, r->body+off, n)
+				|| send_all(fd, "\r\n", 2)) {
+			return -1;
+		}
+		sleep_ms(chunk_ms);
+	}
+	return send_all(fd, "0\r\n\r\n", 5);
+}
+/*****************************************************************************/
+static void *serve(void *arg) {
+	/* One thread per connection, so latency of one does not hold up the
+	 * rest. A request ends at its blank line, which may be split over
+	 * reads, so the match and the request carry over */
+	int fd = (long)arg, i, n, len = 0, matched = 0;
+	char buf[MOCK_READ], request[MOCK_READ];
+	while((n = read(fd, buf, sizeof(buf))) > 0) {
+		for(i = 0; i < n; i++) {
+			if(len < MOCK_READ-1) {
+				request[len++] = buf[i];
+			}
+			matched = buf[i] == "\r\n\r\n"[matched] ? matched+1
+					: buf[i] == '\r';
+			if(matched < 4) {
+				continue;
+			}
+			matched = 0;
+			request[len] = '\0';
+			len = 0;
+			if(respond(fd, request) || close_each) {
+				close(fd);
+				return NULL;
+			}
+		}
+	}
+	close(fd);
+	return NULL;
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	struct sockaddr_in addr;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int i, opt, fd, on = 1, port = MOCK_PORT;
+
+	while((opt = getopt(argc, argv, "c:l:p:t:xz")) != -1) {
+		switch(opt) {
+			case 'c':
+				chunk_size = atoi(optarg);
+				break;
+			case 'l':
+				latency_ms = atoi(optarg);
+				break;
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 't':
+				chunk_ms = atoi(optarg);
+				break;
+			case 'x':
+				close_each = 1;
+				break;
+			case 'z':
+				gzipped = 1;
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+	if(optind == argc) {
+		usage();
+		return 1;
+	}
+	num_responses = argc-optind;
+	if(!(responses = calloc(num_responses, sizeof(response)))) {
+		return 1;
+	}
+	for(i = 0; i < num_responses; i++) {
+		if(load(argv[optind+i], &responses[i])) {
+			fprintf(stderr, "mock_sl: can not read %s\n", argv[optind+i]);
+			return 1;
+		}
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(MOCK_IP);
+	addr.sin_port = htons(port);
+	if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+			|| setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+			|| bind(fd, (struct sockaddr*)&addr, sizeof(addr))
+			|| listen(fd, 1024)) {
+		perror("mock_sl: listen");
+		return 1;
+	}
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for(;;) {
+		long client = accept(fd, NULL, NULL);
+		if(client < 0) {
+			continue;
+		}
+		/* Headers, chunks and bodies are sent apart, and must not wait
+		 * for the acks of each other */
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		if(pthread_create(&thread, &attr, serve, (void*)client)) {
+			close(client);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,180 @@
+/******************************************************************************
+*     File Name           :     cache.c                                       *
+*     Description         :     On-disk cache of packed responses.            *
+******************************************************************************/
+#include <ctype.h>              // isspace, tolower
+#include <errno.h>              // errno, EEXIST
+#include <fcntl.h>              // open
+#include <stdint.h>             // uint32_t, uint64_t, int64_t
+#include <sys/mman.h>           // mmap, munmap
+#include <sys/stat.h>           // fstat, mkdir
+#include "cache.h"
+/*****************************************************************************/
+#define CACHE_MAGIC 0x434c5354 	// "TSLC"
+#define CACHE_VERSION 4
+#define CACHE_PATH_SIZE 4096 	// Longest path of an entry
+#define CACHE_ALIGN 8 			// Alignment of the body in the file
+/*****************************************************************************/
+typedef struct cache_header {
+	uint32_t magic;				// CACHE_MAGIC.
+	uint32_t version;			// CACHE_VERSION.
+	int64_t stored;				// Time the entry was stored.
+	uint32_t key_len;			// Bytes of the key that follows.
+	uint32_t body_len;			// Bytes of the body after the aligned key.
+} cache_header;
+/*****************************************************************************/
+void cache_init(tsl_cache *cache, const char *dir) {
+	cache->dir = dir;
+	cache->ttl = CACHE_TTL;
+	cache->stale = CACHE_STALE_TIME;
+}
+/*****************************************************************************/
+static int normalize(char *dst, int pos, const char *name) {
+	/* Case and runs of white space do not make a different station */
+	int space = 0;
+	while(isspace((unsigned char)*name)) {
+		name++;
+	}
+	for(; *name && pos < CACHE_KEY_SIZE-1; name++) {
+		if(isspace((unsigned char)*name)) {
+			space = 1;
+			continue;
+		}
+		if(space) {
+			dst[pos++] = ' ';
+			space = 0;
+		}
+		if(pos < CACHE_KEY_SIZE-1) {
+			dst[pos++] = tolower((unsigned char)*name);
+		}
+	}
+	return pos;
+}
+/*****************************************************************************/
+int cache_key(const char *origin, const char *dest, char *key) {
+	int len = normalize(key, 0, origin);
+	key[len++] = '\n';
+	len = normalize(key, len, dest);
+	if(len >= CACHE_KEY_SIZE-1) {
+		return E_CACHE;
+	}
+	key[len] = '\0';
+	return len;
+}
+/*****************************************************************************/
+static int make_key(const tsl_cache *cache, const char *origin,
+		const char *dest, char *key, char *path) {
+	/* The file is named by the hash of the key */
+	uint64_t hash = 14695981039346656037ULL;
+	int i, len = cache_key(origin, dest, key);
+	if(len < 0) {
+		return len;
+	}
+	for(i = 0; i < len; i++) {
+		hash = (hash ^ (unsigned char)key[i])*1099511628211ULL;
+	}
+	if(snprintf(path, CACHE_PATH_SIZE, "%s/%016llx.tsl", cache->dir,
+			(unsigned long long)hash) >= CACHE_PATH_SIZE) {
+		return E_CACHE;
+	}
+	return len;
+}
+/*****************************************************************************/
+static size_t body_off(uint32_t key_len) {
+	/* The body is aligned so that a mapped trip_block can be used as is */
+	return (sizeof(cache_header)+key_len+CACHE_ALIGN-1) & ~(size_t)(CACHE_ALIGN-1);
+}
+/*****************************************************************************/
+int cache_get(const tsl_cache *cache, const char *origin, const char *dest,
+		time_t now, cache_entry *entry) {
+	char key[CACHE_KEY_SIZE], path[CACHE_PATH_SIZE];
+	const cache_header *h;
+	struct stat st;
+	int fd, key_len = make_key(cache, origin, dest, key, path);
+
+	if(key_len < 0 || (fd = open(path, O_RDONLY)) < 0) {
+		return CACHE_MISS;
+	}
+	if(fstat(fd, &st) || st.st_size < (off_t)sizeof(cache_header)) {
+		close(fd);
+		return CACHE_MISS;
+	}
+	entry->map_len = st.st_size;
+	entry->map = mmap(NULL, entry->map_len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(entry->map == MAP_FAILED) {
+		return CACHE_MISS;
+	}
+	/* Entries of another layout, another key with the same hash and
+	 * truncated files are all misses */
+	h = entry->map;
+	if(h->magic != CACHE_MAGIC || h->version != CACHE_VERSION
+			|| h->key_len != (uint32_t)key_len
+			|| body_off(h->key_len)+(uint64_t)h->body_len > entry->map_len
+			|| memcmp((char*)(h+1), key, key_len)) {
+		cache_release(entry);
+		return CACHE_MISS;
+	}
+	entry->data = (char*)entry->map+body_off(h->key_len);
+	entry->len = h->body_len;
+	entry->age = now-h->stored;
+	if(entry->age <= cache->ttl) {
+		return CACHE_FRESH;
+	}
+	if(entry->age <= (time_t)cache->ttl+cache->stale) {
+		return CACHE_STALE;
+	}
+	cache_release(entry);
+	return CACHE_MISS;
+}
+/*****************************************************************************/
+static int write_all(int fd, const void *data, size_t len) {
+	const char *p = data;
+	ssize_t n;
+	while(len > 0) {
+		if((n = write(fd, p, len)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+/*****************************************************************************/
+int cache_put(const tsl_cache *cache, const char *origin, const char *dest,
+		time_t now, const void *data, int len) {
+	static const char pad[CACHE_ALIGN];
+	char key[CACHE_KEY_SIZE], path[CACHE_PATH_SIZE], tmp[CACHE_PATH_SIZE+32];
+	cache_header h = {CACHE_MAGIC, CACHE_VERSION, now, 0, len};
+	int fd, key_len, retval;
+
+	if(len < 0 || (key_len = make_key(cache, origin, dest, key, path)) < 0) {
+		return E_CACHE;
+	}
+	h.key_len = key_len;
+	if(mkdir(cache->dir, 0700) && errno != EEXIST) {
+		return E_CACHE;
+	}
+	/* Threads and processes storing the same key each get their own file */
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	if((fd = mkstemp(tmp)) < 0) {
+		return E_CACHE;
+	}
+	retval = write_all(fd, &h, sizeof(h)) || write_all(fd, key, key_len)
+			|| write_all(fd, pad, body_off(key_len)-sizeof(h)-key_len)
+			|| write_all(fd, data, len);
+	if(close(fd) || retval || rename(tmp, path)) {
+		unlink(tmp);
+		return E_CACHE;
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+void cache_release(cache_entry *entry) {
+	munmap(entry->map, entry->map_len);
+	entry->map = NULL;
+}
+/*****************************************************************************/
@@ -0,0 +1,122 @@
+/******************************************************************************
+*     File Name           :     cache.h                                       *
+*     Description         :     On-disk cache of packed responses.            *
+******************************************************************************/
+#ifndef CACHE_H
+#define CACHE_H
+#include <time.h>               // time_t
+#include "tsl.h"                // error numbers
+/*****************************************************************************/
+#define CACHE_TTL 60 			// Seconds an entry is fresh
+#define CACHE_STALE_TIME 240 	// Seconds a stale entry may still be served
+#define CACHE_KEY_SIZE 512 		// Longest normalized key
+/* Lookup results */
+enum cache_state {
+	CACHE_MISS,					// No usable entry.
+	CACHE_FRESH,				// Entry is younger than the ttl.
+	CACHE_STALE					// Entry may be served but should be refreshed.
+};
+/******************************************************************************
+* Struct: tsl_cache                                                           *
+* -----------------                                                           *
+*   Where and for how long responses are cached. Entries are keyed by the     *
+*   normalized origin and destination alone: the planner is always asked for  *
+*   trips from now on, and -a and -r only filter what it answered, so the     *
+*   same body serves every departure time. Its age alone decides whether it   *
+*   is fresh, stale and refreshed, or too old to be served, so a pair asked   *
+*   for again later still gets fresh departure times.                         *
+*                                                                             *
+*   dir: Directory holding one file per entry.                                *
+*   ttl: Seconds an entry is fresh.                                           *
+*   stale: Seconds past the ttl an entry is served while it is refreshed.     *
+******************************************************************************/
+typedef struct tsl_cache {
+	const char *dir;
+	int ttl;
+	int stale;
+} tsl_cache;
+/******************************************************************************
+* Struct: cache_entry                                                         *
+* -------------------                                                         *
+*   A cached body, mapped read-only straight from its file. Bodies are        *
+*   stored at an aligned offset, so a trip_block in one is used in place.     *
+*                                                                             *
+*   data: The body.                                                           *
+*   len: Bytes of the body.                                                   *
+*   age: Seconds since the entry was stored.                                  *
+*   map, map_len: The mapping, unmapped by cache_release.                     *
+******************************************************************************/
+typedef struct cache_entry {
+	const void *data;
+	int len;
+	time_t age;
+	void *map;
+	size_t map_len;
+} cache_entry;
+/******************************************************************************
+* Function: cache_init                                                        *
+* --------------------                                                        *
+*   Sets up a cache in dir with the default ttl and stale time.               *
+*                                                                             *
+*   cache: Pointer to the cache.                                              *
+*   dir: Directory of the cache, created when first stored to.                *
+******************************************************************************/
+void cache_init(tsl_cache *cache, const char *dir);
+/******************************************************************************
+* Function: cache_key                                                         *
+* -------------------                                                         *
+*   Makes the key of a query, "<origin>\n<dest>" with names lower cased and   *
+*   runs of white space made single spaces.                                   *
+*                                                                             *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*   key: Buffer of CACHE_KEY_SIZE bytes where the key is stored.              *
+*                                                                             *
+*   Returns: Length of the key.                                               *
+*            E_CACHE when the key does not fit.                               *
+******************************************************************************/
+int cache_key(const char *origin, const char *dest, char *key);
+/******************************************************************************
+* Function: cache_get                                                         *
+* -------------------                                                         *
+*   Looks up the body of a query.                                             *
+*                                                                             *
+*   cache: Pointer to the cache.                                              *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*   now: Time of the query, the age of the entry is taken from it.            *
+*   entry: Set to the entry unless CACHE_MISS is returned, release with       *
+*          cache_release.                                                     *
+*                                                                             *
+*   Returns: CACHE_FRESH, CACHE_STALE or CACHE_MISS.                          *
+******************************************************************************/
+int cache_get(const tsl_cache *cache, const char *origin, const char *dest,
+		time_t now, cache_entry *entry);
+/******************************************************************************
+* Function: cache_put                                                         *
+* -------------------                                                         *
+*   Stores the body of a query. The entry is written to a unique temporary    *
+*   file and renamed into place over the previous one of the same query, so   *
+*   readers see the old entry, stale or not, until the new one is complete.   *
+*                                                                             *
+*   cache: Pointer to the cache.                                              *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*   now: Time the body was fetched.                                           *
+*   data: The body, usually a trip_block.                                     *
+*   len: Bytes of the body.                                                   *
+*                                                                             *
+*   Returns: E_SUCCESS or E_CACHE.                                            *
+******************************************************************************/
+int cache_put(const tsl_cache *cache, const char *origin, const char *dest,
+		time_t now, const void *data, int len);
+/******************************************************************************
+* Function: cache_release                                                     *
+* -----------------------                                                     *
+*   Unmaps an entry returned by cache_get.                                    *
+*                                                                             *
+*   entry: Pointer to the entry.                                              *
+******************************************************************************/
+void cache_release(cache_entry *entry);
+/*****************************************************************************/
+#endif /* CACHE_H */
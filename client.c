@@ -0,0 +1,410 @@
+/******************************************************************************
+*     File Name           :     client.c                                      *
+*     Description         :     Requests to the travel planner and the trips  *
+*                                 extracted from its json.                    *
+******************************************************************************/
+#include "client.h"
+#include "station.h"            // station_intern, station_count
+#include "writer.h"             // tsl_writer
+/*****************************************************************************/
+void tsl_config_init(tsl_config *config) {
+#ifdef SL_IP
+	config->server = SL_IP;
+#else
+	config->server = HOST_NAME;
+#endif
+	config->port = PORT;
+	config->host = HOST_NAME;
+	config->key = API_KEY;
+	config->dns.hosts = NULL;
+	config->dns.nameserver = NULL;
+	config->sched = NULL;
+}
+/*****************************************************************************/
+void tsl_client_init(tsl_client *client, const tsl_config *config,
+		const tsl_cache *cache) {
+	client->config = *config;
+	conn_init(&client->conn, config->server, config->port,
+			&client->config.dns);
+	buf_init(&client->response);
+	client->cache = cache;
+	triplist_init(&client->tl);
+	client->mapped = 0;
+	client->priority = PRIORITY_INTERACTIVE;
+}
+/*****************************************************************************/
+static void release(tsl_client *client) {
+	/* The last result may point into the entry until the next query */
+	if(client->mapped) {
+		cache_release(&client->entry);
+		client->mapped = 0;
+	}
+}
+/*****************************************************************************/
+void tsl_client_free(tsl_client *client) {
+	release(client);
+	conn_close(&client->conn);
+	buf_free(&client->response);
+	triplist_free(&client->tl);
+}
+/*****************************************************************************/
+int format_request(char *request, const tsl_config *config,
+		const char *origin, const char *dest) {
+	int len = snprintf(request, MESSAGE_SIZE,
+			"GET http://%s/api2/travelplannerv2/"
+			"trip.%s?"				// Format
+			"key=%s&"				// API KEY
+			"originId=%s&"			// originId
+			"destId=%s "			// destId
+			"HTTP/1.1\r\n"			// HTTP version
+			"Host: %s\r\n"			// Server
+			"Accept-Encoding: gzip\r\n"	// Compressed body
+			"\r\n",				// Connection is kept alive
+			config->host, FORMAT, config->key, origin, dest, config->host);
+	return len < MESSAGE_SIZE ? len : E_SEND;
+}
+/*****************************************************************************/
+static int exchange(tsl_client *client, int len) {
+	/* The bucket and the backoff of retries are waited out in the thread
+	 * of the caller */
+	int retval, wait, attempts = 0;
+	while(1) {
+		if((wait = sched_acquire(client->config.sched, client->priority)) < 0) {
+			return wait;
+		}
+		if(wait > 0) {
+			usleep(wait*1000);
+			continue;
+		}
+		retval = http_exchange(&client->conn, client->request, len,
+				&client->response);
+		if((wait = sched_done(client->config.sched, retval,
+				retval < 0 ? 0 : client->conn.status, ++attempts)) < 0) {
+			return retval;
+		}
+		usleep(wait*1000);
+	}
+}
+/*****************************************************************************/
+int get_request(tsl_client *client, char **js, const char *origin,
+		const char *dest) {
+	int len = format_request(client->request, &client->config, origin, dest);
+	if(len < 0) {
+		return len;
+	}
+	if((len = exchange(client, len)) < 0) {
+		return len;
+	}
+	if(client->conn.status/100 != 2) {
+		return E_STATUS;
+	}
+	*js = client->response.data;
+	return len;
+}
+/*****************************************************************************/
+static void lap(tsl_timing *t, int stage) {
+	if(t) {
+		timing_lap(t, stage);
+	}
+}
+/*****************************************************************************/
+int scan_response(const tsl_cache *cache, triplist *tl, tsl_timing *t,
+		const char *origin, const char *dest, char **js, int len) {
+	/* Extracts properties straight from the json. Results are cached packed,
+	 * so a hit needs neither decoding nor a scan. A body without trips is
+	 * most likely an error of the planner and is not cached */
+	trip_block *tb;
+	len = extract_js(js, len);
+	lap(t, STAGE_EXTRACT);
+	if(len < 0) {
+		return len;
+	}
+	len = scan_trips(*js, len, tl);
+	lap(t, STAGE_SCAN);
+	if(len > 0 && cache && (tb = pack_triplist(*js, tl))) {
+		cache_put(cache, origin, dest, time(NULL), tb, tb->size);
+		free(tb);
+		lap(t, STAGE_CACHE);
+	}
+	return len;
+}
+/*****************************************************************************/
+int tsl_lookup(tsl_client *client, const char *origin, const char *dest,
+		tsl_result *result) {
+	/* Cached trips are stored packed and read from the mapping as they are.
+	 * An entry that does not check out is a miss */
+	const trip_block *tb;
+	int state;
+	release(client);
+	if(!client->cache) {
+		return CACHE_MISS;
+	}
+	state = cache_get(client->cache, origin, dest, time(NULL), &client->entry);
+	lap(client->conn.timing, STAGE_CACHE);
+	if(state == CACHE_MISS) {
+		return state;
+	}
+	client->mapped = 1;
+	tb = client->entry.data;
+	if(check_trip_block(tb, client->entry.len)) {
+		release(client);
+		return CACHE_MISS;
+	}
+	if(client->conn.timing) {
+		client->conn.timing->bytes_in += client->entry.len;
+	}
+	result->strings = TRIP_BLOCK_POOL(tb);
+	result->trips = TRIP_BLOCK_TRIPS(tb);
+	result->trips_len = tb->trips_len;
+	result->edges = TRIP_BLOCK_EDGES(tb);
+	result->stale = state == CACHE_STALE;
+	return state;
+}
+/*****************************************************************************/
+static void scanned(tsl_client *client, char *js, tsl_result *result) {
+	result->strings = js;
+	result->trips = client->tl.trips;
+	result->trips_len = client->tl.trips_len;
+	result->edges = client->tl.edges;
+	result->stale = 0;
+}
+/*****************************************************************************/
+int tsl_fetch(tsl_client *client, const char *origin, const char *dest,
+		tsl_result *result) {
+	char *js;
+	int len;
+	release(client);
+	if((len = get_request(client, &js, origin, dest)) < 0) {
+		return len;
+	}
+	if((len = scan_response(client->cache, &client->tl, client->conn.timing,
+			origin, dest, &js, len)) < 0) {
+		return len;
+	}
+	scanned(client, js, result);
+	return len;
+}
+/*****************************************************************************/
+int tsl_query(tsl_client *client, const char *origin, const char *dest,
+		tsl_result *result) {
+	if(tsl_lookup(client, origin, dest, result) != CACHE_MISS) {
+		return result->trips_len;
+	}
+	return tsl_fetch(client, origin, dest, result);
+}
+/*****************************************************************************/
+void tsl_watch_init(tsl_watch *w) {
+	w->etag[0] = w->modified[0] = '\0';
+	w->next_etag[0] = w->next_modified[0] = '\0';
+	w->last = NULL;
+}
+/*****************************************************************************/
+void tsl_watch_free(tsl_watch *w) {
+	free(w->last);
+	tsl_watch_init(w);
+}
+/*****************************************************************************/
+static int add_header(char *request, int len, const char *name,
+		const char *value) {
+	/* Inserted before the blank line that ends the request */
+	int n, space = MESSAGE_SIZE-len+2;
+	if(len < 0 || !*value) {
+		return len;
+	}
+	n = snprintf(request+len-2, space, "%s: %s\r\n\r\n", name, value);
+	return n < space ? len-2+n : E_SEND;
+}
+/*****************************************************************************/
+int tsl_watch_fetch(tsl_client *client, tsl_watch *w, const char *origin,
+		const char *dest, tsl_result *result) {
+	/* Validators are only taken once the trips of the response are kept,
+	 * so a response that did not make it is asked for in full again */
+	char *js;
+	int len = format_request(client->request, &client->config, origin, dest);
+	release(client);
+	len = add_header(client->request, len, "If-None-Match", w->etag);
+	len = add_header(client->request, len, "If-Modified-Since", w->modified);
+	if(len < 0 || (len = exchange(client, len)) < 0) {
+		return len;
+	}
+	if(client->conn.status == 304) {
+		return 0;
+	}
+	if(client->conn.status/100 != 2) {
+		return E_STATUS;
+	}
+	js = client->response.data;
+	if((len = scan_response(client->cache, &client->tl, client->conn.timing,
+			origin, dest, &js, len)) < 0) {
+		return len;
+	}
+	memcpy(w->next_etag, client->conn.etag, HTTP_VALIDATOR);
+	memcpy(w->next_modified, client->conn.modified, HTTP_VALIDATOR);
+	scanned(client, js, result);
+	return 1;
+}
+/*****************************************************************************/
+int tsl_watch_keep(tsl_watch *w, const tsl_result *result,
+		const int *selected, int num_selected) {
+	/* Packed like a cache entry, so the trips outlive the response */
+	trip_block *tb = NULL;
+	int count = station_count(), *offs = malloc(sizeof(int)*(count+1));
+	metrics_alloc(2);
+	if(offs && (tb = malloc(pack_selection(NULL, offs, count, result->strings,
+			result->trips, result->edges, selected, num_selected)))) {
+		pack_selection(tb, offs, count, result->strings, result->trips,
+				result->edges, selected, num_selected);
+	}
+	free(offs);
+	if(!tb) {
+		return E_UNKNOWN;
+	}
+	free(w->last);
+	w->last = tb;
+	tsl_watch_validate(w);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+void tsl_watch_validate(tsl_watch *w) {
+	memcpy(w->etag, w->next_etag, HTTP_VALIDATOR);
+	memcpy(w->modified, w->next_modified, HTTP_VALIDATOR);
+}
+/*****************************************************************************/
+int extract_js(char **js, int len) {
+	int start, end;
+	/* Start json at first '{' */
+	for(start = 0; start < len && (*js)[start] != '{'; start++);
+	/* End json at last '}' */
+	for(end = len-1; end > start && (*js)[end] != '}'; end--);
+	if(end <= start) {
+		return E_NOJSON;
+	}
+	*js += start;
+	return end-start+1;
+}
+/*****************************************************************************/
+int extract_trips(const nx_json *jsmap, trip **trips) {
+	int len;
+	const nx_json *js_trip_list = nx_json_get(jsmap, "TripList");
+	const nx_json *js_trip_array = nx_json_get(js_trip_list, "Trip");
+	if(js_trip_array->type == NX_JSON_ARRAY) {
+		len = js_trip_array->length;
+		*trips = malloc(sizeof(trip)*len);
+		int i;
+		for(i = 0; i < len; i++) {
+			const nx_json *js_trip = nx_json_item(js_trip_array, i);
+			extract_trip(js_trip, &(*trips)[i]);
+		}
+	} else {
+		len = 1;
+		*trips = malloc(sizeof(trip));
+		extract_trip(js_trip_array, &(*trips)[0]);
+	}
+	return len;
+}
+/*****************************************************************************/
+int extract_trip(const nx_json *js_trip, trip *new_trip) {
+	int len;
+	const nx_json *js_edge_list = nx_json_get(js_trip, "LegList");
+	const nx_json *js_edge_array = nx_json_get(js_edge_list, "Leg");
+	new_trip->dur = strdup(nx_json_get(js_trip, "dur")->text_value);
+	if(js_edge_array->type == NX_JSON_ARRAY) {
+		len = js_edge_array->length;
+		new_trip->edges = malloc(sizeof(edge)*len);
+		int i;
+		for(i = 0; i < len; i++) {
+			const nx_json *js_edge = nx_json_item(js_edge_array, i);
+			extract_edge(js_edge, &(new_trip->edges[i]));
+		}
+	} else {
+		len = 1;
+		new_trip->edges = malloc(sizeof(edge));
+		extract_edge(js_edge_array, &(new_trip->edges[0]));
+	}
+	new_trip->edges_len = len;
+	return len;
+}
+/*****************************************************************************/
+int extract_edge(const nx_json *js_edge, edge *new_edge) {
+	new_edge->type = strdup(nx_json_get(js_edge, "name")->text_value);
+	const nx_json *js_origin_station = nx_json_get(js_edge, "Origin");
+	const nx_json *js_dest_station = nx_json_get(js_edge, "Destination");
+	extract_station(js_origin_station, &(new_edge->origin));
+	extract_station(js_dest_station, &(new_edge->dest));
+	return 0;
+}
+/*****************************************************************************/
+int extract_station(const nx_json *js_station, station *new_station) {
+	const nx_json *js_name = nx_json_get(js_station, "name");
+	const nx_json *js_time = nx_json_get(js_station, "time");
+	/* Names repeat across edges, trips and queries, so only one copy of
+	 * each is kept */
+	new_station->id = station_intern(js_name->text_value,
+			strlen(js_name->text_value));
+	if(new_station->id < 0) {
+		return new_station->id;
+	}
+	new_station->name = station_name(new_station->id);
+	new_station->time = strdup(js_time->text_value);
+	return 0;
+}
+/*****************************************************************************/
+int print_trips(trip *trips, int num_trips) {
+	/* Written in pieces through one buffer rather than a printf per edge */
+	tsl_writer w;
+	int i, j, retval = writer_init(&w, STDOUT_FILENO, WRITE_TEXT);
+	for(i = 0; !retval && i < num_trips; i++) {
+		writer_put(&w, "(", 1);
+		writer_put(&w, trips[i].dur, strlen(trips[i].dur));
+		writer_put(&w, " min)\n", 6);
+		for(j = 0; j < trips[i].edges_len; j++) {
+			const edge *ed = &trips[i].edges[j];
+			writer_put(&w, "  [", 3);
+			writer_put(&w, ed->origin.name, strlen(ed->origin.name));
+			writer_put(&w, " : ", 3);
+			writer_put(&w, ed->origin.time, strlen(ed->origin.time));
+			writer_put(&w, "] ---{", 6);
+			writer_put(&w, ed->type, strlen(ed->type));
+			writer_put(&w, "}---> [", 7);
+			writer_put(&w, ed->dest.name, strlen(ed->dest.name));
+			writer_put(&w, " : ", 3);
+			writer_put(&w, ed->dest.time, strlen(ed->dest.time));
+			retval = writer_put(&w, "]\n", 2);
+		}
+	}
+	if(!retval) {
+		retval = writer_flush(&w);
+	}
+	writer_free(&w);
+	return retval;
+}
+/*****************************************************************************/
+int free_trips(trip *trips, int num_trips) {
+	int i;
+	for(i = 0; i < num_trips; i++) {
+		free_trip(trips[i]);
+	}
+	free(trips);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+int free_trip(trip tr) {
+	int i;
+	for(i = 0; i < tr.edges_len; i++) {
+		free_edge(tr.edges[i]);
+	}
+	free(tr.edges);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+int free_edge(edge ed) {
+	free_station(ed.origin);
+	free_station(ed.dest);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+int free_station(station st) {
+	free(st.time);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
@@ -0,0 +1,246 @@
+/******************************************************************************
+*     File Name           :     client.h                                      *
+*     Description         :     Requests to the travel planner and the trips  *
+*                                 extracted from its json.                    *
+******************************************************************************/
+#ifndef CLIENT_H
+#define CLIENT_H
+#include "tsl.h"                // tsl_config, tsl_conn, tsl_buf
+#include "triplist.h"           // triplist, trip_ref, edge_ref
+#include "cache.h"              // tsl_cache, cache_entry
+/******************************************************************************
+* Struct: tsl_result                                                          *
+* ------------------                                                          *
+*   Trips found by a query, valid until the next query of the same client.    *
+*                                                                             *
+*   strings: Json of the response, or pool of a cached trip_block, that the   *
+*            slices of the trips point into.                                  *
+*   trips: Array of trips.                                                    *
+*   trips_len: Number of trips.                                               *
+*   edges: Array of edges of the trips.                                       *
+*   stale: The trips come from a cache entry past its ttl.                    *
+******************************************************************************/
+typedef struct tsl_result {
+	const char *strings;
+	const trip_ref *trips; int trips_len;
+	const edge_ref *edges;
+	int stale;
+} tsl_result;
+/******************************************************************************
+* Struct: tsl_client                                                          *
+* ------------------                                                          *
+*   Everything a query needs, kept warm between queries. Clients share no     *
+*   state but the interned station names, so each thread may use its own.     *
+*                                                                             *
+*   config: Copy of the configuration the client was made with.               *
+*   conn: Connection to the server, kept alive.                               *
+*   response: Receive buffer, grows to fit the largest response.              *
+*   request: Buffer where the http GET request is formatted.                  *
+*   cache: Cache queries are answered from and stored in, or NULL.            *
+*   tl: Trips of the last response.                                           *
+*   entry: Cache entry the last result points into.                           *
+*   mapped: entry is held and has to be released.                             *
+*   priority: An enum sched_priority the requests are scheduled at.           *
+******************************************************************************/
+typedef struct tsl_client {
+	tsl_config config;
+	tsl_conn conn;
+	tsl_buf response;
+	char request[MESSAGE_SIZE];
+	const tsl_cache *cache;
+	triplist tl;
+	cache_entry entry; int mapped;
+	int priority;
+} tsl_client;
+/******************************************************************************
+* Struct: tsl_watch                                                           *
+* -----------------                                                           *
+*   A query asked again and again, and what was last answered.                *
+*                                                                             *
+*   etag: ETag of the last response, sent back in If-None-Match.              *
+*   modified: Last-Modified of the last response, sent back in                *
+*             If-Modified-Since.                                              *
+*   next_etag, next_modified: Validators of the response last fetched, they   *
+*                             become etag and modified once its trips are     *
+*                             kept.                                           *
+*   last: Trips last kept, NULL before the first.                             *
+******************************************************************************/
+typedef struct tsl_watch {
+	char etag[HTTP_VALIDATOR]; char modified[HTTP_VALIDATOR];
+	char next_etag[HTTP_VALIDATOR]; char next_modified[HTTP_VALIDATOR];
+	trip_block *last;
+} tsl_watch;
+/******************************************************************************
+* Function: tsl_client_init                                                   *
+* -------------------------                                                   *
+*   Initializes a client, nothing is allocated or connected until the first   *
+*   request.                                                                  *
+*                                                                             *
+*   client: Pointer to the client.                                            *
+*   config: Where the server is, copied.                                      *
+*   cache: Cache of results, kept by the caller, NULL for none.               *
+******************************************************************************/
+void tsl_client_init(tsl_client *client, const tsl_config *config,
+		const tsl_cache *cache);
+/******************************************************************************
+* Function: tsl_client_free                                                   *
+* -------------------------                                                   *
+*   Closes the connection and frees the buffers of a client.                  *
+*                                                                             *
+*   client: Pointer to the client.                                            *
+******************************************************************************/
+void tsl_client_free(tsl_client *client);
+/******************************************************************************
+* Function: get_request                                                       *
+* ---------------------                                                       *
+*   Sends a http GET request to the SL server to determine the travel path,   *
+*   through the scheduler of the configuration.                               *
+*                                                                             *
+*   client: Client whose connection and buffers are used.                     *
+*   js: Set to the decoded body of the response inside the client's buffer,   *
+*       valid until the next request.                                         *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*                                                                             *
+*   Returns: The length of the body.                                          *
+*            E_RESOLVE when the server name does not resolve.                 *
+*            E_CONNECT when connect fails on every address.                   *
+*            E_SEND when send fails.                                          *
+*            E_RECEIVE when recv fails.                                       *
+*            E_RESPONSE when the response can not be buffered.                *
+*            E_PROTOCOL when the response is not valid http.                  *
+*            E_STATUS when the status code is not 2xx.                        *
+*            E_BREAKER when the breaker of the scheduler is open.             *
+******************************************************************************/
+int get_request(tsl_client *client, char **js, const char *origin,
+		const char *dest);
+/******************************************************************************
+* Function: scan_response                                                     *
+* -----------------------                                                     *
+*   Narrows a response body to its json, scans the trips and stores them      *
+*   packed in the cache. A body without trips, such as an error of the        *
+*   planner sent with status 200, is not stored.                              *
+*                                                                             *
+*   cache: Cache to store in, NULL for none.                                  *
+*   tl: Where the trips are scanned into.                                     *
+*   t: Timing the extract, scan and cache stages are lapped on, or NULL.      *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*   js: Pointer to the body, moved forward to the json.                       *
+*   len: Length of the body.                                                  *
+*                                                                             *
+*   Returns: Number of trips.                                                 *
+*            E_NOJSON when the body holds no trips.                           *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int scan_response(const tsl_cache *cache, triplist *tl, tsl_timing *t,
+		const char *origin, const char *dest, char **js, int len);
+/******************************************************************************
+* Function: tsl_lookup                                                        *
+* --------------------                                                        *
+*   Answers a query from the cache of a client alone.                         *
+*                                                                             *
+*   client: Pointer to the client.                                            *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*   result: Set to the cached trips.                                          *
+*                                                                             *
+*   Returns: CACHE_FRESH or CACHE_STALE when result is set.                   *
+*            CACHE_MISS when there is no cache or no valid entry.             *
+******************************************************************************/
+int tsl_lookup(tsl_client *client, const char *origin, const char *dest,
+		tsl_result *result);
+/******************************************************************************
+* Function: tsl_fetch                                                         *
+* -------------------                                                         *
+*   Answers a query from the server, and caches the trips found.              *
+*                                                                             *
+*   client: Pointer to the client.                                            *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*   result: Set to the trips of the response.                                 *
+*                                                                             *
+*   Returns: Number of trips.                                                 *
+*            An error number of get_request or scan_response.                 *
+******************************************************************************/
+int tsl_fetch(tsl_client *client, const char *origin, const char *dest,
+		tsl_result *result);
+/******************************************************************************
+* Function: tsl_query                                                         *
+* -------------------                                                         *
+*   Answers a query from the cache when it has the trips, fresh or stale,     *
+*   and from the server otherwise. A stale result is the caller's to          *
+*   refresh with tsl_fetch.                                                   *
+*                                                                             *
+*   client: Pointer to the client.                                            *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*   result: Set to the trips.                                                 *
+*                                                                             *
+*   Returns: Number of trips, or an error number as tsl_fetch.                *
+******************************************************************************/
+int tsl_query(tsl_client *client, const char *origin, const char *dest,
+		tsl_result *result);
+/******************************************************************************
+* Function: tsl_watch_init                                                    *
+* ------------------------                                                    *
+*   Initializes a watch that has seen no response.                            *
+*                                                                             *
+*   w: Pointer to the watch.                                                  *
+******************************************************************************/
+void tsl_watch_init(tsl_watch *w);
+/******************************************************************************
+* Function: tsl_watch_free                                                    *
+* ------------------------                                                    *
+*   Frees the trips kept by a watch.                                          *
+*                                                                             *
+*   w: Pointer to the watch.                                                  *
+******************************************************************************/
+void tsl_watch_free(tsl_watch *w);
+/******************************************************************************
+* Function: tsl_watch_fetch                                                   *
+* -------------------------                                                   *
+*   Asks the server again, on the condition that the response changed since   *
+*   the last one of the watch. An unchanged response has no body to parse.    *
+*                                                                             *
+*   client: Pointer to the client.                                            *
+*   w: Pointer to the watch, the validators of a new response are held until  *
+*      tsl_watch_keep or tsl_watch_validate.                                  *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*   result: Set to the trips of a new response.                               *
+*                                                                             *
+*   Returns: 1 when result is set.                                            *
+*            0 when the server answered that nothing changed.                 *
+*            An error number as tsl_fetch.                                    *
+******************************************************************************/
+int tsl_watch_fetch(tsl_client *client, tsl_watch *w, const char *origin,
+		const char *dest, tsl_result *result);
+/******************************************************************************
+* Function: tsl_watch_keep                                                    *
+* ------------------------                                                    *
+*   Packs chosen trips of a result as the ones the next result is diffed      *
+*   against with diff_trips, and takes the validators of its response.        *
+*                                                                             *
+*   w: Pointer to the watch.                                                  *
+*   result: The result.                                                       *
+*   selected: Indexes of the trips to keep, NULL for the first ones.          *
+*   num_selected: Number of trips to keep.                                    *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_UNKNOWN when memory runs out, the last trips and validators    *
+*            are kept.                                                        *
+******************************************************************************/
+int tsl_watch_keep(tsl_watch *w, const tsl_result *result,
+		const int *selected, int num_selected);
+/******************************************************************************
+* Function: tsl_watch_validate                                                *
+* ----------------------------                                                *
+*   Takes the validators of the response last fetched when its trips did not  *
+*   change from the kept ones, so the next fetch is conditional on it.        *
+*                                                                             *
+*   w: Pointer to the watch.                                                  *
+******************************************************************************/
+void tsl_watch_validate(tsl_watch *w);
+/*****************************************************************************/
+#endif /* CLIENT_H */
@@ -0,0 +1,443 @@
+/******************************************************************************
+*     File Name           :     dns.c                                         *
+*     Description         :     Non-blocking resolution of the server name,   *
+*                                 with a cache that keeps answers their ttl.  *
+******************************************************************************/
+#include <ctype.h>              // tolower
+#include <errno.h>              // errno, EINTR
+#include <poll.h>               // poll
+#include <pthread.h>            // pthread_mutex_t
+#include <strings.h>            // strcasecmp
+#include <sys/random.h>         // getrandom
+#include "tsl.h"
+/*****************************************************************************/
+#define DNS_PACKET 1500 		// Largest message read
+#define DNS_HEADER 12 			// Bytes of the header of a message
+#define DNS_LINE 1024 			// Longest line of the hosts and resolv files
+/* Queries, A before AAAA */
+enum {Q_A, Q_AAAA};
+static const uint16_t qtypes[2] = {1, 28};
+/*****************************************************************************/
+static struct {
+	pthread_mutex_t lock;		// Held while the cache is used.
+	char names[DNS_CACHE][DNS_NAME];	// Names cached, "" when empty.
+	dns_answer answers[DNS_CACHE];	// Their answers, kept until they expire.
+} cache = {PTHREAD_MUTEX_INITIALIZER};
+/*****************************************************************************/
+static int64_t now_ms(void) {
+	return metrics_now()/1000000;
+}
+/*****************************************************************************/
+static void set_port(dns_answer *a, int port) {
+	int i;
+	for(i = 0; i < a->len; i++) {
+		if(a->addrs[i].u.sa.sa_family == AF_INET6) {
+			a->addrs[i].u.in6.sin6_port = htons(port);
+		} else {
+			a->addrs[i].u.in.sin_port = htons(port);
+		}
+	}
+}
+/*****************************************************************************/
+static int parse_addr(const char *text, int port, dns_addr *a) {
+	memset(a, 0, sizeof(dns_addr));
+	if(inet_pton(AF_INET, text, &a->u.in.sin_addr) == 1) {
+		a->u.in.sin_family = AF_INET;
+		a->u.in.sin_port = htons(port);
+		a->len = sizeof(a->u.in);
+		return 0;
+	}
+	if(inet_pton(AF_INET6, text, &a->u.in6.sin6_addr) == 1) {
+		a->u.in6.sin6_family = AF_INET6;
+		a->u.in6.sin6_port = htons(port);
+		a->len = sizeof(a->u.in6);
+		return 0;
+	}
+	return -1;
+}
+/*****************************************************************************/
+static int parse_server(const char *text, dns_addr *a) {
+	/* "<ip>", "<ip>:<port>" or "[<ipv6>]:<port>" */
+	char host[DNS_LINE];
+	const char *start = text, *end;
+	if(!parse_addr(text, DNS_PORT, a)) {
+		return 0;
+	}
+	if(*text == '[') {
+		start++;
+		if(!(end = strchr(start, ']')) || end[1] != ':') {
+			return -1;
+		}
+	} else if(!(end = strrchr(text, ':'))) {
+		return -1;
+	}
+	if(end-start >= (int)sizeof(host)) {
+		return -1;
+	}
+	memcpy(host, start, end-start);
+	host[end-start] = '\0';
+	return parse_addr(host, atoi(end + (*end == ']') + 1), a);
+}
+/*****************************************************************************/
+static int read_servers(dns_lookup *l, const dns_config *config) {
+	/* Only servers of the family of the first are asked, over one socket */
+	char line[DNS_LINE], server[DNS_LINE];
+	dns_addr *a;
+	FILE *f;
+	l->servers_len = 0;
+	if(config && config->nameserver) {
+		l->servers_len = !parse_server(config->nameserver, &l->servers[0]);
+		return l->servers_len;
+	}
+	if(!(f = fopen(DNS_RESOLV, "r"))) {
+		return 0;
+	}
+	while(l->servers_len < DNS_SERVERS && fgets(line, sizeof(line), f)) {
+		a = &l->servers[l->servers_len];
+		if(sscanf(line, " nameserver %s", server) == 1
+				&& !parse_server(server, a)
+				&& a->u.sa.sa_family == l->servers[0].u.sa.sa_family) {
+			l->servers_len++;
+		}
+	}
+	fclose(f);
+	return l->servers_len;
+}
+/*****************************************************************************/
+static int read_hosts(const char *path, const char *name, int port,
+		dns_answer *a) {
+	/* "<address> <name> <aliases>...", every line of the name counts */
+	char line[DNS_LINE], *p, *save;
+	dns_addr addr;
+	FILE *f = fopen(path, "r");
+	a->len = 0;
+	if(!f) {
+		return 0;
+	}
+	while(a->len < DNS_ADDRS && fgets(line, sizeof(line), f)) {
+		if((p = strchr(line, '#'))) {
+			*p = '\0';
+		}
+		if(!(p = strtok_r(line, " \t\r\n", &save)) || parse_addr(p, port, &addr)) {
+			continue;
+		}
+		while((p = strtok_r(NULL, " \t\r\n", &save))) {
+			if(!strcasecmp(p, name)) {
+				a->addrs[a->len++] = addr;
+				break;
+			}
+		}
+	}
+	fclose(f);
+	return a->len;
+}
+/*****************************************************************************/
+static int cache_find(const char *name, int port, dns_answer *a) {
+	int64_t now = now_ms();
+	int i, found = 0;
+	pthread_mutex_lock(&cache.lock);
+	for(i = 0; i < DNS_CACHE && !found; i++) {
+		if(cache.answers[i].expires > now && !strcasecmp(cache.names[i], name)) {
+			*a = cache.answers[i];
+			found = 1;
+		}
+	}
+	pthread_mutex_unlock(&cache.lock);
+	set_port(a, port);
+	return found;
+}
+/*****************************************************************************/
+static void cache_store(const char *name, const dns_answer *a) {
+	/* The entry of the name, or else the one expiring first, is replaced */
+	int i, victim = 0;
+	pthread_mutex_lock(&cache.lock);
+	for(i = 0; i < DNS_CACHE; i++) {
+		if(!strcasecmp(cache.names[i], name)) {
+			victim = i;
+			break;
+		}
+		if(cache.answers[i].expires < cache.answers[victim].expires) {
+			victim = i;
+		}
+	}
+	snprintf(cache.names[victim], DNS_NAME, "%s", name);
+	cache.answers[victim] = *a;
+	pthread_mutex_unlock(&cache.lock);
+}
+/*****************************************************************************/
+static int encode_query(unsigned char *buf, const char *name, uint16_t id,
+		uint16_t qtype) {
+	/* A header asking for recursion, and one question */
+	unsigned char *p = buf;
+	const char *label = name, *dot;
+	int len;
+	memset(p, 0, DNS_HEADER);
+	p[0] = id >> 8;
+	p[1] = id;
+	p[2] = 0x01;
+	p[5] = 1;
+	p += DNS_HEADER;
+	while(*label) {
+		dot = strchr(label, '.');
+		len = dot ? dot-label : (int)strlen(label);
+		if(len < 1 || len > 63) {
+			return -1;
+		}
+		*p++ = len;
+		memcpy(p, label, len);
+		p += len;
+		label += len + (dot != NULL);
+	}
+	*p++ = 0;
+	*p++ = qtype >> 8;
+	*p++ = qtype;
+	*p++ = 0;
+	*p++ = 1;
+	return p-buf;
+}
+/*****************************************************************************/
+static void send_queries(dns_lookup *l) {
+	/* Queries not answered yet go to the next server in turn */
+	const dns_addr *server = &l->servers[l->tries % l->servers_len];
+	unsigned char buf[DNS_PACKET];
+	int q, len;
+	for(q = Q_A; q <= Q_AAAA; q++) {
+		if(!l->done[q]
+				&& (len = encode_query(buf, l->name, l->ids[q], qtypes[q])) > 0) {
+			sendto(l->fd, buf, len, 0, &server->u.sa, server->len);
+		}
+	}
+	l->tries++;
+	l->next = now_ms() + DNS_TIMEOUT;
+}
+/*****************************************************************************/
+static int from_server(const dns_lookup *l, const dns_addr *from) {
+	/* Answers from anywhere else are not trusted */
+	const dns_addr *s;
+	int i;
+	for(i = 0; i < l->servers_len; i++) {
+		s = &l->servers[i];
+		if(from->u.sa.sa_family != s->u.sa.sa_family) {
+			continue;
+		}
+		if(s->u.sa.sa_family == AF_INET
+				? from->u.in.sin_port == s->u.in.sin_port
+				&& from->u.in.sin_addr.s_addr == s->u.in.sin_addr.s_addr
+				: from->u.in6.sin6_port == s->u.in6.sin6_port
+				&& !memcmp(&from->u.in6.sin6_addr, &s->u.in6.sin6_addr,
+					sizeof(s->u.in6.sin6_addr))) {
+			return 1;
+		}
+	}
+	return 0;
+}
+/*****************************************************************************/
+static int skip_name(const unsigned char *p, int len, int off) {
+	/* Labels up to the root, or up to a pointer that ends the name */
+	while(off < len) {
+		if(!p[off]) {
+			return off+1;
+		}
+		if((p[off] & 0xc0) == 0xc0) {
+			return off+2 <= len ? off+2 : -1;
+		}
+		if(p[off] & 0xc0) {
+			return -1;
+		}
+		off += p[off]+1;
+	}
+	return -1;
+}
+/*****************************************************************************/
+static void add_record(dns_lookup *l, int q, const unsigned char *rdata,
+		uint32_t ttl) {
+	dns_addr *a = &l->found[q][l->found_len[q]++];
+	memset(a, 0, sizeof(dns_addr));
+	if(q == Q_A) {
+		a->u.in.sin_family = AF_INET;
+		a->u.in.sin_port = htons(l->port);
+		memcpy(&a->u.in.sin_addr, rdata, 4);
+		a->len = sizeof(a->u.in);
+	} else {
+		a->u.in6.sin6_family = AF_INET6;
+		a->u.in6.sin6_port = htons(l->port);
+		memcpy(&a->u.in6.sin6_addr, rdata, 16);
+		a->len = sizeof(a->u.in6);
+	}
+	if(ttl < l->ttl) {
+		l->ttl = ttl;
+	}
+}
+/*****************************************************************************/
+static void read_answer(dns_lookup *l, const unsigned char *p, int len) {
+	/* Answers are matched on their id and question. Records of other
+	 * types, like the CNAMEs leading to the addresses, are skipped */
+	unsigned char query[DNS_PACKET];
+	int i, q, off, count, rcode, rdlen;
+	if(len < DNS_HEADER || !(p[2] & 0x80) || (p[4] << 8 | p[5]) != 1) {
+		return;
+	}
+	for(q = Q_A; q <= Q_AAAA; q++) {
+		if(!l->done[q] && (p[0] << 8 | p[1]) == l->ids[q]) {
+			break;
+		}
+	}
+	if(q > Q_AAAA || (off = encode_query(query, l->name, l->ids[q],
+			qtypes[q])) < 0 || off > len) {
+		return;
+	}
+	for(i = DNS_HEADER; i < off; i++) {
+		if(tolower(p[i]) != tolower(query[i])) {
+			return;
+		}
+	}
+	/* A server that fails is passed over by the next try */
+	rcode = p[3] & 0x0f;
+	if(rcode != 0 && rcode != 3) {
+		return;
+	}
+	count = p[6] << 8 | p[7];
+	for(i = 0; i < count && l->found_len[q] < DNS_ADDRS; i++) {
+		if((off = skip_name(p, len, off)) < 0 || off+10 > len) {
+			break;
+		}
+		rdlen = p[off+8] << 8 | p[off+9];
+		if(off+10+rdlen > len) {
+			break;
+		}
+		if((p[off] << 8 | p[off+1]) == qtypes[q] && (p[off+2] << 8 | p[off+3]) == 1
+				&& rdlen == (q == Q_A ? 4 : 16)) {
+			add_record(l, q, p+off+10, (uint32_t)p[off+4] << 24
+					| p[off+5] << 16 | p[off+6] << 8 | p[off+7]);
+		}
+		off += 10+rdlen;
+	}
+	l->done[q] = 1;
+	if(l->found_len[q] && !l->wait) {
+		l->wait = now_ms() + DNS_WAIT;
+	}
+}
+/*****************************************************************************/
+static int finish(dns_lookup *l) {
+	/* Families interleaved from IPv6, so a broken one costs one attempt */
+	dns_answer *a = &l->answer;
+	int i, q;
+	a->len = 0;
+	for(i = 0; i < DNS_ADDRS; i++) {
+		for(q = Q_AAAA; q >= Q_A; q--) {
+			if(i < l->found_len[q] && a->len < DNS_ADDRS) {
+				a->addrs[a->len++] = l->found[q][i];
+			}
+		}
+	}
+	a->expires = now_ms() + (int64_t)(a->len ? l->ttl : DNS_FAIL_TTL)*1000;
+	cache_store(l->name, a);
+	return a->len ? 1 : E_RESOLVE;
+}
+/*****************************************************************************/
+int dns_lookup_start(dns_lookup *l, const char *name, int port,
+		const dns_config *config) {
+	dns_answer *a = &l->answer;
+	memset(l, 0, sizeof(dns_lookup));
+	l->fd = -1;
+	l->port = port;
+	if(!parse_addr(name, port, &a->addrs[0])) {
+		a->len = 1;
+		a->expires = INT64_MAX;
+		return 1;
+	}
+	if(strlen(name) >= DNS_NAME) {
+		return E_RESOLVE;
+	}
+	strcpy(l->name, name);
+	if(cache_find(name, port, a)) {
+		return a->len ? 1 : E_RESOLVE;
+	}
+	if(read_hosts(config && config->hosts ? config->hosts : DNS_HOSTS, name,
+			port, a)) {
+		a->expires = now_ms() + DNS_HOSTS_TTL*1000;
+		cache_store(name, a);
+		return 1;
+	}
+	if(!read_servers(l, config) || (l->fd = socket(l->servers[0].u.sa.sa_family,
+			SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		return E_RESOLVE;
+	}
+	/* Ids that can not be guessed, so answers can not be forged blind */
+	if(getrandom(l->ids, sizeof(l->ids), GRND_NONBLOCK) != sizeof(l->ids)) {
+		l->ids[Q_A] = metrics_now();
+	}
+	if(l->ids[Q_AAAA] == l->ids[Q_A]) {
+		l->ids[Q_AAAA] = l->ids[Q_A]+1;
+	}
+	l->ttl = DNS_MAX_TTL;
+	send_queries(l);
+	return 0;
+}
+/*****************************************************************************/
+int dns_lookup_timeout(const dns_lookup *l) {
+	int64_t due = l->wait && l->wait < l->next ? l->wait : l->next;
+	int64_t now = now_ms();
+	return due > now ? due-now : 0;
+}
+/*****************************************************************************/
+int dns_lookup_step(dns_lookup *l) {
+	unsigned char buf[DNS_PACKET];
+	socklen_t from_len;
+	dns_addr from;
+	int64_t now;
+	int n;
+	while(1) {
+		from_len = sizeof(from.u);
+		if((n = recvfrom(l->fd, buf, sizeof(buf), 0, &from.u.sa,
+				&from_len)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if(from_server(l, &from)) {
+			read_answer(l, buf, n);
+		}
+	}
+	now = now_ms();
+	if((!l->done[Q_A] || !l->done[Q_AAAA]) && (!l->wait || now < l->wait)) {
+		if(now < l->next) {
+			return 0;
+		}
+		if(l->tries < DNS_TRIES) {
+			send_queries(l);
+			return 0;
+		}
+	}
+	return finish(l);
+}
+/*****************************************************************************/
+void dns_lookup_free(dns_lookup *l) {
+	if(l->fd >= 0) {
+		close(l->fd);
+	}
+	l->fd = -1;
+}
+/*****************************************************************************/
+int dns_resolve(const char *name, int port, const dns_config *config,
+		dns_answer *answer) {
+	dns_lookup l;
+	struct pollfd pfd;
+	int retval = dns_lookup_start(&l, name, port, config);
+	while(retval == 0) {
+		pfd.fd = l.fd;
+		pfd.events = POLLIN;
+		if(poll(&pfd, 1, dns_lookup_timeout(&l)) < 0 && errno != EINTR) {
+			retval = E_RESOLVE;
+			break;
+		}
+		retval = dns_lookup_step(&l);
+	}
+	dns_lookup_free(&l);
+	if(retval > 0) {
+		*answer = l.answer;
+	}
+	return retval > 0 ? E_SUCCESS : retval;
+}
+/*****************************************************************************/
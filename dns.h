@@ -0,0 +1,156 @@
+/******************************************************************************
+*     File Name           :     dns.h                                         *
+*     Description         :     Non-blocking resolution of the server name,   *
+*                                 with a cache that keeps answers their ttl.  *
+******************************************************************************/
+#ifndef DNS_H
+#define DNS_H
+#include <stdint.h>             // int64_t
+#include <netinet/in.h>         // struct sockaddr_in, struct sockaddr_in6
+/*****************************************************************************/
+#define DNS_HOSTS "/etc/hosts" 	// Looked in before any name server
+#define DNS_RESOLV "/etc/resolv.conf"	// Where the name servers are read
+#define DNS_PORT 53 			// Port of name servers
+#define DNS_NAME 256 			// Longest name, with its '\0'
+#define DNS_ADDRS 8 			// Most addresses kept of a name
+#define DNS_SERVERS 3 			// Most name servers asked in turn
+#define DNS_TIMEOUT 1000 		// ms before a query is sent again
+#define DNS_TRIES 3 			// Times a query is sent
+#define DNS_WAIT 50 			// ms an answer of one family waits for the other
+#define DNS_HAPPY 250 			// ms before the next address is tried alongside
+#define DNS_CACHE 64 			// Names cached
+#define DNS_MAX_TTL 3600 		// Longest time an answer is cached, in s
+#define DNS_HOSTS_TTL 60 		// Time names of the hosts file are cached, in s
+#define DNS_FAIL_TTL 5 			// Time a name that failed is cached, in s
+/******************************************************************************
+* Struct: dns_config                                                          *
+* ------------------                                                          *
+*   Where names are looked up, so a test can point at a hosts file or a name  *
+*   server of its own.                                                        *
+*                                                                             *
+*   hosts: Hosts file, NULL for DNS_HOSTS.                                    *
+*   nameserver: "<ip>", "<ip>:<port>" or "[<ipv6>]:<port>" of the name        *
+*               server, NULL for those of DNS_RESOLV.                         *
+******************************************************************************/
+typedef struct dns_config {const char *hosts; const char *nameserver;} dns_config;
+/******************************************************************************
+* Struct: dns_addr                                                            *
+* ----------------                                                            *
+*   An IPv4 or IPv6 address and port, ready for connect.                      *
+*                                                                             *
+*   len: Length of the address.                                               *
+*   u: The address, u.sa.sa_family tells which.                               *
+******************************************************************************/
+typedef struct dns_addr {
+	socklen_t len;
+	union {struct sockaddr sa; struct sockaddr_in in; struct sockaddr_in6 in6;} u;
+} dns_addr;
+/******************************************************************************
+* Struct: dns_answer                                                          *
+* ------------------                                                          *
+*   Addresses of a name, IPv6 and IPv4 interleaved in the order they are      *
+*   tried (RFC 8305).                                                         *
+*                                                                             *
+*   len: Number of addresses, 0 when the name does not resolve.               *
+*   expires: ms of metrics_now when the answer is past its ttl.               *
+*   addrs: The addresses.                                                     *
+******************************************************************************/
+typedef struct dns_answer {
+	int len; int64_t expires;
+	dns_addr addrs[DNS_ADDRS];
+} dns_answer;
+/******************************************************************************
+* Struct: dns_lookup                                                          *
+* ------------------                                                          *
+*   A and AAAA queries of one name in flight on one UDP socket, driven by     *
+*   the event loop of the caller.                                             *
+*                                                                             *
+*   fd: The socket, -1 when no query is in flight.                            *
+*   name: Name looked up.                                                     *
+*   port: Port set in the addresses found.                                    *
+*   servers: Name servers, asked in turn on every try.                        *
+*   tries: Times the queries have been sent.                                  *
+*   next: ms when the queries are sent again.                                 *
+*   wait: ms when the answer of one family stops waiting for the other, 0     *
+*         until one is answered.                                              *
+*   ids: Ids of the A and AAAA queries.                                       *
+*   done: The A and AAAA queries are answered.                                *
+*   found: Addresses of the A and AAAA answers.                               *
+*   ttl: Lowest ttl of the records found.                                     *
+*   answer: The result once the lookup is done.                               *
+******************************************************************************/
+typedef struct dns_lookup {
+	int fd;
+	char name[DNS_NAME]; int port;
+	dns_addr servers[DNS_SERVERS]; int servers_len;
+	int tries; int64_t next; int64_t wait;
+	uint16_t ids[2]; int done[2];
+	dns_addr found[2][DNS_ADDRS]; int found_len[2];
+	uint32_t ttl;
+	dns_answer answer;
+} dns_lookup;
+/******************************************************************************
+* Function: dns_lookup_start                                                  *
+* --------------------------                                                  *
+*   Starts resolving a name. Addresses, names cached and names of the hosts   *
+*   file are answered at once, anything else is asked of the name servers.    *
+*                                                                             *
+*   l: The lookup.                                                            *
+*   name: Name or address to resolve.                                         *
+*   port: Port of the addresses.                                              *
+*   config: Where to look, NULL for the defaults.                             *
+*                                                                             *
+*   Returns: 1 when l->answer is set already.                                 *
+*            0 when queries are in flight, l->fd becomes readable with the    *
+*            answers.                                                         *
+*            E_RESOLVE when the name does not resolve.                        *
+******************************************************************************/
+int dns_lookup_start(dns_lookup *l, const char *name, int port,
+		const dns_config *config);
+/******************************************************************************
+* Function: dns_lookup_timeout                                                *
+* ----------------------------                                                *
+*   l: The lookup.                                                            *
+*                                                                             *
+*   Returns: ms until dns_lookup_step has to be called even if l->fd is not   *
+*            readable, 0 when it is due.                                      *
+******************************************************************************/
+int dns_lookup_timeout(const dns_lookup *l);
+/******************************************************************************
+* Function: dns_lookup_step                                                   *
+* -------------------------                                                   *
+*   Reads the answers that arrived and sends the queries again when they are  *
+*   due. The result is cached, a failure for DNS_FAIL_TTL.                    *
+*                                                                             *
+*   l: The lookup.                                                            *
+*                                                                             *
+*   Returns: 1 when l->answer is set, l->fd may be closed.                    *
+*            0 when the lookup goes on.                                       *
+*            E_RESOLVE when the name does not resolve.                        *
+******************************************************************************/
+int dns_lookup_step(dns_lookup *l);
+/******************************************************************************
+* Function: dns_lookup_free                                                   *
+* -------------------------                                                   *
+*   Closes the socket of a lookup, which may still be in flight.              *
+*                                                                             *
+*   l: The lookup.                                                            *
+******************************************************************************/
+void dns_lookup_free(dns_lookup *l);
+/******************************************************************************
+* Function: dns_resolve                                                       *
+* ---------------------                                                       *
+*   Resolves a name, waiting for the lookup with poll.                        *
+*                                                                             *
+*   name: Name or address to resolve.                                         *
+*   port: Port of the addresses.                                              *
+*   config: Where to look, NULL for the defaults.                             *
+*   answer: Set to the addresses.                                             *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_RESOLVE when the name does not resolve.                        *
+******************************************************************************/
+int dns_resolve(const char *name, int port, const dns_config *config,
+		dns_answer *answer);
+/*****************************************************************************/
+#endif /* DNS_H */
@@ -0,0 +1,497 @@
+/******************************************************************************
+*     File Name           :     http.c                                        *
+*     Description         :     Persistent HTTP/1.1 connection to the server. *
+******************************************************************************/
+#define _GNU_SOURCE             // strcasestr
+#include <errno.h>              // errno
+#include <fcntl.h>              // fcntl, O_NONBLOCK
+#include <limits.h>             // INT_MAX
+#include <poll.h>               // poll
+#include <strings.h>            // strncasecmp
+#include "tsl.h"
+/*****************************************************************************/
+#define HTTP_READ 16384			// Bytes read at a time outside the body
+/* Parser states */
+enum {
+	S_STATUS,					// Status line.
+	S_HEADER,					// Header lines up to the blank line.
+	S_BODY,						// Body bytes, or bytes of one chunk.
+	S_CHUNK_SIZE,				// Size line of a chunk.
+	S_CHUNK_END,				// Line break after the data of a chunk.
+	S_TRAILER,					// Trailer lines after the last chunk.
+	S_DONE						// Response complete.
+};
+/*****************************************************************************/
+void conn_init(tsl_conn *conn, const char *server, int port,
+		const dns_config *dns) {
+	conn->server = server;
+	conn->port = port;
+	conn->dns = dns;
+	conn->addrs.len = 0;
+	conn->addr = 0;
+	conn->fd = -1;
+	conn->requests = 0;
+	conn->status = 0;
+	conn->etag[0] = conn->modified[0] = '\0';
+	conn->timing = NULL;
+}
+/*****************************************************************************/
+void conn_close(tsl_conn *conn) {
+	if(conn->fd >= 0) {
+		close(conn->fd);
+	}
+	conn->fd = -1;
+	conn->requests = 0;
+}
+/*****************************************************************************/
+void buf_init(tsl_buf *buf) {
+	buf->data = NULL;
+	buf->len = 0;
+	buf->cap = 0;
+}
+/*****************************************************************************/
+void buf_free(tsl_buf *buf) {
+	free(buf->data);
+	buf_init(buf);
+}
+/*****************************************************************************/
+int buf_reserve(tsl_buf *buf, int n) {
+	/* One byte more than asked for is kept for a terminating '\0' */
+	char *data;
+	int cap = buf->cap ? buf->cap : RESPONSE_SIZE;
+	if(buf->len+n < buf->cap) {
+		return E_SUCCESS;
+	}
+	metrics_alloc(1);
+	while(buf->len+n >= cap) {
+		if(cap > INT_MAX/2) {
+			return E_RESPONSE;
+		}
+		cap *= 2;
+	}
+	if(!(data = realloc(buf->data, cap))) {
+		return E_RESPONSE;
+	}
+	buf->data = data;
+	buf->cap = cap;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int conn_race(tsl_conn *conn) {
+	/* Connects to the addresses in turn from the one that worked last, the
+	 * next one started after DNS_HAPPY ms or when one fails. The first to
+	 * connect wins and the rest are closed */
+	struct pollfd fds[DNS_ADDRS];
+	int index[DNS_ADDRS], i, n = 0, next = 0, ready, err;
+	socklen_t err_len;
+	const dns_addr *a;
+	while(conn->fd < 0 && (n || next < conn->addrs.len)) {
+		if(next < conn->addrs.len) {
+			i = (conn->addr+next++) % conn->addrs.len;
+			a = &conn->addrs.addrs[i];
+			fds[n].fd = socket(a->u.sa.sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+			fds[n].events = POLLOUT;
+			index[n] = i;
+			if(fds[n].fd >= 0 && (!connect(fds[n].fd, &a->u.sa, a->len)
+					|| errno == EINPROGRESS)) {
+				n++;
+			} else if(fds[n].fd >= 0) {
+				close(fds[n].fd);
+			}
+		}
+		if(!n || !(ready = poll(fds, n, next < conn->addrs.len ? DNS_HAPPY
+				: -1))) {
+			continue;
+		}
+		if(ready < 0 && errno != EINTR) {
+			break;
+		}
+		for(i = 0; ready > 0 && conn->fd < 0 && i < n;) {
+			if(!fds[i].revents) {
+				i++;
+				continue;
+			}
+			err_len = sizeof(err);
+			if(!getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &err_len)
+					&& !err) {
+				conn->fd = fds[i].fd;
+				conn->addr = index[i];
+			} else {
+				close(fds[i].fd);
+			}
+			fds[i] = fds[--n];
+			index[i] = index[n];
+		}
+	}
+	for(i = 0; i < n; i++) {
+		close(fds[i].fd);
+	}
+	if(conn->fd < 0) {
+		return E_CONNECT;
+	}
+	fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) & ~O_NONBLOCK);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int conn_open(tsl_conn *conn) {
+	/* The name is resolved for every new socket, mostly from the cache */
+	int retval;
+	if(conn->fd >= 0) {
+		return E_SUCCESS;
+	}
+	if((retval = dns_resolve(conn->server, conn->port, conn->dns,
+			&conn->addrs)) < 0) {
+		return retval;
+	}
+	if(conn->timing) {
+		timing_lap(conn->timing, STAGE_DNS);
+	}
+	if(conn->addr >= conn->addrs.len) {
+		conn->addr = 0;
+	}
+	return conn_race(conn);
+}
+/*****************************************************************************/
+static int send_all(tsl_conn *conn, const char *p, int len) {
+	int retval;
+	while(len > 0) {
+		/* MSG_NOSIGNAL: a socket closed by the server must not kill us */
+		if((retval = send(conn->fd, p, len, MSG_NOSIGNAL)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return E_SEND;
+		}
+		p += retval;
+		len -= retval;
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+void http_parser_init(http_parser *p, tsl_buf *body) {
+	memset(p, 0, sizeof(http_parser));
+	p->state = S_STATUS;
+	p->remaining = -1;
+	p->body = body;
+	body->len = 0;
+}
+/*****************************************************************************/
+void http_parser_free(http_parser *p) {
+	if(p->gzip) {
+		inflateEnd(&p->zs);
+		p->gzip = 0;
+	}
+}
+/*****************************************************************************/
+static int finish(http_parser *p) {
+	if(p->gzip && !p->inflated) {
+		return E_PROTOCOL;		// Compressed stream was cut short
+	}
+	p->state = S_DONE;
+	p->body->data[p->body->len] = '\0';
+	return 1;
+}
+/*****************************************************************************/
+static int end_of_headers(http_parser *p) {
+	if(p->status/100 == 1) {
+		/* Interim response, the real one follows */
+		p->state = S_STATUS;
+		p->chunked = p->gzip = 0;
+		p->remaining = -1;
+		return 0;
+	}
+	if(p->gzip) {
+		memset(&p->zs, 0, sizeof(z_stream));
+		if(inflateInit2(&p->zs, 16+MAX_WBITS) != Z_OK) {
+			p->gzip = 0;
+			return E_RESPONSE;
+		}
+	}
+	if(buf_reserve(p->body, 0) < 0) {
+		return E_RESPONSE;
+	}
+	if(p->status == 204 || p->status == 304) {
+		p->inflated = 1;
+		return finish(p);
+	}
+	if(p->chunked) {
+		p->state = S_CHUNK_SIZE;
+	} else if(p->remaining == 0) {
+		p->inflated = 1;
+		return finish(p);
+	} else {
+		if(p->remaining < 0) {
+			p->close = 1;		// No framing, the body ends when the server closes
+		}
+		p->state = S_BODY;
+	}
+	return 0;
+}
+/*****************************************************************************/
+static void validator(char *dst, const char *value, const char *end) {
+	/* One that does not fit is dropped, a request without it is only
+	 * answered in full */
+	int len = end-value;
+	while(len > 0 && (value[len-1] == ' ' || value[len-1] == '\t')) {
+		len--;
+	}
+	if(len >= HTTP_VALIDATOR) {
+		len = 0;
+	}
+	memcpy(dst, value, len);
+	dst[len] = '\0';
+}
+/*****************************************************************************/
+static int on_line(http_parser *p, char *line, int len) {
+	char *value, *end;
+	long chunk;
+	switch(p->state) {
+		case S_STATUS:
+			if(len < 12 || strncmp(line, "HTTP/1.", 7) || line[8] != ' ') {
+				return E_PROTOCOL;
+			}
+			p->status = atoi(line+9);
+			p->close = line[7] == '0';	// HTTP/1.0 closes by default
+			p->state = S_HEADER;
+			return 0;
+		case S_HEADER:
+			if(len == 0) {
+				return end_of_headers(p);
+			}
+			if(!(value = memchr(line, ':', len))) {
+				return E_PROTOCOL;
+			}
+			for(value++; *value == ' ' || *value == '\t'; value++);
+			if(!strncasecmp(line, "Content-Length:", 15)) {
+				/* Digits only, a sign or junk would leave the body
+				 * without an end */
+				p->remaining = strtol(value, &end, 10);
+				for(; *end == ' ' || *end == '\t'; end++);
+				if(*value < '0' || *value > '9' || *end) {
+					return E_PROTOCOL;
+				}
+				if(p->remaining > INT_MAX/2) {
+					return E_RESPONSE;
+				}
+			} else if(!strncasecmp(line, "Transfer-Encoding:", 18)) {
+				p->chunked = strcasestr(value, "chunked") != NULL;
+			} else if(!strncasecmp(line, "Content-Encoding:", 17)) {
+				p->gzip = strcasestr(value, "gzip") != NULL;
+			} else if(!strncasecmp(line, "Connection:", 11)) {
+				p->close = !strncasecmp(value, "close", 5);
+			} else if(!strncasecmp(line, "ETag:", 5)) {
+				validator(p->etag, value, line+len);
+			} else if(!strncasecmp(line, "Last-Modified:", 14)) {
+				validator(p->modified, value, line+len);
+			}
+			return 0;
+		case S_CHUNK_SIZE:
+			chunk = strtol(line, &end, 16);	// ignores extensions
+			if(end == line || chunk < 0 || chunk > INT_MAX/2) {
+				return E_PROTOCOL;
+			}
+			p->remaining = chunk;
+			p->state = chunk ? S_BODY : S_TRAILER;
+			return 0;
+		case S_CHUNK_END:
+			if(len) {
+				return E_PROTOCOL;
+			}
+			p->state = S_CHUNK_SIZE;
+			return 0;
+		case S_TRAILER:
+			return len ? 0 : finish(p);
+	}
+	return E_PROTOCOL;
+}
+/*****************************************************************************/
+static int emit(http_parser *p, const char *data, int len) {
+	/* Appends body bytes, inflating them when the body is compressed */
+	tsl_buf *body = p->body;
+	int retval;
+	if(!p->gzip) {
+		if((retval = buf_reserve(body, len)) < 0) {
+			return retval;
+		}
+		memcpy(body->data+body->len, data, len);
+		body->len += len;
+		return 0;
+	}
+	if(p->inflated) {
+		return 0;				// Bytes after the end of the gzip stream
+	}
+	p->zs.next_in = (Bytef*)data;
+	p->zs.avail_in = len;
+	do {
+		if((retval = buf_reserve(body, len*4 > HTTP_READ ? len*4 : HTTP_READ)) < 0) {
+			return retval;
+		}
+		p->zs.next_out = (Bytef*)body->data+body->len;
+		p->zs.avail_out = body->cap-1-body->len;
+		retval = inflate(&p->zs, Z_NO_FLUSH);
+		body->len = body->cap-1-p->zs.avail_out;
+		if(retval == Z_STREAM_END) {
+			p->inflated = 1;
+			return 0;
+		}
+		if(retval != Z_OK && retval != Z_BUF_ERROR) {
+			return E_PROTOCOL;
+		}
+	} while(p->zs.avail_in > 0 || p->zs.avail_out == 0);
+	return 0;
+}
+/*****************************************************************************/
+static int end_of_segment(http_parser *p) {
+	if(p->chunked) {
+		p->state = S_CHUNK_END;
+		return 0;
+	}
+	return finish(p);
+}
+/*****************************************************************************/
+int http_parser_feed(http_parser *p, const char *data, int len) {
+	const char *nl;
+	int take, retval = 0;
+	p->received += len;
+	while(len > 0 && p->state != S_DONE && retval >= 0) {
+		if(p->state == S_BODY) {
+			take = p->remaining >= 0 && p->remaining < len ? p->remaining : len;
+			if((retval = emit(p, data, take)) == 0 && p->remaining >= 0
+					&& !(p->remaining -= take)) {
+				retval = end_of_segment(p);
+			}
+		} else {
+			/* Lines may be split between reads, so they are gathered first */
+			nl = memchr(data, '\n', len);
+			take = nl ? nl-data+1 : len;
+			if(p->line_len+take >= HTTP_LINE_SIZE) {
+				return E_PROTOCOL;
+			}
+			memcpy(p->line+p->line_len, data, take);
+			p->line_len += take;
+			if(nl) {
+				int line_len = p->line_len-1;
+				if(line_len > 0 && p->line[line_len-1] == '\r') {
+					line_len--;
+				}
+				p->line[line_len] = '\0';
+				p->line_len = 0;
+				retval = on_line(p, p->line, line_len);
+			}
+		}
+		data += take;
+		len -= take;
+	}
+	if(retval < 0) {
+		return retval;
+	}
+	return p->state == S_DONE;
+}
+/*****************************************************************************/
+int http_parser_space(http_parser *p, char **dst) {
+	/* Uncompressed body bytes skip the parser and land in the body buffer.
+	 * The length the server claims is not reserved up front, the buffer
+	 * only grows as bytes arrive, whatever room it has is used first */
+	int n, retval;
+	if(p->state != S_BODY || p->gzip) {
+		return 0;
+	}
+	if((retval = buf_reserve(p->body, HTTP_READ)) < 0) {
+		return retval;
+	}
+	n = p->body->cap-1-p->body->len;
+	if(p->remaining >= 0 && p->remaining < n) {
+		n = p->remaining;
+	}
+	*dst = p->body->data+p->body->len;
+	return n;
+}
+/*****************************************************************************/
+int http_parser_commit(http_parser *p, int n) {
+	p->received += n;
+	p->body->len += n;
+	if(p->remaining >= 0 && !(p->remaining -= n)) {
+		int retval = end_of_segment(p);
+		return retval < 0 ? retval : p->state == S_DONE;
+	}
+	return 0;
+}
+/*****************************************************************************/
+int http_parser_eof(http_parser *p) {
+	if(p->state == S_BODY && p->remaining < 0 && !p->chunked) {
+		return finish(p);
+	}
+	return p->state == S_DONE ? 1 : E_RECEIVE;
+}
+/*****************************************************************************/
+static int read_response(tsl_conn *conn, http_parser *p) {
+	char raw[HTTP_READ], *dst;
+	int n, space, retval = 0;
+	while(retval == 0) {
+		if((space = http_parser_space(p, &dst)) < 0) {
+			return space;
+		}
+		if(space > 0) {
+			n = read(conn->fd, dst, space);
+		} else {
+			n = read(conn->fd, raw, sizeof(raw));
+		}
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return E_RECEIVE;
+		}
+		if(n > 0 && !p->received && conn->timing) {
+			timing_lap(conn->timing, STAGE_FIRST_BYTE);
+		}
+		if(n == 0) {
+			retval = http_parser_eof(p);
+		} else if(space > 0) {
+			retval = http_parser_commit(p, n);
+		} else {
+			retval = http_parser_feed(p, raw, n);
+		}
+	}
+	return retval;
+}
+/*****************************************************************************/
+int http_exchange(tsl_conn *conn, const char *request, int request_len,
+		tsl_buf *body) {
+	http_parser parser;
+	int retval, reused;
+	do {
+		reused = conn->requests > 0;
+		http_parser_init(&parser, body);
+		if((retval = conn_open(conn)) < 0) {
+			return retval;
+		}
+		if(!conn->requests && conn->timing) {
+			timing_lap(conn->timing, STAGE_CONNECT);
+		}
+		conn->requests++;
+		if((retval = send_all(conn, request, request_len)) == E_SUCCESS) {
+			retval = read_response(conn, &parser);
+		}
+		http_parser_free(&parser);
+		if(retval < 0 || parser.close) {
+			conn_close(conn);
+		}
+		/* A kept-alive socket may have been closed by the server while idle,
+		 * that shows up as nothing received and is retried once */
+	} while(retval < 0 && reused && !parser.received
+			&& (retval == E_SEND || retval == E_RECEIVE));
+	if(retval < 0) {
+		return retval;
+	}
+	if(conn->timing) {
+		timing_lap(conn->timing, STAGE_BODY);
+		conn->timing->bytes_in += parser.received;
+		conn->timing->body_bytes = body->len;
+	}
+	conn->status = parser.status;
+	memcpy(conn->etag, parser.etag, HTTP_VALIDATOR);
+	memcpy(conn->modified, parser.modified, HTTP_VALIDATOR);
+	return body->len;
+}
+/*****************************************************************************/
@@ -0,0 +1,227 @@
+/******************************************************************************
+*     File Name           :     http.h                                        *
+*     Description         :     Persistent HTTP/1.1 connection to the server. *
+******************************************************************************/
+#ifndef HTTP_H
+#define HTTP_H
+#include <zlib.h>               // z_stream
+#include "metrics.h"            // tsl_timing
+#include "dns.h"                // dns_config, dns_answer
+/*****************************************************************************/
+#define HTTP_LINE_SIZE 8192		// Longest status, header or chunk size line
+#define HTTP_VALIDATOR 128		// Longest ETag or Last-Modified kept, with '\0'
+/******************************************************************************
+* Struct: tsl_conn                                                            *
+* ----------------                                                            *
+*   A connection to the server that is kept open between requests.            *
+*                                                                             *
+*   fd: Socket, -1 while disconnected.                                        *
+*   server: Name or address of the server.                                    *
+*   port: Port of the server.                                                 *
+*   dns: Where server is resolved, NULL for the defaults.                     *
+*   addrs: Addresses server resolved to when the socket was last opened.      *
+*   addr: Index in addrs of the address connected to, tried first the next    *
+*         time.                                                               *
+*   requests: Number of requests sent since the socket was opened.            *
+*   status: Status code of the last response.                                 *
+*   etag: ETag of the last response of http_exchange, empty without one.      *
+*   modified: Last-Modified of that response, empty without one.              *
+*   timing: Where the connect, first byte and body of exchanges are lapped,   *
+*           NULL for nowhere.                                                 *
+******************************************************************************/
+typedef struct tsl_conn {
+	int fd; const char *server; int port; const dns_config *dns;
+	dns_answer addrs; int addr;
+	int requests; int status;
+	char etag[HTTP_VALIDATOR]; char modified[HTTP_VALIDATOR];
+	tsl_timing *timing;
+} tsl_conn;
+/******************************************************************************
+* Struct: tsl_buf                                                             *
+* ---------------                                                             *
+*   A receive buffer that grows geometrically and is reused by every          *
+*   request, so it stops allocating once it fits the largest response.        *
+*                                                                             *
+*   data: The buffer, NULL until the first request.                           *
+*   len: Number of bytes stored.                                              *
+*   cap: Size of the buffer.                                                  *
+******************************************************************************/
+typedef struct tsl_buf {char *data; int len; int cap;} tsl_buf;
+/******************************************************************************
+* Struct: http_parser                                                         *
+* -------------------                                                         *
+*   Incremental parser of one HTTP/1.1 response. Bytes can be fed in pieces   *
+*   of any size as they arrive; the body is decoded from chunked transfer     *
+*   encoding and gzip content encoding on the fly and appended to a buffer.   *
+*                                                                             *
+*   state: Part of the response that is expected next.                        *
+*   status: Status code of the response.                                      *
+*   remaining: Bytes left of the body or of the current chunk, -1 when the    *
+*              body ends with the connection.                                 *
+*   chunked: Body uses chunked transfer encoding.                             *
+*   gzip: Body is gzip compressed, zs inflates it.                            *
+*   inflated: The end of the compressed stream has been reached.              *
+*   close: Server closes the connection after the response.                   *
+*   received: Number of bytes of the response seen so far.                    *
+*   etag: Value of the ETag header, empty without one or when too long.       *
+*   modified: Value of the Last-Modified header, as etag.                     *
+*   body: Buffer where the decoded body is stored.                            *
+*   line: Partial line carried over between pieces.                           *
+******************************************************************************/
+typedef struct http_parser {
+	int state; int status; long remaining;
+	int chunked; int gzip; int inflated; int close;
+	long received;
+	char etag[HTTP_VALIDATOR]; char modified[HTTP_VALIDATOR];
+	tsl_buf *body;
+	z_stream zs;
+	int line_len; char line[HTTP_LINE_SIZE];
+} http_parser;
+/******************************************************************************
+* Function: conn_init                                                         *
+* -------------------                                                         *
+*   Initializes a disconnected connection, nothing is resolved or sent until  *
+*   the first request.                                                        *
+*                                                                             *
+*   conn: Pointer to the connection.                                          *
+*   server: Name or address of the server, kept by the caller.                *
+*   port: Port of the server.                                                 *
+*   dns: Where server is resolved, kept by the caller, NULL for the defaults. *
+******************************************************************************/
+void conn_init(tsl_conn *conn, const char *server, int port,
+		const dns_config *dns);
+/******************************************************************************
+* Function: conn_close                                                        *
+* --------------------                                                        *
+*   Closes the socket of a connection, the next request reconnects.           *
+*                                                                             *
+*   conn: Pointer to the connection.                                          *
+******************************************************************************/
+void conn_close(tsl_conn *conn);
+/******************************************************************************
+* Function: buf_init                                                          *
+* ------------------                                                          *
+*   Initializes an empty buffer, nothing is allocated until it is used.       *
+*                                                                             *
+*   buf: Pointer to the buffer.                                               *
+******************************************************************************/
+void buf_init(tsl_buf *buf);
+/******************************************************************************
+* Function: buf_free                                                          *
+* ------------------                                                          *
+*   Frees the memory of a buffer and empties it.                              *
+*                                                                             *
+*   buf: Pointer to the buffer.                                               *
+******************************************************************************/
+void buf_free(tsl_buf *buf);
+/******************************************************************************
+* Function: buf_reserve                                                       *
+* ---------------------                                                       *
+*   Makes room for n more bytes after the stored ones, and a terminating      *
+*   '\0' after those.                                                         *
+*                                                                             *
+*   buf: Pointer to the buffer.                                               *
+*   n: Number of bytes.                                                       *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_RESPONSE when the buffer can not grow.                         *
+******************************************************************************/
+int buf_reserve(tsl_buf *buf, int n);
+/******************************************************************************
+* Function: http_parser_init                                                  *
+* --------------------------                                                  *
+*   Prepares a parser for a new response.                                     *
+*                                                                             *
+*   p: Pointer to the parser.                                                 *
+*   body: Buffer where the decoded body is stored, emptied.                   *
+******************************************************************************/
+void http_parser_init(http_parser *p, tsl_buf *body);
+/******************************************************************************
+* Function: http_parser_free                                                  *
+* --------------------------                                                  *
+*   Frees the decompression state of a parser.                                *
+*                                                                             *
+*   p: Pointer to the parser.                                                 *
+******************************************************************************/
+void http_parser_free(http_parser *p);
+/******************************************************************************
+* Function: http_parser_feed                                                  *
+* --------------------------                                                  *
+*   Parses the next piece of a response.                                      *
+*                                                                             *
+*   p: Pointer to the parser.                                                 *
+*   data: Bytes received.                                                     *
+*   len: Number of bytes.                                                     *
+*                                                                             *
+*   Returns: 1 when the response is complete, 0 when more bytes are needed.   *
+*            E_PROTOCOL when the response is not valid http.                  *
+*            E_RESPONSE when the body can not be buffered.                    *
+******************************************************************************/
+int http_parser_feed(http_parser *p, const char *data, int len);
+/******************************************************************************
+* Function: http_parser_space                                                 *
+* ---------------------------                                                 *
+*   Uncompressed body bytes need no parsing, so they can be read straight     *
+*   into the body buffer instead of being fed. The buffer grows as the body   *
+*   arrives, never by the length the server claims up front.                  *
+*                                                                             *
+*   p: Pointer to the parser.                                                 *
+*   dst: Set to where the next body bytes should be stored.                   *
+*                                                                             *
+*   Returns: Number of bytes that may be stored at dst, then committed.       *
+*            0 when received bytes must go through http_parser_feed.          *
+*            E_RESPONSE when the body can not be buffered.                    *
+******************************************************************************/
+int http_parser_space(http_parser *p, char **dst);
+/******************************************************************************
+* Function: http_parser_commit                                                *
+* ----------------------------                                                *
+*   Accounts for n body bytes stored at the place given by                    *
+*   http_parser_space.                                                        *
+*                                                                             *
+*   p: Pointer to the parser.                                                 *
+*   n: Number of bytes stored.                                                *
+*                                                                             *
+*   Returns: As http_parser_feed.                                             *
+******************************************************************************/
+int http_parser_commit(http_parser *p, int n);
+/******************************************************************************
+* Function: http_parser_eof                                                   *
+* -------------------------                                                   *
+*   Tells the parser that the server closed the connection.                   *
+*                                                                             *
+*   p: Pointer to the parser.                                                 *
+*                                                                             *
+*   Returns: 1 when that completed the response.                              *
+*            E_RECEIVE when the response was cut short.                       *
+*            E_PROTOCOL when the compressed body was cut short.               *
+******************************************************************************/
+int http_parser_eof(http_parser *p);
+/******************************************************************************
+* Function: http_exchange                                                     *
+* -----------------------                                                     *
+*   Sends a request over a kept-alive connection and reads exactly one        *
+*   response. A connection that the server closed while idle is reopened      *
+*   and the request is sent again. A new connection races the addresses of    *
+*   the server, each started DNS_HAPPY ms after the one before or as soon as  *
+*   it fails, and keeps the first to connect (RFC 8305).                      *
+*                                                                             *
+*   conn: Pointer to the connection, conn->status, conn->etag and             *
+*         conn->modified are set from the response.                           *
+*   request: The http request.                                                *
+*   request_len: Length of the request.                                       *
+*   body: Buffer where the decoded body is stored followed by a '\0', grows   *
+*         to fit the body.                                                    *
+*                                                                             *
+*   Returns: Length of the body.                                              *
+*            E_RESOLVE when the server name does not resolve.                 *
+*            E_CONNECT when connect fails on every address.                   *
+*            E_SEND when send fails.                                          *
+*            E_RECEIVE when recv fails.                                       *
+*            E_RESPONSE when the buffer can not grow to fit the body.         *
+*            E_PROTOCOL when the response is not valid http.                  *
+******************************************************************************/
+int http_exchange(tsl_conn *conn, const char *request, int request_len,
+		tsl_buf *body);
+/*****************************************************************************/
+#endif /* HTTP_H */
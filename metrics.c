@@ -0,0 +1,165 @@
+/******************************************************************************
+*     File Name           :     metrics.c                                     *
+*     Description         :     Timings of the stages of queries and          *
+*                                 histograms of them.                         *
+******************************************************************************/
+#include <string.h>             // memset
+#include <time.h>               // clock_gettime
+#include "metrics.h"
+/*****************************************************************************/
+#define HIST_SUB (1 << HIST_SUB_BITS)
+/*****************************************************************************/
+static const char *stage_names[STAGES] = {
+	"cache", "dns", "connect", "first byte", "body", "extract", "scan",
+	"search", "select", "output", "total"
+};
+/* Each thread counts its own, so counting needs no atomics */
+static _Thread_local long allocs;
+/*****************************************************************************/
+int64_t metrics_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+/*****************************************************************************/
+void metrics_alloc(int n) {
+	allocs += n;
+}
+/*****************************************************************************/
+void timing_begin(tsl_timing *t) {
+	int i;
+	memset(t, 0, sizeof(tsl_timing));
+	for(i = 0; i < STAGES; i++) {
+		t->ns[i] = -1;
+	}
+	t->start = t->mark = metrics_now();
+	t->allocs = allocs;
+}
+/*****************************************************************************/
+void timing_lap(tsl_timing *t, int stage) {
+	/* A stage run more than once, like a retried connect, adds up */
+	int64_t now = metrics_now();
+	t->ns[stage] = (t->ns[stage] < 0 ? 0 : t->ns[stage]) + now - t->mark;
+	t->mark = now;
+}
+/*****************************************************************************/
+void timing_end(tsl_timing *t) {
+	t->mark = metrics_now();
+	t->ns[STAGE_TOTAL] = t->mark - t->start;
+	t->allocs = allocs - t->allocs;
+}
+/*****************************************************************************/
+static int hist_index(uint64_t value) {
+	/* Below HIST_SUB a bucket per value, then HIST_SUB buckets per power
+	 * of two told apart by the bits under the highest one */
+	int shift;
+	if(value >= (uint64_t)1 << HIST_MAX_BITS) {
+		value = ((uint64_t)1 << HIST_MAX_BITS) - 1;
+	}
+	if(value < HIST_SUB) {
+		return value;
+	}
+	shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	return ((shift+1) << HIST_SUB_BITS) + (value >> shift) - HIST_SUB;
+}
+/*****************************************************************************/
+static uint64_t hist_value(int index) {
+	/* Largest value of a bucket */
+	int shift = (index >> HIST_SUB_BITS) - 1;
+	if(shift < 0) {
+		return index;
+	}
+	return ((uint64_t)(HIST_SUB + (index & (HIST_SUB-1))) << shift)
+			+ ((uint64_t)1 << shift) - 1;
+}
+/*****************************************************************************/
+void hist_add(tsl_hist *h, uint64_t value) {
+	h->count++;
+	h->sum += value;
+	h->max = value > h->max ? value : h->max;
+	h->buckets[hist_index(value)]++;
+}
+/*****************************************************************************/
+uint64_t hist_percentile(const tsl_hist *h, double percent) {
+	uint64_t rank, seen = 0, value;
+	int i;
+	if(!h->count) {
+		return 0;
+	}
+	rank = percent/100*h->count + 0.5;
+	rank = rank < 1 ? 1 : rank > h->count ? h->count : rank;
+	for(i = 0; i < HIST_BUCKETS; i++) {
+		if((seen += h->buckets[i]) >= rank) {
+			break;
+		}
+	}
+	value = hist_value(i);
+	return value < h->max ? value : h->max;
+}
+/*****************************************************************************/
+void metrics_init(tsl_metrics *m) {
+	memset(m, 0, sizeof(tsl_metrics));
+}
+/*****************************************************************************/
+void metrics_add(tsl_metrics *m, const tsl_timing *t, int status) {
+	int i;
+	for(i = 0; i < STAGES; i++) {
+		if(t->ns[i] >= 0) {
+			hist_add(&m->stages[i], t->ns[i]);
+		}
+	}
+	m->queries++;
+	m->failed += status < 0;
+	m->bytes_in += t->bytes_in;
+	m->body_bytes += t->body_bytes;
+	m->bytes_out += t->bytes_out;
+	m->trips += t->trips;
+	m->edges += t->edges;
+	m->allocs += t->allocs;
+}
+/*****************************************************************************/
+void metrics_merge(tsl_metrics *m, const tsl_metrics *other) {
+	int i, j;
+	for(i = 0; i < STAGES; i++) {
+		const tsl_hist *h = &other->stages[i];
+		m->stages[i].count += h->count;
+		m->stages[i].sum += h->sum;
+		m->stages[i].max = h->max > m->stages[i].max ? h->max
+				: m->stages[i].max;
+		for(j = 0; j < HIST_BUCKETS; j++) {
+			m->stages[i].buckets[j] += h->buckets[j];
+		}
+	}
+	m->queries += other->queries;
+	m->failed += other->failed;
+	m->bytes_in += other->bytes_in;
+	m->body_bytes += other->body_bytes;
+	m->bytes_out += other->bytes_out;
+	m->trips += other->trips;
+	m->edges += other->edges;
+	m->allocs += other->allocs;
+}
+/*****************************************************************************/
+void metrics_print(FILE *out, const tsl_metrics *m) {
+	int i;
+	fprintf(out, "%-10s %8s %10s %10s %10s %10s %10s\n", "stage", "count",
+			"mean us", "p50 us", "p90 us", "p99 us", "max us");
+	for(i = 0; i < STAGES; i++) {
+		const tsl_hist *h = &m->stages[i];
+		if(!h->count) {
+			continue;
+		}
+		fprintf(out, "%-10s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+				stage_names[i], (unsigned long long)h->count,
+				(double)h->sum/h->count/1e3, hist_percentile(h, 50)/1e3,
+				hist_percentile(h, 90)/1e3, hist_percentile(h, 99)/1e3,
+				h->max/1e3);
+	}
+	fprintf(out, "%llu queries, %llu failed, %llu bytes in, %llu body bytes, "
+			"%llu bytes out, %llu trips, %llu edges, %llu allocations\n",
+			(unsigned long long)m->queries, (unsigned long long)m->failed,
+			(unsigned long long)m->bytes_in, (unsigned long long)m->body_bytes,
+			(unsigned long long)m->bytes_out, (unsigned long long)m->trips,
+			(unsigned long long)m->edges, (unsigned long long)m->allocs);
+}
+/*****************************************************************************/
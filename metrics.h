@@ -0,0 +1,186 @@
+/******************************************************************************
+*     File Name           :     metrics.h                                     *
+*     Description         :     Timings of the stages of queries and          *
+*                                 histograms of them.                         *
+******************************************************************************/
+#ifndef METRICS_H
+#define METRICS_H
+#include <stdint.h>             // int64_t, uint64_t
+#include <stdio.h>              // FILE
+/*****************************************************************************/
+#define HIST_SUB_BITS 5 		// Buckets per power of two as bits, 3% apart
+#define HIST_MAX_BITS 40 		// Largest value as bits, 18 minutes in ns
+#define HIST_BUCKETS ((HIST_MAX_BITS-HIST_SUB_BITS+1) << HIST_SUB_BITS)
+/*****************************************************************************/
+/* Stages of a query, in the order they run */
+enum tsl_stage {
+	STAGE_CACHE,				// Looking up the cache.
+	STAGE_DNS,					// Resolving the server, only on a new connection.
+	STAGE_CONNECT,				// Connecting, only on a new connection.
+	STAGE_FIRST_BYTE,			// Sending until the first byte comes back.
+	STAGE_BODY,					// Receiving and decoding the rest.
+	STAGE_EXTRACT,				// Narrowing the body to the json.
+	STAGE_SCAN,					// Parsing the json and extracting trips.
+	STAGE_SEARCH,				// Searching the timetable.
+	STAGE_SELECT,				// Filtering and ordering trips.
+	STAGE_OUTPUT,				// Formatting trips.
+	STAGE_TOTAL,				// The whole query.
+	STAGES
+};
+/******************************************************************************
+* Struct: tsl_timing                                                          *
+* ------------------                                                          *
+*   What one query took. Stages are timed with a monotonic clock as laps      *
+*   from a mark, each lap ending the stage it is given and starting the       *
+*   next at the same instant.                                                 *
+*                                                                             *
+*   start: When the query started, in ns.                                     *
+*   mark: End of the last lap.                                                *
+*   ns: Time spent in each stage, -1 for stages that did not run.             *
+*   bytes_in: Bytes of the response as received.                              *
+*   body_bytes: Bytes of the body once decoded.                               *
+*   bytes_out: Bytes printed.                                                 *
+*   trips: Trips found.                                                       *
+*   edges: Edges of the trips.                                                *
+*   allocs: Allocations made by the thread while the query ran.               *
+******************************************************************************/
+typedef struct tsl_timing {
+	int64_t start; int64_t mark;
+	int64_t ns[STAGES];
+	long bytes_in; long body_bytes; long bytes_out;
+	int trips; int edges;
+	long allocs;
+} tsl_timing;
+/******************************************************************************
+* Struct: tsl_hist                                                            *
+* ----------------                                                            *
+*   Histogram of values in buckets that are 1 wide below 2^HIST_SUB_BITS and  *
+*   then 2^HIST_SUB_BITS to every power of two, so any value is kept within   *
+*   about 3% in constant space. Larger values are counted as the largest.     *
+*                                                                             *
+*   count: Number of values.                                                  *
+*   sum: Sum of the values.                                                   *
+*   max: Largest value.                                                       *
+*   buckets: Number of values in each bucket.                                 *
+******************************************************************************/
+typedef struct tsl_hist {
+	uint64_t count; uint64_t sum; uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+} tsl_hist;
+/******************************************************************************
+* Struct: tsl_metrics                                                         *
+* -------------------                                                         *
+*   Timings of many queries added together.                                   *
+*                                                                             *
+*   stages: Histogram of the ns of each stage, of the queries it ran in.      *
+*   queries: Number of queries.                                               *
+*   failed: Queries that failed.                                              *
+*   bytes_in, body_bytes, bytes_out, trips, edges, allocs: Sums of those of   *
+*                                                          the queries.       *
+******************************************************************************/
+typedef struct tsl_metrics {
+	tsl_hist stages[STAGES];
+	uint64_t queries; uint64_t failed;
+	uint64_t bytes_in; uint64_t body_bytes; uint64_t bytes_out;
+	uint64_t trips; uint64_t edges; uint64_t allocs;
+} tsl_metrics;
+/******************************************************************************
+* Function: metrics_now                                                       *
+* ---------------------                                                       *
+*   Returns: ns of the monotonic clock.                                       *
+******************************************************************************/
+int64_t metrics_now(void);
+/******************************************************************************
+* Function: metrics_alloc                                                     *
+* -----------------------                                                     *
+*   Counts allocations made by the calling thread. Called wherever the        *
+*   buffers of a query grow.                                                  *
+*                                                                             *
+*   n: Number of allocations.                                                 *
+******************************************************************************/
+void metrics_alloc(int n);
+/******************************************************************************
+* Function: timing_begin                                                      *
+* ----------------------                                                      *
+*   Starts timing a query, with no stage run yet and the mark set to now.     *
+*                                                                             *
+*   t: Pointer to the timing.                                                 *
+******************************************************************************/
+void timing_begin(tsl_timing *t);
+/******************************************************************************
+* Function: timing_lap                                                        *
+* --------------------                                                        *
+*   Adds the time since the mark to a stage and moves the mark to now.        *
+*                                                                             *
+*   t: Pointer to the timing.                                                 *
+*   stage: An enum tsl_stage.                                                 *
+******************************************************************************/
+void timing_lap(tsl_timing *t, int stage);
+/******************************************************************************
+* Function: timing_end                                                        *
+* --------------------                                                        *
+*   Sets the total time and the allocations of a query.                       *
+*                                                                             *
+*   t: Pointer to the timing.                                                 *
+******************************************************************************/
+void timing_end(tsl_timing *t);
+/******************************************************************************
+* Function: hist_add                                                          *
+* ------------------                                                          *
+*   Counts a value.                                                           *
+*                                                                             *
+*   h: Pointer to the histogram.                                              *
+*   value: The value.                                                         *
+******************************************************************************/
+void hist_add(tsl_hist *h, uint64_t value);
+/******************************************************************************
+* Function: hist_percentile                                                   *
+* -------------------------                                                   *
+*   Finds the value that a share of the counted values are at or below.       *
+*                                                                             *
+*   h: Pointer to the histogram.                                              *
+*   percent: The share, 0 to 100.                                             *
+*                                                                             *
+*   Returns: The largest value of the bucket it falls in, at most the         *
+*            largest value counted. 0 when nothing is counted.                *
+******************************************************************************/
+uint64_t hist_percentile(const tsl_hist *h, double percent);
+/******************************************************************************
+* Function: metrics_init                                                      *
+* ----------------------                                                      *
+*   Clears metrics.                                                           *
+*                                                                             *
+*   m: Pointer to the metrics.                                                *
+******************************************************************************/
+void metrics_init(tsl_metrics *m);
+/******************************************************************************
+* Function: metrics_add                                                       *
+* ---------------------                                                       *
+*   Adds the timing of a query.                                               *
+*                                                                             *
+*   m: Pointer to the metrics.                                                *
+*   t: Timing of the query, ended with timing_end.                            *
+*   status: Number of trips, or the error number of the query.                *
+******************************************************************************/
+void metrics_add(tsl_metrics *m, const tsl_timing *t, int status);
+/******************************************************************************
+* Function: metrics_merge                                                     *
+* -----------------------                                                     *
+*   Adds metrics kept apart, such as by another thread.                       *
+*                                                                             *
+*   m: Pointer to the metrics added to.                                       *
+*   other: Pointer to the metrics added.                                      *
+******************************************************************************/
+void metrics_merge(tsl_metrics *m, const tsl_metrics *other);
+/******************************************************************************
+* Function: metrics_print                                                     *
+* -----------------------                                                     *
+*   Prints the count, p50, p90, p99 and max in us of every stage that ran,    *
+*   then the sums of the counters.                                            *
+*                                                                             *
+*   out: Stream to print to.                                                  *
+*   m: Pointer to the metrics.                                                *
+******************************************************************************/
+void metrics_print(FILE *out, const tsl_metrics *m);
+/*****************************************************************************/
+#endif /* METRICS_H */
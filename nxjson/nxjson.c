@@ -31,6 +31,10 @@ extern "C" {
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "nxjson.h"
 
@@ -45,15 +49,97 @@ extern "C" {
 #define NX_JSON_REPORT_ERROR(msg, p) fprintf(stderr, "NXJSON PARSE ERROR (%d): " msg " at %s\n", __LINE__, p)
 #endif
 
+// containers with fewer children than this are scanned linearly and never indexed
+#ifndef NX_JSON_INDEX_MIN
+#define NX_JSON_INDEX_MIN 16
+#endif
+
 #define IS_WHITESPACE(c) ((unsigned char)(c)<=(unsigned char)' ')
 
+// children of a large container by position, plus an open-addressing key table for objects.
+// until built, an arena-backed container keeps its arena in the index field tagged with bit 0
+typedef struct nx_json_index {
+  nx_json** items;  // length entries in document order
+  nx_json** slots;  // mask+1 entries, objects only
+  unsigned int mask;
+} nx_json_index;
+
+#define INDEX_ARENA_TAG 1
+#define INDEX_IS_BUILT(js) ((js)->index && !((uintptr_t)(js)->index & INDEX_ARENA_TAG))
+
 static const nx_json dummy={ NX_JSON_NULL };
 
-static nx_json* create_json(nx_json_type type, const char* key, nx_json* parent) {
-  nx_json* js=NX_JSON_CALLOC();
-  assert(js);
+#ifndef NX_JSON_ARENA_CHUNK
+#define NX_JSON_ARENA_CHUNK (64*1024)
+#endif
+
+#define NX_JSON_ARENA_ALIGN(n) (((n)+sizeof(void*)*2-1) & ~(sizeof(void*)*2-1))
+
+void nx_json_arena_init(nx_json_arena* arena, size_t chunk_size) {
+  arena->head=0;
+  arena->chunk_size=chunk_size? chunk_size : NX_JSON_ARENA_CHUNK;
+  arena->index=0;
+  arena->index_cap=0;
+}
+
+void* nx_json_arena_alloc(nx_json_arena* arena, size_t size) {
+  nx_json_arena_chunk* c=arena->head;
+  size=NX_JSON_ARENA_ALIGN(size);
+  if (!c || c->size-c->used<size) {
+    size_t csize=arena->chunk_size;
+    while (csize<size) csize*=2;
+    c=malloc(NX_JSON_ARENA_ALIGN(sizeof(nx_json_arena_chunk))+csize);
+    if (!c) return 0;
+    c->size=csize;
+    c->used=0;
+    c->next=arena->head;
+    arena->head=c;
+    arena->chunk_size=csize*2; // geometric growth keeps the chunk count logarithmic
+  }
+  void* p=(char*)c+NX_JSON_ARENA_ALIGN(sizeof(nx_json_arena_chunk))+c->used;
+  c->used+=size;
+  return p;
+}
+
+void nx_json_arena_reset(nx_json_arena* arena) {
+  // keep the newest chunk (the largest) so steady-state parsing stops calling malloc
+  nx_json_arena_chunk* c=arena->head;
+  if (!c) return;
+  nx_json_arena_chunk* p=c->next;
+  while (p) {
+    nx_json_arena_chunk* p1=p->next;
+    free(p);
+    p=p1;
+  }
+  c->next=0;
+  c->used=0;
+}
+
+void nx_json_arena_destroy(nx_json_arena* arena) {
+  nx_json_arena_reset(arena);
+  free(arena->head);
+  arena->head=0;
+  free(arena->index);
+  arena->index=0;
+  arena->index_cap=0;
+}
+
+static nx_json* create_json(nx_json_type type, const char* key, nx_json* parent, nx_json_arena* arena) {
+  nx_json* js;
+  if (arena) {
+    js=nx_json_arena_alloc(arena, sizeof(nx_json));
+    assert(js);
+    memset(js, 0, sizeof(nx_json));
+  }
+  else {
+    js=NX_JSON_CALLOC();
+    assert(js);
+  }
   js->type=type;
   js->key=key;
+  if (arena && (type==NX_JSON_OBJECT || type==NX_JSON_ARRAY)) {
+    js->index=(nx_json_index*)((uintptr_t)arena | INDEX_ARENA_TAG);
+  }
   if (!parent->last_child) {
     parent->child=parent->last_child=js;
   }
@@ -73,6 +159,7 @@ void nx_json_free(const nx_json* js) {
     nx_json_free(p);
     p=p1;
   }
+  if (INDEX_IS_BUILT(js)) free(js->index);
   NX_JSON_FREE(js);
 }
 
@@ -238,7 +325,7 @@ static char* parse_key(const char** key, char* p, nx_json_unicode_encoder encode
   return 0; // error
 }
 
-static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unicode_encoder encoder) {
+static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unicode_encoder encoder, nx_json_arena* arena) {
   nx_json* js;
   while (1) {
     switch (*p) {
@@ -251,21 +338,21 @@ static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unic
         p++;
         break;
       case '{':
-        js=create_json(NX_JSON_OBJECT, key, parent);
+        js=create_json(NX_JSON_OBJECT, key, parent, arena);
         p++;
         while (1) {
           const char* new_key;
           p=parse_key(&new_key, p, encoder);
           if (!p) return 0; // error
           if (*p=='}') return p+1; // end of object
-          p=parse_value(js, new_key, p, encoder);
+          p=parse_value(js, new_key, p, encoder, arena);
           if (!p) return 0; // error
         }
       case '[':
-        js=create_json(NX_JSON_ARRAY, key, parent);
+        js=create_json(NX_JSON_ARRAY, key, parent, arena);
         p++;
         while (1) {
-          p=parse_value(js, 0, p, encoder);
+          p=parse_value(js, 0, p, encoder, arena);
           if (!p) return 0; // error
           if (*p==']') return p+1; // end of array
         }
@@ -273,13 +360,13 @@ static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unic
         return p;
       case '"':
         p++;
-        js=create_json(NX_JSON_STRING, key, parent);
+        js=create_json(NX_JSON_STRING, key, parent, arena);
         js->text_value=unescape_string(p, &p, encoder);
         if (!js->text_value) return 0; // propagate error
         return p;
       case '-': case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
         {
-          js=create_json(NX_JSON_INTEGER, key, parent);
+          js=create_json(NX_JSON_INTEGER, key, parent, arena);
           char* pe;
           js->int_value=strtoll(p, &pe, 0);
           if (pe==p || errno==ERANGE) {
@@ -301,7 +388,7 @@ static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unic
         }
       case 't':
         if (!strncmp(p, "true", 4)) {
-          js=create_json(NX_JSON_BOOL, key, parent);
+          js=create_json(NX_JSON_BOOL, key, parent, arena);
           js->int_value=1;
           return p+4;
         }
@@ -309,7 +396,7 @@ static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unic
         return 0; // error
       case 'f':
         if (!strncmp(p, "false", 5)) {
-          js=create_json(NX_JSON_BOOL, key, parent);
+          js=create_json(NX_JSON_BOOL, key, parent, arena);
           js->int_value=0;
           return p+5;
         }
@@ -317,7 +404,7 @@ static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unic
         return 0; // error
       case 'n':
         if (!strncmp(p, "null", 4)) {
-          create_json(NX_JSON_NULL, key, parent);
+          create_json(NX_JSON_NULL, key, parent, arena);
           return p+4;
         }
         NX_JSON_REPORT_ERROR("unexpected chars", p);
@@ -348,21 +435,336 @@ static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unic
   }
 }
 
+// two-stage parsing: stage 1 classifies 64-byte blocks at a time and records the
+// position of every structural char, quote, escaping backslash and scalar start;
+// stage 2 builds the tree from those positions without touching the bytes between them
+
+typedef struct block_masks {
+  uint64_t quote, backslash, op, ws, slash, ctrl;
+} block_masks;
+
+typedef void (*classify_fn)(const char* p, block_masks* m);
+
+static void classify_scalar(const char* p, block_masks* m) {
+  memset(m, 0, sizeof(block_masks));
+  int i;
+  for (i=0; i<64; i++) {
+    uint64_t bit=1ULL<<i;
+    switch (p[i]) {
+      case '"': m->quote|=bit; break;
+      case '\\': m->backslash|=bit; break;
+      case '{': case '}': case '[': case ']': case ':': case ',': m->op|=bit; break;
+      case ' ': case '\t': case '\n': case '\r': m->ws|=bit; break;
+      case '/': m->slash|=bit; break;
+      default: if ((unsigned char)p[i]<' ') m->ctrl|=bit; break;
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CMP16(v, c) (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)))
+
+__attribute__((target("sse4.2")))
+static void classify_sse(const char* p, block_masks* m) {
+  memset(m, 0, sizeof(block_masks));
+  int i;
+  for (i=0; i<64; i+=16) {
+    __m128i v=_mm_loadu_si128((const __m128i*)(p+i));
+    m->quote|=CMP16(v, '"')<<i;
+    m->backslash|=CMP16(v, '\\')<<i;
+    m->op|=(CMP16(v, '{') | CMP16(v, '}') | CMP16(v, '[') | CMP16(v, ']') | CMP16(v, ':') | CMP16(v, ','))<<i;
+    uint64_t ws=CMP16(v, '\t') | CMP16(v, '\n') | CMP16(v, '\r');
+    m->ws|=(ws | CMP16(v, ' '))<<i;
+    m->slash|=CMP16(v, '/')<<i;
+    m->ctrl|=((uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v)) & ~ws)<<i;
+  }
+}
+
+#define CMP32(v, c) (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)))
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char* p, block_masks* m) {
+  memset(m, 0, sizeof(block_masks));
+  int i;
+  for (i=0; i<64; i+=32) {
+    __m256i v=_mm256_loadu_si256((const __m256i*)(p+i));
+    m->quote|=CMP32(v, '"')<<i;
+    m->backslash|=CMP32(v, '\\')<<i;
+    m->op|=(CMP32(v, '{') | CMP32(v, '}') | CMP32(v, '[') | CMP32(v, ']') | CMP32(v, ':') | CMP32(v, ','))<<i;
+    uint64_t ws=CMP32(v, '\t') | CMP32(v, '\n') | CMP32(v, '\r');
+    m->ws|=(ws | CMP32(v, ' '))<<i;
+    m->slash|=CMP32(v, '/')<<i;
+    m->ctrl|=((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1f)), v)) & ~ws)<<i;
+  }
+}
+#endif
+
+nx_json_scan nx_json_scan_mode=NX_JSON_SCAN_AUTO;
+
+static classify_fn pick_classifier(void) {
+  nx_json_scan mode=nx_json_scan_mode;
+#if defined(__x86_64__) || defined(__i386__)
+  if (mode==NX_JSON_SCAN_AUTO) {
+    mode=__builtin_cpu_supports("avx2")? NX_JSON_SCAN_AVX2 : __builtin_cpu_supports("sse4.2")? NX_JSON_SCAN_SSE : NX_JSON_SCAN_BYTES;
+  }
+  if (mode==NX_JSON_SCAN_AVX2) return classify_avx2;
+  if (mode==NX_JSON_SCAN_SSE) return classify_sse;
+#endif
+  // without vectors stage 1 is slower than the byte parser, so it is only used when asked for
+  if (mode==NX_JSON_SCAN_SCALAR) return classify_scalar;
+  return 0;
+}
+
+static inline uint64_t prefix_xor(uint64_t x) {
+  // bit i becomes the parity of bits 0..i, i.e. whether position i is inside quotes
+  x^=x<<1; x^=x<<2; x^=x<<4; x^=x<<8; x^=x<<16; x^=x<<32;
+  return x;
+}
+
+static size_t find_structure(const char* text, size_t len, uint32_t* idx, classify_fn classify) {
+  // returns number of positions stored in idx, or (size_t)-1 when text has comments,
+  // stray backslashes or control chars outside strings, which the byte parser
+  // rejects or skips in some places only
+  uint64_t in_string=0, escape_carry=0, scalar_carry=0;
+  size_t n=0, pos;
+  char tail[64];
+  for (pos=0; pos<len; pos+=64) {
+    const char* p=text+pos;
+    if (len-pos<64) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, p, len-pos);
+      p=tail;
+    }
+    block_masks m;
+    classify(p, &m);
+    // backslashes are rare, so resolve escapes one at a time
+    uint64_t escaped=escape_carry, starts=0, bs=m.backslash & ~escape_carry;
+    escape_carry=0;
+    while (bs) {
+      int i=__builtin_ctzll(bs);
+      starts|=1ULL<<i;
+      if (i==63) escape_carry=1;
+      else escaped|=1ULL<<(i+1);
+      bs&=~(3ULL<<i);
+    }
+    uint64_t quote=m.quote & ~escaped;
+    uint64_t str=prefix_xor(quote) ^ in_string; // opening quote and contents, not closing quote
+    in_string=(uint64_t)((int64_t)str>>63);
+    if ((m.slash | m.ctrl | m.backslash) & ~str) return (size_t)-1;
+    uint64_t scalar=~(m.ws | m.op | quote | str);
+    uint64_t bits=(m.op & ~str) | quote | (starts & str) | (scalar & ~(scalar<<1 | scalar_carry));
+    scalar_carry=scalar>>63;
+    while (bits) {
+      idx[n++]=(uint32_t)(pos+__builtin_ctzll(bits));
+      bits&=bits-1;
+    }
+  }
+  return n;
+}
+
+typedef struct stage2 {
+  char* text;
+  const uint32_t* idx;
+  size_t n;
+  size_t i;
+  nx_json_unicode_encoder encoder;
+  nx_json_arena* arena;
+} stage2;
+
+#define S2_AT(s) ((s)->text+(s)->idx[(s)->i])
+
+static char* stage2_string(stage2* s) {
+  // S2_AT(s) is the opening quote
+  char* p=S2_AT(s)+1;
+  s->i++;
+  if (s->i<s->n && *S2_AT(s)=='"') { // no escapes: terminate in place
+    *S2_AT(s)='\0';
+    s->i++;
+    return p;
+  }
+  char* end;
+  char* str=unescape_string(p, &end, s->encoder);
+  while (s->i<s->n && S2_AT(s)<end) s->i++;
+  return str;
+}
+
+static int stage2_value(stage2* s, nx_json* parent, const char* key) {
+  while (s->i<s->n && *S2_AT(s)==',') s->i++; // like parse_value, commas before a value are skipped
+  if (s->i>=s->n) {
+    NX_JSON_REPORT_ERROR("unexpected end of text", "");
+    return 0; // error
+  }
+  char* p=S2_AT(s);
+  nx_json* js;
+  switch (*p) {
+    case '{':
+      js=create_json(NX_JSON_OBJECT, key, parent, s->arena);
+      s->i++;
+      while (1) {
+        if (s->i>=s->n) {
+          NX_JSON_REPORT_ERROR("unexpected end of text", p);
+          return 0; // error
+        }
+        char* pk=S2_AT(s);
+        if (*pk=='}') { s->i++; return 1; } // end of object
+        if (*pk==',') { s->i++; continue; }
+        if (*pk!='"') {
+          NX_JSON_REPORT_ERROR("unexpected chars", pk);
+          return 0; // error
+        }
+        const char* new_key=stage2_string(s);
+        if (!new_key) return 0; // propagate error
+        if (s->i>=s->n || *S2_AT(s)!=':') {
+          NX_JSON_REPORT_ERROR("unexpected chars", pk);
+          return 0; // error
+        }
+        char* colon=S2_AT(s);
+        s->i++;
+        if (s->i<s->n && S2_AT(s)==colon+1 && *S2_AT(s)=='}') { s->i++; return 1; } // like parse_key, "k":} ends the object
+        if (!stage2_value(s, js, new_key)) return 0; // error
+      }
+    case '[':
+      js=create_json(NX_JSON_ARRAY, key, parent, s->arena);
+      s->i++;
+      while (1) {
+        if (s->i>=s->n) {
+          NX_JSON_REPORT_ERROR("unexpected end of text", p);
+          return 0; // error
+        }
+        if (*S2_AT(s)==']') { s->i++; return 1; } // end of array
+        if (*S2_AT(s)==',') { s->i++; continue; }
+        if (!stage2_value(s, js, 0)) return 0; // error
+      }
+    case '"':
+      js=create_json(NX_JSON_STRING, key, parent, s->arena);
+      js->text_value=stage2_string(s);
+      return js->text_value!=0;
+    case '}': case ']': case ':':
+      NX_JSON_REPORT_ERROR("unexpected chars", p);
+      return 0; // error
+    default: // numbers and literals are rare and short; the byte parser handles them
+      s->i++;
+      p=parse_value(parent, key, p, s->encoder, s->arena);
+      if (!p) return 0; // error
+      if (parent->type==NX_JSON_NULL) return 1; // trailing text after the root is ignored
+      while (1) { // the rest of the scalar run is what the byte parser reads next
+        while (*p==' ' || *p=='\t' || *p=='\n' || *p=='\r') p++;
+        if (!*p || (s->i<s->n && p==S2_AT(s))) return 1;
+        if (parent->type!=NX_JSON_ARRAY) {
+          NX_JSON_REPORT_ERROR("unexpected chars", p);
+          return 0; // error
+        }
+        p=parse_value(parent, 0, p, s->encoder, s->arena);
+        if (!p) return 0; // error
+      }
+  }
+}
+
+static uint32_t* index_buffer(nx_json_arena* arena, size_t len) {
+  // an arena keeps the largest index it has needed, others get one per parse
+  if (len>=UINT32_MAX) return 0;
+  if (!arena) return malloc(sizeof(uint32_t)*(len+1));
+  if (arena->index_cap<len+1) {
+    size_t cap=arena->index_cap? arena->index_cap : 1024;
+    while (cap<len+1) cap*=2;
+    uint32_t* idx=realloc(arena->index, sizeof(uint32_t)*cap);
+    if (!idx) return 0;
+    arena->index=idx;
+    arena->index_cap=cap;
+  }
+  return arena->index;
+}
+
+static const nx_json* parse_text(char* text, nx_json_unicode_encoder encoder, nx_json_arena* arena) {
+  nx_json js={0};
+  int ok=-1;
+  classify_fn classify=pick_classifier();
+  if (classify) {
+    size_t len=strlen(text);
+    uint32_t* idx=index_buffer(arena, len);
+    if (idx) {
+      size_t n=find_structure(text, len, idx, classify);
+      if (n!=(size_t)-1) { // texts with comments or control chars take the byte parser
+        stage2 s={text, idx, n, 0, encoder, arena};
+        ok=stage2_value(&s, &js, 0);
+      }
+      if (!arena) free(idx);
+    }
+  }
+  if (ok<0) ok=parse_value(&js, 0, text, encoder, arena)!=0;
+  if (!ok) {
+    if (js.child && !arena) nx_json_free(js.child);
+    return 0; // a partial tree in an arena stays there until it is reset
+  }
+  return js.child;
+}
+
 const nx_json* nx_json_parse_utf8(char* text) {
   return nx_json_parse(text, unicode_to_utf8);
 }
 
 const nx_json* nx_json_parse(char* text, nx_json_unicode_encoder encoder) {
-  nx_json js={0};
-  if (!parse_value(&js, 0, text, encoder)) {
-    if (js.child) nx_json_free(js.child);
-    return 0;
+  return parse_text(text, encoder, 0);
+}
+
+const nx_json* nx_json_parse_arena(char* text, nx_json_unicode_encoder encoder, nx_json_arena* arena) {
+  return parse_text(text, encoder, arena);
+}
+
+static unsigned int hash_key(const char* key) {
+  // FNV-1a
+  unsigned int h=2166136261u;
+  while (*key) h=(h ^ (unsigned char)*key++)*16777619u;
+  return h;
+}
+
+static const nx_json_index* get_index(const nx_json* json) {
+  if (json->length<NX_JSON_INDEX_MIN || (json->type!=NX_JSON_OBJECT && json->type!=NX_JSON_ARRAY)) return 0;
+  if (INDEX_IS_BUILT(json)) return json->index;
+  nx_json_arena* arena=(nx_json_arena*)((uintptr_t)json->index & ~(uintptr_t)INDEX_ARENA_TAG);
+  unsigned int cap=0;
+  if (json->type==NX_JSON_OBJECT) {
+    for (cap=NX_JSON_INDEX_MIN; cap<(unsigned int)json->length*2; cap*=2);
+  }
+  size_t size=sizeof(nx_json_index)+sizeof(nx_json*)*(json->length+cap);
+  nx_json_index* idx=arena? nx_json_arena_alloc(arena, size) : malloc(size);
+  if (!idx) return 0; // fall back to scanning the list
+  idx->items=(nx_json**)(idx+1);
+  idx->slots=idx->items+json->length;
+  idx->mask=cap-1;
+  memset(idx->slots, 0, sizeof(nx_json*)*cap);
+  int i=0;
+  nx_json* js;
+  for (js=json->child; js; js=js->next) {
+    idx->items[i++]=js;
+    if (!cap || !js->key) continue;
+    unsigned int h=hash_key(js->key) & idx->mask;
+    while (idx->slots[h] && strcmp(idx->slots[h]->key, js->key)) h=(h+1) & idx->mask;
+    if (!idx->slots[h]) idx->slots[h]=js; // first of duplicate keys wins, as with the linear scan
+  }
+  ((nx_json*)json)->index=idx; // lookup tables are a cache; the tree is logically unchanged
+  return idx;
+}
+
+void nx_json_build_index(const nx_json* json) {
+  if (!json) return;
+  get_index(json);
+  nx_json* js;
+  for (js=json->child; js; js=js->next) {
+    nx_json_build_index(js);
   }
-  return js.child;
 }
 
 const nx_json* nx_json_get(const nx_json* json, const char* key) {
   if (!json || !key) return &dummy; // never return null
+  const nx_json_index* idx=get_index(json);
+  if (idx && json->type==NX_JSON_OBJECT) {
+    unsigned int h=hash_key(key) & idx->mask;
+    for (; idx->slots[h]; h=(h+1) & idx->mask) {
+      if (!strcmp(idx->slots[h]->key, key)) return idx->slots[h];
+    }
+    return &dummy; // never return null
+  }
   nx_json* js;
   for (js=json->child; js; js=js->next) {
     if (js->key && !strcmp(js->key, key)) return js;
@@ -372,6 +774,10 @@ const nx_json* nx_json_get(const nx_json* json, const char* key) {
 
 const nx_json* nx_json_item(const nx_json* json, int idx) {
   if (!json) return &dummy; // never return null
+  const nx_json_index* index=get_index(json);
+  if (index) {
+    return idx>=0 && idx<json->length? index->items[idx] : &dummy;
+  }
   nx_json* js;
   for (js=json->child; js; js=js->next) {
     if (!idx--) return js;
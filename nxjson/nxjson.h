@@ -24,6 +24,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 
 typedef enum nx_json_type {
   NX_JSON_NULL,    // this is null value
@@ -45,8 +46,36 @@ typedef struct nx_json {
   struct nx_json* child;   // points to first child
   struct nx_json* next;    // points to next child
   struct nx_json* last_child;
+  struct nx_json_index* index; // lookup table of a large OBJECT or ARRAY, built on first access
 } nx_json;
 
+// bump allocator that can own a whole parsed tree; chunks grow geometrically
+typedef struct nx_json_arena_chunk {
+  struct nx_json_arena_chunk* next; // previous (smaller) chunk
+  size_t size;                      // usable bytes following the header
+  size_t used;                      // bytes handed out from this chunk
+} nx_json_arena_chunk;
+
+typedef struct nx_json_arena {
+  nx_json_arena_chunk* head; // current chunk; older chunks hang off head->next
+  size_t chunk_size;         // size of the next chunk to allocate
+  unsigned int* index;       // structural positions of the text being parsed, kept across resets
+  size_t index_cap;          // entries index has room for
+} nx_json_arena;
+
+// how nx_json_parse finds structure: BYTES is the original one-char-at-a-time parser,
+// the others build a structural index 64 bytes at a time; AUTO picks the widest vectors
+// the cpu has, or BYTES without any, as SCALAR is slower than it
+typedef enum nx_json_scan {
+  NX_JSON_SCAN_AUTO,
+  NX_JSON_SCAN_BYTES,
+  NX_JSON_SCAN_SCALAR,
+  NX_JSON_SCAN_SSE,
+  NX_JSON_SCAN_AVX2
+} nx_json_scan;
+
+extern nx_json_scan nx_json_scan_mode;
+
 typedef int (*nx_json_unicode_encoder)(unsigned int codepoint, char* p, char** endp);
 
 extern nx_json_unicode_encoder nx_json_unicode_to_utf8;
@@ -56,6 +85,16 @@ const nx_json* nx_json_parse_utf8(char* text);
 void nx_json_free(const nx_json* js);
 const nx_json* nx_json_get(const nx_json* json, const char* key); // get object's property by key
 const nx_json* nx_json_item(const nx_json* json, int idx); // get array element by index
+// eagerly index every large container below json; needed before sharing a tree between threads
+void nx_json_build_index(const nx_json* json);
+
+void nx_json_arena_init(nx_json_arena* arena, size_t chunk_size); // chunk_size 0 picks a default
+void* nx_json_arena_alloc(nx_json_arena* arena, size_t size);
+void nx_json_arena_reset(nx_json_arena* arena); // releases every tree parsed into the arena at once
+void nx_json_arena_destroy(nx_json_arena* arena);
+// parse into arena instead of one calloc per node; never nx_json_free() the result, reset the arena instead.
+// the structural index reuses a buffer of the arena, so steady-state parsing does not malloc at all
+const nx_json* nx_json_parse_arena(char* text, nx_json_unicode_encoder encoder, nx_json_arena* arena);
 
 
 #ifdef  __cplusplus
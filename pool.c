@@ -0,0 +1,207 @@
+/******************************************************************************
+*     File Name           :     pool.c                                        *
+*     Description         :     Work-stealing pool of threads running         *
+*                                 batches of independent tasks.               *
+******************************************************************************/
+#include <pthread.h>            // pthread_create, pthread_cond_wait
+#include <stdatomic.h>          // atomic_compare_exchange_weak
+#include <stdint.h>             // uint64_t
+#include <stdlib.h>             // posix_memalign, free
+#include "pool.h"
+/*****************************************************************************/
+#define POOL_LINE 64 			// Bytes of a cache line
+/*****************************************************************************/
+/* Tasks lo to hi-1 left to a worker, packed as hi<<32 | lo so the owner
+ * taking from the front and thieves taking from the back agree with one
+ * compare and swap */
+typedef struct range {
+	_Atomic uint64_t span;
+	char pad[POOL_LINE - sizeof(uint64_t)];	// Keeps workers off each
+											// other's cache lines.
+} range;
+/*****************************************************************************/
+struct tsl_pool {
+	int threads;
+	pthread_t *ids;				// Threads 1 to threads-1.
+	range *ranges;				// Tasks left to each worker.
+	pthread_mutex_t lock;
+	pthread_cond_t start;		// Signalled when a batch is started.
+	pthread_cond_t done;		// Signalled when the last thread is done.
+	unsigned batch;				// Number of the current batch.
+	int running;				// Threads still working on it.
+	int stop;					// Threads should return.
+	pool_task fn;
+	void *arg;
+};
+typedef struct worker {tsl_pool *pool; int self;} worker;
+/*****************************************************************************/
+static uint64_t span(uint64_t lo, uint64_t hi) {
+	return hi << 32 | lo;
+}
+/*****************************************************************************/
+static int take(range *r) {
+	uint64_t old = atomic_load(&r->span), lo, hi;
+	do {
+		lo = old & 0xffffffff;
+		hi = old >> 32;
+		if(lo >= hi) {
+			return -1;
+		}
+	} while(!atomic_compare_exchange_weak(&r->span, &old, span(lo+1, hi)));
+	return lo;
+}
+/*****************************************************************************/
+static int steal(tsl_pool *pool, int self) {
+	/* The back half of the first range with tasks left is moved over, and
+	 * its first task is run right away */
+	uint64_t old, lo, hi, mid;
+	range *r;
+	int i;
+	for(i = 1; i < pool->threads; i++) {
+		r = &pool->ranges[(self+i) % pool->threads];
+		old = atomic_load(&r->span);
+		do {
+			lo = old & 0xffffffff;
+			hi = old >> 32;
+			mid = lo + (hi-lo)/2;
+		} while(lo < hi
+				&& !atomic_compare_exchange_weak(&r->span, &old, span(lo, mid)));
+		if(lo < hi) {
+			atomic_store(&pool->ranges[self].span, span(mid+1, hi));
+			return mid;
+		}
+	}
+	return -1;
+}
+/*****************************************************************************/
+static void work(tsl_pool *pool, int self) {
+	int task;
+	while((task = take(&pool->ranges[self])) >= 0
+			|| (task = steal(pool, self)) >= 0) {
+		pool->fn(pool->arg, self, task);
+	}
+}
+/*****************************************************************************/
+static void *thread_main(void *arg) {
+	worker *w = arg;
+	tsl_pool *pool = w->pool;
+	int self = w->self;
+	unsigned batch = 0;
+	free(w);
+	pthread_mutex_lock(&pool->lock);
+	for(;;) {
+		while(!pool->stop && pool->batch == batch) {
+			pthread_cond_wait(&pool->start, &pool->lock);
+		}
+		if(pool->stop) {
+			break;
+		}
+		batch = pool->batch;
+		pthread_mutex_unlock(&pool->lock);
+		work(pool, self);
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->running == 0) {
+			pthread_cond_signal(&pool->done);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+/*****************************************************************************/
+static void stop_threads(tsl_pool *pool, int started) {
+	int i;
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for(i = 0; i < started; i++) {
+		pthread_join(pool->ids[i], NULL);
+	}
+}
+/*****************************************************************************/
+tsl_pool *pool_new(int threads) {
+	tsl_pool *pool = calloc(1, sizeof(tsl_pool));
+	void *ranges;
+	worker *w;
+	int i;
+	if(!pool || threads < 1) {
+		free(pool);
+		return NULL;
+	}
+	if(posix_memalign(&ranges, POOL_LINE, sizeof(range)*threads)) {
+		free(pool);
+		return NULL;
+	}
+	pool->threads = threads;
+	pool->ranges = ranges;
+	for(i = 0; i < threads; i++) {
+		atomic_init(&pool->ranges[i].span, 0);
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	if(!(pool->ids = malloc(sizeof(pthread_t)*threads))) {
+		pool_free(pool);
+		return NULL;
+	}
+	for(i = 1; i < threads; i++) {
+		if(!(w = malloc(sizeof(worker)))) {
+			break;
+		}
+		w->pool = pool;
+		w->self = i;
+		if(pthread_create(&pool->ids[i-1], NULL, thread_main, w)) {
+			free(w);
+			break;
+		}
+	}
+	if(i < threads) {
+		stop_threads(pool, i-1);
+		pool->threads = 1;
+		pool_free(pool);
+		return NULL;
+	}
+	return pool;
+}
+/*****************************************************************************/
+void pool_run(tsl_pool *pool, int tasks, pool_task fn, void *arg) {
+	int i;
+	if(tasks <= 0) {
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	for(i = 0; i < pool->threads; i++) {
+		atomic_store(&pool->ranges[i].span, span(
+				(uint64_t)tasks*i/pool->threads,
+				(uint64_t)tasks*(i+1)/pool->threads));
+	}
+	pool->running = pool->threads-1;
+	pool->batch++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	work(pool, 0);
+	pthread_mutex_lock(&pool->lock);
+	while(pool->running) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+/*****************************************************************************/
+int pool_threads(const tsl_pool *pool) {
+	return pool->threads;
+}
+/*****************************************************************************/
+void pool_free(tsl_pool *pool) {
+	if(pool->ids && pool->threads > 1) {
+		stop_threads(pool, pool->threads-1);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	free(pool->ids);
+	free(pool->ranges);
+	free(pool);
+}
+/*****************************************************************************/
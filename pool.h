@@ -0,0 +1,67 @@
+/******************************************************************************
+*     File Name           :     pool.h                                        *
+*     Description         :     Work-stealing pool of threads running         *
+*                                 batches of independent tasks.               *
+******************************************************************************/
+#ifndef POOL_H
+#define POOL_H
+/*****************************************************************************/
+#define POOL_WINDOW 1024 		// Queries answered before any is printed
+/******************************************************************************
+* Function: pool_task                                                         *
+* -------------------                                                         *
+*   Runs one task of a batch.                                                 *
+*                                                                             *
+*   arg: Argument given to pool_run.                                          *
+*   worker: Number of the thread running the task, 0 to threads-1, so it      *
+*           can use scratch space of its own.                                 *
+*   task: Number of the task, 0 to tasks-1.                                   *
+******************************************************************************/
+typedef void (*pool_task)(void *arg, int worker, int task);
+/******************************************************************************
+* Struct: tsl_pool                                                            *
+* ----------------                                                            *
+*   Threads waiting for batches. A batch is split evenly between them, and a  *
+*   thread that runs out of tasks takes half of what is left to another.      *
+******************************************************************************/
+typedef struct tsl_pool tsl_pool;
+/******************************************************************************
+* Function: pool_new                                                          *
+* ------------------                                                          *
+*   Starts a pool. The thread calling pool_run works as worker 0, so          *
+*   threads-1 threads are started.                                            *
+*                                                                             *
+*   threads: Number of workers, at least 1.                                   *
+*                                                                             *
+*   Returns: The pool, stop with pool_free.                                   *
+*            NULL when threads can not be started.                            *
+******************************************************************************/
+tsl_pool *pool_new(int threads);
+/******************************************************************************
+* Function: pool_run                                                          *
+* ------------------                                                          *
+*   Runs tasks 0 to tasks-1 and returns when all have finished. Tasks may     *
+*   run in any order and at the same time.                                    *
+*                                                                             *
+*   pool: Pointer to the pool.                                                *
+*   tasks: Number of tasks.                                                   *
+*   fn: Function running a task.                                              *
+*   arg: Passed on to fn.                                                     *
+******************************************************************************/
+void pool_run(tsl_pool *pool, int tasks, pool_task fn, void *arg);
+/******************************************************************************
+* Function: pool_threads                                                      *
+* ----------------------                                                      *
+*   Returns: Number of workers of a pool.                                     *
+******************************************************************************/
+int pool_threads(const tsl_pool *pool);
+/******************************************************************************
+* Function: pool_free                                                         *
+* -------------------                                                         *
+*   Stops the threads of a pool and frees it.                                 *
+*                                                                             *
+*   pool: Pointer to the pool.                                                *
+******************************************************************************/
+void pool_free(tsl_pool *pool);
+/*****************************************************************************/
+#endif /* POOL_H */
@@ -0,0 +1,261 @@
+/******************************************************************************
+*     File Name           :     scheduler.c                                   *
+*     Description         :     Pacing of upstream requests within the quota  *
+*                                 of the API key, with retries and a circuit  *
+*                                 breaker.                                    *
+******************************************************************************/
+#include <sys/random.h>         // getrandom
+#include "tsl.h"
+/*****************************************************************************/
+static int64_t now_ms(void) {
+	return metrics_now()/1000000;
+}
+/*****************************************************************************/
+void sched_init(tsl_sched *s, int quota) {
+	memset(s, 0, sizeof(tsl_sched));
+	pthread_mutex_init(&s->lock, NULL);
+	s->rate = quota > 0 ? quota/60000.0 : 0;
+	s->tokens = SCHED_BURST;
+	s->filled = now_ms();
+	s->cooldown = SCHED_COOLDOWN;
+	if(getrandom(&s->seed, sizeof(s->seed), GRND_NONBLOCK)
+			!= sizeof(s->seed)) {
+		s->seed = metrics_now();
+	}
+}
+/*****************************************************************************/
+void sched_free(tsl_sched *s) {
+	pthread_mutex_destroy(&s->lock);
+}
+/*****************************************************************************/
+static int take(tsl_sched *s, int priority, int64_t now) {
+	/* Refreshes leave the last half of the bucket to the rest, so a burst
+	 * of them can not hold up someone who waits */
+	double need = priority == PRIORITY_REFRESH ? 1+SCHED_BURST/2 : 1;
+	if(s->rate <= 0) {
+		return 0;
+	}
+	s->tokens += (now-s->filled)*s->rate;
+	if(s->tokens > SCHED_BURST) {
+		s->tokens = SCHED_BURST;
+	}
+	s->filled = now;
+	if(s->tokens < need) {
+		return (need-s->tokens)/s->rate + 1;
+	}
+	s->tokens--;
+	return 0;
+}
+/*****************************************************************************/
+int sched_acquire(tsl_sched *s, int priority) {
+	/* Once the breaker has been open long enough one request is let
+	 * through as a probe, the rest keep failing until it is answered */
+	int64_t now = now_ms();
+	int retval;
+	if(!s) {
+		return 0;
+	}
+	pthread_mutex_lock(&s->lock);
+	if(s->until && (now < s->until || s->probing)) {
+		s->rejected++;
+		retval = E_BREAKER;
+	} else if((retval = take(s, priority, now)) > 0) {
+		s->throttled++;
+	} else {
+		s->probing = s->until != 0;
+		s->sent++;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return retval;
+}
+/*****************************************************************************/
+int sched_done(tsl_sched *s, int retval, int status, int attempts) {
+	/* Every outcome ends a probe, one way or the other. Full backoffs are
+	 * drawn from their upper half, so retries of a burst spread out but
+	 * none comes back too soon */
+	int retry = retval == E_CONNECT || retval == E_SEND
+			|| retval == E_RECEIVE || status/100 == 5;
+	int failed = retry || retval == E_RESOLVE, wait = -1;
+	int64_t now = now_ms();
+	if(!s) {
+		return -1;
+	}
+	pthread_mutex_lock(&s->lock);
+	if(status == 429) {
+		s->tokens = 0;
+		s->filled = now;
+	}
+	if(failed && (s->probing || ++s->failures >= SCHED_TRIP)) {
+		if(s->probing) {
+			s->cooldown = s->cooldown*2 > SCHED_COOLDOWN_MAX
+					? SCHED_COOLDOWN_MAX : s->cooldown*2;
+		}
+		s->until = now+s->cooldown;
+		s->probing = 0;
+		s->failures = 0;
+	} else if(!failed) {
+		s->until = 0;
+		s->probing = 0;
+		s->failures = 0;
+		s->cooldown = SCHED_COOLDOWN;
+	}
+	if((retry || status == 429) && !s->until && attempts <= SCHED_RETRIES) {
+		wait = SCHED_BACKOFF << (attempts-1);
+		if(wait > SCHED_BACKOFF_MAX) {
+			wait = SCHED_BACKOFF_MAX;
+		}
+		wait = wait/2 + rand_r(&s->seed) % (wait/2+1);
+		s->retried++;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return wait;
+}
+/*****************************************************************************/
+void sched_cancel(tsl_sched *s) {
+	/* The token goes back, and the next request probes instead */
+	if(!s) {
+		return;
+	}
+	pthread_mutex_lock(&s->lock);
+	if(s->rate > 0 && ++s->tokens > SCHED_BURST) {
+		s->tokens = SCHED_BURST;
+	}
+	s->probing = 0;
+	s->sent--;
+	pthread_mutex_unlock(&s->lock);
+}
+/*****************************************************************************/
+void sched_print(FILE *out, tsl_sched *s) {
+	pthread_mutex_lock(&s->lock);
+	fprintf(out, "sent %lu\nthrottled %lu\nretried %lu\nrejected %lu\n",
+			s->sent, s->throttled, s->retried, s->rejected);
+	pthread_mutex_unlock(&s->lock);
+}
+/*****************************************************************************/
+void sched_queue_init(sched_queue *q) {
+	memset(q, 0, sizeof(sched_queue));
+}
+/*****************************************************************************/
+void sched_queue_free(sched_queue *q) {
+	int i;
+	for(i = 0; i < PRIORITIES; i++) {
+		free(q->fifos[i].e);
+	}
+	free(q->delayed.e);
+	sched_queue_init(q);
+}
+/*****************************************************************************/
+static int fifo_push(sched_fifo *f, const sched_entry *e) {
+	/* Taken entries are reclaimed when the fifo runs empty or full */
+	sched_entry *entries;
+	int cap;
+	if(f->head == f->len) {
+		f->head = f->len = 0;
+	}
+	if(f->len == f->cap && f->head) {
+		memmove(f->e, f->e+f->head, sizeof(sched_entry)*(f->len-f->head));
+		f->len -= f->head;
+		f->head = 0;
+	}
+	if(f->len == f->cap) {
+		cap = f->cap ? f->cap*2 : 16;
+		if(!(entries = realloc(f->e, sizeof(sched_entry)*cap))) {
+			return E_UNKNOWN;
+		}
+		f->e = entries;
+		f->cap = cap;
+	}
+	f->e[f->len++] = *e;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+int sched_push(sched_queue *q, const sched_entry *e) {
+	if(e->ready > now_ms()) {
+		if(!q->due || e->ready < q->due) {
+			q->due = e->ready;
+		}
+		return fifo_push(&q->delayed, e);
+	}
+	return fifo_push(&q->fifos[e->priority], e);
+}
+/*****************************************************************************/
+int sched_raise(sched_queue *q, const void *item, int priority) {
+	/* The entry is left behind emptied, as the order of the rest must be
+	 * kept */
+	sched_entry e;
+	sched_fifo *f;
+	int i, j;
+	for(i = 0; i < q->delayed.len; i++) {
+		if(q->delayed.e[i].item == item && q->delayed.e[i].priority > priority) {
+			q->delayed.e[i].priority = priority;
+		}
+	}
+	for(i = priority+1; i < PRIORITIES; i++) {
+		f = &q->fifos[i];
+		for(j = f->head; j < f->len; j++) {
+			if(f->e[j].item == item) {
+				e = f->e[j];
+				e.priority = priority;
+				f->e[j].item = NULL;
+				return fifo_push(&q->fifos[priority], &e);
+			}
+		}
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static void release_delayed(sched_queue *q, int64_t now) {
+	/* Retries whose backoff is over join the back of their priority */
+	sched_fifo *d = &q->delayed;
+	int i;
+	q->due = 0;
+	for(i = 0; i < d->len;) {
+		if(d->e[i].ready <= now && !fifo_push(&q->fifos[d->e[i].priority],
+				&d->e[i])) {
+			d->e[i] = d->e[--d->len];
+			continue;
+		}
+		if(!q->due || d->e[i].ready < q->due) {
+			q->due = d->e[i].ready;
+		}
+		i++;
+	}
+}
+/*****************************************************************************/
+int sched_pop(tsl_sched *s, sched_queue *q, sched_entry *e) {
+	int64_t now = now_ms();
+	sched_fifo *f;
+	int i, wait;
+	if(q->due && q->due <= now) {
+		release_delayed(q, now);
+	}
+	for(i = 0; i < PRIORITIES; i++) {
+		f = &q->fifos[i];
+		while(f->head < f->len && !f->e[f->head].item) {
+			f->head++;
+		}
+		if(f->head == f->len) {
+			continue;
+		}
+		if((wait = sched_acquire(s, i)) > 0) {
+			/* A lower priority may still fit in what is left of the
+			 * bucket, but it waits behind this one */
+			if(!q->due || now+wait < q->due) {
+				q->due = now+wait;
+			}
+			return 0;
+		}
+		*e = f->e[f->head++];
+		return wait < 0 ? wait : 1;
+	}
+	return 0;
+}
+/*****************************************************************************/
+int sched_timeout(const sched_queue *q) {
+	int64_t now = now_ms();
+	if(!q->due) {
+		return -1;
+	}
+	return q->due > now ? q->due-now : 0;
+}
+/*****************************************************************************/
@@ -0,0 +1,221 @@
+/******************************************************************************
+*     File Name           :     scheduler.h                                   *
+*     Description         :     Pacing of upstream requests within the quota  *
+*                                 of the API key, with retries and a circuit  *
+*                                 breaker.                                    *
+******************************************************************************/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <pthread.h>            // pthread_mutex_t
+#include <stdint.h>             // int64_t
+#include <stdio.h>              // FILE
+/*****************************************************************************/
+#define SCHED_BURST 10 			// Most requests sent at once after a pause
+#define SCHED_RETRIES 3 		// Times a failed request is sent again
+#define SCHED_BACKOFF 100 		// ms before the first retry, doubled for each
+#define SCHED_BACKOFF_MAX 5000 	// Longest wait before a retry, in ms
+#define SCHED_TRIP 5 			// Failures in a row that open the breaker
+#define SCHED_COOLDOWN 1000 	// ms the breaker stays open the first time
+#define SCHED_COOLDOWN_MAX 60000	// Most it is doubled to by failed probes
+/*****************************************************************************/
+/* Priorities of requests, the lowest is served first */
+enum sched_priority {
+	PRIORITY_INTERACTIVE,			// Someone is waiting for the answer.
+	PRIORITY_BATCH,				// One of the queries of a batch.
+	PRIORITY_REFRESH,				// Refresh of an answer that is still given.
+	PRIORITIES
+};
+/******************************************************************************
+* Struct: tsl_sched                                                           *
+* -----------------                                                           *
+*   Requests to the server go through one of these, shared by everything in   *
+*   the process that uses the same API key. A token bucket keeps them within  *
+*   the quota, leaving the last half of the bucket to requests that are not   *
+*   refreshes. Requests that fail in a way that may pass are sent again after *
+*   a jittered exponential backoff, and SCHED_TRIP failures in a row open the *
+*   breaker: requests fail at once until one probe gets through.              *
+*                                                                             *
+*   lock: Held while the state is used.                                       *
+*   rate: Tokens added per ms, 0 for no limit.                                *
+*   tokens: Tokens in the bucket at filled.                                   *
+*   filled: ms of metrics_now when tokens was last topped up.                 *
+*   failures: Failures in a row.                                              *
+*   until: ms the breaker is open until, 0 when it is closed.                 *
+*   cooldown: ms the breaker is opened for the next time.                     *
+*   probing: A request is testing the server after the breaker was open.      *
+*   seed: State of the jitter.                                                *
+*   sent: Requests let through.                                               *
+*   throttled: Times a request had to wait for a token.                       *
+*   retried: Requests sent again.                                             *
+*   rejected: Requests failed by the open breaker.                            *
+******************************************************************************/
+typedef struct tsl_sched {
+	pthread_mutex_t lock;
+	double rate; double tokens; int64_t filled;
+	int failures; int64_t until; int cooldown; int probing;
+	unsigned int seed;
+	unsigned long sent, throttled, retried, rejected;
+} tsl_sched;
+/******************************************************************************
+* Struct: sched_entry                                                         *
+* -------------------                                                         *
+*   A request waiting in a sched_queue.                                       *
+*                                                                             *
+*   item: What the caller queued, NULL once moved to another priority.        *
+*   priority: An enum sched_priority.                                         *
+*   attempts: Times the request has been sent.                                *
+*   ready: ms of metrics_now before which it is not sent again.               *
+******************************************************************************/
+typedef struct sched_entry {
+	const void *item; int priority;
+	int attempts; int64_t ready;
+} sched_entry;
+/******************************************************************************
+* Struct: sched_queue                                                         *
+* -------------------                                                         *
+*   Requests of one event loop waiting to be sent, first in first out within  *
+*   each priority, and retries waiting out their backoff.                     *
+*                                                                             *
+*   fifos: Entries of each priority, from head to len.                        *
+*   delayed: Retries not ready yet, in no order.                              *
+*   due: ms when sched_pop may give something that it did not before, 0 when  *
+*        nothing waits for time to pass.                                      *
+******************************************************************************/
+typedef struct sched_fifo {sched_entry *e; int head; int len; int cap;} sched_fifo;
+typedef struct sched_queue {
+	sched_fifo fifos[PRIORITIES];
+	sched_fifo delayed;
+	int64_t due;
+} sched_queue;
+/******************************************************************************
+* Function: sched_init                                                        *
+* --------------------                                                        *
+*   Initializes a scheduler with a full bucket and a closed breaker.          *
+*                                                                             *
+*   s: Pointer to the scheduler.                                              *
+*   quota: Requests per minute allowed by the API key, 0 for no limit.        *
+******************************************************************************/
+void sched_init(tsl_sched *s, int quota);
+/******************************************************************************
+* Function: sched_free                                                        *
+* --------------------                                                        *
+*   Frees the lock of a scheduler.                                            *
+*                                                                             *
+*   s: Pointer to the scheduler.                                              *
+******************************************************************************/
+void sched_free(tsl_sched *s);
+/******************************************************************************
+* Function: sched_acquire                                                     *
+* -----------------------                                                     *
+*   Asks to send a request now.                                               *
+*                                                                             *
+*   s: The scheduler, NULL to always send.                                    *
+*   priority: An enum sched_priority.                                         *
+*                                                                             *
+*   Returns: 0 when the request may be sent, its token is taken.              *
+*            ms to wait before asking again when the bucket is short.         *
+*            E_BREAKER when the breaker is open and the request must fail.    *
+******************************************************************************/
+int sched_acquire(tsl_sched *s, int priority);
+/******************************************************************************
+* Function: sched_done                                                        *
+* --------------------                                                        *
+*   Tells how a request let through went, and whether to send it again.       *
+*   Resolve, connect, send and receive errors and 5xx statuses count against  *
+*   the breaker, and reopen it after a probe. Anything else closes it. All    *
+*   but resolve errors are retried, and 429, which also empties the bucket.   *
+*                                                                             *
+*   s: The scheduler, NULL to never retry.                                    *
+*   retval: Length of the body, or the error number of the request.           *
+*   status: Http status of the response, 0 without one.                       *
+*   attempts: Times the request has been sent.                                *
+*                                                                             *
+*   Returns: ms to wait before sending the request again.                     *
+*            -1 when it is not to be sent again.                              *
+******************************************************************************/
+int sched_done(tsl_sched *s, int retval, int status, int attempts);
+/******************************************************************************
+* Function: sched_cancel                                                      *
+* ----------------------                                                      *
+*   Gives back the turn of a request let through that was not sent after      *
+*   all, in place of sched_done.                                              *
+*                                                                             *
+*   s: The scheduler, NULL for none.                                          *
+******************************************************************************/
+void sched_cancel(tsl_sched *s);
+/******************************************************************************
+* Function: sched_print                                                       *
+* ---------------------                                                       *
+*   Prints the counters of a scheduler.                                       *
+*                                                                             *
+*   out: Stream to print to.                                                  *
+*   s: The scheduler.                                                         *
+******************************************************************************/
+void sched_print(FILE *out, tsl_sched *s);
+/******************************************************************************
+* Function: sched_queue_init                                                  *
+* --------------------------                                                  *
+*   Initializes an empty queue, nothing is allocated until it is used.        *
+*                                                                             *
+*   q: Pointer to the queue.                                                  *
+******************************************************************************/
+void sched_queue_init(sched_queue *q);
+/******************************************************************************
+* Function: sched_queue_free                                                  *
+* --------------------------                                                  *
+*   Frees the entries of a queue.                                             *
+*                                                                             *
+*   q: Pointer to the queue.                                                  *
+******************************************************************************/
+void sched_queue_free(sched_queue *q);
+/******************************************************************************
+* Function: sched_push                                                        *
+* --------------------                                                        *
+*   Queues a request.                                                         *
+*                                                                             *
+*   q: Pointer to the queue.                                                  *
+*   e: The entry, copied. It waits among the delayed while it is not ready.   *
+*                                                                             *
+*   Returns: E_SUCCESS or E_UNKNOWN when memory runs out.                     *
+******************************************************************************/
+int sched_push(sched_queue *q, const sched_entry *e);
+/******************************************************************************
+* Function: sched_raise                                                       *
+* ---------------------                                                       *
+*   Moves a queued request to a priority served sooner, such as a refresh     *
+*   someone has come to wait for.                                             *
+*                                                                             *
+*   q: Pointer to the queue.                                                  *
+*   item: The item of the entry.                                              *
+*   priority: The new priority, nothing is done unless it is lower.           *
+*                                                                             *
+*   Returns: E_SUCCESS, also when the item is not queued.                     *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int sched_raise(sched_queue *q, const void *item, int priority);
+/******************************************************************************
+* Function: sched_pop                                                         *
+* -------------------                                                         *
+*   Takes the first ready request of the lowest priority that the scheduler   *
+*   lets through.                                                             *
+*                                                                             *
+*   s: The scheduler, NULL to let everything through.                         *
+*   q: Pointer to the queue, q->due is set when something has to wait.        *
+*   e: Set to the entry taken.                                                *
+*                                                                             *
+*   Returns: 1 when e may be sent.                                            *
+*            0 when nothing may be sent now.                                  *
+*            E_BREAKER when e is taken to fail, the breaker is open.          *
+******************************************************************************/
+int sched_pop(tsl_sched *s, sched_queue *q, sched_entry *e);
+/******************************************************************************
+* Function: sched_timeout                                                     *
+* -----------------------                                                     *
+*   q: Pointer to the queue.                                                  *
+*                                                                             *
+*   Returns: ms until sched_pop has to be called again even if nothing else   *
+*            happens, 0 when it is due, -1 when nothing waits.                *
+******************************************************************************/
+int sched_timeout(const sched_queue *q);
+/*****************************************************************************/
+#endif /* SCHEDULER_H */
@@ -0,0 +1,752 @@
+/******************************************************************************
+*     File Name           :     server.c                                      *
+*     Description         :     Long-running tsl answering local clients on   *
+*                                 a Unix domain socket.                       *
+******************************************************************************/
+#define _GNU_SOURCE             // accept4
+#include <errno.h>              // errno
+#include <fcntl.h>              // fcntl, O_NONBLOCK
+#include <poll.h>               // poll
+#include <stdint.h>             // uint64_t
+#include <sys/epoll.h>          // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/stat.h>           // lstat, S_ISSOCK
+#include <sys/un.h>             // struct sockaddr_un
+#include "server.h"
+#include "client.h"             // scan_response
+#include "writer.h"
+/*****************************************************************************/
+#define SERVER_EVENTS 64 		// Events handled per epoll_wait
+#define SERVER_READ 4096 		// Bytes read from a client at a time
+#define SERVER_READ_PASS 65536 	// Bytes read from a client per event
+#define SERVER_OUT_HIGH (1<<20) // Unsent bytes that pause reading a client
+#define SERVER_RESULTS 64 		// Initial size of the result table
+#define SERVER_STATS "!stats" 	// Line asking for the counters
+#define SERVER_HEAD 32 			// Longest "<status> <length>" line
+/*****************************************************************************/
+typedef struct client client;
+/*****************************************************************************/
+typedef struct answer {
+	int refs;					// Requests and results holding the answer.
+	int status;					// E_SUCCESS or an error number.
+	int text_len;				// Length of text.
+	char text[];				// Printed trips, read-only once shared.
+} answer;
+/*****************************************************************************/
+typedef struct request {
+	query q;					// The query, names owned by the request.
+	client *client;				// Who asked, NULL once it has gone away.
+	struct request *next;		// Next request of the same client.
+	answer *answer;				// NULL until answered.
+	char *key;					// Key of the result, set when sent upstream.
+	struct request *waiters;	// Identical requests waiting for this one.
+	struct request *next_waiter;// Next request waiting for the same answer.
+} request;
+/*****************************************************************************/
+struct client {
+	int fd;						// Connection to the client, -1 once closed.
+	int eof;					// Client sends no more queries.
+	tsl_buf in;					// Bytes read that are not a full line yet.
+	tsl_buf out;				// Answers not written yet.
+	request *head, *tail;		// Requests in the order they were sent.
+	client *next_closed;		// Next client to free after the events.
+};
+/*****************************************************************************/
+typedef struct result {
+	char *key;					// See cache_key, NULL for an empty slot.
+	answer *answer;				// Last successful answer, or NULL.
+	time_t stored;				// Time the answer was stored.
+	request *inflight;			// Request gone upstream for the key, or NULL.
+} result;
+/*****************************************************************************/
+typedef struct server {
+	int epfd;					// The epoll instance.
+	int listen_fd;				// The Unix domain socket.
+	batch *batch;				// Queries on their way to the server.
+	const tsl_cache *cache;		// Ttl and stale time of results.
+	result *results;			// Open addressed table of results.
+	int results_len;			// Used slots of results.
+	int results_cap;			// Size of results, a power of two.
+	triplist tl;				// Reused for every answer.
+	tsl_writer text;			// Answers are printed into, in memory.
+	client *closed;				// Clients closed while handling events.
+	unsigned long hits;			// Queries answered from results.
+	unsigned long upstream;		// Queries sent to the server.
+	unsigned long coalesced;	// Queries that waited for an identical one.
+	unsigned long refreshed;	// Stale answers given while they are refreshed.
+	tsl_sched *sched;			// Scheduler of upstream queries, or NULL.
+	tsl_metrics *metrics;		// Timings of upstream queries, or NULL.
+} server;
+/*****************************************************************************/
+/* Answer of last resort, its reference count never reaches 0 */
+static answer no_memory = {1, E_UNKNOWN, 0};
+/*****************************************************************************/
+static uint64_t hash_key(const char *key) {
+	uint64_t hash = 14695981039346656037ULL;
+	for(; *key; key++) {
+		hash = (hash ^ (unsigned char)*key)*1099511628211ULL;
+	}
+	return hash;
+}
+/*****************************************************************************/
+static result *results_find(server *sv, const char *key) {
+	/* Slot of key, or the empty slot where it belongs */
+	unsigned mask = sv->results_cap-1, i = hash_key(key) & mask;
+	while(sv->results[i].key && strcmp(sv->results[i].key, key)) {
+		i = (i+1) & mask;
+	}
+	return &sv->results[i];
+}
+/*****************************************************************************/
+static answer *answer_new(int status, const char *text, int text_len) {
+	answer *a;
+	if(status < 0) {
+		text_len = 0;
+	}
+	if(!(a = malloc(sizeof(answer)+text_len+1))) {
+		return &no_memory;
+	}
+	a->refs = 0;
+	a->status = status;
+	a->text_len = text_len;
+	memcpy(a->text, text, text_len);
+	a->text[text_len] = '\0';
+	return a;
+}
+/*****************************************************************************/
+static void answer_put(answer *a) {
+	if(a && --a->refs == 0) {
+		free(a);
+	}
+}
+/*****************************************************************************/
+static int live(const server *sv, const result *r, time_t now) {
+	return r->inflight || (r->answer
+			&& now-r->stored <= sv->cache->ttl+sv->cache->stale);
+}
+/*****************************************************************************/
+static int results_grow(server *sv, time_t now) {
+	/* Expired results are dropped on the way, so the table only grows
+	 * when the live results fill it */
+	result *old = sv->results, *r;
+	int i, old_cap = sv->results_cap, num_live = 0;
+	for(i = 0; i < old_cap; i++) {
+		num_live += old[i].key && live(sv, &old[i], now);
+	}
+	while(num_live*2 >= sv->results_cap) {
+		sv->results_cap *= 2;
+	}
+	if(!(sv->results = calloc(sv->results_cap, sizeof(result)))) {
+		sv->results = old;
+		sv->results_cap = old_cap;
+		return E_UNKNOWN;
+	}
+	sv->results_len = 0;
+	for(i = 0; i < old_cap; i++) {
+		if(!old[i].key) {
+			continue;
+		}
+		if(!live(sv, &old[i], now)) {
+			free(old[i].key);
+			answer_put(old[i].answer);
+			continue;
+		}
+		r = results_find(sv, old[i].key);
+		*r = old[i];
+		sv->results_len++;
+	}
+	free(old);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static result *results_add(server *sv, const char *key, time_t now) {
+	/* Slot of key, created if missing */
+	result *r;
+	if(sv->results_len*2 >= sv->results_cap && results_grow(sv, now)) {
+		return NULL;
+	}
+	if(!(r = results_find(sv, key))->key) {
+		if(!(r->key = strdup(key))) {
+			return NULL;
+		}
+		sv->results_len++;
+	}
+	return r;
+}
+/*****************************************************************************/
+static void request_free(request *r) {
+	free(r->q.origin);
+	free(r->q.dest);
+	free(r->key);
+	answer_put(r->answer);
+	free(r);
+}
+/*****************************************************************************/
+static void client_close(server *sv, client *c) {
+	/* Requests still in flight are left for on_result to free. The client
+	 * itself may have events waiting, so it is freed after them */
+	request *r, *next;
+	if(c->fd < 0) {
+		return;
+	}
+	for(r = c->head; r; r = next) {
+		next = r->next;
+		if(r->answer) {
+			request_free(r);
+		} else {
+			r->client = NULL;
+		}
+	}
+	c->head = c->tail = NULL;
+	close(c->fd);
+	c->fd = -1;
+	c->next_closed = sv->closed;
+	sv->closed = c;
+}
+/*****************************************************************************/
+static void free_closed(server *sv) {
+	client *c;
+	while((c = sv->closed)) {
+		sv->closed = c->next_closed;
+		buf_free(&c->in);
+		buf_free(&c->out);
+		free(c);
+	}
+}
+/*****************************************************************************/
+static int client_write(server *sv, client *c) {
+	struct epoll_event ev;
+	int n;
+	while(c->out.len > 0) {
+		if((n = send(c->fd, c->out.data, c->out.len, MSG_NOSIGNAL)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK) {
+				return E_SEND;
+			}
+			break;
+		}
+		memmove(c->out.data, c->out.data+n, c->out.len-n);
+		c->out.len -= n;
+	}
+	/* A client that is done sending is closed once it has every answer */
+	if(c->eof && !c->head && c->out.len == 0) {
+		return E_RECEIVE;
+	}
+	/* Only wait for the socket to drain while there is something left, and
+	 * take no more queries from a client that does not read its answers */
+	ev.events = (c->eof || c->out.len >= SERVER_OUT_HIGH ? 0 : EPOLLIN)
+			| (c->out.len > 0 ? EPOLLOUT : 0);
+	ev.data.ptr = c;
+	return epoll_ctl(sv->epfd, EPOLL_CTL_MOD, c->fd, &ev) ? E_SEND : E_SUCCESS;
+}
+/*****************************************************************************/
+static int client_queue(client *c) {
+	/* Answers leave in the order the queries came in */
+	request *r;
+	answer *a;
+	char head[32];
+	int len;
+	while((r = c->head) && (a = r->answer)) {
+		len = snprintf(head, sizeof(head), "%d %d\n", a->status, a->text_len);
+		if(buf_reserve(&c->out, len+a->text_len)) {
+			return E_UNKNOWN;
+		}
+		memcpy(c->out.data+c->out.len, head, len);
+		memcpy(c->out.data+c->out.len+len, a->text, a->text_len);
+		c->out.len += len+a->text_len;
+		if(!(c->head = r->next)) {
+			c->tail = NULL;
+		}
+		request_free(r);
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int client_flush(server *sv, client *c) {
+	if(client_queue(c)) {
+		return E_UNKNOWN;
+	}
+	return client_write(sv, c);
+}
+/*****************************************************************************/
+static void give(request *r, answer *a) {
+	r->answer = a;
+	a->refs++;
+}
+/*****************************************************************************/
+static void deliver(server *sv, request *r, answer *a) {
+	/* Flushing frees the request along with its answer */
+	client *c = r->client;
+	if(!c) {
+		request_free(r);
+		return;
+	}
+	give(r, a);
+	if(client_flush(sv, c)) {
+		client_close(sv, c);
+	}
+}
+/*****************************************************************************/
+static void on_result(void *arg, const query *q, char *js, int len,
+		tsl_timing *t) {
+	/* One upstream answer is shared by every request that waited for it */
+	server *sv = arg;
+	request *r = (request*)q, *w, *next;
+	time_t now = time(NULL);
+	result *res = results_find(sv, r->key);
+	answer *a;
+
+	sv->text.buf.len = 0;
+	if(len >= 0 && (len = scan_response(NULL, &sv->tl, t, r->q.origin,
+			r->q.dest, &js, len)) >= 0) {
+		t->trips = sv->tl.trips_len;
+		t->edges = sv->tl.edges_len;
+		len = writer_result(&sv->text, r->q.origin, r->q.dest, js,
+				sv->tl.trips, sv->tl.edges, NULL, len);
+		timing_lap(t, STAGE_OUTPUT);
+	}
+	a = answer_new(len < 0 ? len : E_SUCCESS, sv->text.buf.data,
+			sv->text.buf.len);
+	t->bytes_out = sv->text.buf.len;
+	timing_end(t);
+	if(sv->metrics) {
+		metrics_add(sv->metrics, t, len);
+	}
+	res->inflight = NULL;
+	if(a->status == E_SUCCESS) {
+		answer_put(res->answer);
+		a->refs++;
+		res->answer = a;
+		res->stored = now;
+	}
+	/* Delivering may close the client of r and free r with it */
+	w = r->waiters;
+	a->refs++;
+	deliver(sv, r, a);
+	for(; w; w = next) {
+		next = w->next_waiter;
+		deliver(sv, w, a);
+	}
+	answer_put(a);
+}
+/*****************************************************************************/
+static answer *stats_answer(const server *sv) {
+	/* The counters, then the timings of upstream queries when kept */
+	answer *a;
+	char *text = NULL;
+	size_t len = 0;
+	FILE *f = open_memstream(&text, &len);
+	if(!f) {
+		return &no_memory;
+	}
+	fprintf(f, "hits %lu\nupstream %lu\ncoalesced %lu\nrefreshed %lu\n",
+			sv->hits, sv->upstream, sv->coalesced, sv->refreshed);
+	if(sv->sched) {
+		sched_print(f, sv->sched);
+	}
+	if(sv->metrics) {
+		metrics_print(f, sv->metrics);
+	}
+	if(fclose(f)) {
+		free(text);
+		return &no_memory;
+	}
+	a = answer_new(E_SUCCESS, text, len);
+	free(text);
+	return a;
+}
+/*****************************************************************************/
+static int upstream(server *sv, result *res, request *r, int priority) {
+	/* The result is marked first, as a query the batch fails at once is
+	 * answered before batch_submit returns */
+	if(!(r->key = strdup(res->key))) {
+		return E_UNKNOWN;
+	}
+	res->inflight = r;
+	if(batch_submit(sv->batch, &r->q, priority)) {
+		res->inflight = NULL;
+		return E_UNKNOWN;
+	}
+	sv->upstream++;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static void refresh(server *sv, result *res, const request *r) {
+	/* Nobody waits for a refresh, its answer is only stored */
+	request *f = calloc(1, sizeof(request));
+	if(!f) {
+		return;
+	}
+	if(!(f->q.origin = strdup(r->q.origin)) || !(f->q.dest = strdup(r->q.dest))
+			|| upstream(sv, res, f, PRIORITY_REFRESH)) {
+		request_free(f);
+		return;
+	}
+	sv->refreshed++;
+}
+/*****************************************************************************/
+static int client_query(server *sv, client *c, char *line) {
+	char key[CACHE_KEY_SIZE];
+	time_t now = time(NULL);
+	request *r;
+	result *res;
+	if(!(r = calloc(1, sizeof(request)))) {
+		return E_UNKNOWN;
+	}
+	r->client = c;
+	if(c->tail) {
+		c->tail->next = r;
+	} else {
+		c->head = r;
+	}
+	c->tail = r;
+	if(!strcmp(line, SERVER_STATS)) {
+		give(r, stats_answer(sv));
+		return E_SUCCESS;
+	}
+	/* Every line is answered, even a bad one */
+	if(!parse_query(line, &r->q)
+			|| cache_key(r->q.origin, r->q.dest, key) < 0) {
+		give(r, answer_new(E_SEND, "", 0));
+		return E_SUCCESS;
+	}
+	if(!(res = results_add(sv, key, now))) {
+		give(r, &no_memory);
+		return E_SUCCESS;
+	}
+	if(res->answer && now-res->stored <= sv->cache->ttl) {
+		sv->hits++;
+		give(r, res->answer);
+		return E_SUCCESS;
+	}
+	/* A stale answer is given while a refresh goes upstream behind the
+	 * queries someone waits for */
+	if(res->answer && now-res->stored <= sv->cache->ttl+sv->cache->stale) {
+		sv->hits++;
+		give(r, res->answer);
+		if(!res->inflight) {
+			refresh(sv, res, r);
+		}
+		return E_SUCCESS;
+	}
+	/* Single flight, only the first of identical queries goes upstream, and
+	 * a refresh someone comes to wait for is sent sooner */
+	if(res->inflight) {
+		sv->coalesced++;
+		r->next_waiter = res->inflight->waiters;
+		res->inflight->waiters = r;
+		batch_raise(sv->batch, &res->inflight->q, PRIORITY_INTERACTIVE);
+		return E_SUCCESS;
+	}
+	if(upstream(sv, res, r, PRIORITY_INTERACTIVE)) {
+		give(r, &no_memory);
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int client_lines(server *sv, client *c) {
+	/* Queries are taken as soon as their line is complete */
+	char *line, *end;
+	int n, retval;
+	c->in.data[c->in.len] = '\0';
+	for(line = c->in.data; (end = strchr(line, '\n')); line = end+1) {
+		*end = '\0';
+		if((retval = client_query(sv, c, line))) {
+			return retval;
+		}
+	}
+	if((n = c->in.data+c->in.len-line) > MESSAGE_SIZE) {
+		return E_RESPONSE;
+	}
+	memmove(c->in.data, line, n);
+	c->in.len = n;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int client_read(server *sv, client *c) {
+	/* A pass reads a bounded amount, the rest waits for the next event so
+	 * that one client cannot hold the loop or fill memory */
+	int n, retval, total = 0;
+	while(!c->eof && total < SERVER_READ_PASS && c->out.len < SERVER_OUT_HIGH) {
+		if(buf_reserve(&c->in, SERVER_READ)) {
+			return E_UNKNOWN;
+		}
+		if((n = read(c->fd, c->in.data+c->in.len, SERVER_READ)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return E_RECEIVE;
+		}
+		if(n == 0) {
+			c->eof = 1;
+			break;
+		}
+		c->in.len += n;
+		total += n;
+		if((retval = client_lines(sv, c)) || (retval = client_queue(c))) {
+			return retval;
+		}
+	}
+	return client_flush(sv, c);
+}
+/*****************************************************************************/
+static void accept_clients(server *sv) {
+	struct epoll_event ev;
+	client *c;
+	int fd;
+	while((fd = accept4(sv->listen_fd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+		if(!(c = calloc(1, sizeof(client)))) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if(epoll_ctl(sv->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+			client_close(sv, c);
+		}
+	}
+}
+/*****************************************************************************/
+static int listen_on(const char *path) {
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	/* A socket left behind by a server that did not exit cleanly */
+	if(!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+		return -1;
+	}
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 128)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+/*****************************************************************************/
+int run_server(const char *path, const tsl_config *config, int max_inflight,
+		const tsl_cache *cache, tsl_metrics *metrics, int stop_fd) {
+	struct epoll_event ev, events[SERVER_EVENTS];
+	server sv = {.cache = cache, .results_cap = SERVER_RESULTS,
+			.metrics = metrics};
+	int i, n, stop = 0, retval = E_SUCCESS;
+
+	if((sv.listen_fd = listen_on(path)) < 0) {
+		return E_CONNECT;
+	}
+	sv.epfd = epoll_create1(0);
+	sv.batch = batch_new(config, max_inflight, on_result, &sv);
+	sv.sched = config->sched;
+	sv.results = calloc(sv.results_cap, sizeof(result));
+	if(sv.epfd < 0 || !sv.batch || !sv.results
+			|| writer_init(&sv.text, -1, WRITE_TEXT)) {
+		retval = E_UNKNOWN;
+		goto out;
+	}
+	triplist_init(&sv.tl);
+	/* The batch has an epoll instance of its own, it is readable when
+	 * upstream connections have events */
+	ev.events = EPOLLIN;
+	ev.data.ptr = &sv;
+	epoll_ctl(sv.epfd, EPOLL_CTL_ADD, sv.listen_fd, &ev);
+	ev.data.ptr = sv.batch;
+	epoll_ctl(sv.epfd, EPOLL_CTL_ADD, batch_fd(sv.batch), &ev);
+	/* The caller says when to stop, no client or connection is NULL */
+	ev.data.ptr = NULL;
+	if(stop_fd >= 0 && epoll_ctl(sv.epfd, EPOLL_CTL_ADD, stop_fd, &ev)) {
+		retval = E_UNKNOWN;
+		goto out;
+	}
+	while(!stop) {
+		free_closed(&sv);
+		if((n = epoll_wait(sv.epfd, events, SERVER_EVENTS,
+				batch_timeout(sv.batch))) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			retval = E_UNKNOWN;
+			break;
+		}
+		if(!n) {
+			batch_dispatch(sv.batch, 0);
+		}
+		for(i = 0; i < n; i++) {
+			if(!events[i].data.ptr) {
+				stop = 1;
+			} else if(events[i].data.ptr == &sv) {
+				accept_clients(&sv);
+			} else if(events[i].data.ptr == sv.batch) {
+				batch_dispatch(sv.batch, 0);
+			} else if(((client*)events[i].data.ptr)->fd < 0) {
+				continue;
+			} else if(((events[i].events & EPOLLOUT)
+					&& client_write(&sv, events[i].data.ptr))
+					|| ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+					&& client_read(&sv, events[i].data.ptr))) {
+				client_close(&sv, events[i].data.ptr);
+			}
+		}
+	}
+
+	fprintf(stderr, "tsl: %lu hits, %lu upstream, %lu coalesced, "
+			"%lu refreshed\n", sv.hits, sv.upstream, sv.coalesced,
+			sv.refreshed);
+
+out:
+	/* Requests of clients that are still connected are left to the exit */
+	free_closed(&sv);
+	if(sv.batch) {
+		batch_free(sv.batch);
+	}
+	for(i = 0; sv.results && i < sv.results_cap; i++) {
+		free(sv.results[i].key);
+		answer_put(sv.results[i].answer);
+	}
+	free(sv.results);
+	triplist_free(&sv.tl);
+	writer_free(&sv.text);
+	if(sv.epfd >= 0) {
+		close(sv.epfd);
+	}
+	close(sv.listen_fd);
+	unlink(path);
+	return retval;
+}
+/*****************************************************************************/
+static int queue_queries(tsl_buf *out, const query *queries, int num_queries,
+		int *next) {
+	/* The next queries as lines, a pass at a time */
+	out->len = 0;
+	for(; *next < num_queries && out->len < SERVER_READ_PASS; (*next)++) {
+		const query *q = &queries[*next];
+		if(buf_reserve(out, strlen(q->origin)+strlen(q->dest)+2)) {
+			return E_UNKNOWN;
+		}
+		out->len += sprintf(out->data+out->len, "%s\t%s\n", q->origin,
+				q->dest);
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+typedef struct answers {
+	const query *queries;		// Queries in the order they were sent.
+	int headers;				// Print the query before its answer.
+	int done;					// Answers printed.
+	int failed;					// Answers that were errors.
+	int status;					// Status of the last answer.
+} answers;
+/*****************************************************************************/
+static int print_answers(answers *a, tsl_buf *in, int num_queries) {
+	/* Prints the answers that have come in whole and keeps the rest */
+	char head[SERVER_HEAD], *p = in->data, *end = in->data+in->len, *nl;
+	int len;
+	while(a->done < num_queries && (nl = memchr(p, '\n', end-p))) {
+		if(nl-p >= (int)sizeof(head)) {
+			return E_RECEIVE;
+		}
+		memcpy(head, p, nl-p);
+		head[nl-p] = '\0';
+		if(sscanf(head, "%d %d", &a->status, &len) != 2 || len < 0) {
+			return E_RECEIVE;
+		}
+		if(end-(nl+1) < len) {
+			break;
+		}
+		if(a->headers) {
+			printf("%s -> %s\n", a->queries[a->done].origin,
+					a->queries[a->done].dest);
+		}
+		fwrite(nl+1, 1, len, stdout);
+		if(a->status < 0) {
+			fprintf(stderr, "tsl: %s -> %s failed (%d)\n",
+					a->queries[a->done].origin, a->queries[a->done].dest,
+					a->status);
+			a->failed++;
+		}
+		a->done++;
+		p = nl+1+len;
+	}
+	memmove(in->data, p, end-p);
+	in->len = end-p;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+int query_server(const char *path, const query *queries, int num_queries,
+		int headers) {
+	/* Answers are read while queries are still being sent, as the server
+	 * stops reading a client that does not take its answers */
+	struct sockaddr_un addr;
+	struct pollfd pfd;
+	answers a = {queries, headers, 0, 0, 0};
+	tsl_buf in, out;
+	int fd, n, next = 0, sent = 0, retval = E_SUCCESS;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		return E_CONNECT;
+	}
+	strcpy(addr.sun_path, path);
+	if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		return E_CONNECT;
+	}
+	if(connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		close(fd);
+		return E_CONNECT;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	buf_init(&in);
+	buf_init(&out);
+	while(retval == E_SUCCESS && a.done < num_queries) {
+		if(sent == out.len && next < num_queries) {
+			sent = 0;
+			retval = queue_queries(&out, queries, num_queries, &next);
+			continue;
+		}
+		pfd.fd = fd;
+		pfd.events = POLLIN | (sent < out.len ? POLLOUT : 0);
+		if(poll(&pfd, 1, -1) < 0) {
+			retval = errno == EINTR ? E_SUCCESS : E_RECEIVE;
+			continue;
+		}
+		if(pfd.revents & POLLOUT) {
+			if((n = send(fd, out.data+sent, out.len-sent, MSG_NOSIGNAL)) > 0) {
+				sent += n;
+			} else if(errno != EAGAIN && errno != EINTR) {
+				retval = E_SEND;
+				continue;
+			}
+		}
+		if(!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+			continue;
+		}
+		if(buf_reserve(&in, SERVER_READ)) {
+			retval = E_UNKNOWN;
+		} else if((n = read(fd, in.data+in.len, in.cap-1-in.len)) > 0) {
+			in.len += n;
+			retval = print_answers(&a, &in, num_queries);
+		} else if(n == 0 || (errno != EAGAIN && errno != EINTR)) {
+			retval = E_RECEIVE;		// Gone before every query was answered
+		}
+	}
+	buf_free(&in);
+	buf_free(&out);
+	close(fd);
+	if(retval < 0) {
+		return retval;
+	}
+	return num_queries == 1 && a.failed ? a.status : a.failed;
+}
+/*****************************************************************************/
@@ -0,0 +1,69 @@
+/******************************************************************************
+*     File Name           :     server.h                                      *
+*     Description         :     Long-running tsl answering local clients on   *
+*                                 a Unix domain socket.                       *
+******************************************************************************/
+#ifndef SERVER_H
+#define SERVER_H
+#include "batch.h"              // query
+#include "cache.h"              // tsl_cache
+/******************************************************************************
+* Protocol                                                                    *
+* --------                                                                    *
+*   A client writes one query per line, "<Origin>\t<Destination>\n", and may  *
+*   write more before reading. Every query is answered in the order it was    *
+*   sent with a line "<status> <length>\n" followed by length bytes of trips  *
+*   printed as by print_triplist. status is 0 or an error number, in which    *
+*   case length is 0.                                                         *
+*   The line "!stats" is answered with the number of queries answered from    *
+*   memory, sent upstream, coalesced with an identical one in flight and      *
+*   answered stale while refreshed, then the counters of the scheduler when   *
+*   there is one, and the stage timings of upstream queries when they are     *
+*   kept.                                                                     *
+******************************************************************************/
+/******************************************************************************
+* Function: run_server                                                        *
+* --------------------                                                        *
+*   Listens on a Unix domain socket until stop_fd becomes readable.           *
+*   Results are kept in memory for the ttl of the cache, so repeated queries  *
+*   are answered without going to the server, and the rest go out over        *
+*   kept-alive connections that stay warm between clients. Identical          *
+*   queries arriving while one is in flight wait for it and share its answer. *
+*   For the stale time of the cache past the ttl a result is still given,     *
+*   while a refresh goes upstream behind the queries someone waits for.       *
+*                                                                             *
+*   path: Path of the socket, a stale socket there is replaced.               *
+*   config: Server, key and scheduler queries go to, copied.                  *
+*   max_inflight: Largest number of concurrent connections to the server.     *
+*   cache: Ttl and stale time of results, its dir is not used.                *
+*   metrics: Where timings of upstream queries are added, NULL for none.      *
+*   stop_fd: Descriptor of the caller, such as the read end of a pipe its     *
+*            signal handlers write to, -1 to serve until an error. It is      *
+*            not read or closed.                                              *
+*                                                                             *
+*   Returns: E_SUCCESS when stopped.                                          *
+*            E_CONNECT when the socket can not be set up.                     *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int run_server(const char *path, const tsl_config *config, int max_inflight,
+		const tsl_cache *cache, tsl_metrics *metrics, int stop_fd);
+/******************************************************************************
+* Function: query_server                                                      *
+* ----------------------                                                      *
+*   Sends queries to a running server and prints the answers as they come,    *
+*   reading them while later queries are still being sent.                    *
+*                                                                             *
+*   path: Path of the socket of the server.                                   *
+*   queries: Array of queries.                                                *
+*   num_queries: Number of queries in the array.                              *
+*   headers: Print "<Origin> -> <Destination>" before every answer.           *
+*                                                                             *
+*   Returns: Number of queries that failed, or the error of the only query.   *
+*            E_CONNECT when the server can not be reached.                    *
+*            E_SEND or E_RECEIVE when the server goes away.                   *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int query_server(const char *path, const query *queries, int num_queries,
+		int headers);
+/*****************************************************************************/
+#endif /* SERVER_H */
@@ -0,0 +1,440 @@
+/******************************************************************************
+*     File Name           :     sites.c                                       *
+*     Description         :     Index resolving what a user typed to the      *
+*                                 names and ids of SL sites.                  *
+******************************************************************************/
+#define _GNU_SOURCE             // qsort_r
+#include <ctype.h>              // isspace, tolower
+#include <errno.h>              // errno, EINTR
+#include <fcntl.h>              // open
+#include <stdint.h>             // uint32_t
+#include <sys/mman.h>           // mmap, munmap
+#include <sys/stat.h>           // fstat
+#include "sites.h"
+/*****************************************************************************/
+#define SITE_MAGIC 0x45544953 	// "SITE"
+#define SITE_VERSION 1
+#define SITE_PATH_SIZE 4096 	// Longest path of an index
+/*****************************************************************************/
+typedef struct site_header {
+	uint32_t magic;				// SITE_MAGIC.
+	uint32_t version;			// SITE_VERSION.
+	int32_t sites_len;			// Records following the header.
+	int32_t pool_len;			// Bytes of strings following the records.
+} site_header;
+typedef struct site_rec {
+	int key, key_len;			// Folded name in the pool.
+	int name;					// Name in the pool.
+	int id;						// Id in the pool.
+} site_rec;
+/*****************************************************************************/
+struct site_index {
+	void *map; size_t map_len;
+	const site_rec *sites; int sites_len;
+	const char *pool;
+};
+/*****************************************************************************/
+/* Letters of the two byte UTF-8 sequences starting with 0xc3, À to ÿ */
+static const char latin1[] = "aaaaaaaceeeeiiiidnoooooxouuuuyts"
+		"aaaaaaaceeeeiiiidnooooo/ouuuuyty";
+/*****************************************************************************/
+int site_fold(const char *name, char *key) {
+	const unsigned char *p = (const unsigned char*)name;
+	int len = 0, space = 0;
+	char c;
+	for(; *p; p++) {
+		if(isspace(*p)) {
+			space = len > 0;
+			continue;
+		}
+		if(*p == 0xc3 && p[1] >= 0x80 && p[1] <= 0xbf) {
+			c = latin1[*++p - 0x80];
+		} else {
+			c = tolower(*p);
+		}
+		if(len + space + 1 >= SITE_KEY_SIZE) {
+			return E_STATION;
+		}
+		if(space) {
+			key[len++] = ' ';
+			space = 0;
+		}
+		key[len++] = c;
+	}
+	key[len] = '\0';
+	return len;
+}
+/*****************************************************************************/
+/* Edit distances from what was typed to names taken in sorted order. Rows
+ * of the table belong to letters of a name, so a name reuses the rows of
+ * the prefix it shares with the name before it, and names below a prefix
+ * that is already too far off are passed over */
+typedef struct fuzzy {
+	const char *key; int len;	// What was typed, folded.
+	int max;					// Most edits of a match.
+	unsigned char rows[SITE_KEY_SIZE][SITE_KEY_SIZE];	// Edits from the
+								// first j letters typed to the first q
+								// letters of the name, at most max+1.
+	unsigned char ends[SITE_KEY_SIZE];	// Fewest edits from all typed to
+								// the first q or fewer letters.
+	const char *prev;			// Name the rows were filled for.
+	int depth;					// Rows filled for it.
+	int dead;					// Rows stopped at a prefix too far off.
+} fuzzy;
+/*****************************************************************************/
+static void fuzzy_init(fuzzy *f, const char *key, int len, int max) {
+	int j;
+	f->key = key;
+	f->len = len;
+	f->max = max;
+	for(j = 0; j <= len; j++) {
+		f->rows[0][j] = j <= max ? j : max+1;
+	}
+	f->ends[0] = f->rows[0][len];
+	f->prev = "";
+	f->depth = 0;
+	f->dead = 0;
+}
+/*****************************************************************************/
+static void fuzzy_next(fuzzy *f, const char *name, int name_len, int *whole,
+		int *prefix) {
+	/* Edits to the whole name and to its closest prefix, max+1 when there
+	 * are more than max */
+	const unsigned char *up;
+	unsigned char *row;
+	int q, j, cost, low, none = f->max+1;
+	for(q = 0; q < f->depth && name[q] == f->prev[q]; q++);
+	if(!(q == f->depth && f->dead)) {
+		for(f->dead = 0; q < name_len && !f->dead; q++) {
+			up = f->rows[q];
+			row = f->rows[q+1];
+			low = row[0] = q+1 <= f->max ? q+1 : none;
+			for(j = 1; j <= f->len; j++) {
+				cost = up[j-1] + (f->key[j-1] != name[q]);
+				cost = up[j]+1 < cost ? up[j]+1 : cost;
+				cost = row[j-1]+1 < cost ? row[j-1]+1 : cost;
+				row[j] = cost < none ? cost : none;
+				low = row[j] < low ? row[j] : low;
+			}
+			f->ends[q+1] = row[f->len] < f->ends[q] ? row[f->len] : f->ends[q];
+			f->dead = low == none;
+		}
+		f->depth = q;
+	}
+	f->prev = name;
+	*whole = f->dead || f->depth < name_len ? none : f->rows[name_len][f->len];
+	*prefix = f->ends[f->depth];
+}
+/*****************************************************************************/
+static int max_edits(int len) {
+	/* Short names are too easily turned into each other */
+	return len < 4 ? 0 : len < 8 ? 1 : 2;
+}
+/*****************************************************************************/
+/* Sites as they are read, before they are sorted */
+typedef struct site_list {
+	site_rec *sites; int sites_len, sites_cap;
+	tsl_buf pool;
+} site_list;
+/*****************************************************************************/
+static int pool_add(tsl_buf *pool, const char *s, int len) {
+	int off = pool->len;
+	if(buf_reserve(pool, len+1)) {
+		return E_UNKNOWN;
+	}
+	memcpy(pool->data+pool->len, s, len);
+	pool->data[pool->len+len] = '\0';
+	pool->len += len+1;
+	return off;
+}
+/*****************************************************************************/
+static int add_site(site_list *l, const char *line) {
+	char key[SITE_KEY_SIZE];
+	const char *name;
+	site_rec *r, *new_sites;
+	int id_len, name_len, key_len;
+	for(id_len = 0; line[id_len] && line[id_len] != ';'
+			&& line[id_len] != '\t'; id_len++);
+	if(!id_len || !line[id_len]) {
+		return E_STATION;
+	}
+	name = line+id_len+1;
+	for(name_len = strlen(name); name_len > 0
+			&& isspace((unsigned char)name[name_len-1]); name_len--);
+	if((key_len = site_fold(name, key)) <= 0) {
+		return E_STATION;
+	}
+	if(l->sites_len == l->sites_cap) {
+		l->sites_cap = l->sites_cap ? l->sites_cap*2 : 256;
+		if(!(new_sites = realloc(l->sites, sizeof(site_rec)*l->sites_cap))) {
+			return E_UNKNOWN;
+		}
+		l->sites = new_sites;
+	}
+	r = &l->sites[l->sites_len];
+	r->key_len = key_len;
+	if((r->key = pool_add(&l->pool, key, key_len)) < 0
+			|| (r->name = pool_add(&l->pool, name, name_len)) < 0
+			|| (r->id = pool_add(&l->pool, line, id_len)) < 0) {
+		return E_UNKNOWN;
+	}
+	l->sites_len++;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int compare_sites(const void *a, const void *b, void *arg) {
+	/* By key, then id, so the same list always makes the same file */
+	const site_rec *x = a, *y = b;
+	const char *pool = arg;
+	int c = strcmp(pool+x->key, pool+y->key);
+	return c ? c : strcmp(pool+x->id, pool+y->id);
+}
+/*****************************************************************************/
+static int write_all(int fd, const void *data, size_t len) {
+	const char *p = data;
+	ssize_t n;
+	while(len > 0) {
+		if((n = write(fd, p, len)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+/*****************************************************************************/
+static int write_index(const site_list *l, int sites_len, const char *path) {
+	site_header h = {SITE_MAGIC, SITE_VERSION, sites_len, l->pool.len};
+	char tmp[SITE_PATH_SIZE];
+	int fd, retval;
+	snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+	if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		return E_STATION;
+	}
+	retval = write_all(fd, &h, sizeof(h))
+			|| write_all(fd, l->sites, sizeof(site_rec)*sites_len)
+			|| write_all(fd, l->pool.data, l->pool.len);
+	if(close(fd) || retval || rename(tmp, path)) {
+		unlink(tmp);
+		return E_STATION;
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+int site_import(const char *list, const char *path) {
+	FILE *in = fopen(list, "r");
+	site_list l;
+	char *line = NULL;
+	size_t cap = 0;
+	int i, len = 0, retval = E_SUCCESS;
+	if(!in) {
+		return E_STATION;
+	}
+	memset(&l, 0, sizeof(l));
+	buf_init(&l.pool);
+	while(!retval && getline(&line, &cap, in) >= 0) {
+		if(*line != '#' && *line != '\n' && *line != '\r') {
+			retval = add_site(&l, line);
+		}
+	}
+	fclose(in);
+	free(line);
+	if(!retval && !l.sites_len) {
+		retval = E_STATION;
+	}
+	if(!retval) {
+		/* Sites listed twice under the same name are kept once */
+		qsort_r(l.sites, l.sites_len, sizeof(site_rec), compare_sites,
+				l.pool.data);
+		for(i = 1, len = 1; i < l.sites_len; i++) {
+			if(compare_sites(&l.sites[len-1], &l.sites[i], l.pool.data)) {
+				l.sites[len++] = l.sites[i];
+			}
+		}
+		retval = write_index(&l, len, path);
+	}
+	free(l.sites);
+	buf_free(&l.pool);
+	return retval ? E_STATION : len;
+}
+/*****************************************************************************/
+static int check_index(const site_index *index, int pool_len) {
+	const site_rec *r;
+	int i;
+	if(pool_len < 1 || index->pool[pool_len-1]) {
+		return E_STATION;
+	}
+	for(i = 0; i < index->sites_len; i++) {
+		r = &index->sites[i];
+		if(r->key < 0 || r->key_len < 0 || r->key_len >= SITE_KEY_SIZE
+				|| r->key >= pool_len - r->key_len
+				|| index->pool[r->key+r->key_len]
+				|| r->name < 0 || r->name >= pool_len
+				|| r->id < 0 || r->id >= pool_len
+				|| (i && strcmp(index->pool+r[-1].key, index->pool+r->key) > 0)) {
+			return E_STATION;
+		}
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+site_index *site_open(const char *path) {
+	site_index *index = calloc(1, sizeof(site_index));
+	const site_header *h;
+	struct stat st;
+	int fd;
+	if(!index || (fd = open(path, O_RDONLY)) < 0) {
+		free(index);
+		return NULL;
+	}
+	if(fstat(fd, &st) || st.st_size < (off_t)sizeof(site_header)
+			|| (index->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd,
+			0)) == MAP_FAILED) {
+		close(fd);
+		free(index);
+		return NULL;
+	}
+	close(fd);
+	index->map_len = st.st_size;
+	h = index->map;
+	if(h->magic != SITE_MAGIC || h->version != SITE_VERSION
+			|| h->sites_len < 0 || h->pool_len < 0
+			|| sizeof(site_header) + sizeof(site_rec)*(uint64_t)h->sites_len
+			+ h->pool_len != index->map_len) {
+		site_close(index);
+		return NULL;
+	}
+	index->sites = (const site_rec*)((char*)index->map+sizeof(site_header));
+	index->sites_len = h->sites_len;
+	index->pool = (const char*)(index->sites+index->sites_len);
+	if(check_index(index, h->pool_len)) {
+		site_close(index);
+		return NULL;
+	}
+	return index;
+}
+/*****************************************************************************/
+void site_close(site_index *index) {
+	munmap(index->map, index->map_len);
+	free(index);
+}
+/*****************************************************************************/
+static int lower_bound(const site_index *index, const char *key) {
+	int lo = 0, hi = index->sites_len, mid;
+	while(lo < hi) {
+		mid = lo + (hi-lo)/2;
+		if(strcmp(index->pool+index->sites[mid].key, key) < 0) {
+			lo = mid+1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+/*****************************************************************************/
+static int has_prefix(const site_index *index, int i, const char *key,
+		int len) {
+	return i < index->sites_len && index->sites[i].key_len >= len
+			&& !memcmp(index->pool+index->sites[i].key, key, len);
+}
+/*****************************************************************************/
+static int prefix_end(const site_index *index, int lo, const char *prefix,
+		int len) {
+	/* First site after lo not starting with the prefix lo starts with */
+	int hi = index->sites_len, mid;
+	while(lo < hi) {
+		mid = lo + (hi-lo)/2;
+		if(strncmp(index->pool+index->sites[mid].key, prefix, len) > 0) {
+			hi = mid;
+		} else {
+			lo = mid+1;
+		}
+	}
+	return lo;
+}
+/*****************************************************************************/
+static void set_site(const site_index *index, int i, int distance,
+		site *match) {
+	match->id = index->pool+index->sites[i].id;
+	match->name = index->pool+index->sites[i].name;
+	match->distance = distance;
+}
+/*****************************************************************************/
+int site_complete(const site_index *index, const char *text, site *matches,
+		int max) {
+	char key[SITE_KEY_SIZE];
+	const site_rec *r;
+	fuzzy f;
+	int i, j, n = 0, first, whole, d, len = site_fold(text, key);
+	if(len < 0) {
+		return len;
+	}
+	for(i = lower_bound(index, key); n < max && has_prefix(index, i, key, len);
+			i++) {
+		set_site(index, i, 0, &matches[n++]);
+	}
+	/* The rest are the closest names that do not start with it, kept
+	 * sorted by distance as they are found, earlier names first */
+	fuzzy_init(&f, key, len, max_edits(len));
+	for(i = 0, first = n; first < max && f.max && i < index->sites_len; i++) {
+		r = &index->sites[i];
+		fuzzy_next(&f, index->pool+r->key, r->key_len, &whole, &d);
+		if(d > f.max && f.dead) {
+			i = prefix_end(index, i, f.prev, f.depth)-1;
+		}
+		if(d > f.max || has_prefix(index, i, key, len)
+				|| (n == max && d >= matches[n-1].distance)) {
+			continue;
+		}
+		for(j = n < max ? n++ : n-1; j > first && matches[j-1].distance > d;
+				j--) {
+			matches[j] = matches[j-1];
+		}
+		set_site(index, i, d, &matches[j]);
+	}
+	return n;
+}
+/*****************************************************************************/
+int site_resolve(const site_index *index, const char *text, site *match) {
+	char key[SITE_KEY_SIZE];
+	const site_rec *r;
+	fuzzy f;
+	int i, d, prefix, best, found = -1, len = site_fold(text, key);
+	if(len <= 0) {
+		return E_STATION;
+	}
+	/* The name itself, then the only name starting with it */
+	i = lower_bound(index, key);
+	if(has_prefix(index, i, key, len) && (index->sites[i].key_len == len
+			|| !has_prefix(index, i+1, key, len))) {
+		set_site(index, i, 0, match);
+		return E_SUCCESS;
+	}
+	if(has_prefix(index, i, key, len)) {
+		return E_STATION;
+	}
+	/* Then the only closest name */
+	fuzzy_init(&f, key, len, max_edits(len));
+	for(i = 0, best = f.max+1; i < index->sites_len; i++) {
+		r = &index->sites[i];
+		fuzzy_next(&f, index->pool+r->key, r->key_len, &d, &prefix);
+		if(f.dead) {
+			i = prefix_end(index, i, f.prev, f.depth)-1;
+		}
+		if(d < best) {
+			best = d;
+			found = i;
+		} else if(d == best && d <= f.max) {
+			found = -2;
+		}
+	}
+	if(found < 0) {
+		return E_STATION;
+	}
+	set_site(index, found, best, match);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
@@ -0,0 +1,113 @@
+/******************************************************************************
+*     File Name           :     sites.h                                       *
+*     Description         :     Index resolving what a user typed to the      *
+*                                 names and ids of SL sites.                  *
+******************************************************************************/
+#ifndef SITES_H
+#define SITES_H
+#include "tsl.h"                // error numbers
+/*****************************************************************************/
+#define SITE_KEY_SIZE 128 		// Longest folded name, with its '\0'
+#define SITE_MATCHES 10 		// Completions printed for a name
+/******************************************************************************
+* Struct: site_index                                                          *
+* ------------------                                                          *
+*   Sites mapped read-only from a file written by site_import, sorted by      *
+*   their folded names so prefixes are found by binary search.                *
+******************************************************************************/
+typedef struct site_index site_index;
+/******************************************************************************
+* Struct: site                                                                *
+* ------------                                                                *
+*   A site found in the index.                                                *
+*                                                                             *
+*   id: Id of the site, as the travel planner takes it.                       *
+*   name: Name of the site, as it is spelled in the list.                     *
+*   distance: Edits from what was typed, 0 for a prefix of the name.          *
+******************************************************************************/
+typedef struct site {
+	const char *id;
+	const char *name;
+	int distance;
+} site;
+/******************************************************************************
+* Function: site_fold                                                         *
+* -------------------                                                         *
+*   Makes the key a name is looked up by: lower case, without the accents     *
+*   of å, ä, ö and other Latin-1 letters, and with runs of white space made   *
+*   single spaces.                                                            *
+*                                                                             *
+*   name: Name in UTF-8.                                                      *
+*   key: Buffer of SITE_KEY_SIZE bytes where the key is stored.               *
+*                                                                             *
+*   Returns: Length of the key.                                               *
+*            E_STATION when the key does not fit.                             *
+******************************************************************************/
+int site_fold(const char *name, char *key);
+/******************************************************************************
+* Function: site_import                                                       *
+* ---------------------                                                       *
+*   Reads a site list, one "<id>;<name>" or "<id>\t<name>" per line, and      *
+*   writes it as an index. Empty lines and lines starting with '#' are        *
+*   skipped.                                                                  *
+*                                                                             *
+*   list: Path of the site list.                                              *
+*   path: File the index is written to, replaced when it exists.              *
+*                                                                             *
+*   Returns: Number of sites in the index.                                    *
+*            E_STATION when the list can not be read or the file written.     *
+******************************************************************************/
+int site_import(const char *list, const char *path);
+/******************************************************************************
+* Function: site_open                                                         *
+* -------------------                                                         *
+*   Maps an index and checks that it is sorted and every offset in it stays   *
+*   inside it.                                                                *
+*                                                                             *
+*   path: File written by site_import.                                        *
+*                                                                             *
+*   Returns: The index, close with site_close.                                *
+*            NULL when the file is missing or malformed.                      *
+******************************************************************************/
+site_index *site_open(const char *path);
+/******************************************************************************
+* Function: site_close                                                        *
+* --------------------                                                        *
+*   Unmaps an index. Sites found in it are no longer valid.                   *
+*                                                                             *
+*   index: Pointer to the index.                                              *
+******************************************************************************/
+void site_close(site_index *index);
+/******************************************************************************
+* Function: site_complete                                                     *
+* -----------------------                                                     *
+*   Finds sites for what has been typed so far. Names starting with it come   *
+*   first, in order, then names within a few edits of it, closest first.      *
+*                                                                             *
+*   index: Pointer to the index.                                              *
+*   text: What has been typed.                                                *
+*   matches: Array where the sites are stored.                                *
+*   max: Size of the array.                                                   *
+*                                                                             *
+*   Returns: Number of sites stored.                                          *
+*            E_STATION when text does not fit in a key.                       *
+******************************************************************************/
+int site_complete(const site_index *index, const char *text, site *matches,
+		int max);
+/******************************************************************************
+* Function: site_resolve                                                      *
+* ----------------------                                                      *
+*   Finds the one site meant by a name: the site of that name, else the only  *
+*   site whose name starts with it, else the only site closest to it within   *
+*   a few edits.                                                              *
+*                                                                             *
+*   index: Pointer to the index.                                              *
+*   text: The name.                                                           *
+*   match: Where the site is stored.                                          *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_STATION when no site or more than one site is meant.           *
+******************************************************************************/
+int site_resolve(const site_index *index, const char *text, site *match);
+/*****************************************************************************/
+#endif /* SITES_H */
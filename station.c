@@ -0,0 +1,137 @@
+/******************************************************************************
+*     File Name           :     station.c                                     *
+*     Description         :     Process-wide table interning station names.   *
+******************************************************************************/
+#include <pthread.h>            // pthread_mutex_t
+#include <stdint.h>             // uint32_t
+#include "station.h"
+/*****************************************************************************/
+typedef struct name {
+	const char *name;			// '\0' terminated copy in the arena.
+	int len;					// Length of the name.
+	uint32_t hash;				// Hash of the name, kept for growing.
+} name;
+/*****************************************************************************/
+static struct {
+	pthread_mutex_t lock;		// Held while interning.
+	nx_json_arena arena;		// Holds the names.
+	int *slots;					// Open addressed ids plus one, 0 when empty.
+	int slots_cap;				// Size of slots, a power of two.
+	name *pages[STATION_PAGES];	// Names indexed by id, in pages that never move.
+	int names_len;				// Number of names, read without the lock.
+} table = {PTHREAD_MUTEX_INITIALIZER};
+#define NAME(id) (&table.pages[(id) >> STATION_PAGE_BITS] \
+		[(id) & ((1 << STATION_PAGE_BITS)-1)])
+/*****************************************************************************/
+static uint32_t hash_name(const char *name, int len) {
+	uint32_t hash = 2166136261u;
+	int i;
+	for(i = 0; i < len; i++) {
+		hash = (hash ^ (unsigned char)name[i])*16777619u;
+	}
+	return hash;
+}
+/*****************************************************************************/
+static int *find_slot(int *slots, int cap, const char *name, int len,
+		uint32_t hash) {
+	/* Slot of the name, or the empty slot where it belongs */
+	unsigned mask = cap-1, i = hash & mask;
+	const struct name *n;
+	for(; slots[i]; i = (i+1) & mask) {
+		n = NAME(slots[i]-1);
+		if(n->hash == hash && n->len == len && !memcmp(n->name, name, len)) {
+			break;
+		}
+	}
+	return &slots[i];
+}
+/*****************************************************************************/
+static int grow_table(void) {
+	/* Kept at most half full */
+	int i, new_cap = table.slots_cap ? table.slots_cap*2 : STATION_TABLE;
+	int *new_slots = calloc(new_cap, sizeof(int));
+	metrics_alloc(1);
+	if(!new_slots) {
+		return E_UNKNOWN;
+	}
+	if(!table.slots) {
+		nx_json_arena_init(&table.arena, 0);
+	}
+	for(i = 0; i < table.names_len; i++) {
+		*find_slot(new_slots, new_cap, NAME(i)->name, NAME(i)->len,
+				NAME(i)->hash) = i+1;
+	}
+	free(table.slots);
+	table.slots = new_slots;
+	table.slots_cap = new_cap;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int intern(const char *name, int len) {
+	uint32_t hash = hash_name(name, len);
+	int id = table.names_len, page = id >> STATION_PAGE_BITS;
+	struct name *n;
+	char *copy;
+	int *slot;
+	if(id*2 >= table.slots_cap && grow_table()) {
+		return E_UNKNOWN;
+	}
+	slot = find_slot(table.slots, table.slots_cap, name, len, hash);
+	if(*slot) {
+		return *slot-1;
+	}
+	if(page >= STATION_PAGES) {
+		return E_UNKNOWN;
+	}
+	if(!table.pages[page]) {
+		metrics_alloc(1);
+		if(!(table.pages[page] = malloc(sizeof(struct name) << STATION_PAGE_BITS))) {
+			return E_UNKNOWN;
+		}
+	}
+	if(!(copy = nx_json_arena_alloc(&table.arena, len+1))) {
+		return E_UNKNOWN;
+	}
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+	n = NAME(id);
+	n->name = copy;
+	n->len = len;
+	n->hash = hash;
+	*slot = id+1;
+	/* The name is complete before any thread can see the new count */
+	__atomic_store_n(&table.names_len, id+1, __ATOMIC_RELEASE);
+	return id;
+}
+/*****************************************************************************/
+int station_intern(const char *name, int len) {
+	int id;
+	pthread_mutex_lock(&table.lock);
+	id = intern(name, len);
+	pthread_mutex_unlock(&table.lock);
+	return id;
+}
+/*****************************************************************************/
+const char *station_name(int id) {
+	return id >= 0 && id < station_count() ? NAME(id)->name : NULL;
+}
+/*****************************************************************************/
+int station_count(void) {
+	return __atomic_load_n(&table.names_len, __ATOMIC_ACQUIRE);
+}
+/*****************************************************************************/
+void station_table_free(void) {
+	int i;
+	if(table.slots) {
+		nx_json_arena_destroy(&table.arena);
+	}
+	free(table.slots);
+	for(i = 0; i < STATION_PAGES; i++) {
+		free(table.pages[i]);
+		table.pages[i] = NULL;
+	}
+	table.slots = NULL;
+	table.slots_cap = 0;
+	table.names_len = 0;
+}
+/*****************************************************************************/
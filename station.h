@@ -0,0 +1,52 @@
+/******************************************************************************
+*     File Name           :     station.h                                     *
+*     Description         :     Process-wide table interning station names.   *
+******************************************************************************/
+#ifndef STATION_H
+#define STATION_H
+#include "tsl.h"                // error numbers
+/*****************************************************************************/
+#define STATION_TABLE 256 		// Initial number of slots of the table
+#define STATION_PAGE_BITS 10 	// Names per page of the table as bits
+#define STATION_PAGES 4096 		// Most pages, 4M names
+/******************************************************************************
+* Function: station_intern                                                    *
+* ------------------------                                                    *
+*   Looks up a station name, adding it the first time it is seen. Every       *
+*   distinct name gets a small id that stays the same for the life of the     *
+*   process, so stations of different queries compare as integers. Names      *
+*   are copied into an arena and never move. Threads may intern at the same   *
+*   time, and look up names without waiting for each other.                   *
+*                                                                             *
+*   name: Name of the station, need not be '\0' terminated.                   *
+*   len: Length of the name.                                                  *
+*                                                                             *
+*   Returns: Id of the name, counting from 0.                                 *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int station_intern(const char *name, int len);
+/******************************************************************************
+* Function: station_name                                                      *
+* ----------------------                                                      *
+*   Gets the name of an interned station.                                     *
+*                                                                             *
+*   id: Id returned by station_intern.                                        *
+*                                                                             *
+*   Returns: The '\0' terminated name, valid until station_table_free.        *
+*            NULL when no station has the id.                                 *
+******************************************************************************/
+const char *station_name(int id);
+/******************************************************************************
+* Function: station_count                                                     *
+* -----------------------                                                     *
+*   Returns: Number of names interned so far, one more than the largest id.   *
+******************************************************************************/
+int station_count(void);
+/******************************************************************************
+* Function: station_table_free                                                *
+* ----------------------------                                                *
+*   Frees every interned name. Ids handed out before are not valid after.     *
+******************************************************************************/
+void station_table_free(void);
+/*****************************************************************************/
+#endif /* STATION_H */
@@ -0,0 +1,227 @@
+/******************************************************************************
+*     File Name           :     diff_json.c                                   *
+*     Description         :     Parses random documents with every scan mode  *
+*                                 of nxjson and fails when a mode disagrees   *
+*                                 with the byte parser.                       *
+******************************************************************************/
+#define NX_JSON_REPORT_ERROR(msg, p) ((void)(p))	// Most documents are bad
+#include "../nxjson/nxjson.c"
+/*****************************************************************************/
+#define DIFF_DOCS 20000 		// Documents generated by default
+#define DIFF_TEXT 4096 			// Longest document, with its '\0'
+#define DIFF_DEPTH 6 			// Deepest nesting generated
+/*****************************************************************************/
+/* Scan modes compared with the byte parser */
+static const struct {nx_json_scan mode; const char *name;} modes[] = {
+	{NX_JSON_SCAN_SCALAR, "scalar"},
+#if defined(__x86_64__) || defined(__i386__)
+	{NX_JSON_SCAN_SSE, "sse"},
+	{NX_JSON_SCAN_AVX2, "avx2"},
+#endif
+};
+/* Documents that once differed, checked before the random ones */
+static const char *known[] = {
+	"{\"r\":[]\f}",
+	"{\"r\":[414\f,true\v,\"s\"]}",
+	"{\"a\":falsee}",
+	"[1e]",
+	"[0x1\\, 2]",
+	", {}",
+	"[0false]",
+	"{\"k\":}",
+	"{\"k\": }",
+};
+/* Bytes put between tokens, every control char among them */
+static const char spaces[] = " \t\n\r\f\v\b\x01\x1f";
+/*****************************************************************************/
+typedef struct text {char data[DIFF_TEXT]; int len;} text;
+/*****************************************************************************/
+static void put(text *t, const char *s, int len) {
+	if(t->len+len < DIFF_TEXT-1) {
+		memcpy(t->data+t->len, s, len);
+		t->len += len;
+	}
+}
+/*****************************************************************************/
+static void space(text *t) {
+	/* Mostly nothing or plain spaces, so blocks line up every which way */
+	int n = rand()%8 < 5 ? 0 : rand()%4+1;
+	while(n--) {
+		put(t, rand()%3 ? " " : &spaces[rand()%(sizeof(spaces)-1)], 1);
+	}
+}
+/*****************************************************************************/
+static void string(text *t) {
+	static const char *parts[] = {"a", "bc", "\\\"", "\\\\", "\\n", "\\u00e5",
+			"\\ud83d\\ude00", "/", "{", "]", ":", ",", " ", "\t", "\x01", "x"};
+	int n = rand()%12;
+	put(t, "\"", 1);
+	while(n--) {
+		const char *p = parts[rand()%(sizeof(parts)/sizeof(*parts))];
+		put(t, p, strlen(p));
+	}
+	put(t, "\"", 1);
+}
+/*****************************************************************************/
+static void value(text *t, int depth) {
+	static const char *scalars[] = {"0", "-12", "414", "3.25", "1e3", "true",
+			"false", "null", "0x1f"};
+	int i, n, kind = rand()%(depth < DIFF_DEPTH ? 5 : 3);
+	space(t);
+	if(kind == 0) {
+		string(t);
+	} else if(kind < 3) {
+		const char *s = scalars[rand()%(sizeof(scalars)/sizeof(*scalars))];
+		put(t, s, strlen(s));
+	} else {
+		put(t, kind == 3 ? "[" : "{", 1);
+		for(i = 0, n = rand()%6; i < n; i++) {
+			if(i) {
+				space(t);
+				put(t, ",", 1);
+			}
+			if(kind == 4) {
+				space(t);
+				string(t);
+				space(t);
+				put(t, ":", 1);
+			}
+			value(t, depth+1);
+		}
+		space(t);
+		put(t, kind == 3 ? "]" : "}", 1);
+	}
+	space(t);
+}
+/*****************************************************************************/
+static void mutate(text *t) {
+	/* A byte dropped, changed or doubled, to reach the error paths */
+	int at = rand()%(t->len+1);
+	switch(rand()%3) {
+		case 0:
+			if(at < t->len) {
+				memmove(t->data+at, t->data+at+1, t->len-at-1);
+				t->len--;
+			}
+			break;
+		case 1:
+			if(at < t->len) {
+				t->data[at] = "{}[]:,\"\\/ \f\v0"[rand()%14];
+			}
+			break;
+		default:
+			if(at < t->len && t->len < DIFF_TEXT-1) {
+				memmove(t->data+at+1, t->data+at, t->len-at);
+				t->len++;
+			}
+			break;
+	}
+}
+/*****************************************************************************/
+static void dump(FILE *out, const nx_json *js) {
+	/* Everything a caller can see of a tree */
+	const nx_json *c;
+	if(!js) {
+		fputs("NULL", out);
+		return;
+	}
+	fprintf(out, "<%d %s>", js->type, js->key ? js->key : "");
+	switch(js->type) {
+		case NX_JSON_STRING:
+			fprintf(out, "%s", js->text_value);
+			break;
+		case NX_JSON_INTEGER:
+		case NX_JSON_DOUBLE:
+		case NX_JSON_BOOL:
+			fprintf(out, "%lld %.17g", (long long)js->int_value, js->dbl_value);
+			break;
+		case NX_JSON_OBJECT:
+		case NX_JSON_ARRAY:
+			fprintf(out, "%d(", js->length);
+			for(c = js->child; c; c = c->next) {
+				dump(out, c);
+			}
+			fputs(")", out);
+			break;
+		default:
+			break;
+	}
+}
+/*****************************************************************************/
+static int supported(nx_json_scan mode) {
+#if defined(__x86_64__) || defined(__i386__)
+	if(mode == NX_JSON_SCAN_SSE) {
+		return __builtin_cpu_supports("sse4.2");
+	} else if(mode == NX_JSON_SCAN_AVX2) {
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+	return 1;
+}
+/*****************************************************************************/
+static char *parse(const text *t, nx_json_scan mode, nx_json_arena *arena,
+		size_t *len) {
+	/* Parsed from a copy, as the parser writes into the text. An arena is
+	 * kept over every document, so its index buffer is reused */
+	char copy[DIFF_TEXT], *printed = NULL;
+	const nx_json *js;
+	FILE *out;
+	memcpy(copy, t->data, t->len);
+	copy[t->len] = '\0';
+	nx_json_scan_mode = mode;
+	js = arena ? nx_json_parse_arena(copy, nx_json_unicode_to_utf8, arena)
+			: nx_json_parse_utf8(copy);
+	if(!(out = open_memstream(&printed, len))) {
+		exit(2);
+	}
+	dump(out, js);
+	fclose(out);
+	if(arena) {
+		nx_json_arena_reset(arena);
+	} else if(js) {
+		nx_json_free(js);
+	}
+	return printed;
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	int i, m, docs = argc > 1 ? atoi(argv[1]) : DIFF_DOCS, failed = 0;
+	unsigned seed = argc > 2 ? atoi(argv[2]) : 1;
+	char *expected, *got;
+	size_t len, got_len;
+	nx_json_arena arena;
+	text t;
+	srand(seed);
+	nx_json_arena_init(&arena, 0);
+	for(i = 0; i < docs; i++) {
+		t.len = 0;
+		if(i < (int)(sizeof(known)/sizeof(*known))) {
+			put(&t, known[i], strlen(known[i]));
+		} else {
+			value(&t, 0);
+			if(rand()%4 == 0) {
+				mutate(&t);
+			}
+		}
+		expected = parse(&t, NX_JSON_SCAN_BYTES, NULL, &len);
+		for(m = 0; m < (int)(sizeof(modes)/sizeof(*modes))*2; m++) {
+			int mode = m/2;
+			if(!supported(modes[mode].mode)) {
+				continue;
+			}
+			got = parse(&t, modes[mode].mode, m%2 ? &arena : NULL, &got_len);
+			if(got_len != len || memcmp(got, expected, len)) {
+				if(failed++ < 10) {
+					fprintf(stderr, "diff_json: %s%s differs on %.*s\n",
+							modes[mode].name, m%2 ? " in an arena" : "",
+							t.len, t.data);
+				}
+			}
+			free(got);
+		}
+		free(expected);
+	}
+	nx_json_arena_destroy(&arena);
+	printf("diff_json: %d documents, %d differences\n", docs, failed);
+	return failed != 0;
+}
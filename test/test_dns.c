@@ -0,0 +1,269 @@
+/******************************************************************************
+*     File Name           :     test_dns.c                                    *
+*     Description         :     Resolves names from a hosts file and a stub   *
+*                                 name server, and races a connect that hangs *
+*                                 against one that works in the epoll batch.  *
+******************************************************************************/
+#include <errno.h>              // errno
+#include <pthread.h>            // pthread_create
+#include <time.h>               // clock_gettime
+#include "../tsl.h"             // dns_resolve, tsl_config
+#include "../batch.h"           // run_batch
+/*****************************************************************************/
+#define TEST_IP "127.0.0.1" 	// Address of the stubs
+#define TEST_HANG "127.0.0.2" 	// Address whose connects never finish
+#define TEST_TTL 60 			// ttl of the records of the stub
+#define TEST_BODY "{\"TripList\":{}}"	// Body the http stub answers with
+#define TEST_LIMIT 20 			// s before a hanging test is killed
+/*****************************************************************************/
+/* Records of the stub name server, a name without any is answered NXDOMAIN */
+static const struct {const char *name; const char *a[2]; const char *aaaa[2];
+		int drop;} records[] = {
+	{"both.test", {"10.0.0.1", "10.0.0.2"}, {"::2"}, 0},
+	{"v4.test", {"10.0.0.3"}, {NULL}, 0},
+	{"drop.test", {"10.0.0.4"}, {NULL}, 1},
+};
+static int queries;				// Queries the stub has seen.
+static int failed;				// Checks that failed.
+/*****************************************************************************/
+static void check(int ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	failed += !ok;
+}
+/*****************************************************************************/
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+/*****************************************************************************/
+static int seen(void) {
+	return __atomic_load_n(&queries, __ATOMIC_SEQ_CST);
+}
+/*****************************************************************************/
+static int add_record(unsigned char *p, int type, const char *ip) {
+	/* Every record names the question by a pointer to it */
+	int len = type == 1 ? 4 : 16;
+	p[0] = 0xc0;
+	p[1] = 12;
+	p[2] = 0;
+	p[3] = type;
+	p[4] = 0;
+	p[5] = 1;
+	p[6] = p[7] = p[8] = 0;
+	p[9] = TEST_TTL;
+	p[10] = 0;
+	p[11] = len;
+	inet_pton(type == 1 ? AF_INET : AF_INET6, ip, p+12);
+	return 12+len;
+}
+/*****************************************************************************/
+static void *name_server(void *arg) {
+	/* Answers A and AAAA questions from records, led by a CNAME of the
+	 * name to itself that the resolver has to skip */
+	unsigned char buf[1500], name[256];
+	struct sockaddr_in from;
+	socklen_t from_len;
+	int fd = *(int*)arg, i, j, n, off, len, type, count, found, drops[2] = {0};
+	while(1) {
+		from_len = sizeof(from);
+		if((n = recvfrom(fd, buf, 512, 0, (struct sockaddr*)&from,
+				&from_len)) < 12) {
+			continue;
+		}
+		__atomic_add_fetch(&queries, 1, __ATOMIC_SEQ_CST);
+		for(off = 12, len = 0; off < n && buf[off]; off += buf[off]+1) {
+			len += sprintf((char*)name+len, "%s%.*s", len ? "." : "",
+					buf[off], buf+off+1);
+		}
+		type = buf[off+2];
+		off += 5;
+		for(i = 0, found = -1; i < (int)(sizeof(records)/sizeof(*records)); i++) {
+			if(!strcmp((char*)name, records[i].name)) {
+				found = i;
+			}
+		}
+		if(found >= 0 && records[found].drop && drops[type == 1]++ == 0) {
+			continue;
+		}
+		count = 0;
+		if(found >= 0) {
+			memcpy(buf+off, "\xc0\x0c\x00\x05\x00\x01\x00\x00\x00\x3c\x00\x02"
+					"\xc0\x0c", 14);
+			off += 14;
+			count++;
+			for(j = 0; j < 2; j++) {
+				const char *ip = type == 1 ? records[found].a[j]
+						: records[found].aaaa[j];
+				if(ip) {
+					off += add_record(buf+off, type, ip);
+					count++;
+				}
+			}
+		}
+		buf[2] = 0x81;
+		buf[3] = found >= 0 ? 0x80 : 0x83;
+		buf[6] = 0;
+		buf[7] = count;
+		sendto(fd, buf, off, 0, (struct sockaddr*)&from, from_len);
+	}
+	return NULL;
+}
+/*****************************************************************************/
+static void *web_server(void *arg) {
+	/* One response per connection */
+	static const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: "
+			"15\r\nConnection: close\r\n\r\n" TEST_BODY;
+	char buf[4096];
+	int listen_fd = *(int*)arg, fd, n, got;
+	while((fd = accept(listen_fd, NULL, NULL)) >= 0 || errno == EINTR) {
+		for(got = 0; fd >= 0 && (n = read(fd, buf+got, sizeof(buf)-got-1)) > 0;) {
+			got += n;
+			buf[got] = '\0';
+			if(strstr(buf, "\r\n\r\n")) {
+				send(fd, response, sizeof(response)-1, MSG_NOSIGNAL);
+				break;
+			}
+		}
+		if(fd >= 0) {
+			close(fd);
+		}
+	}
+	return NULL;
+}
+/*****************************************************************************/
+static int open_socket(int type, const char *ip, int port, int backlog) {
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET, type, 0), on = 1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(ip);
+	addr.sin_port = htons(port);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr))
+			|| (type == SOCK_STREAM && listen(fd, backlog))) {
+		perror("test_dns: bind");
+		exit(2);
+	}
+	return fd;
+}
+/*****************************************************************************/
+static int port_of(int fd) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	getsockname(fd, (struct sockaddr*)&addr, &len);
+	return ntohs(addr.sin_port);
+}
+/*****************************************************************************/
+static int is_addr(const dns_addr *a, const char *ip, int port) {
+	char text[INET6_ADDRSTRLEN];
+	if(a->u.sa.sa_family == AF_INET6) {
+		inet_ntop(AF_INET6, &a->u.in6.sin6_addr, text, sizeof(text));
+		return !strcmp(text, ip) && ntohs(a->u.in6.sin6_port) == port;
+	}
+	inet_ntop(AF_INET, &a->u.in.sin_addr, text, sizeof(text));
+	return !strcmp(text, ip) && ntohs(a->u.in.sin_port) == port;
+}
+/*****************************************************************************/
+static void fill_backlog(int port) {
+	/* A listener that does not accept drops the handshakes past its
+	 * backlog, so later connects neither finish nor fail for a second */
+	struct sockaddr_in addr;
+	int i, fd;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(TEST_HANG);
+	addr.sin_port = htons(port);
+	for(i = 0; i < 4; i++) {
+		if((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) >= 0) {
+			connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+		}
+	}
+	usleep(100000);
+}
+/*****************************************************************************/
+static void on_result(void *arg, const query *q, char *js, int len,
+		tsl_timing *t) {
+	*(int*)arg = js && len == (int)strlen(TEST_BODY)
+			&& !memcmp(js, TEST_BODY, len);
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	char dir[] = "/tmp/test_dns.XXXXXX", hosts[64], server[32];
+	query q = {"Duvbo", "Slussen"};
+	tsl_config config;
+	dns_answer a;
+	pthread_t thread;
+	int dns_fd, web_fd, hang_fd, port, before, ok = 0;
+	double start;
+	FILE *f;
+
+	alarm(TEST_LIMIT);
+	dns_fd = open_socket(SOCK_DGRAM, TEST_IP, 0, 0);
+	web_fd = open_socket(SOCK_STREAM, TEST_IP, 0, 16);
+	port = port_of(web_fd);
+	hang_fd = open_socket(SOCK_STREAM, TEST_HANG, port, 0);
+	pthread_create(&thread, NULL, name_server, &dns_fd);
+	pthread_create(&thread, NULL, web_server, &web_fd);
+	if(!mkdtemp(dir)) {
+		return 2;
+	}
+	snprintf(hosts, sizeof(hosts), "%s/hosts", dir);
+	snprintf(server, sizeof(server), "%s:%d", TEST_IP, port_of(dns_fd));
+	if(!(f = fopen(hosts, "w"))) {
+		return 2;
+	}
+	fprintf(f, "# 127.0.0.9 hosts.test\n127.0.0.5 hosts.test alias.test\n"
+			"::1\tHOSTS.test\n%s eyeballs.test\n%s eyeballs.test\n",
+			TEST_HANG, TEST_IP);
+	fclose(f);
+	tsl_config_init(&config);
+	config.dns.hosts = hosts;
+	config.dns.nameserver = server;
+
+	/* The hosts file is read before any name server */
+	check(!dns_resolve("hosts.test", 80, &config.dns, &a) && a.len == 2
+			&& is_addr(&a.addrs[0], "127.0.0.5", 80)
+			&& is_addr(&a.addrs[1], "::1", 80), "hosts file, every line");
+	check(!dns_resolve("ALIAS.test", 81, &config.dns, &a) && a.len == 1
+			&& is_addr(&a.addrs[0], "127.0.0.5", 81), "hosts file, alias");
+	check(!dns_resolve("10.1.2.3", 82, &config.dns, &a) && a.len == 1
+			&& is_addr(&a.addrs[0], "10.1.2.3", 82), "address");
+	check(seen() == 0, "no queries for the hosts file");
+
+	/* Families interleaved from IPv6, and cached with their ttl */
+	check(!dns_resolve("both.test", 80, &config.dns, &a) && a.len == 3
+			&& is_addr(&a.addrs[0], "::2", 80)
+			&& is_addr(&a.addrs[1], "10.0.0.1", 80)
+			&& is_addr(&a.addrs[2], "10.0.0.2", 80), "name server");
+	before = seen();
+	check(!dns_resolve("both.test", 443, &config.dns, &a) && a.len == 3
+			&& is_addr(&a.addrs[2], "10.0.0.2", 443) && seen() == before,
+			"cached, port of the lookup");
+	check(!dns_resolve("v4.test", 80, &config.dns, &a) && a.len == 1
+			&& is_addr(&a.addrs[0], "10.0.0.3", 80), "empty AAAA answer");
+	check(dns_resolve("missing.test", 80, &config.dns, &a) == E_RESOLVE,
+			"NXDOMAIN");
+	before = seen();
+	check(dns_resolve("missing.test", 80, &config.dns, &a) == E_RESOLVE
+			&& seen() == before, "failure cached");
+	check(!dns_resolve("drop.test", 80, &config.dns, &a) && a.len == 1
+			&& is_addr(&a.addrs[0], "10.0.0.4", 80), "lost query sent again");
+
+	/* The first address hangs, the second is started after DNS_HAPPY ms
+	 * and wins long before the handshake of the first is sent again */
+	fill_backlog(port);
+	config.server = "eyeballs.test";
+	config.port = port;
+	config.host = "eyeballs.test";
+	config.key = "";
+	start = now();
+	check(run_batch(&q, 1, &config, 1, on_result, &ok) == 0 && ok,
+			"batch connects to the second address");
+	check(now()-start < 0.9, "batch does not wait for the first address");
+	printf("test_dns: %d failed\n", failed);
+	close(hang_fd);
+	unlink(hosts);
+	rmdir(dir);
+	return failed != 0;
+}
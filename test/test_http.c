@@ -0,0 +1,183 @@
+/******************************************************************************
+*     File Name           :     test_http.c                                   *
+*     Description         :     Feeds responses to the http parser split at   *
+*                                 every offset, with and without reading the  *
+*                                 body in place, and checks what it decodes.  *
+******************************************************************************/
+#include "../tsl.h"             // http_parser, tsl_buf
+/*****************************************************************************/
+#define TEST_GZIP_SIZE 50000 	// Bytes of the body that is compressed
+#define TEST_CLAIM "1000000000" // Content-Length far past what is sent
+/*****************************************************************************/
+static int failed;				// Checks that failed.
+/*****************************************************************************/
+static void check(int ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	failed += !ok;
+}
+/*****************************************************************************/
+static int run(http_parser *p, tsl_buf *body, const char *data, int len,
+		int step, int direct, int eof) {
+	/* Gives the parser step bytes at a time, body bytes straight into the
+	 * buffer when direct, the way the readers do */
+	char *dst;
+	int n, space, retval = 0;
+	http_parser_init(p, body);
+	while(len > 0 && retval == 0) {
+		if((space = direct ? http_parser_space(p, &dst) : 0) < 0) {
+			retval = space;
+		} else if(space > 0) {
+			n = space < step ? space : step;
+			n = n < len ? n : len;
+			memcpy(dst, data, n);
+			retval = http_parser_commit(p, n);
+		} else {
+			n = step < len ? step : len;
+			retval = http_parser_feed(p, data, n);
+		}
+		data += n;
+		len -= n;
+	}
+	if(retval == 0 && eof) {
+		retval = http_parser_eof(p);
+	}
+	http_parser_free(p);
+	return retval;
+}
+/*****************************************************************************/
+static int decodes(const char *response, int len, const char *expected,
+		int expected_len, int eof) {
+	/* The same body whatever the reads are split at */
+	http_parser p;
+	tsl_buf body;
+	int step, direct, ok = 1;
+	buf_init(&body);
+	for(step = 1; step <= len && ok; step++) {
+		for(direct = 0; direct < 2 && ok; direct++) {
+			ok = run(&p, &body, response, len, step, direct, eof) == 1
+					&& body.len == expected_len
+					&& !memcmp(body.data, expected, expected_len)
+					&& body.data[body.len] == '\0';
+			if(!ok) {
+				fprintf(stderr, "test_http: split every %d bytes%s\n", step,
+						direct ? ", body in place" : "");
+			}
+		}
+	}
+	buf_free(&body);
+	return ok;
+}
+/*****************************************************************************/
+static int fails(const char *response, int eof) {
+	/* Error of the response, fed in one piece */
+	http_parser p;
+	tsl_buf body;
+	int retval;
+	buf_init(&body);
+	retval = run(&p, &body, response, strlen(response), strlen(response), 1,
+			eof);
+	buf_free(&body);
+	return retval;
+}
+/*****************************************************************************/
+static int gzip(const char *data, int len, char *out, int cap) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if(deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 16+MAX_WBITS, 8,
+			Z_DEFAULT_STRATEGY) != Z_OK) {
+		exit(2);
+	}
+	zs.next_in = (Bytef*)data;
+	zs.avail_in = len;
+	zs.next_out = (Bytef*)out;
+	zs.avail_out = cap;
+	if(deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		exit(2);
+	}
+	deflateEnd(&zs);
+	return cap-zs.avail_out;
+}
+/*****************************************************************************/
+static int chunked(char *out, const char *data, int len, int size,
+		const char *trailer) {
+	/* data as chunks of size bytes, sizes in upper case hex with an
+	 * extension now and then */
+	int i, n = 0;
+	for(i = 0; i < len; i += size) {
+		int take = len-i < size ? len-i : size;
+		n += sprintf(out+n, "%X%s\r\n", take, i%(3*size) ? "" : ";x=1");
+		memcpy(out+n, data+i, take);
+		n += take;
+		n += sprintf(out+n, "\r\n");
+	}
+	return n+sprintf(out+n, "0\r\n%s\r\n", trailer);
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	static const char text[] = "{\"TripList\":{\"Trip\":[]}}";
+	static char plain[TEST_GZIP_SIZE], packed[TEST_GZIP_SIZE],
+			response[4*TEST_GZIP_SIZE];
+	http_parser p;
+	tsl_buf body;
+	int i, n, len;
+
+	/* Framed by length, by chunks and by the close */
+	len = sprintf(response, "HTTP/1.1 200 OK\r\nContent-Length:  %d \r\n"
+			"ETag: \"e1\"\r\n\r\n%s", (int)strlen(text), text);
+	check(decodes(response, len, text, strlen(text), 0), "content-length");
+	len = sprintf(response, "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\n"
+			"Transfer-Encoding: chunked\r\n\r\n");
+	len += chunked(response+len, text, strlen(text), 7, "X-Trailer: 1\r\n"
+			"X-Other: 2\r\n");
+	check(decodes(response, len, text, strlen(text), 0),
+			"chunked, sizes split between reads, trailers");
+	len = sprintf(response, "HTTP/1.0 200 OK\r\n\r\n%s", text);
+	check(decodes(response, len, text, strlen(text), 1), "read to the close");
+	len = sprintf(response, "HTTP/1.1 304 Not Modified\r\nContent-Length: "
+			"12\r\n\r\n");
+	check(decodes(response, len, "", 0, 0), "not modified has no body");
+
+	/* Compressed whole and in chunks */
+	for(i = 0; i < TEST_GZIP_SIZE; i++) {
+		plain[i] = "abcdefghij0123456789{}[],:\""[(i*7+i/13)%27];
+	}
+	n = gzip(plain, TEST_GZIP_SIZE, packed, sizeof(packed));
+	len = sprintf(response, "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\n"
+			"Content-Length: %d\r\n\r\n", n);
+	memcpy(response+len, packed, n);
+	check(decodes(response, len+n, plain, TEST_GZIP_SIZE, 0), "gzip");
+	len = sprintf(response, "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\n"
+			"Transfer-Encoding: chunked\r\n\r\n");
+	len += chunked(response+len, packed, n, 1000, "");
+	check(decodes(response, len, plain, TEST_GZIP_SIZE, 0), "chunked gzip");
+	len = sprintf(response, "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\n"
+			"\r\n");
+	memcpy(response+len, packed, n/2);
+	buf_init(&body);
+	check(run(&p, &body, response, len+n/2, len+n/2, 0, 1) == E_PROTOCOL,
+			"gzip cut short");
+
+	/* Lengths that would leave the body without an end */
+	check(fails("HTTP/1.1 200 OK\r\nContent-Length: -1\r\n\r\nabc", 0)
+			== E_PROTOCOL, "negative content-length");
+	check(fails("HTTP/1.1 200 OK\r\nContent-Length: 12abc\r\n\r\n", 0)
+			== E_PROTOCOL, "malformed content-length");
+	check(fails("HTTP/1.1 200 OK\r\nContent-Length:\r\n\r\n", 0)
+			== E_PROTOCOL, "empty content-length");
+	check(fails("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+			"zz\r\n", 0) == E_PROTOCOL, "malformed chunk size");
+	check(fails("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+			"5\r\nab", 1) == E_RECEIVE, "chunk cut short");
+
+	/* A length claimed is not reserved before the bytes arrive, read in
+	 * place after the headers */
+	len = sprintf(response, "HTTP/1.1 200 OK\r\nContent-Length: " TEST_CLAIM
+			"\r\n\r\n%s", text);
+	n = len-strlen(text);
+	check(run(&p, &body, response, len, n, 1, 0) == 0
+			&& body.len == (int)strlen(text) && body.cap <= 2*RESPONSE_SIZE,
+			"claimed length not reserved");
+	buf_free(&body);
+	printf("test_http: %d failed\n", failed);
+	return failed != 0;
+}
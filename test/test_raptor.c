@@ -0,0 +1,92 @@
+/******************************************************************************
+*     File Name           :     test_raptor.c                                 *
+*     Description         :     Imports a small feed with known journeys and  *
+*                                 checks what the timetable finds in it.      *
+******************************************************************************/
+#include "../tsl.h"             // E_TIMETABLE
+#include "../timetable.h"       // timetable_import, timetable_query
+/*****************************************************************************/
+#define TEST_FEED "test/gtfs" 	// Feed used without an argument
+/*****************************************************************************/
+/* Journeys of the feed: a bus to Berga and another from its other platform,
+ * a slower direct train, and the buses again every half hour */
+#define TRAIN_0805 "(45 min)\n" \
+	"  [Alby : 08:05] ---{tåg 3}---> [Centrum : 08:50]\n"
+#define BUSES(dep, arr, walk, board, dest, dur) "(" dur " min)\n" \
+	"  [Alby : " dep "] ---{buss 1}---> [Berga : " arr "]\n" \
+	"  [Berga : " arr "] ---{Gång}---> [Berga : " walk "]\n" \
+	"  [Berga : " board "] ---{buss 2}---> [Centrum : " dest "]\n"
+#define BUSES_0800 BUSES("08:00", "08:10", "08:12", "08:15", "08:25", "25")
+#define BUSES_0830 BUSES("08:30", "08:40", "08:42", "08:45", "08:55", "25")
+#define BUSES_0900 BUSES("09:00", "09:10", "09:12", "09:15", "09:25", "25")
+/*****************************************************************************/
+static int failed;				// Checks that failed.
+/*****************************************************************************/
+static void check(int ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	failed += !ok;
+}
+/*****************************************************************************/
+static int finds(timetable *tt, const char *origin, const char *dest,
+		int when, int expected_len, const char *expected) {
+	/* The journeys as tsl prints them */
+	triplist tl;
+	tsl_buf strings;
+	char *printed = NULL;
+	size_t len;
+	FILE *out;
+	int n, ok;
+	triplist_init(&tl);
+	buf_init(&strings);
+	n = timetable_query(tt, origin, dest, when, &tl, &strings);
+	if(!(out = open_memstream(&printed, &len))) {
+		exit(2);
+	}
+	if(n > 0) {
+		print_triplist(out, strings.data, &tl);
+	}
+	fclose(out);
+	ok = n == expected_len && (!expected || !strcmp(printed, expected));
+	if(!ok) {
+		fprintf(stderr, "test_raptor: %s -> %s gave %d\n%s", origin, dest, n,
+				printed);
+	}
+	free(printed);
+	triplist_free(&tl);
+	buf_free(&strings);
+	return ok;
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	char path[] = "/tmp/test_raptor.XXXXXX";
+	timetable *tt;
+	int fd;
+
+	if((fd = mkstemp(path)) < 0) {
+		return 2;
+	}
+	close(fd);
+	if(timetable_import(argc > 1 ? argv[1] : TEST_FEED, path)
+			|| !(tt = timetable_open(path))) {
+		fprintf(stderr, "test_raptor: can not import the feed\n");
+		unlink(path);
+		return 2;
+	}
+	check(finds(tt, "Alby", "Centrum", 8*60, 4, TRAIN_0805 BUSES_0800
+			BUSES_0830 BUSES_0900), "transfer, direct trip with fewer legs, "
+			"later departures");
+	check(finds(tt, "Alby", "Centrum", 8*60+20, 2, BUSES_0830 BUSES_0900),
+			"trips gone are not taken");
+	check(finds(tt, "aLBY", "CENTRUM", 8*60, 4, NULL), "case is ignored");
+	check(finds(tt, "Berga", "Centrum", 8*60, 3, NULL),
+			"every stop of a name");
+	check(finds(tt, "Alby", "Island", 8*60, 0, NULL), "name without routes");
+	check(finds(tt, "Alby", "Nowhere", 8*60, E_TIMETABLE, NULL)
+			&& finds(tt, "Aaa", "Centrum", 8*60, E_TIMETABLE, NULL)
+			&& finds(tt, "Zzz", "Centrum", 8*60, E_TIMETABLE, NULL),
+			"unknown names");
+	timetable_close(tt);
+	unlink(path);
+	printf("test_raptor: %d failed\n", failed);
+	return failed != 0;
+}
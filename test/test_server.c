@@ -0,0 +1,174 @@
+/******************************************************************************
+*     File Name           :     test_server.c                                 *
+*     Description         :     Runs the server against a stub planner and    *
+*                                 sends it a batch whose answers are far more *
+*                                 than it buffers for a client at once.       *
+******************************************************************************/
+#include <errno.h>              // errno
+#include <pthread.h>            // pthread_create
+#include <sys/stat.h>           // stat
+#include "../tsl.h"             // tsl_config
+#include "../server.h"          // run_server, query_server
+/*****************************************************************************/
+#define TEST_IP "127.0.0.1" 	// Address of the stub planner
+#define TEST_QUERIES 30000 		// Queries in the batch
+#define TEST_LIMIT 20 			// s before a hanging test is killed
+#define TEST_BYTES (2<<20) 		// Least bytes of answers, past what is buffered
+/* One trip of two legs, printed as about 150 bytes */
+#define TEST_BODY "{\"TripList\":{\"Trip\":[{\"dur\":\"22\",\"chg\":\"1\"," \
+	"\"LegList\":{\"Leg\":[{\"idx\":\"0\",\"name\":\"buss 515\",\"type\":" \
+	"\"BUS\",\"Origin\":{\"name\":\"Marsta\",\"id\":\"400100777\",\"time\":" \
+	"\"08:00\",\"date\":\"2016-06-16\"},\"Destination\":{\"name\":" \
+	"\"Uppsala C\",\"id\":\"400100814\",\"time\":\"08:02\",\"date\":" \
+	"\"2016-06-16\"}},{\"idx\":\"1\",\"name\":\"pendeltag 35\",\"type\":" \
+	"\"TRAIN\",\"Origin\":{\"name\":\"Stockholm City\",\"id\":\"400100148\"," \
+	"\"time\":\"08:02\",\"date\":\"2016-06-16\"},\"Destination\":{\"name\":" \
+	"\"T-Centralen\",\"id\":\"400100185\",\"time\":\"08:18\",\"date\":" \
+	"\"2016-06-16\"}}]}}]}}"
+/*****************************************************************************/
+static int failed;				// Checks that failed.
+/*****************************************************************************/
+typedef struct server_args {
+	const char *path;
+	tsl_config config;
+	tsl_cache cache;
+	int stop_fd;				// Read end of the pipe that stops it.
+	int retval;					// What run_server returned.
+} server_args;
+/*****************************************************************************/
+static void check(int ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	failed += !ok;
+}
+/*****************************************************************************/
+static void *web_server(void *arg) {
+	/* One response per connection */
+	static char response[sizeof(TEST_BODY)+128];
+	char buf[4096];
+	int listen_fd = *(int*)arg, fd, n, got, len;
+	len = sprintf(response, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n"
+			"Connection: close\r\n\r\n%s", (int)strlen(TEST_BODY), TEST_BODY);
+	while((fd = accept(listen_fd, NULL, NULL)) >= 0 || errno == EINTR) {
+		for(got = 0; fd >= 0 && (n = read(fd, buf+got, sizeof(buf)-got-1)) > 0;) {
+			got += n;
+			buf[got] = '\0';
+			if(strstr(buf, "\r\n\r\n")) {
+				send(fd, response, len, MSG_NOSIGNAL);
+				break;
+			}
+		}
+		if(fd >= 0) {
+			close(fd);
+		}
+	}
+	return NULL;
+}
+/*****************************************************************************/
+static void *server(void *arg) {
+	server_args *a = arg;
+	a->retval = run_server(a->path, &a->config, 4, &a->cache, NULL,
+			a->stop_fd);
+	return NULL;
+}
+/*****************************************************************************/
+static int open_listener(void) {
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(TEST_IP);
+	if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr))
+			|| listen(fd, 16)) {
+		perror("test_server: bind");
+		exit(2);
+	}
+	return fd;
+}
+/*****************************************************************************/
+static int port_of(int fd) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	getsockname(fd, (struct sockaddr*)&addr, &len);
+	return ntohs(addr.sin_port);
+}
+/*****************************************************************************/
+static long count(FILE *f, const char *line) {
+	char buf[MESSAGE_SIZE];
+	long n = 0;
+	rewind(f);
+	while(fgets(buf, sizeof(buf), f)) {
+		n += !strcmp(buf, line);
+	}
+	return n;
+}
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+	char dir[] = "/tmp/test_server.XXXXXX", path[64];
+	static query queries[TEST_QUERIES];
+	server_args args;
+	pthread_t thread, server_thread;
+	struct stat st;
+	int i, web_fd, out_fd, saved_fd, retval, stop[2];
+	long size;
+	FILE *out;
+
+	alarm(TEST_LIMIT);
+	web_fd = open_listener();
+	pthread_create(&thread, NULL, web_server, &web_fd);
+	if(!mkdtemp(dir)) {
+		return 2;
+	}
+	snprintf(path, sizeof(path), "%s/tsl.sock", dir);
+	args.path = path;
+	tsl_config_init(&args.config);
+	args.config.server = TEST_IP;
+	args.config.port = port_of(web_fd);
+	args.config.host = TEST_IP;
+	args.config.key = "";
+	cache_init(&args.cache, NULL);
+	if(pipe(stop)) {
+		return 2;
+	}
+	args.stop_fd = stop[0];
+	pthread_create(&server_thread, NULL, server, &args);
+	for(i = 0; i < 200 && stat(path, &st); i++) {
+		usleep(10000);
+	}
+
+	/* The answers are read while the queries are sent, a client that only
+	 * read after sending every query would wait on a server that waits
+	 * for it to read */
+	for(i = 0; i < TEST_QUERIES; i++) {
+		queries[i].origin = "Marsta";
+		queries[i].dest = "T-Centralen";
+	}
+	if(!(out = tmpfile())) {
+		return 2;
+	}
+	fflush(stdout);
+	saved_fd = dup(STDOUT_FILENO);
+	out_fd = fileno(out);
+	dup2(out_fd, STDOUT_FILENO);
+	retval = query_server(path, queries, TEST_QUERIES, 1);
+	fflush(stdout);
+	dup2(saved_fd, STDOUT_FILENO);
+	close(saved_fd);
+	fseek(out, 0, SEEK_END);
+	size = ftell(out);
+	check(retval == 0, "every query answered");
+	check(count(out, "Marsta -> T-Centralen\n") == TEST_QUERIES,
+			"every answer printed");
+	check(size > TEST_BYTES, "answers larger than the server buffers");
+	check(count(out, "  [Marsta : 08:00] ---{buss 515}---> "
+			"[Uppsala C : 08:02]\n") == TEST_QUERIES, "answers are the trips");
+	fclose(out);
+
+	/* The caller stops the server, which removes its socket */
+	check(write(stop[1], "", 1) == 1 && !pthread_join(server_thread, NULL)
+			&& args.retval == E_SUCCESS && stat(path, &st) && errno == ENOENT,
+			"stopped by its caller");
+	printf("test_server: %d failed\n", failed);
+	unlink(path);
+	rmdir(dir);
+	return failed != 0;
+}
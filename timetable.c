@@ -0,0 +1,1300 @@
+/******************************************************************************
+*     File Name           :     timetable.c                                   *
+*     Description         :     Offline journeys over a timetable imported    *
+*                                 from a GTFS feed.                           *
+******************************************************************************/
+#define _GNU_SOURCE             // qsort_r
+#include <errno.h>              // errno, EINTR
+#include <fcntl.h>              // open
+#include <stdint.h>             // uint32_t, uint64_t, int64_t
+#include <strings.h>            // strcasecmp
+#include <sys/mman.h>           // mmap, munmap
+#include <sys/stat.h>           // fstat
+#include "timetable.h"
+#include "station.h"
+/*****************************************************************************/
+#define TT_MAGIC 0x4c545354 	// "TSTL"
+#define TT_VERSION 2
+#define TT_ALIGN 8 				// Alignment of the sections of the file
+#define TT_FIELDS 32 			// Most columns of a GTFS file that are split
+#define TT_GROUP 64 			// Most stops of a name joined by transfers
+#define TT_NONE 0x7f7f7f7f 		// Stop not reached, set with memset
+#define TT_PATH_SIZE 4096 		// Longest path of a GTFS file
+/*****************************************************************************/
+/* Sections of the file, in the order they are stored */
+enum tt_section {
+	SEC_STOPS, SEC_ROUTES, SEC_ROUTE_STOPS, SEC_STOP_ROUTES, SEC_TRANSFERS,
+	SEC_TIMES, SEC_NAMES, SEC_POOL, TT_SECTIONS
+};
+typedef struct tt_header {
+	uint32_t magic;				// TT_MAGIC.
+	uint32_t version;			// TT_VERSION.
+	int32_t len[TT_SECTIONS];	// Records in each section.
+} tt_header;
+typedef struct tt_stop {
+	int name;					// Offset of the name in the pool.
+	int routes_off, routes_len;	// Routes calling at the stop.
+	int transfers_off, transfers_len;// Stops that can be walked to.
+} tt_stop;
+typedef struct tt_route {
+	int name;					// Offset of the name in the pool.
+	int stops_off, stops_len;	// Stops in the order they are visited.
+	int trips_len;				// Trips, sorted by departure.
+	int times_off;				// Times of trip t at stop p are at
+								// times_off + t*stops_len + p.
+} tt_route;
+typedef struct tt_stop_route {int route; int pos;} tt_stop_route;
+typedef struct tt_transfer {int to; int secs;} tt_transfer;
+typedef struct tt_time {int arr; int dep;} tt_time;
+static const size_t section_size[TT_SECTIONS] = {
+	sizeof(tt_stop), sizeof(tt_route), sizeof(int), sizeof(tt_stop_route),
+	sizeof(tt_transfer), sizeof(tt_time), sizeof(int), 1
+};
+/*****************************************************************************/
+/* How a stop was reached in a round */
+enum tt_kind {KIND_COPY, KIND_SOURCE, KIND_RIDE, KIND_WALK};
+typedef struct label {
+	int from;					// Stop boarded at or walked from.
+	int route, trip, board;		// Ride from position board of the route.
+} label;
+/*****************************************************************************/
+struct timetable {
+	void *map; size_t map_len;
+	const tt_stop *stops; int stops_len;
+	const tt_route *routes; int routes_len;
+	const int *route_stops;
+	const tt_stop_route *stop_routes;
+	const tt_transfer *transfers;
+	const tt_time *times;
+	const int *names;			// Stops by name, case ignored, then index.
+	const char *pool;
+	int *stop_ids;				// Interned station id of each stop.
+	tt_search *search;			// Scratch space of timetable_query.
+};
+struct tt_search {
+	const timetable *tt;
+	int *arrival;				// Arrival at each stop in each round.
+	unsigned char *kind;		// enum tt_kind of each arrival.
+	label *labels;				// Where each arrival came from.
+	int *best;					// Earliest arrival at each stop.
+	int *marked, marked_len;	// Stops improved in the last round.
+	unsigned char *is_marked;
+	unsigned char *is_target;
+	int *sources, *targets;
+	int *first;					// First marked position of each route, -1.
+	int *touched, touched_len;	// Routes with a marked stop.
+};
+/*****************************************************************************/
+/* Feed as it is read, before it is laid out */
+typedef struct idmap {char **keys; int *vals; int cap; int len;} idmap;
+typedef struct row {int trip; int seq; int stop; int arr; int dep;} row;
+typedef struct xfer {int from; int to; int secs;} xfer;
+typedef struct trip_info {int route; int start; int len; uint32_t hash;} trip_info;
+typedef struct feed {
+	idmap stop_ids, route_ids, trip_ids;
+	char **stop_names; int stops_len, stops_cap;
+	char **route_names; int routes_len, routes_cap;
+	int *trip_routes; int trips_len, trips_cap;
+	row *rows; int rows_len, rows_cap;
+	xfer *xfers; int xfers_len, xfers_cap;
+} feed;
+/*****************************************************************************/
+static int grow(void **array, int *cap, int len, size_t size) {
+	void *new_array;
+	int new_cap;
+	if(len < *cap) {
+		return E_SUCCESS;
+	}
+	new_cap = *cap ? *cap*2 : 16;
+	metrics_alloc(1);
+	if(!(new_array = realloc(*array, new_cap*size))) {
+		return E_UNKNOWN;
+	}
+	*array = new_array;
+	*cap = new_cap;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t len) {
+	const unsigned char *p = data;
+	while(len--) {
+		hash = (hash ^ *p++)*16777619u;
+	}
+	return hash;
+}
+/*****************************************************************************/
+static int *idmap_slot(idmap *m, const char *key) {
+	unsigned mask = m->cap-1, i = hash_bytes(2166136261u, key, strlen(key)) & mask;
+	while(m->keys[i] && strcmp(m->keys[i], key)) {
+		i = (i+1) & mask;
+	}
+	return &m->vals[i];
+}
+/*****************************************************************************/
+static int idmap_get(idmap *m, const char *key) {
+	int *slot;
+	if(!m->cap) {
+		return -1;
+	}
+	slot = idmap_slot(m, key);
+	return m->keys[slot-m->vals] ? *slot : -1;
+}
+/*****************************************************************************/
+static int idmap_put(idmap *m, const char *key, int val) {
+	/* Kept at most half full, ids seen twice keep their first value */
+	idmap old = *m;
+	int i, *slot;
+	if(m->len*2 >= m->cap) {
+		m->cap = m->cap ? m->cap*2 : 1024;
+		m->keys = calloc(m->cap, sizeof(char*));
+		m->vals = calloc(m->cap, sizeof(int));
+		if(!m->keys || !m->vals) {
+			free(m->keys);
+			free(m->vals);
+			*m = old;
+			return E_UNKNOWN;
+		}
+		for(i = 0; i < old.cap; i++) {
+			if(old.keys[i]) {
+				slot = idmap_slot(m, old.keys[i]);
+				m->keys[slot-m->vals] = old.keys[i];
+				*slot = old.vals[i];
+			}
+		}
+		free(old.keys);
+		free(old.vals);
+	}
+	slot = idmap_slot(m, key);
+	if(m->keys[slot-m->vals]) {
+		return E_SUCCESS;
+	}
+	if(!(m->keys[slot-m->vals] = strdup(key))) {
+		return E_UNKNOWN;
+	}
+	*slot = val;
+	m->len++;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static void idmap_free(idmap *m) {
+	int i;
+	for(i = 0; i < m->cap; i++) {
+		free(m->keys[i]);
+	}
+	free(m->keys);
+	free(m->vals);
+}
+/*****************************************************************************/
+static int csv_split(char *line, char **fields) {
+	/* Fields are split in place, quotes are removed and "" becomes " */
+	char *p = line, *d;
+	int n = 0;
+	line[strcspn(line, "\r\n")] = '\0';
+	while(n < TT_FIELDS) {
+		fields[n++] = d = p;
+		if(*p == '"') {
+			for(p++; *p && (*p != '"' || p[1] == '"'); p++) {
+				*d++ = *p;
+				p += *p == '"';
+			}
+			p += *p == '"';
+			while(*p && *p != ',') {
+				p++;
+			}
+		} else {
+			while(*p && *p != ',') {
+				*d++ = *p++;
+			}
+		}
+		if(!*p) {
+			*d = '\0';
+			break;
+		}
+		*d = '\0';
+		p++;
+	}
+	return n;
+}
+/*****************************************************************************/
+static FILE *csv_open(const char *dir, const char *file, const char **columns,
+		int *cols, char **line, size_t *line_cap) {
+	/* Finds the position of each wanted column in the header, -1 when it
+	 * is missing */
+	char path[TT_PATH_SIZE], *fields[TT_FIELDS];
+	FILE *in;
+	int i, j, n;
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	if(!(in = fopen(path, "r"))) {
+		return NULL;
+	}
+	if(getline(line, line_cap, in) < 0) {
+		fclose(in);
+		return NULL;
+	}
+	n = csv_split(*line + (strncmp(*line, "\xef\xbb\xbf", 3) ? 0 : 3), fields);
+	for(i = 0; columns[i]; i++) {
+		for(cols[i] = -1, j = 0; j < n; j++) {
+			if(!strcmp(fields[j], columns[i])) {
+				cols[i] = j;
+			}
+		}
+	}
+	return in;
+}
+/*****************************************************************************/
+static const char *field(char **fields, int n, int col) {
+	return col >= 0 && col < n ? fields[col] : "";
+}
+/*****************************************************************************/
+static int parse_seconds(const char *s) {
+	/* "H:MM:SS", hours may go past 24 for trips after midnight */
+	int h, m, sec, n = -1;
+	if(sscanf(s, "%d:%2d:%2d%n", &h, &m, &sec, &n) != 3 || s[n]
+			|| h < 0 || h > 240 || m < 0 || m > 59 || sec < 0 || sec > 59) {
+		return -1;
+	}
+	return h*3600 + m*60 + sec;
+}
+/*****************************************************************************/
+static const char *mode_name(int type) {
+	/* Basic and extended GTFS route types, named as SL names them */
+	if(type == 0 || (type >= 900 && type < 1000)) {
+		return "spårvagn";
+	}
+	if(type == 1 || (type >= 400 && type < 500)) {
+		return "tunnelbana";
+	}
+	if(type == 2 || (type >= 100 && type < 200)) {
+		return "tåg";
+	}
+	if(type == 3 || (type >= 700 && type < 800)) {
+		return "buss";
+	}
+	if(type == 4 || (type >= 1000 && type < 1100)) {
+		return "båt";
+	}
+	return "linje";
+}
+/*****************************************************************************/
+static int read_stops(const char *dir, feed *f, char **line, size_t *cap) {
+	static const char *columns[] = {"stop_id", "stop_name", NULL};
+	char *fields[TT_FIELDS];
+	int cols[2], n;
+	FILE *in = csv_open(dir, "stops.txt", columns, cols, line, cap);
+	if(!in) {
+		return E_TIMETABLE;
+	}
+	if(cols[0] < 0) {
+		fclose(in);
+		return E_TIMETABLE;
+	}
+	while(getline(line, cap, in) > 0) {
+		n = csv_split(*line, fields);
+		if(grow((void**)&f->stop_names, &f->stops_cap, f->stops_len, sizeof(char*))
+				|| !(f->stop_names[f->stops_len] = strdup(field(fields, n, cols[1])))
+				|| idmap_put(&f->stop_ids, field(fields, n, cols[0]), f->stops_len)) {
+			fclose(in);
+			return E_UNKNOWN;
+		}
+		f->stops_len++;
+	}
+	fclose(in);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int read_routes(const char *dir, feed *f, char **line, size_t *cap) {
+	static const char *columns[] = {"route_id", "route_short_name",
+			"route_long_name", "route_type", NULL};
+	char *fields[TT_FIELDS], name[MESSAGE_SIZE];
+	const char *short_name, *long_name, *mode;
+	int cols[4], n;
+	FILE *in = csv_open(dir, "routes.txt", columns, cols, line, cap);
+	if(!in) {
+		return E_TIMETABLE;
+	}
+	if(cols[0] < 0) {
+		fclose(in);
+		return E_TIMETABLE;
+	}
+	while(getline(line, cap, in) > 0) {
+		n = csv_split(*line, fields);
+		short_name = field(fields, n, cols[1]);
+		long_name = field(fields, n, cols[2]);
+		mode = mode_name(atoi(field(fields, n, cols[3])));
+		if(*short_name) {
+			snprintf(name, sizeof(name), "%s %s", mode, short_name);
+		} else {
+			snprintf(name, sizeof(name), "%s", *long_name ? long_name : mode);
+		}
+		if(grow((void**)&f->route_names, &f->routes_cap, f->routes_len,
+				sizeof(char*))
+				|| !(f->route_names[f->routes_len] = strdup(name))
+				|| idmap_put(&f->route_ids, field(fields, n, cols[0]),
+				f->routes_len)) {
+			fclose(in);
+			return E_UNKNOWN;
+		}
+		f->routes_len++;
+	}
+	fclose(in);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int read_trips(const char *dir, feed *f, char **line, size_t *cap) {
+	static const char *columns[] = {"route_id", "trip_id", NULL};
+	char *fields[TT_FIELDS];
+	int cols[2], n, route;
+	FILE *in = csv_open(dir, "trips.txt", columns, cols, line, cap);
+	if(!in) {
+		return E_TIMETABLE;
+	}
+	if(cols[0] < 0 || cols[1] < 0) {
+		fclose(in);
+		return E_TIMETABLE;
+	}
+	while(getline(line, cap, in) > 0) {
+		n = csv_split(*line, fields);
+		if((route = idmap_get(&f->route_ids, field(fields, n, cols[0]))) < 0) {
+			continue;
+		}
+		if(grow((void**)&f->trip_routes, &f->trips_cap, f->trips_len, sizeof(int))
+				|| idmap_put(&f->trip_ids, field(fields, n, cols[1]), f->trips_len)) {
+			fclose(in);
+			return E_UNKNOWN;
+		}
+		f->trip_routes[f->trips_len++] = route;
+	}
+	fclose(in);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int read_stop_times(const char *dir, feed *f, char **line, size_t *cap) {
+	static const char *columns[] = {"trip_id", "arrival_time",
+			"departure_time", "stop_id", "stop_sequence", NULL};
+	char *fields[TT_FIELDS];
+	int cols[5], n;
+	row r;
+	FILE *in = csv_open(dir, "stop_times.txt", columns, cols, line, cap);
+	if(!in) {
+		return E_TIMETABLE;
+	}
+	if(cols[0] < 0 || cols[3] < 0 || cols[4] < 0) {
+		fclose(in);
+		return E_TIMETABLE;
+	}
+	while(getline(line, cap, in) > 0) {
+		n = csv_split(*line, fields);
+		r.trip = idmap_get(&f->trip_ids, field(fields, n, cols[0]));
+		r.stop = idmap_get(&f->stop_ids, field(fields, n, cols[3]));
+		r.seq = atoi(field(fields, n, cols[4]));
+		r.arr = parse_seconds(field(fields, n, cols[1]));
+		r.dep = parse_seconds(field(fields, n, cols[2]));
+		if(r.trip < 0 || r.stop < 0) {
+			continue;
+		}
+		if(grow((void**)&f->rows, &f->rows_cap, f->rows_len, sizeof(row))) {
+			fclose(in);
+			return E_UNKNOWN;
+		}
+		f->rows[f->rows_len++] = r;
+	}
+	fclose(in);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int read_transfers(const char *dir, feed *f, char **line, size_t *cap) {
+	/* The file is optional */
+	static const char *columns[] = {"from_stop_id", "to_stop_id",
+			"transfer_type", "min_transfer_time", NULL};
+	char *fields[TT_FIELDS];
+	int cols[4], n;
+	xfer x;
+	FILE *in = csv_open(dir, "transfers.txt", columns, cols, line, cap);
+	if(!in) {
+		return E_SUCCESS;
+	}
+	while(getline(line, cap, in) > 0) {
+		n = csv_split(*line, fields);
+		x.from = idmap_get(&f->stop_ids, field(fields, n, cols[0]));
+		x.to = idmap_get(&f->stop_ids, field(fields, n, cols[1]));
+		x.secs = atoi(field(fields, n, cols[3]));
+		/* Type 3 means the transfer is not possible */
+		if(x.from < 0 || x.to < 0 || x.from == x.to || x.secs < 0
+				|| atoi(field(fields, n, cols[2])) == 3) {
+			continue;
+		}
+		if(grow((void**)&f->xfers, &f->xfers_cap, f->xfers_len, sizeof(xfer))) {
+			fclose(in);
+			return E_UNKNOWN;
+		}
+		f->xfers[f->xfers_len++] = x;
+	}
+	fclose(in);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static void free_feed(feed *f) {
+	int i;
+	idmap_free(&f->stop_ids);
+	idmap_free(&f->route_ids);
+	idmap_free(&f->trip_ids);
+	for(i = 0; i < f->stops_len; i++) {
+		free(f->stop_names[i]);
+	}
+	for(i = 0; i < f->routes_len; i++) {
+		free(f->route_names[i]);
+	}
+	free(f->stop_names);
+	free(f->route_names);
+	free(f->trip_routes);
+	free(f->rows);
+	free(f->xfers);
+}
+/*****************************************************************************/
+static int compare_rows(const void *a, const void *b) {
+	const row *x = a, *y = b;
+	return x->trip != y->trip ? (x->trip > y->trip) - (x->trip < y->trip)
+			: (x->seq > y->seq) - (x->seq < y->seq);
+}
+/*****************************************************************************/
+static int same_stops(const row *rows, const trip_info *x,
+		const trip_info *y) {
+	int i;
+	if(x->route != y->route || x->len != y->len || x->hash != y->hash) {
+		return 0;
+	}
+	for(i = 0; i < x->len; i++) {
+		if(rows[x->start+i].stop != rows[y->start+i].stop) {
+			return 0;
+		}
+	}
+	return 1;
+}
+/*****************************************************************************/
+static int compare_trips(const void *a, const void *b, void *arg) {
+	/* Trips of the same stops end up together, by departure */
+	const trip_info *x = a, *y = b;
+	const row *rows = arg;
+	int i, d;
+	if(x->route != y->route) {
+		return (x->route > y->route) - (x->route < y->route);
+	}
+	if(x->len != y->len) {
+		return (x->len > y->len) - (x->len < y->len);
+	}
+	if(x->hash != y->hash) {
+		return (x->hash > y->hash) - (x->hash < y->hash);
+	}
+	for(i = 0; i < x->len; i++) {
+		if((d = rows[x->start+i].stop - rows[y->start+i].stop)) {
+			return d;
+		}
+	}
+	d = rows[x->start].dep - rows[y->start].dep;
+	return d ? d : x->start - y->start;
+}
+/*****************************************************************************/
+static int compare_names(const void *a, const void *b, void *arg) {
+	char **names = arg;
+	int d = strcmp(names[*(const int*)a], names[*(const int*)b]);
+	return d ? d : *(const int*)a - *(const int*)b;
+}
+/*****************************************************************************/
+static int compare_folded(const void *a, const void *b, void *arg) {
+	char **names = arg;
+	int d = strcasecmp(names[*(const int*)a], names[*(const int*)b]);
+	return d ? d : *(const int*)a - *(const int*)b;
+}
+/*****************************************************************************/
+static int compare_transfers(const void *a, const void *b) {
+	const xfer *x = a, *y = b;
+	return x->from != y->from ? x->from - y->from : x->to - y->to;
+}
+/*****************************************************************************/
+static int overtakes(const row *rows, const trip_info *x,
+		const trip_info *y) {
+	/* Trips of a route are searched by departure at every stop, so a trip
+	 * leaving a stop before the one ahead of it starts a new route */
+	int i;
+	for(i = 0; i < x->len; i++) {
+		if(rows[y->start+i].dep < rows[x->start+i].dep
+				|| rows[y->start+i].arr < rows[x->start+i].arr) {
+			return 1;
+		}
+	}
+	return 0;
+}
+/*****************************************************************************/
+static int fill_times(row *rows, int len) {
+	/* Stops without times take those of the stop before */
+	int i;
+	for(i = 0; i < len; i++) {
+		if(rows[i].arr < 0) {
+			rows[i].arr = rows[i].dep >= 0 ? rows[i].dep : i ? rows[i-1].dep : -1;
+		}
+		if(rows[i].dep < 0) {
+			rows[i].dep = rows[i].arr;
+		}
+		if(rows[i].arr < 0) {
+			return E_TIMETABLE;
+		}
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int pool_add(tsl_buf *pool, const char *s) {
+	int len = strlen(s), off = pool->len;
+	if(buf_reserve(pool, len+1)) {
+		return E_UNKNOWN;
+	}
+	memcpy(pool->data+pool->len, s, len+1);
+	pool->len += len+1;
+	return off;
+}
+/*****************************************************************************/
+static int write_all(int fd, const void *data, size_t len) {
+	const char *p = data;
+	ssize_t n;
+	while(len > 0) {
+		if((n = write(fd, p, len)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+/*****************************************************************************/
+static uint64_t layout(const int32_t *len, uint64_t *off) {
+	/* Offsets of the sections, returns the size of the file */
+	int i;
+	off[0] = (sizeof(tt_header)+TT_ALIGN-1) & ~(uint64_t)(TT_ALIGN-1);
+	for(i = 1; i <= TT_SECTIONS; i++) {
+		off[i] = off[i-1] + section_size[i-1]*(uint64_t)len[i-1];
+		if(i < TT_SECTIONS) {
+			off[i] = (off[i]+TT_ALIGN-1) & ~(uint64_t)(TT_ALIGN-1);
+		}
+	}
+	return off[TT_SECTIONS];
+}
+/*****************************************************************************/
+typedef struct tables {
+	tt_header h;
+	tt_stop *stops;
+	tt_route *routes; int routes_cap;
+	int *route_stops; int route_stops_cap;
+	tt_stop_route *stop_routes;
+	tt_transfer *transfers;
+	tt_time *times; int times_cap;
+	int *names;
+	tsl_buf pool;
+} tables;
+/*****************************************************************************/
+static int add_route(tables *t, feed *f, const trip_info *trips, int len) {
+	/* One route of trips with the same stops, already sorted */
+	const trip_info *first = &trips[0];
+	tt_route *r;
+	int i, j, stops = first->len;
+	if(grow((void**)&t->routes, &t->routes_cap, t->h.len[SEC_ROUTES],
+			sizeof(tt_route))) {
+		return E_UNKNOWN;
+	}
+	while(t->h.len[SEC_ROUTE_STOPS]+stops > t->route_stops_cap) {
+		if(grow((void**)&t->route_stops, &t->route_stops_cap,
+				t->route_stops_cap, sizeof(int))) {
+			return E_UNKNOWN;
+		}
+	}
+	while((int64_t)t->h.len[SEC_TIMES]+(int64_t)len*stops > t->times_cap) {
+		if(t->times_cap > INT32_MAX/2 || grow((void**)&t->times, &t->times_cap,
+				t->times_cap, sizeof(tt_time))) {
+			return E_UNKNOWN;
+		}
+	}
+	r = &t->routes[t->h.len[SEC_ROUTES]++];
+	if((r->name = pool_add(&t->pool, f->route_names[first->route])) < 0) {
+		return E_UNKNOWN;
+	}
+	r->stops_off = t->h.len[SEC_ROUTE_STOPS];
+	r->stops_len = stops;
+	r->trips_len = len;
+	r->times_off = t->h.len[SEC_TIMES];
+	for(j = 0; j < stops; j++) {
+		t->route_stops[t->h.len[SEC_ROUTE_STOPS]++] = f->rows[first->start+j].stop;
+	}
+	for(i = 0; i < len; i++) {
+		for(j = 0; j < stops; j++) {
+			t->times[t->h.len[SEC_TIMES]].arr = f->rows[trips[i].start+j].arr;
+			t->times[t->h.len[SEC_TIMES]++].dep = f->rows[trips[i].start+j].dep;
+		}
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int build_routes(tables *t, feed *f) {
+	trip_info *trips;
+	int i, j, len = 0;
+	qsort(f->rows, f->rows_len, sizeof(row), compare_rows);
+	if(!(trips = malloc(sizeof(trip_info)*(f->rows_len+1)))) {
+		return E_UNKNOWN;
+	}
+	for(i = 0; i < f->rows_len; i = j) {
+		for(j = i+1; j < f->rows_len && f->rows[j].trip == f->rows[i].trip; j++);
+		if(j-i < 2 || fill_times(&f->rows[i], j-i)) {
+			continue;
+		}
+		trips[len].route = f->trip_routes[f->rows[i].trip];
+		trips[len].start = i;
+		trips[len].len = j-i;
+		trips[len].hash = 2166136261u;
+		for(; i < j; i++) {
+			trips[len].hash = hash_bytes(trips[len].hash, &f->rows[i].stop,
+					sizeof(int));
+		}
+		len++;
+	}
+	qsort_r(trips, len, sizeof(trip_info), compare_trips, f->rows);
+	for(i = 0; i < len; i = j) {
+		for(j = i+1; j < len && same_stops(f->rows, &trips[i], &trips[j])
+				&& !overtakes(f->rows, &trips[j-1], &trips[j]); j++);
+		if(add_route(t, f, &trips[i], j-i)) {
+			free(trips);
+			return E_UNKNOWN;
+		}
+	}
+	free(trips);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int build_stops(tables *t, feed *f) {
+	/* Routes and transfers are grouped by stop with counting sorts */
+	int i, j, k, g, *order = malloc(sizeof(int)*(f->stops_len+1));
+	const tt_route *r;
+	if(!order || !(t->stops = calloc(f->stops_len+1, sizeof(tt_stop)))
+			|| !(t->stop_routes = malloc(sizeof(tt_stop_route)
+			*(t->h.len[SEC_ROUTE_STOPS]+1)))) {
+		free(order);
+		return E_UNKNOWN;
+	}
+	t->h.len[SEC_STOPS] = f->stops_len;
+	t->h.len[SEC_STOP_ROUTES] = t->h.len[SEC_ROUTE_STOPS];
+	for(i = 0; i < t->h.len[SEC_ROUTE_STOPS]; i++) {
+		t->stops[t->route_stops[i]].routes_len++;
+	}
+	for(i = 0, k = 0; i < f->stops_len; i++) {
+		t->stops[i].routes_off = k;
+		k += t->stops[i].routes_len;
+		t->stops[i].routes_len = 0;
+		if((t->stops[i].name = pool_add(&t->pool, f->stop_names[i])) < 0) {
+			free(order);
+			return E_UNKNOWN;
+		}
+	}
+	for(i = 0; i < t->h.len[SEC_ROUTES]; i++) {
+		r = &t->routes[i];
+		for(j = 0; j < r->stops_len; j++) {
+			tt_stop *st = &t->stops[t->route_stops[r->stops_off+j]];
+			t->stop_routes[st->routes_off + st->routes_len].route = i;
+			t->stop_routes[st->routes_off + st->routes_len++].pos = j;
+		}
+	}
+	/* Stops sharing a name are platforms of one station */
+	for(i = 0; i < f->stops_len; i++) {
+		order[i] = i;
+	}
+	qsort_r(order, f->stops_len, sizeof(int), compare_names, f->stop_names);
+	for(i = 0; i < f->stops_len; i = g) {
+		for(g = i+1; g < f->stops_len
+				&& !strcmp(f->stop_names[order[g]], f->stop_names[order[i]]); g++);
+		for(j = i; g-i <= TT_GROUP && j < g; j++) {
+			for(k = i; k < g; k++) {
+				if(j == k) {
+					continue;
+				}
+				if(grow((void**)&f->xfers, &f->xfers_cap, f->xfers_len,
+						sizeof(xfer))) {
+					free(order);
+					return E_UNKNOWN;
+				}
+				f->xfers[f->xfers_len].from = order[j];
+				f->xfers[f->xfers_len].to = order[k];
+				f->xfers[f->xfers_len++].secs = TT_TRANSFER;
+			}
+		}
+	}
+	/* Queries look names up in the same order with case ignored, the
+	 * order is kept as the table of names */
+	t->names = order;
+	for(i = 0; i < f->stops_len; i++) {
+		order[i] = i;
+	}
+	qsort_r(order, f->stops_len, sizeof(int), compare_folded, f->stop_names);
+	t->h.len[SEC_NAMES] = f->stops_len;
+	qsort(f->xfers, f->xfers_len, sizeof(xfer), compare_transfers);
+	if(!(t->transfers = malloc(sizeof(tt_transfer)*(f->xfers_len+1)))) {
+		return E_UNKNOWN;
+	}
+	t->h.len[SEC_TRANSFERS] = f->xfers_len;
+	for(i = 0; i < f->xfers_len; i++) {
+		tt_stop *st = &t->stops[f->xfers[i].from];
+		if(!st->transfers_len) {
+			st->transfers_off = i;
+		}
+		st->transfers_len++;
+		t->transfers[i].to = f->xfers[i].to;
+		t->transfers[i].secs = f->xfers[i].secs;
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int write_tables(tables *t, const char *path) {
+	static const char pad[TT_ALIGN];
+	const void *data[TT_SECTIONS] = {t->stops, t->routes, t->route_stops,
+			t->stop_routes, t->transfers, t->times, t->names, t->pool.data};
+	char tmp[TT_PATH_SIZE+32];
+	uint64_t off[TT_SECTIONS+1], pos;
+	int i, fd, retval;
+	t->h.magic = TT_MAGIC;
+	t->h.version = TT_VERSION;
+	t->h.len[SEC_POOL] = t->pool.len;
+	layout(t->h.len, off);
+	snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+	if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		return E_TIMETABLE;
+	}
+	retval = write_all(fd, &t->h, sizeof(t->h));
+	for(i = 0, pos = sizeof(t->h); !retval && i < TT_SECTIONS; i++) {
+		retval = write_all(fd, pad, off[i]-pos)
+				|| write_all(fd, data[i], section_size[i]*t->h.len[i]);
+		pos = off[i] + section_size[i]*t->h.len[i];
+	}
+	if(close(fd) || retval || rename(tmp, path)) {
+		unlink(tmp);
+		return E_TIMETABLE;
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+int timetable_import(const char *dir, const char *path) {
+	feed f;
+	tables t;
+	char *line = NULL;
+	size_t cap = 0;
+	int retval;
+	memset(&f, 0, sizeof(f));
+	memset(&t, 0, sizeof(t));
+	buf_init(&t.pool);
+	retval = read_stops(dir, &f, &line, &cap);
+	if(!retval) {
+		retval = read_routes(dir, &f, &line, &cap);
+	}
+	if(!retval) {
+		retval = read_trips(dir, &f, &line, &cap);
+	}
+	if(!retval) {
+		retval = read_stop_times(dir, &f, &line, &cap);
+	}
+	if(!retval) {
+		retval = read_transfers(dir, &f, &line, &cap);
+	}
+	if(!retval) {
+		retval = build_routes(&t, &f);
+	}
+	if(!retval) {
+		retval = build_stops(&t, &f);
+	}
+	if(!retval) {
+		retval = write_tables(&t, path);
+	}
+	free(line);
+	free_feed(&f);
+	free(t.stops);
+	free(t.routes);
+	free(t.route_stops);
+	free(t.stop_routes);
+	free(t.transfers);
+	free(t.times);
+	free(t.names);
+	buf_free(&t.pool);
+	return retval;
+}
+/*****************************************************************************/
+static int check_tables(const timetable *tt, int route_stops_len,
+		int stop_routes_len, int transfers_len, int times_len, int names_len,
+		int pool_len) {
+	/* Times are never used as indexes, so only they go unchecked */
+	const tt_route *r;
+	int i;
+	if(pool_len < 1 || tt->pool[pool_len-1]) {
+		return E_TIMETABLE;
+	}
+	for(i = 0; i < tt->stops_len; i++) {
+		const tt_stop *st = &tt->stops[i];
+		if(st->name < 0 || st->name >= pool_len
+				|| st->routes_off < 0 || st->routes_len < 0
+				|| st->routes_off > stop_routes_len-st->routes_len
+				|| st->transfers_off < 0 || st->transfers_len < 0
+				|| st->transfers_off > transfers_len-st->transfers_len) {
+			return E_TIMETABLE;
+		}
+	}
+	for(i = 0; i < tt->routes_len; i++) {
+		r = &tt->routes[i];
+		if(r->name < 0 || r->name >= pool_len || r->stops_len < 1
+				|| r->stops_off < 0 || r->stops_off > route_stops_len-r->stops_len
+				|| r->trips_len < 0 || r->times_off < 0
+				|| r->times_off+(int64_t)r->trips_len*r->stops_len > times_len) {
+			return E_TIMETABLE;
+		}
+	}
+	for(i = 0; i < route_stops_len; i++) {
+		if(tt->route_stops[i] < 0 || tt->route_stops[i] >= tt->stops_len) {
+			return E_TIMETABLE;
+		}
+	}
+	for(i = 0; i < stop_routes_len; i++) {
+		if(tt->stop_routes[i].route < 0 || tt->stop_routes[i].route >= tt->routes_len
+				|| tt->stop_routes[i].pos < 0
+				|| tt->stop_routes[i].pos >= tt->routes[tt->stop_routes[i].route].stops_len) {
+			return E_TIMETABLE;
+		}
+	}
+	for(i = 0; i < transfers_len; i++) {
+		if(tt->transfers[i].to < 0 || tt->transfers[i].to >= tt->stops_len
+				|| tt->transfers[i].secs < 0) {
+			return E_TIMETABLE;
+		}
+	}
+	/* Names are searched by halves, so they have to be in order */
+	if(names_len != tt->stops_len) {
+		return E_TIMETABLE;
+	}
+	for(i = 0; i < names_len; i++) {
+		if(tt->names[i] < 0 || tt->names[i] >= tt->stops_len || (i
+				&& strcasecmp(tt->pool+tt->stops[tt->names[i-1]].name,
+				tt->pool+tt->stops[tt->names[i]].name) > 0)) {
+			return E_TIMETABLE;
+		}
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+tt_search *tt_search_new(const timetable *tt) {
+	tt_search *s = calloc(1, sizeof(tt_search));
+	size_t n = (size_t)(TT_ROUNDS+1)*tt->stops_len;
+	if(!s) {
+		return NULL;
+	}
+	s->tt = tt;
+	s->arrival = malloc(sizeof(int)*n);
+	s->kind = malloc(n);
+	s->labels = malloc(sizeof(label)*n);
+	s->best = malloc(sizeof(int)*(tt->stops_len+1));
+	s->marked = malloc(sizeof(int)*(tt->stops_len+1));
+	s->is_marked = calloc(tt->stops_len+1, 1);
+	s->is_target = calloc(tt->stops_len+1, 1);
+	s->sources = malloc(sizeof(int)*(tt->stops_len+1));
+	s->targets = malloc(sizeof(int)*(tt->stops_len+1));
+	s->first = malloc(sizeof(int)*(tt->routes_len+1));
+	s->touched = malloc(sizeof(int)*(tt->routes_len+1));
+	if(!s->arrival || !s->kind || !s->labels || !s->best || !s->marked
+			|| !s->is_marked || !s->is_target || !s->sources || !s->targets
+			|| !s->first || !s->touched) {
+		tt_search_free(s);
+		return NULL;
+	}
+	memset(s->first, -1, sizeof(int)*tt->routes_len);
+	return s;
+}
+/*****************************************************************************/
+void tt_search_free(tt_search *s) {
+	free(s->arrival);
+	free(s->kind);
+	free(s->labels);
+	free(s->best);
+	free(s->marked);
+	free(s->is_marked);
+	free(s->is_target);
+	free(s->sources);
+	free(s->targets);
+	free(s->first);
+	free(s->touched);
+	free(s);
+}
+/*****************************************************************************/
+static int intern_stops(timetable *tt) {
+	/* Names are interned while the timetable is opened, so searches in
+	 * several threads never write to the station table */
+	const char *name;
+	int i;
+	if(!(tt->stop_ids = malloc(sizeof(int)*(tt->stops_len+1)))) {
+		return E_UNKNOWN;
+	}
+	for(i = 0; i < tt->stops_len; i++) {
+		name = tt->pool+tt->stops[i].name;
+		if((tt->stop_ids[i] = station_intern(name, strlen(name))) < 0) {
+			return tt->stop_ids[i];
+		}
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+timetable *timetable_open(const char *path) {
+	timetable *tt = calloc(1, sizeof(timetable));
+	const tt_header *h;
+	uint64_t off[TT_SECTIONS+1];
+	struct stat st;
+	int i, fd;
+	if(!tt || (fd = open(path, O_RDONLY)) < 0) {
+		free(tt);
+		return NULL;
+	}
+	if(fstat(fd, &st) || st.st_size < (off_t)sizeof(tt_header)
+			|| (tt->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+			== MAP_FAILED) {
+		close(fd);
+		free(tt);
+		return NULL;
+	}
+	close(fd);
+	tt->map_len = st.st_size;
+	h = tt->map;
+	for(i = 0; i < TT_SECTIONS && h->len[i] >= 0; i++);
+	if(h->magic != TT_MAGIC || h->version != TT_VERSION || i < TT_SECTIONS
+			|| layout(h->len, off) != tt->map_len) {
+		munmap(tt->map, tt->map_len);
+		free(tt);
+		return NULL;
+	}
+	tt->stops = (const tt_stop*)((char*)tt->map+off[SEC_STOPS]);
+	tt->stops_len = h->len[SEC_STOPS];
+	tt->routes = (const tt_route*)((char*)tt->map+off[SEC_ROUTES]);
+	tt->routes_len = h->len[SEC_ROUTES];
+	tt->route_stops = (const int*)((char*)tt->map+off[SEC_ROUTE_STOPS]);
+	tt->stop_routes = (const tt_stop_route*)((char*)tt->map+off[SEC_STOP_ROUTES]);
+	tt->transfers = (const tt_transfer*)((char*)tt->map+off[SEC_TRANSFERS]);
+	tt->times = (const tt_time*)((char*)tt->map+off[SEC_TIMES]);
+	tt->names = (const int*)((char*)tt->map+off[SEC_NAMES]);
+	tt->pool = (const char*)tt->map+off[SEC_POOL];
+	if(check_tables(tt, h->len[SEC_ROUTE_STOPS], h->len[SEC_STOP_ROUTES],
+			h->len[SEC_TRANSFERS], h->len[SEC_TIMES], h->len[SEC_NAMES],
+			h->len[SEC_POOL])
+			|| intern_stops(tt) || !(tt->search = tt_search_new(tt))) {
+		timetable_close(tt);
+		return NULL;
+	}
+	return tt;
+}
+/*****************************************************************************/
+void timetable_close(timetable *tt) {
+	munmap(tt->map, tt->map_len);
+	if(tt->search) {
+		tt_search_free(tt->search);
+	}
+	free(tt->stop_ids);
+	free(tt);
+}
+/*****************************************************************************/
+static int find_stops(const timetable *tt, const char *name, int *stops) {
+	/* The first stop of the name by halves, the rest follow it in the
+	 * order of their index */
+	int lo = 0, hi = tt->stops_len, mid, len = 0;
+	while(lo < hi) {
+		mid = lo + (hi-lo)/2;
+		if(strcasecmp(tt->pool+tt->stops[tt->names[mid]].name, name) < 0) {
+			lo = mid+1;
+		} else {
+			hi = mid;
+		}
+	}
+	for(; lo < tt->stops_len
+			&& !strcasecmp(tt->pool+tt->stops[tt->names[lo]].name, name); lo++) {
+		stops[len++] = tt->names[lo];
+	}
+	return len;
+}
+/*****************************************************************************/
+static void reach(tt_search *s, int k, int stop, int arrival, int kind,
+		label lab, int *target_best) {
+	int i = k*s->tt->stops_len + stop;
+	s->arrival[i] = s->best[stop] = arrival;
+	s->kind[i] = kind;
+	s->labels[i] = lab;
+	if(!s->is_marked[stop]) {
+		s->is_marked[stop] = 1;
+		s->marked[s->marked_len++] = stop;
+	}
+	if(s->is_target[stop] && arrival < *target_best) {
+		*target_best = arrival;
+	}
+}
+/*****************************************************************************/
+static void walk(tt_search *s, int k, int from, int *target_best) {
+	const timetable *tt = s->tt;
+	const tt_stop *st = &tt->stops[from];
+	const tt_transfer *tr;
+	label lab = {from, -1, -1, -1};
+	int64_t arrival;
+	int i;
+	for(i = 0; i < st->transfers_len; i++) {
+		tr = &tt->transfers[st->transfers_off+i];
+		arrival = (int64_t)s->arrival[k*tt->stops_len+from] + tr->secs;
+		if(arrival < s->best[tr->to] && arrival < *target_best) {
+			reach(s, k, tr->to, arrival, KIND_WALK, lab, target_best);
+		}
+	}
+}
+/*****************************************************************************/
+static int earliest_trip(const timetable *tt, const tt_route *r, int pos,
+		int time) {
+	/* First trip leaving the stop at pos at time or later, trips of a
+	 * route never overtake each other */
+	int lo = 0, hi = r->trips_len, mid;
+	while(lo < hi) {
+		mid = lo + (hi-lo)/2;
+		if(tt->times[r->times_off + mid*r->stops_len + pos].dep < time) {
+			lo = mid+1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo < r->trips_len ? lo : -1;
+}
+/*****************************************************************************/
+static void scan_route(tt_search *s, int k, int route, int *target_best) {
+	const timetable *tt = s->tt;
+	const tt_route *r = &tt->routes[route];
+	const int *prev = &s->arrival[(k-1)*tt->stops_len];
+	const tt_time *t;
+	label lab = {-1, route, -1, -1};
+	int pos, stop, trip;
+	for(pos = s->first[route]; pos < r->stops_len; pos++) {
+		stop = tt->route_stops[r->stops_off+pos];
+		t = lab.trip >= 0 ? &tt->times[r->times_off + lab.trip*r->stops_len + pos]
+				: NULL;
+		if(t && t->arr < s->best[stop] && t->arr < *target_best) {
+			reach(s, k, stop, t->arr, KIND_RIDE, lab, target_best);
+		}
+		/* An earlier trip may be caught where the last round got to */
+		if(prev[stop] != TT_NONE && (!t || prev[stop] <= t->dep)
+				&& (trip = earliest_trip(tt, r, pos, prev[stop])) >= 0
+				&& (lab.trip < 0 || trip < lab.trip)) {
+			lab.trip = trip;
+			lab.board = pos;
+			lab.from = stop;
+		}
+	}
+	s->first[route] = -1;
+}
+/*****************************************************************************/
+static void raptor(tt_search *s, int sources_len, int departure) {
+	const timetable *tt = s->tt;
+	int S = tt->stops_len, i, j, k, stop, marked_len, target_best = TT_NONE;
+	const tt_stop_route *sr;
+	label lab = {-1, -1, -1, -1};
+	memset(s->arrival, 0x7f, sizeof(int)*(TT_ROUNDS+1)*S);
+	memset(s->best, 0x7f, sizeof(int)*S);
+	memset(s->kind, KIND_COPY, (size_t)(TT_ROUNDS+1)*S);
+	s->marked_len = 0;
+	for(i = 0; i < sources_len; i++) {
+		reach(s, 0, s->sources[i], departure, KIND_SOURCE, lab, &target_best);
+	}
+	for(i = 0; i < sources_len; i++) {
+		walk(s, 0, s->sources[i], &target_best);
+	}
+	for(k = 1; k <= TT_ROUNDS && s->marked_len; k++) {
+		memcpy(&s->arrival[k*S], &s->arrival[(k-1)*S], sizeof(int)*S);
+		/* Each route is scanned once, from its first improved stop */
+		s->touched_len = 0;
+		for(i = 0; i < s->marked_len; i++) {
+			stop = s->marked[i];
+			s->is_marked[stop] = 0;
+			for(j = 0; j < tt->stops[stop].routes_len; j++) {
+				sr = &tt->stop_routes[tt->stops[stop].routes_off+j];
+				if(s->first[sr->route] < 0) {
+					s->touched[s->touched_len++] = sr->route;
+					s->first[sr->route] = sr->pos;
+				} else if(sr->pos < s->first[sr->route]) {
+					s->first[sr->route] = sr->pos;
+				}
+			}
+		}
+		s->marked_len = 0;
+		for(i = 0; i < s->touched_len; i++) {
+			scan_route(s, k, s->touched[i], &target_best);
+		}
+		for(i = 0, marked_len = s->marked_len; i < marked_len; i++) {
+			walk(s, k, s->marked[i], &target_best);
+		}
+	}
+	for(i = 0; i < s->marked_len; i++) {
+		s->is_marked[s->marked[i]] = 0;
+	}
+}
+/*****************************************************************************/
+static int put_string(tsl_buf *strings, slice *s, const char *str, int len) {
+	if(buf_reserve(strings, len+1)) {
+		return E_UNKNOWN;
+	}
+	memcpy(strings->data+strings->len, str, len);
+	strings->data[strings->len+len] = '\0';
+	s->off = strings->len;
+	s->len = len;
+	strings->len += len+1;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int put_station(const timetable *tt, tsl_buf *strings, station_ref *st,
+		int stop, int secs, int day) {
+	const char *name = tt->pool+tt->stops[stop].name;
+	char time[16];
+	int len = snprintf(time, sizeof(time), "%02d:%02d", secs/3600%24,
+			secs/60%60);
+	st->when = day*24*60 + secs/60;
+	st->id = tt->stop_ids[stop];
+	return put_string(strings, &st->name, name, strlen(name))
+			|| put_string(strings, &st->time, time, len) ? E_UNKNOWN : E_SUCCESS;
+}
+/*****************************************************************************/
+typedef struct leg {int kind; int route; int from; int to; int dep; int arr;} leg;
+/*****************************************************************************/
+static int add_journey(const tt_search *s, int k, int stop, int day,
+		triplist *tl, tsl_buf *strings, int *first_dep) {
+	/* Follows the labels back from the destination, then stores the legs
+	 * from the origin on */
+	leg legs[2*TT_ROUNDS+2];
+	const label *lab;
+	trip_ref *tr;
+	edge_ref *ed;
+	char dur[16];
+	const timetable *tt = s->tt;
+	int i, n = 0, S = tt->stops_len, len;
+	while(k >= 0 && s->kind[k*S+stop] != KIND_SOURCE && n < 2*TT_ROUNDS+2) {
+		if(s->kind[k*S+stop] == KIND_COPY) {
+			k--;
+			continue;
+		}
+		lab = &s->labels[k*S+stop];
+		legs[n].kind = s->kind[k*S+stop];
+		legs[n].route = lab->route;
+		legs[n].from = lab->from;
+		legs[n].to = stop;
+		legs[n].arr = s->arrival[k*S+stop];
+		if(legs[n].kind == KIND_RIDE) {
+			const tt_route *r = &tt->routes[lab->route];
+			legs[n].dep = tt->times[r->times_off + lab->trip*r->stops_len
+					+ lab->board].dep;
+			k--;
+		} else {
+			legs[n].dep = s->arrival[k*S+lab->from];
+		}
+		stop = lab->from;
+		n++;
+	}
+	for(i = n-1; i >= 0 && legs[i].kind != KIND_RIDE; i--);
+	if(i < 0 || k < 0) {
+		return E_SUCCESS;
+	}
+	*first_dep = legs[i].dep;
+	/* Walks to the first vehicle leave just in time for it */
+	for(len = legs[i].dep, i++; i < n; i++) {
+		legs[i].dep = len - (legs[i].arr - legs[i].dep);
+		legs[i].arr = len;
+		len = legs[i].dep;
+	}
+	/* The same journey is found again by the search for later ones */
+	for(i = 0; i < tl->trips_len; i++) {
+		tr = &tl->trips[i];
+		if(tr->edges_len == n
+				&& tl->edges[tr->edges_off].origin.when == day*24*60 + legs[n-1].dep/60
+				&& tl->edges[tr->edges_off+n-1].dest.when == day*24*60 + legs[0].arr/60) {
+			return E_SUCCESS;
+		}
+	}
+	if(grow((void**)&tl->trips, &tl->trips_cap, tl->trips_len, sizeof(trip_ref))) {
+		return E_UNKNOWN;
+	}
+	tr = &tl->trips[tl->trips_len++];
+	tr->edges_off = tl->edges_len;
+	tr->edges_len = n;
+	for(i = n-1; i >= 0; i--) {
+		if(grow((void**)&tl->edges, &tl->edges_cap, tl->edges_len,
+				sizeof(edge_ref))) {
+			return E_UNKNOWN;
+		}
+		ed = &tl->edges[tl->edges_len++];
+		if(legs[i].kind == KIND_RIDE) {
+			const char *name = tt->pool+tt->routes[legs[i].route].name;
+			len = put_string(strings, &ed->type, name, strlen(name));
+		} else {
+			len = put_string(strings, &ed->type, TT_WALK, strlen(TT_WALK));
+		}
+		if(len || put_station(tt, strings, &ed->origin, legs[i].from, legs[i].dep, day)
+				|| put_station(tt, strings, &ed->dest, legs[i].to, legs[i].arr, day)) {
+			return E_UNKNOWN;
+		}
+	}
+	tr->depart = tl->edges[tr->edges_off].origin.when;
+	tr->arrive = tl->edges[tl->edges_len-1].dest.when;
+	tr->minutes = tr->arrive - tr->depart;
+	len = snprintf(dur, sizeof(dur), "%d", tr->minutes);
+	return put_string(strings, &tr->dur, dur, len);
+}
+/*****************************************************************************/
+int tt_search_query(tt_search *s, const char *origin, const char *dest,
+		int when, triplist *tl, tsl_buf *strings) {
+	const timetable *tt = s->tt;
+	int S = tt->stops_len, sources_len, targets_len, i, k, stop, best, search;
+	int day = when/(24*60), departure = when%(24*60)*60, next, first_dep;
+	int retval = E_SUCCESS;
+	tl->trips_len = 0;
+	tl->edges_len = 0;
+	strings->len = 0;
+	sources_len = find_stops(tt, origin, s->sources);
+	targets_len = find_stops(tt, dest, s->targets);
+	if(!sources_len || !targets_len) {
+		return E_TIMETABLE;
+	}
+	for(i = 0; i < targets_len; i++) {
+		s->is_target[s->targets[i]] = 1;
+	}
+	/* Later journeys are found by searching again after the first
+	 * departure, a bounded number of times */
+	for(search = 0; !retval && tl->trips_len < TT_JOURNEYS
+			&& search < 2*TT_JOURNEYS; search++) {
+		raptor(s, sources_len, departure);
+		/* A round is kept when it gets there earlier than fewer vehicles */
+		next = TT_NONE;
+		for(k = 1, best = TT_NONE; !retval && k <= TT_ROUNDS; k++) {
+			for(i = 0, stop = -1; i < targets_len; i++) {
+				if(s->kind[k*S+s->targets[i]] != KIND_COPY
+						&& s->arrival[k*S+s->targets[i]] < best) {
+					stop = s->targets[i];
+					best = s->arrival[k*S+stop];
+				}
+			}
+			first_dep = TT_NONE;
+			if(stop >= 0 && tl->trips_len < TT_JOURNEYS) {
+				retval = add_journey(s, k, stop, day, tl, strings, &first_dep);
+			}
+			next = first_dep < next ? first_dep : next;
+		}
+		if(next == TT_NONE) {
+			break;
+		}
+		departure = next+1;
+	}
+	for(i = 0; i < targets_len; i++) {
+		s->is_target[s->targets[i]] = 0;
+	}
+	return retval ? retval : tl->trips_len;
+}
+/*****************************************************************************/
+int timetable_query(timetable *tt, const char *origin, const char *dest,
+		int when, triplist *tl, tsl_buf *strings) {
+	return tt_search_query(tt->search, origin, dest, when, tl, strings);
+}
+/*****************************************************************************/
@@ -0,0 +1,123 @@
+/******************************************************************************
+*     File Name           :     timetable.h                                   *
+*     Description         :     Offline journeys over a timetable imported    *
+*                                 from a GTFS feed.                           *
+******************************************************************************/
+#ifndef TIMETABLE_H
+#define TIMETABLE_H
+#include "tsl.h"                // error numbers, tsl_buf
+#include "triplist.h"           // triplist
+/*****************************************************************************/
+#define TT_ROUNDS 5 			// Most vehicles ridden in one journey
+#define TT_JOURNEYS 5 			// Journeys looked for by a query
+#define TT_TRANSFER 120 		// Seconds to change between stops of a name
+#define TT_WALK "Gång" 			// Type of walking edges, as SL names them
+/******************************************************************************
+* Struct: timetable                                                           *
+* -----------------                                                           *
+*   A timetable mapped read-only from a file written by timetable_import,     *
+*   with scratch space for queries. Trips run every day, the calendar of      *
+*   the feed is not imported. Apart from timetable_query it is never          *
+*   written after it is opened, so searches may share it between threads.     *
+******************************************************************************/
+typedef struct timetable timetable;
+/******************************************************************************
+* Struct: tt_search                                                           *
+* -----------------                                                           *
+*   Scratch space of one search over a timetable, sized for it when made, so  *
+*   searches allocate nothing but the journeys they return. Every thread      *
+*   searching a timetable uses its own.                                       *
+******************************************************************************/
+typedef struct tt_search tt_search;
+/******************************************************************************
+* Function: timetable_import                                                  *
+* --------------------------                                                  *
+*   Reads stops.txt, routes.txt, trips.txt, stop_times.txt and, when there    *
+*   is one, transfers.txt of a GTFS feed and writes them as a timetable.      *
+*   Trips visiting the same stops in the same order become one route with     *
+*   its trips sorted by departure, and stops of the same name are joined      *
+*   by transfers of TT_TRANSFER seconds. Stops are also listed by name with   *
+*   case ignored, so queries find a name by halves.                           *
+*                                                                             *
+*   dir: Directory of the feed.                                               *
+*   path: File the timetable is written to, replaced when it exists.          *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_TIMETABLE when the feed can not be read or the file written.   *
+******************************************************************************/
+int timetable_import(const char *dir, const char *path);
+/******************************************************************************
+* Function: timetable_open                                                    *
+* ------------------------                                                    *
+*   Maps a timetable and checks that every index in it stays inside it.       *
+*                                                                             *
+*   path: File written by timetable_import.                                   *
+*                                                                             *
+*   Returns: The timetable, close with timetable_close.                       *
+*            NULL when the file is missing or malformed.                      *
+******************************************************************************/
+timetable *timetable_open(const char *path);
+/******************************************************************************
+* Function: timetable_close                                                   *
+* -------------------------                                                   *
+*   Unmaps a timetable and frees its scratch space.                           *
+*                                                                             *
+*   tt: Pointer to the timetable.                                             *
+******************************************************************************/
+void timetable_close(timetable *tt);
+/******************************************************************************
+* Function: timetable_query                                                   *
+* -------------------------                                                   *
+*   Finds journeys between all stops of two names with rounds of RAPTOR,      *
+*   one round per vehicle. Every journey that arrives earlier than those      *
+*   with fewer vehicles is kept, and the search is repeated after the         *
+*   first departure until TT_JOURNEYS are found or no later one exists.       *
+*                                                                             *
+*   tt: Pointer to the timetable.                                             *
+*   origin: Name of the stops where travel starts, case is ignored.           *
+*   dest: Name of the stops where travel ends, case is ignored.               *
+*   when: Earliest departure, in the units of station_ref.when.               *
+*   tl: Pointer to triplist where journeys are stored as trips, previous      *
+*       records are discarded.                                                *
+*   strings: Buffer the slices of tl point into, emptied.                     *
+*                                                                             *
+*   Returns: Number of journeys found.                                        *
+*            E_TIMETABLE when a name matches no stop.                         *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int timetable_query(timetable *tt, const char *origin, const char *dest,
+		int when, triplist *tl, tsl_buf *strings);
+/******************************************************************************
+* Function: tt_search_new                                                     *
+* -----------------------                                                     *
+*   Makes scratch space for searches over a timetable.                        *
+*                                                                             *
+*   tt: Pointer to the timetable, open for as long as the search is used.     *
+*                                                                             *
+*   Returns: The search, free with tt_search_free.                            *
+*            NULL when memory runs out.                                       *
+******************************************************************************/
+tt_search *tt_search_new(const timetable *tt);
+/******************************************************************************
+* Function: tt_search_free                                                    *
+* ------------------------                                                    *
+*   Frees the scratch space of a search.                                      *
+*                                                                             *
+*   s: Pointer to the search.                                                 *
+******************************************************************************/
+void tt_search_free(tt_search *s);
+/******************************************************************************
+* Function: tt_search_query                                                   *
+* -------------------------                                                   *
+*   As timetable_query, with the scratch space of s. tl and strings keep      *
+*   their memory between queries.                                             *
+*                                                                             *
+*   s: Pointer to the search.                                                 *
+*   origin, dest, when, tl, strings: As for timetable_query.                  *
+*                                                                             *
+*   Returns: As timetable_query.                                              *
+******************************************************************************/
+int tt_search_query(tt_search *s, const char *origin, const char *dest,
+		int when, triplist *tl, tsl_buf *strings);
+/*****************************************************************************/
+#endif /* TIMETABLE_H */
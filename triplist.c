@@ -0,0 +1,733 @@
+/******************************************************************************
+*     File Name           :     triplist.c                                    *
+*     Description         :     Zero-copy TripList extraction straight from   *
+*                                 the response buffer.                        *
+******************************************************************************/
+#define _GNU_SOURCE             // qsort_r
+#include <stdint.h>             // uint32_t
+#include "triplist.h"
+#include "station.h"
+/*****************************************************************************/
+#define SLICE(js, s) (s).len, (js)+(s).off
+/*****************************************************************************/
+typedef struct scanner {char *js; char *p; char *end; triplist *tl;} scanner;
+typedef int (*scan_fn)(scanner *s);
+/*****************************************************************************/
+static int peek(scanner *s) {
+	while(s->p < s->end && (unsigned char)*s->p <= ' ') {
+		s->p++;
+	}
+	return s->p < s->end ? (unsigned char)*s->p : -1;
+}
+/*****************************************************************************/
+static int hex4(const char *p) {
+	int i, v = 0;
+	for(i = 0; i < 4; i++) {
+		char c = p[i];
+		v <<= 4;
+		if(c >= '0' && c <= '9') {
+			v |= c - '0';
+		} else if(c >= 'a' && c <= 'f') {
+			v |= c - 'a' + 10;
+		} else if(c >= 'A' && c <= 'F') {
+			v |= c - 'A' + 10;
+		} else {
+			return -1;
+		}
+	}
+	return v;
+}
+/*****************************************************************************/
+static char *put_utf8(char *d, unsigned int cp) {
+	if(cp < 0x80) {
+		*d++ = cp;
+	} else if(cp < 0x800) {
+		*d++ = 0xc0 | cp >> 6;
+		*d++ = 0x80 | (cp & 0x3f);
+	} else if(cp < 0x10000) {
+		*d++ = 0xe0 | cp >> 12;
+		*d++ = 0x80 | (cp >> 6 & 0x3f);
+		*d++ = 0x80 | (cp & 0x3f);
+	} else {
+		*d++ = 0xf0 | cp >> 18;
+		*d++ = 0x80 | (cp >> 12 & 0x3f);
+		*d++ = 0x80 | (cp >> 6 & 0x3f);
+		*d++ = 0x80 | (cp & 0x3f);
+	}
+	return d;
+}
+/*****************************************************************************/
+static int unescape(scanner *s, char **dp) {
+	/* s->p is at the character after a backslash */
+	char *d = *dp;
+	int cp, lo;
+	switch(*s->p) {
+		case 'b': *d++ = '\b'; break;
+		case 'f': *d++ = '\f'; break;
+		case 'n': *d++ = '\n'; break;
+		case 'r': *d++ = '\r'; break;
+		case 't': *d++ = '\t'; break;
+		case 'u':
+			if(s->end - s->p < 5 || (cp = hex4(s->p+1)) < 0) {
+				return E_NOJSON;
+			}
+			s->p += 4;
+			if((cp & 0xfc00) == 0xd800) {
+				if(s->end - s->p < 7 || s->p[1] != '\\' || s->p[2] != 'u'
+						|| (lo = hex4(s->p+3)) < 0 || (lo & 0xfc00) != 0xdc00) {
+					return E_NOJSON;
+				}
+				cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+				s->p += 6;
+			}
+			d = put_utf8(d, cp);
+			break;
+		default: *d++ = *s->p; break;
+	}
+	s->p++;
+	*dp = d;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int scan_string(scanner *s, slice *out) {
+	/* s->p is at the opening quote */
+	char *start = ++s->p, *d;
+	while(s->p < s->end && *s->p != '"' && *s->p != '\\') {
+		s->p++;
+	}
+	/* Strings with escapes are decoded in place, output never overtakes */
+	d = s->p;
+	while(s->p < s->end && *s->p != '"') {
+		if(*s->p == '\\') {
+			if(++s->p == s->end || unescape(s, &d)) {
+				return E_NOJSON;
+			}
+		} else {
+			*d++ = *s->p++;
+		}
+	}
+	if(s->p == s->end) {
+		return E_NOJSON;
+	}
+	out->off = start - s->js;
+	out->len = d - start;
+	s->p++;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int skip_value(scanner *s) {
+	/* Only counts brackets, fields tsl does not use are never validated */
+	int c, depth = 0;
+	do {
+		if((c = peek(s)) < 0) {
+			return E_NOJSON;
+		}
+		if(c == '"') {
+			for(s->p++; s->p < s->end && *s->p != '"'; s->p++) {
+				if(*s->p == '\\') {
+					s->p++;
+				}
+			}
+			if(s->p >= s->end) {
+				return E_NOJSON;
+			}
+			s->p++;
+		} else if(c == '{' || c == '[') {
+			depth++;
+			s->p++;
+		} else if(c == '}' || c == ']') {
+			if(--depth < 0) {
+				return E_NOJSON;
+			}
+			s->p++;
+		} else if(c == ',' || c == ':') {
+			s->p++;
+		} else {
+			while(s->p < s->end && !strchr(",:]} \t\r\n", *s->p)) {
+				s->p++;
+			}
+		}
+	} while(depth > 0);
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int object_begin(scanner *s) {
+	if(peek(s) != '{') {
+		return E_NOJSON;
+	}
+	s->p++;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int object_next(scanner *s, slice *key) {
+	/* Returns 1 when a key was read, 0 at the end of the object */
+	int c = peek(s);
+	if(c == ',') {
+		s->p++;
+		c = peek(s);
+	}
+	if(c == '}') {
+		s->p++;
+		return 0;
+	}
+	if(c != '"' || scan_string(s, key) || peek(s) != ':') {
+		return E_NOJSON;
+	}
+	s->p++;
+	return 1;
+}
+/*****************************************************************************/
+static int key_is(scanner *s, slice key, const char *name) {
+	return (int)strlen(name) == key.len && !memcmp(s->js+key.off, name, key.len);
+}
+/*****************************************************************************/
+static int scan_field(scanner *s, slice *out) {
+	if(peek(s) == '"') {
+		return scan_string(s, out);
+	}
+	return skip_value(s);
+}
+/*****************************************************************************/
+static int scan_one_or_many(scanner *s, scan_fn fn) {
+	/* SL sends a single object instead of an array of length one */
+	int c, retval;
+	if(peek(s) != '[') {
+		return fn(s);
+	}
+	s->p++;
+	while((c = peek(s)) != ']') {
+		if(c == ',') {
+			s->p++;
+		} else if(c < 0) {
+			return E_NOJSON;
+		} else if((retval = fn(s))) {
+			return retval;
+		}
+	}
+	s->p++;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int grow(void **array, int *cap, int len, size_t size) {
+	void *new_array;
+	int new_cap;
+	if(len < *cap) {
+		return E_SUCCESS;
+	}
+	new_cap = *cap ? *cap*2 : 16;
+	metrics_alloc(1);
+	if(!(new_array = realloc(*array, new_cap*size))) {
+		return E_UNKNOWN;
+	}
+	*array = new_array;
+	*cap = new_cap;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int parse_clock(const char *p, int len) {
+	/* "HH:MM" to minutes since midnight, every byte is checked at once */
+	unsigned h1, h2, m1, m2;
+	if(len != 5) {
+		return -1;
+	}
+	h1 = p[0]-'0'; h2 = p[1]-'0'; m1 = p[3]-'0'; m2 = p[4]-'0';
+	return (h1 < 3) & (h2 < 10) & (h1*10+h2 < 24) & (m1 < 6) & (m2 < 10)
+			& (p[2] == ':') ? (int)((h1*10+h2)*60 + m1*10+m2) : -1;
+}
+/*****************************************************************************/
+static int parse_date(const char *p, int len) {
+	/* "YYYY-MM-DD" to days since 1970-01-01, by the civil calendar
+	 * without a branch on the month */
+	static const char pos[8] = {0, 1, 2, 3, 5, 6, 8, 9};
+	unsigned d[8];
+	int i, ok, y, m, day, era, yoe, doy;
+	if(len != 10) {
+		return -1;
+	}
+	for(i = 0, ok = (p[4] == '-') & (p[7] == '-'); i < 8; i++) {
+		d[i] = p[(int)pos[i]]-'0';
+		ok &= d[i] < 10;
+	}
+	y = d[0]*1000 + d[1]*100 + d[2]*10 + d[3];
+	m = d[4]*10 + d[5];
+	day = d[6]*10 + d[7];
+	ok &= (m >= 1) & (m <= 12) & (day >= 1) & (y >= 1970);
+	y -= m <= 2;
+	era = y/400;
+	yoe = y - era*400;
+	doy = (153*(m + 9 - 12*(m > 2)) + 2)/5 + day-1;
+	return ok ? era*146097 + yoe*365 + yoe/4 - yoe/100 + doy - 719468 : -1;
+}
+/*****************************************************************************/
+static int parse_minutes(const char *p, int len) {
+	/* Durations are whole minutes, or "H:MM" */
+	unsigned digit, m1, m2;
+	int i, minutes = 0;
+	if(len < 1 || len > 6) {
+		return -1;
+	}
+	for(i = 0; i < len; i++) {
+		if(p[i] == ':' && i > 0 && len-i == 3) {
+			m1 = p[i+1]-'0';
+			m2 = p[i+2]-'0';
+			return (m1 < 6) & (m2 < 10) ? minutes*60 + (int)(m1*10+m2) : -1;
+		}
+		if((digit = p[i]-'0') >= 10) {
+			return -1;
+		}
+		minutes = minutes*10 + digit;
+	}
+	return minutes;
+}
+/*****************************************************************************/
+static int scan_station(scanner *s, station_ref *st) {
+	slice key, date = {0, 0};
+	int retval, days;
+	if(object_begin(s)) {
+		return E_NOJSON;
+	}
+	while((retval = object_next(s, &key)) > 0) {
+		if(key_is(s, key, "name")) {
+			retval = scan_field(s, &st->name);
+		} else if(key_is(s, key, "time")) {
+			retval = scan_field(s, &st->time);
+		} else if(key_is(s, key, "date")) {
+			retval = scan_field(s, &date);
+		} else {
+			retval = skip_value(s);
+		}
+		if(retval) {
+			return retval;
+		}
+	}
+	if(retval) {
+		return retval;
+	}
+	if((st->id = station_intern(s->js+st->name.off, st->name.len)) < 0) {
+		return st->id;
+	}
+	if((st->when = parse_clock(s->js+st->time.off, st->time.len)) >= 0
+			&& (days = parse_date(s->js+date.off, date.len)) >= 0) {
+		st->when += days*24*60;
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int scan_edge(scanner *s) {
+	triplist *tl = s->tl;
+	edge_ref *ed;
+	slice key;
+	int retval;
+	/* Running out of memory is not a malformed response */
+	if((retval = grow((void**)&tl->edges, &tl->edges_cap, tl->edges_len,
+			sizeof(edge_ref)))) {
+		return retval;
+	}
+	if(object_begin(s)) {
+		return E_NOJSON;
+	}
+	ed = &tl->edges[tl->edges_len++];
+	memset(ed, 0, sizeof(edge_ref));
+	ed->origin.id = ed->dest.id = -1;
+	ed->origin.when = ed->dest.when = -1;
+	while((retval = object_next(s, &key)) > 0) {
+		if(key_is(s, key, "name")) {
+			retval = scan_field(s, &ed->type);
+		} else if(key_is(s, key, "Origin")) {
+			retval = scan_station(s, &ed->origin);
+		} else if(key_is(s, key, "Destination")) {
+			retval = scan_station(s, &ed->dest);
+		} else {
+			retval = skip_value(s);
+		}
+		if(retval) {
+			return retval;
+		}
+	}
+	return retval;
+}
+/*****************************************************************************/
+static int scan_edge_list(scanner *s) {
+	slice key;
+	int retval;
+	if(object_begin(s)) {
+		return E_NOJSON;
+	}
+	while((retval = object_next(s, &key)) > 0) {
+		if(key_is(s, key, "Leg")) {
+			retval = scan_one_or_many(s, scan_edge);
+		} else {
+			retval = skip_value(s);
+		}
+		if(retval) {
+			return retval;
+		}
+	}
+	return retval;
+}
+/*****************************************************************************/
+static int scan_trip(scanner *s) {
+	triplist *tl = s->tl;
+	int index = tl->trips_len;
+	trip_ref *tr;
+	slice key;
+	int retval;
+	if((retval = grow((void**)&tl->trips, &tl->trips_cap, tl->trips_len,
+			sizeof(trip_ref)))) {
+		return retval;
+	}
+	if(object_begin(s)) {
+		return E_NOJSON;
+	}
+	tl->trips_len++;
+	memset(&tl->trips[index], 0, sizeof(trip_ref));
+	tl->trips[index].edges_off = tl->edges_len;
+	while((retval = object_next(s, &key)) > 0) {
+		if(key_is(s, key, "dur")) {
+			retval = scan_field(s, &tl->trips[index].dur);
+		} else if(key_is(s, key, "LegList")) {
+			retval = scan_edge_list(s);
+		} else {
+			retval = skip_value(s);
+		}
+		if(retval) {
+			return retval;
+		}
+	}
+	tr = &tl->trips[index];
+	tr->edges_len = tl->edges_len - tr->edges_off;
+	tr->minutes = parse_minutes(s->js+tr->dur.off, tr->dur.len);
+	tr->depart = tr->edges_len ? tl->edges[tr->edges_off].origin.when : -1;
+	tr->arrive = tr->edges_len ? tl->edges[tl->edges_len-1].dest.when : -1;
+	return retval;
+}
+/*****************************************************************************/
+static int scan_trip_list(scanner *s) {
+	slice key;
+	int retval;
+	if(object_begin(s)) {
+		return E_NOJSON;
+	}
+	while((retval = object_next(s, &key)) > 0) {
+		if(key_is(s, key, "Trip")) {
+			retval = scan_one_or_many(s, scan_trip);
+		} else {
+			retval = skip_value(s);
+		}
+		if(retval) {
+			return retval;
+		}
+	}
+	return retval;
+}
+/*****************************************************************************/
+void triplist_init(triplist *tl) {
+	memset(tl, 0, sizeof(triplist));
+}
+/*****************************************************************************/
+void triplist_free(triplist *tl) {
+	free(tl->trips);
+	free(tl->edges);
+	triplist_init(tl);
+}
+/*****************************************************************************/
+int scan_trips(char *js, int len, triplist *tl) {
+	scanner s = {js, js, js+len, tl};
+	slice key;
+	int retval;
+	tl->trips_len = 0;
+	tl->edges_len = 0;
+	if(object_begin(&s)) {
+		return E_NOJSON;
+	}
+	while((retval = object_next(&s, &key)) > 0) {
+		if(key_is(&s, key, "TripList")) {
+			retval = scan_trip_list(&s);
+		} else {
+			retval = skip_value(&s);
+		}
+		if(retval) {
+			return retval;
+		}
+	}
+	if(retval < 0) {
+		return retval;
+	}
+	return tl->trips_len;
+}
+/*****************************************************************************/
+int print_selection(FILE *out, const char *strings, const trip_ref *trips,
+		const edge_ref *edges, const int *selected, int num_selected) {
+	int i, j;
+	for(i = 0; i < num_selected; i++) {
+		const trip_ref *tr = &trips[selected ? selected[i] : i];
+		fprintf(out, "(%.*s min)\n", SLICE(strings, tr->dur));
+		for(j = 0; j < tr->edges_len; j++) {
+			const edge_ref *ed = &edges[tr->edges_off + j];
+			fprintf(out, "  [%.*s : %.*s] ---{%.*s}---> [%.*s : %.*s]\n",
+					SLICE(strings, ed->origin.name), SLICE(strings, ed->origin.time),
+					SLICE(strings, ed->type),
+					SLICE(strings, ed->dest.name), SLICE(strings, ed->dest.time));
+		}
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+int print_triplist(FILE *out, const char *js, const triplist *tl) {
+	return print_selection(out, js, tl->trips, tl->edges, NULL, tl->trips_len);
+}
+/*****************************************************************************/
+void trip_filter_init(trip_filter *f) {
+	f->depart_after = f->arrive_before = f->max_minutes = f->max_legs = -1;
+}
+/*****************************************************************************/
+static int clock_diff(int a, int b) {
+	/* Times without a date are only compared by the time of day */
+	return a < 24*60 || b < 24*60 ? a%(24*60) - b%(24*60) : a - b;
+}
+/*****************************************************************************/
+static int keep_trip(const trip_ref *tr, const trip_filter *f) {
+	return (f->depart_after < 0 || (tr->depart >= 0
+			&& clock_diff(tr->depart, f->depart_after) >= 0))
+		&& (f->arrive_before < 0 || (tr->arrive >= 0
+			&& clock_diff(tr->arrive, f->arrive_before) <= 0))
+		&& (f->max_minutes < 0 || (tr->minutes >= 0
+			&& tr->minutes <= f->max_minutes))
+		&& (f->max_legs < 0 || tr->edges_len <= f->max_legs);
+}
+/*****************************************************************************/
+static uint32_t trip_key(const trip_ref *tr, int order) {
+	/* Unknown values are -1, which as unsigned puts them last */
+	return order == TRIP_ORDER_DEPART ? tr->depart
+			: order == TRIP_ORDER_ARRIVE ? tr->arrive
+			: order == TRIP_ORDER_DURATION ? tr->minutes : tr->edges_len;
+}
+/*****************************************************************************/
+typedef struct trip_order_ctx {const trip_ref *trips; int order;} trip_order_ctx;
+/*****************************************************************************/
+static int compare_selected(const void *a, const void *b, void *arg) {
+	/* Ties fall back on the position, so the sort keeps the response order */
+	const trip_order_ctx *ctx = arg;
+	int i = *(const int*)a, j = *(const int*)b;
+	uint32_t x = trip_key(&ctx->trips[i], ctx->order);
+	uint32_t y = trip_key(&ctx->trips[j], ctx->order);
+	return x != y ? (x > y) - (x < y) : (i > j) - (i < j);
+}
+/*****************************************************************************/
+int select_trips(const trip_ref *trips, int trips_len, const trip_filter *f,
+		int order, int *selected) {
+	/* Sorted in place through the comparator, nothing is allocated */
+	trip_order_ctx ctx = {trips, order};
+	int i, len = 0;
+	for(i = 0; i < trips_len; i++) {
+		if(!f || keep_trip(&trips[i], f)) {
+			selected[len++] = i;
+		}
+	}
+	if(order != TRIP_ORDER_NONE && len > 1) {
+		qsort_r(selected, len, sizeof(int), compare_selected, &ctx);
+	}
+	return len;
+}
+/*****************************************************************************/
+static void pool_slice(char *pool, int *pool_len, const char *js, slice *s) {
+	/* Moves a slice of js into the pool, '\0' terminated */
+	if(pool) {
+		memcpy(pool+*pool_len, js+s->off, s->len);
+		pool[*pool_len+s->len] = '\0';
+		s->off = *pool_len;
+	}
+	*pool_len += s->len+1;
+}
+/*****************************************************************************/
+static void pool_station(char *pool, int *pool_len, const char *js,
+		station_ref *st, int *offs, int num_offs) {
+	/* Names seen before in this block point at their first copy. Without
+	 * a pool only the size is counted and the slices are left alone. Ids
+	 * interned after offs was sized are copied every time */
+	int known = st->id >= 0 && st->id < num_offs;
+	if(known && offs[st->id] >= 0) {
+		if(pool) {
+			st->name.off = offs[st->id];
+		}
+	} else {
+		pool_slice(pool, pool_len, js, &st->name);
+		if(known) {
+			offs[st->id] = pool ? st->name.off : 0;
+		}
+	}
+	pool_slice(pool, pool_len, js, &st->time);
+}
+/*****************************************************************************/
+int pack_selection(trip_block *tb, int *offs, int num_offs,
+		const char *strings, const trip_ref *trips, const edge_ref *edges,
+		const int *selected, int num_selected) {
+	/* Edges of the chosen trips are laid out in the order of the trips,
+	 * then their strings are pooled, durations last */
+	char *pool = NULL;
+	int i, j, n = 0, pool_off, pool_len = 0;
+	for(i = 0; i < num_selected; i++) {
+		n += trips[selected ? selected[i] : i].edges_len;
+	}
+	pool_off = sizeof(trip_block) + sizeof(trip_ref)*num_selected
+			+ sizeof(edge_ref)*n;
+	if(tb) {
+		tb->magic = TRIP_BLOCK_MAGIC;
+		tb->trips_len = num_selected;
+		tb->edges_len = n;
+		tb->pool_off = pool_off;
+		pool = TRIP_BLOCK_POOL(tb);
+	}
+	memset(offs, -1, sizeof(int)*num_offs);
+	for(i = 0, n = 0; i < num_selected; i++) {
+		const trip_ref *tr = &trips[selected ? selected[i] : i];
+		for(j = 0; j < tr->edges_len; j++, n++) {
+			edge_ref ed = edges[tr->edges_off + j];
+			pool_slice(pool, &pool_len, strings, &ed.type);
+			pool_station(pool, &pool_len, strings, &ed.origin, offs, num_offs);
+			pool_station(pool, &pool_len, strings, &ed.dest, offs, num_offs);
+			if(tb) {
+				ed.origin.id = ed.dest.id = -1;
+				TRIP_BLOCK_EDGES(tb)[n] = ed;
+			}
+		}
+	}
+	for(i = 0, n = 0; i < num_selected; i++) {
+		trip_ref tr = trips[selected ? selected[i] : i];
+		pool_slice(pool, &pool_len, strings, &tr.dur);
+		tr.edges_off = n;
+		n += tr.edges_len;
+		if(tb) {
+			TRIP_BLOCK_TRIPS(tb)[i] = tr;
+		}
+	}
+	if(tb) {
+		tb->size = pool_off+pool_len;
+		tb->pool_len = pool_len;
+	}
+	return pool_off+pool_len;
+}
+/*****************************************************************************/
+trip_block *pack_triplist(const char *js, const triplist *tl) {
+	/* The block is sized by a dry run over the slices, so it is one
+	 * allocation. Interned ids tell which names are repeated */
+	trip_block *tb = NULL;
+	int count = station_count(), *offs = malloc(sizeof(int)*(count+1));
+	metrics_alloc(2);
+	if(offs && (tb = malloc(pack_selection(NULL, offs, count, js, tl->trips,
+			tl->edges, NULL, tl->trips_len)))) {
+		pack_selection(tb, offs, count, js, tl->trips, tl->edges, NULL,
+				tl->trips_len);
+	}
+	free(offs);
+	return tb;
+}
+/*****************************************************************************/
+static int check_slice(const trip_block *tb, slice s) {
+	return s.off >= 0 && s.len >= 0 && s.len < tb->pool_len
+			&& s.off < tb->pool_len-s.len;
+}
+/*****************************************************************************/
+int check_trip_block(const void *data, size_t len) {
+	/* Everything is checked before use, the block may come from a file */
+	const trip_block *tb = data;
+	const trip_ref *trips;
+	const edge_ref *edges;
+	int i;
+	if(len < sizeof(trip_block) || tb->magic != TRIP_BLOCK_MAGIC
+			|| tb->size < 0 || (size_t)tb->size != len
+			|| tb->trips_len < 0 || tb->edges_len < 0 || tb->pool_len < 0
+			|| (uint64_t)sizeof(trip_block) + sizeof(trip_ref)*(uint64_t)tb->trips_len
+			+ sizeof(edge_ref)*(uint64_t)tb->edges_len != (uint64_t)tb->pool_off
+			|| (uint64_t)tb->pool_off+tb->pool_len != (uint64_t)tb->size) {
+		return E_NOJSON;
+	}
+	trips = TRIP_BLOCK_TRIPS(tb);
+	edges = TRIP_BLOCK_EDGES(tb);
+	for(i = 0; i < tb->trips_len; i++) {
+		if(!check_slice(tb, trips[i].dur) || trips[i].edges_off < 0
+				|| trips[i].edges_len < 0
+				|| trips[i].edges_off > tb->edges_len-trips[i].edges_len) {
+			return E_NOJSON;
+		}
+	}
+	for(i = 0; i < tb->edges_len; i++) {
+		if(!check_slice(tb, edges[i].type)
+				|| !check_slice(tb, edges[i].origin.name)
+				|| !check_slice(tb, edges[i].origin.time)
+				|| !check_slice(tb, edges[i].dest.name)
+				|| !check_slice(tb, edges[i].dest.time)) {
+			return E_NOJSON;
+		}
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+int print_trip_block(FILE *out, const trip_block *tb) {
+	return print_selection(out, TRIP_BLOCK_POOL(tb), TRIP_BLOCK_TRIPS(tb),
+			TRIP_BLOCK_EDGES(tb), NULL, tb->trips_len);
+}
+/*****************************************************************************/
+static int same_slice(const char *a, slice x, const char *b, slice y) {
+	return x.len == y.len && !memcmp(a+x.off, b+y.off, x.len);
+}
+/*****************************************************************************/
+static int same_trip(const char *a, const trip_ref *x, const edge_ref *xe,
+		const char *b, const trip_ref *y, const edge_ref *ye, int exact) {
+	/* Names are compared as strings, ids are not kept in a block */
+	int i;
+	if(x->edges_len != y->edges_len || (x->edges_len
+			&& !same_slice(a, xe->origin.time, b, ye->origin.time))
+			|| (exact && !same_slice(a, x->dur, b, y->dur))) {
+		return 0;
+	}
+	for(i = 0; i < x->edges_len; i++) {
+		if(!same_slice(a, xe[i].type, b, ye[i].type)
+				|| !same_slice(a, xe[i].origin.name, b, ye[i].origin.name)
+				|| !same_slice(a, xe[i].dest.name, b, ye[i].dest.name)
+				|| (exact && (!same_slice(a, xe[i].origin.time, b,
+					ye[i].origin.time) || !same_slice(a, xe[i].dest.time, b,
+					ye[i].dest.time)))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+/*****************************************************************************/
+int diff_trips(const trip_block *tb, int *old_marks, const char *strings,
+		const trip_ref *trips, const edge_ref *edges, const int *selected,
+		int num_selected, int *marks) {
+	/* Unchanged trips are matched first, so a trip that repeats through
+	 * the day is not taken for a changed copy of another. Results hold a
+	 * handful of trips, so every pair is compared */
+	const trip_ref *old = tb ? TRIP_BLOCK_TRIPS(tb) : NULL, *tr;
+	const edge_ref *old_edges = tb ? TRIP_BLOCK_EDGES(tb) : NULL;
+	const char *pool = tb ? TRIP_BLOCK_POOL(tb) : NULL;
+	int i, j, exact, old_len = tb ? tb->trips_len : 0, changes = 0;
+	for(i = 0; i < old_len; i++) {
+		old_marks[i] = TRIP_REMOVED;
+	}
+	for(j = 0; j < num_selected; j++) {
+		marks[j] = TRIP_ADDED;
+	}
+	for(exact = 1; exact >= 0; exact--) {
+		for(j = 0; j < num_selected; j++) {
+			tr = &trips[selected ? selected[j] : j];
+			for(i = 0; marks[j] == TRIP_ADDED && i < old_len; i++) {
+				if(old_marks[i] == TRIP_REMOVED && same_trip(pool, &old[i],
+						&old_edges[old[i].edges_off], strings, tr,
+						&edges[tr->edges_off], exact)) {
+					old_marks[i] = marks[j] = exact ? TRIP_SAME : TRIP_CHANGED;
+				}
+			}
+		}
+	}
+	for(i = 0; i < old_len; i++) {
+		changes += old_marks[i] == TRIP_REMOVED;
+	}
+	for(j = 0; j < num_selected; j++) {
+		changes += marks[j] != TRIP_SAME;
+	}
+	return changes;
+}
+/*****************************************************************************/
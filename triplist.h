@@ -0,0 +1,294 @@
+/******************************************************************************
+*     File Name           :     triplist.h                                    *
+*     Description         :     Zero-copy TripList extraction straight from   *
+*                                 the response buffer.                        *
+******************************************************************************/
+#ifndef TRIPLIST_H
+#define TRIPLIST_H
+#include "tsl.h"                // error numbers
+/******************************************************************************
+* Struct: slice                                                               *
+* -------------                                                               *
+*   A string inside the response buffer. Escaped strings are decoded in       *
+*   place, so a slice never needs to be copied before use.                    *
+*                                                                             *
+*   off: Offset of the first byte from the start of the buffer.               *
+*   len: Number of bytes, 0 if the field was missing.                         *
+******************************************************************************/
+typedef struct slice {int off; int len;} slice;
+/******************************************************************************
+* Struct: station_ref                                                         *
+* -------------------                                                         *
+*   Arrival at a station, see struct station.                                 *
+*                                                                             *
+*   id: Interned name, see station_intern. -1 in a trip_block, as ids only    *
+*       hold in the process that made them.                                   *
+*   when: Minutes since 1970-01-01 00:00 when the station has a date,         *
+*         minutes since midnight when it has none, -1 without a valid time.   *
+******************************************************************************/
+typedef struct station_ref {
+	slice name; slice time;
+	int id; int when;
+} station_ref;
+/******************************************************************************
+* Struct: edge_ref                                                            *
+* ----------------                                                            *
+*   Travel between two stations, see struct edge.                             *
+******************************************************************************/
+typedef struct edge_ref {slice type; station_ref origin; station_ref dest;} edge_ref;
+/******************************************************************************
+* Struct: trip_ref                                                            *
+* ----------------                                                            *
+*   Travel over a run of edges, see struct trip.                              *
+*                                                                             *
+*   dur: Duration of the travel.                                              *
+*   edges_off: Index of the first edge in triplist.edges.                     *
+*   edges_len: Number of edges.                                               *
+*   minutes: Duration in minutes, -1 if dur is not a number.                  *
+*   depart: When of the origin of the first edge, -1 if unknown.              *
+*   arrive: When of the destination of the last edge, -1 if unknown.          *
+******************************************************************************/
+typedef struct trip_ref {
+	slice dur; int edges_off; int edges_len;
+	int minutes; int depart; int arrive;
+} trip_ref;
+/******************************************************************************
+* Struct: triplist                                                            *
+* ----------------                                                            *
+*   Flat record arrays filled by scan_trips. The arrays are kept between      *
+*   scans and only grow, so repeated queries stop allocating.                 *
+*                                                                             *
+*   trips: Array of trips_len trips.                                          *
+*   edges: Array of edges_len edges, shared by all trips.                     *
+******************************************************************************/
+typedef struct triplist {
+	trip_ref *trips; int trips_len; int trips_cap;
+	edge_ref *edges; int edges_len; int edges_cap;
+} triplist;
+/******************************************************************************
+* Function: triplist_init                                                     *
+* -----------------------                                                     *
+*   Initializes an empty triplist.                                            *
+*                                                                             *
+*   tl: Pointer to the triplist.                                              *
+******************************************************************************/
+void triplist_init(triplist *tl);
+/******************************************************************************
+* Function: triplist_free                                                     *
+* -----------------------                                                     *
+*   Frees the record arrays of a triplist.                                    *
+*                                                                             *
+*   tl: Pointer to the triplist.                                              *
+******************************************************************************/
+void triplist_free(triplist *tl);
+/******************************************************************************
+* Function: scan_trips                                                        *
+* --------------------                                                        *
+*   Walks a TripList json string once and records trips, edges and stations   *
+*   as slices into it, skipping every field that tsl does not use.            *
+*                                                                             *
+*   js: Json string, escaped strings in it are decoded in place.              *
+*   len: Length of the json string.                                           *
+*   tl: Pointer to triplist where records are stored, previous records are    *
+*       discarded.                                                            *
+*                                                                             *
+*   Returns: Number of trips that were found in the json.                     *
+*            E_NOJSON when the json is malformed.                             *
+*            E_UNKNOWN when memory runs out or a station name can not be      *
+*            interned.                                                        *
+******************************************************************************/
+int scan_trips(char *js, int len, triplist *tl);
+/******************************************************************************
+* Function: print_triplist                                                    *
+* ------------------------                                                    *
+*   Prints data of trips in the same format as print_trips.                   *
+*                                                                             *
+*   out: Stream to print to.                                                  *
+*   js: Json string that tl was scanned from.                                 *
+*   tl: Pointer to triplist.                                                  *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+******************************************************************************/
+int print_triplist(FILE *out, const char *js, const triplist *tl);
+/* Orders of select_trips */
+enum trip_order {
+	TRIP_ORDER_NONE,			// As in the response.
+	TRIP_ORDER_DEPART,			// Earliest departure first.
+	TRIP_ORDER_ARRIVE,			// Earliest arrival first.
+	TRIP_ORDER_DURATION,		// Shortest first.
+	TRIP_ORDER_LEGS				// Fewest edges first.
+};
+/******************************************************************************
+* Struct: trip_filter                                                         *
+* -------------------                                                         *
+*   Limits on the trips kept by select_trips, -1 for no limit. A trip         *
+*   missing a value that is limited is not kept. Times are compared as        *
+*   minutes since midnight when either side has no date.                      *
+*                                                                             *
+*   depart_after: Earliest departure, in the units of station_ref.when.       *
+*   arrive_before: Latest arrival, in the units of station_ref.when.          *
+*   max_minutes: Longest duration.                                            *
+*   max_legs: Most edges.                                                     *
+******************************************************************************/
+typedef struct trip_filter {
+	int depart_after;
+	int arrive_before;
+	int max_minutes;
+	int max_legs;
+} trip_filter;
+/******************************************************************************
+* Function: trip_filter_init                                                  *
+* --------------------------                                                  *
+*   Sets up a filter that keeps every trip.                                   *
+*                                                                             *
+*   f: Pointer to the filter.                                                 *
+******************************************************************************/
+void trip_filter_init(trip_filter *f);
+/******************************************************************************
+* Function: select_trips                                                      *
+* ----------------------                                                      *
+*   Filters and orders trips on their decoded numbers alone. Works on the     *
+*   trips of a triplist as well as those of a trip_block.                     *
+*                                                                             *
+*   trips: Array of trips.                                                    *
+*   trips_len: Number of trips.                                               *
+*   f: Limits on the trips kept, NULL to keep all.                            *
+*   order: An enum trip_order, ties keep the order of the response.           *
+*   selected: Array of trips_len ints where indexes of the kept trips are     *
+*             stored in order.                                                *
+*                                                                             *
+*   Returns: Number of trips kept, nothing is allocated.                      *
+******************************************************************************/
+int select_trips(const trip_ref *trips, int trips_len, const trip_filter *f,
+		int order, int *selected);
+/******************************************************************************
+* Function: print_selection                                                   *
+* -------------------------                                                   *
+*   Prints chosen trips in the same format as print_triplist.                 *
+*                                                                             *
+*   out: Stream to print to.                                                  *
+*   strings: Json string of a triplist, or the pool of a trip_block.          *
+*   trips: Array of trips.                                                    *
+*   edges: Array of edges of the trips.                                       *
+*   selected: Indexes of the trips to print, NULL for the first ones.         *
+*   num_selected: Number of trips to print.                                   *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+******************************************************************************/
+int print_selection(FILE *out, const char *strings, const trip_ref *trips,
+		const edge_ref *edges, const int *selected, int num_selected);
+/******************************************************************************
+* Struct: trip_block                                                          *
+* ------------------                                                          *
+*   Trips packed into one contiguous block: this header, trips_len trip_refs, *
+*   edges_len edge_refs and a pool of '\0' terminated strings, with slices    *
+*   being offsets into the pool. Every station name is in the pool once.      *
+*   Nothing in the block is a pointer, so it can be written to disk, mapped   *
+*   or shared between processes as it is, and freed with one free.            *
+*                                                                             *
+*   magic: TRIP_BLOCK_MAGIC.                                                  *
+*   size: Bytes of the whole block.                                           *
+*   trips_len: Number of trips.                                               *
+*   edges_len: Number of edges.                                               *
+*   pool_off: Offset of the pool from the start of the block.                 *
+*   pool_len: Bytes of the pool.                                              *
+******************************************************************************/
+typedef struct trip_block {
+	int magic; int size;
+	int trips_len; int edges_len;
+	int pool_off; int pool_len;
+} trip_block;
+#define TRIP_BLOCK_MAGIC 0x42505254 	// "TRPB"
+#define TRIP_BLOCK_TRIPS(tb) ((trip_ref*)((tb)+1))
+#define TRIP_BLOCK_EDGES(tb) ((edge_ref*)(TRIP_BLOCK_TRIPS(tb)+(tb)->trips_len))
+#define TRIP_BLOCK_POOL(tb) ((char*)(tb)+(tb)->pool_off)
+/******************************************************************************
+* Function: pack_triplist                                                     *
+* -----------------------                                                     *
+*   Copies scanned trips and the strings they refer to into a trip_block.     *
+*                                                                             *
+*   js: Json string that tl was scanned from.                                 *
+*   tl: Pointer to triplist.                                                  *
+*                                                                             *
+*   Returns: The block, free with free.                                       *
+*            NULL when memory runs out.                                       *
+******************************************************************************/
+trip_block *pack_triplist(const char *js, const triplist *tl);
+/******************************************************************************
+* Function: pack_selection                                                    *
+* ------------------------                                                    *
+*   Copies chosen trips and the strings they refer to into a trip_block in    *
+*   the order they are chosen, or counts the bytes such a block takes.        *
+*                                                                             *
+*   tb: Where the block is stored, NULL to only count its size.               *
+*   offs: Scratch space of num_offs ints.                                     *
+*   num_offs: What station_count() returned when offs was sized, read once.   *
+*             Stations interned since are not looked up in offs.              *
+*   strings: Json string of a triplist, or the pool of a trip_block.          *
+*   trips: Array of trips.                                                    *
+*   edges: Array of edges of the trips.                                       *
+*   selected: Indexes of the trips to copy, NULL for the first ones.          *
+*   num_selected: Number of trips to copy.                                    *
+*                                                                             *
+*   Returns: Bytes of the block.                                              *
+******************************************************************************/
+int pack_selection(trip_block *tb, int *offs, int num_offs,
+		const char *strings, const trip_ref *trips, const edge_ref *edges,
+		const int *selected, int num_selected);
+/******************************************************************************
+* Function: check_trip_block                                                  *
+* --------------------------                                                  *
+*   Checks that a block read from outside the process is whole and that       *
+*   every offset in it stays inside it.                                       *
+*                                                                             *
+*   data: The block.                                                          *
+*   len: Bytes available at data.                                             *
+*                                                                             *
+*   Returns: E_SUCCESS if the block can be used.                              *
+*            E_NOJSON when it is malformed.                                   *
+******************************************************************************/
+int check_trip_block(const void *data, size_t len);
+/******************************************************************************
+* Function: print_trip_block                                                  *
+* --------------------------                                                  *
+*   Prints packed trips in the same format as print_triplist.                 *
+*                                                                             *
+*   out: Stream to print to.                                                  *
+*   tb: Pointer to the block.                                                 *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+******************************************************************************/
+int print_trip_block(FILE *out, const trip_block *tb);
+/* Marks of diff_trips */
+enum trip_change {
+	TRIP_SAME,					// In both results as it was.
+	TRIP_ADDED,					// Only in the new result.
+	TRIP_REMOVED,				// Only in the old result.
+	TRIP_CHANGED				// In both, with other times.
+};
+/******************************************************************************
+* Function: diff_trips                                                        *
+* --------------------                                                        *
+*   Matches chosen trips against those of a block packed from an earlier      *
+*   result. Trips are the same trip when their legs have the same types and   *
+*   stations and they depart at the same time, and changed when any other     *
+*   time or the duration differs.                                             *
+*                                                                             *
+*   tb: Block of the earlier trips, NULL when there were none.                *
+*   old_marks: Array of tb->trips_len ints, set to TRIP_REMOVED or to the     *
+*              mark of the trip matched.                                      *
+*   strings: Json string of a triplist, or the pool of a trip_block.          *
+*   trips: Array of trips.                                                    *
+*   edges: Array of edges of the trips.                                       *
+*   selected: Indexes of the trips to match, NULL for the first ones.         *
+*   num_selected: Number of trips to match.                                   *
+*   marks: Array of num_selected ints, set to TRIP_SAME, TRIP_ADDED or        *
+*          TRIP_CHANGED.                                                      *
+*                                                                             *
+*   Returns: Number of trips added, removed or changed.                       *
+******************************************************************************/
+int diff_trips(const trip_block *tb, int *old_marks, const char *strings,
+		const trip_ref *trips, const edge_ref *edges, const int *selected,
+		int num_selected, int *marks);
+/*****************************************************************************/
+#endif /* TRIPLIST_H */
@@ -5,244 +5,266 @@
 *     Last Modified       :     [2016-06-16 14:07]                            *
 *     Description         :     tsl finds info on SL departures and arrivals. *
 ******************************************************************************/
+#define _GNU_SOURCE             // pipe2
+#include <fcntl.h>              // O_NONBLOCK, O_CLOEXEC
+#include <signal.h>             // sigaction, SIGINT, SIGTERM
 #include "tsl.h"
+#include "answer.h"
+#include "server.h"
 /*****************************************************************************/
-int main(int argc, char *argv[]) {
-	char *js;
-	int retval;
-	trip *trips;
-	const nx_json *jsmap;
-
-	if(argc < 2) {
-		printf("tsl <Origin> <Destination>\n");
-		return -1;
-	}
-
-	/* Get data from server */
-	retval = get_request(&js, argv[1], argv[2]);
-	/* Extract json from data */
-	extract_js(&js, retval);
-	/* Parse json */
-	jsmap = nx_json_parse(js, 0);
-	/* Free js since it will no longer be used */
-	free(js);
-	/* Extract properties */
-	retval = extract_trips(jsmap, &trips);
-	/* Print properties */
-	print_trips(trips, retval);
-	/* Free memory */
-	free_trips(trips, retval);
-
-	return 0;
+static int stop_fd = -1;		// Written to when SIGINT or SIGTERM arrive.
+/*****************************************************************************/
+static void usage(void) {
+	printf("tsl [-c <cache dir>] [-t <ttl>] [-s <stale>] [-w <seconds>]\n"
+			"    [-q <per minute>] <Origin> <Destination>\n"
+			"tsl [-c <cache dir>] [-j <in-flight>] [-e epoll|uring] -b <file|->\n"
+			"    [-o dep|arr|dur|legs] [-a <HH:MM|now>] [-r <HH:MM>]\n"
+			"    [-f text|json|bin] [-q <per minute>] [-S]\n"
+			"tsl [-j <in-flight>] [-t <ttl>] [-s <stale>] [-q <per minute>]\n"
+			"    -D <socket>\n"
+			"tsl -g <timetable> <Origin> <Destination> | [-p <threads>] -b <file|->\n"
+			"tsl -G <gtfs dir> -g <timetable>\n"
+			"tsl -d <socket> <Origin> <Destination> | -b <file|->\n"
+			"tsl -N <site list> -n <site index>\n"
+			"tsl -n <site index> -k <text> | <any of the above>\n");
 }
 /*****************************************************************************/
-int get_request(char **js, char *origin, char *dest) {
-	int sock_fd;
-	struct sockaddr_in serv_addr;
-	char *http_get = (char*) malloc(sizeof(char)*MESSAGE_SIZE);
-	*js = (char*) malloc(sizeof(char)*RESPONSE_SIZE);
-	//struct hostent *server = gethostbyname(HOST_NAME);
-
-	sprintf(http_get,
-			"GET http://api.sl.se/api2/travelplannerv2/"
-			"trip.%s?"				// Format
-			"key=%s&"				// API KEY
-			"originId=%s&"			// originId
-			"destId=%s "			// destId
-			"HTTP/1.1\r\n"			// HTTP version
-			"Host: api.sl.se\r\n"	// Server
-			"Connection: close\r\n"	// Connection settings
-			"\r\n",
-			FORMAT, API_KEY, origin, dest);
-
-	sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-
-	serv_addr.sin_family = AF_INET;
-	serv_addr.sin_addr.s_addr = inet_addr(SL_IP);
-	serv_addr.sin_port = htons(PORT);
-//	bzero(&(socket_details.sin_zero), 8);
-
-	if(connect(sock_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr))) {
-		free(http_get);
-		free(*js);
-		return E_CONNECT;
-	}
-
-	int sent_bytes, recv_bytes = 0;
-	if((sent_bytes = write(sock_fd, http_get, strlen(http_get))) > 0) {
-		int retval;
-		do {
-			retval = read(sock_fd, *js+recv_bytes, RESPONSE_SIZE-recv_bytes);
-			if(retval == 0) {
-				break;
-			} else if(retval < 0) {
-				free(http_get);
-				free(*js);
-				close(sock_fd);
-				return E_RECEIVE;
-			} else {
-				recv_bytes += retval;
-			}
-		} while(recv_bytes < RESPONSE_SIZE);
-	} else {
-		free(http_get);
-		free(*js);
-		return E_SEND;
+static void on_signal(int sig) {
+	/* Whoever polls the read end wakes up, nothing else is safe here */
+	if(write(stop_fd, "", 1) < 0) {
+		return;
 	}
-
-	free(http_get);
-	close(sock_fd);
-
-	if(recv_bytes > RESPONSE_SIZE) {
-		return E_RESPONSE;
+}
+/*****************************************************************************/
+static int catch_signals(void) {
+	/* Read end of a pipe that is readable once tsl is told to stop */
+	struct sigaction sa;
+	int fds[2];
+	if(pipe2(fds, O_NONBLOCK | O_CLOEXEC)) {
+		return -1;
 	}
-
-	return recv_bytes;
+	stop_fd = fds[1];
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	return fds[0];
 }
 /*****************************************************************************/
-int extract_js(char **js, int len) {
-	int i, json_len = 0;
-	/* End json at last '}' */
-	for(i = len-1; i > 0; i--) {
-		if((*js)[i] == '}') {
-			json_len = i;
-			(*js)[i+1] = '\0';
-			break;
-		}
+int main(int argc, char *argv[]) {
+	static const char *orders[] = {"", "dep", "arr", "dur", "legs"};
+	static const char *formats[] = {"text", "json", "bin"};
+	char *key, *batch_path = NULL, *cache_dir = NULL, *server_path = NULL;
+	char *gtfs_dir = NULL, *tt_path = NULL, *site_list = NULL;
+	char *site_path = NULL, *complete = NULL;
+	int serve = 0, interval = 0, quota = 0;
+	int opt, retval;
+	tsl_output out;
+	tsl_config config;
+	tsl_client client;
+	tsl_cache cache;
+	tsl_sched sched;
+
+	tsl_config_init(&config);
+	if((key = getenv("TSL_API_KEY"))) {
+		config.key = key;
 	}
-	if(i == 0) {
-		return E_NOJSON;
+	config.dns.hosts = getenv("TSL_HOSTS");
+	config.dns.nameserver = getenv("TSL_NAMESERVER");
+	cache_init(&cache, NULL);
+	if(tsl_output_init(&out, STDOUT_FILENO, WRITE_TEXT)) {
+		return E_UNKNOWN;
 	}
-	/* Start json at first '{' */
-	for(i = 0; i < len; i++) {
-		if((*js)[i] == '{') {
-			json_len -= i;
-			memmove(*js, *js+i, strlen(*js));
-			break;
+	while((opt = getopt(argc, argv, "a:b:c:D:d:e:f:G:g:j:k:N:n:o:p:q:r:Ss:t:w:"))
+			!= -1) {
+		switch(opt) {
+			case 'S':
+				if(!out.metrics && !(out.metrics = malloc(sizeof(tsl_metrics)))) {
+					return E_UNKNOWN;
+				}
+				metrics_init(out.metrics);
+				break;
+			case 'f':
+				for(out.writer.format = WRITE_BINARY;
+						out.writer.format >= WRITE_TEXT
+						&& strcmp(optarg, formats[out.writer.format]);
+						out.writer.format--);
+				if(out.writer.format < WRITE_TEXT) {
+					usage();
+					return -1;
+				}
+				break;
+			case 'G':
+				gtfs_dir = optarg;
+				break;
+			case 'g':
+				tt_path = optarg;
+				break;
+			case 'N':
+				site_list = optarg;
+				break;
+			case 'n':
+				site_path = optarg;
+				break;
+			case 'k':
+				complete = optarg;
+				break;
+			case 'a':
+				if((out.filter.depart_after = parse_when(optarg)) < 0) {
+					usage();
+					return -1;
+				}
+				break;
+			case 'r':
+				if((out.filter.arrive_before = parse_when(optarg)) < 0) {
+					usage();
+					return -1;
+				}
+				break;
+			case 'o':
+				for(out.order = TRIP_ORDER_LEGS; out.order > TRIP_ORDER_NONE
+						&& strcmp(optarg, orders[out.order]); out.order--);
+				if(out.order == TRIP_ORDER_NONE) {
+					usage();
+					return -1;
+				}
+				break;
+			case 'D':
+				serve = 1;
+				server_path = optarg;
+				break;
+			case 'd':
+				out.server = optarg;
+				break;
+			case 'b':
+				batch_path = optarg;
+				break;
+			case 'c':
+				cache_dir = optarg;
+				break;
+			case 's':
+				cache.stale = atoi(optarg);
+				break;
+			case 't':
+				cache.ttl = atoi(optarg);
+				break;
+			case 'e':
+				if(!strcmp(optarg, "uring")) {
+#ifndef TSL_URING
+					fprintf(stderr, "tsl: built without io_uring\n");
+					return -1;
+#endif
+					out.uring = 1;
+				} else if(strcmp(optarg, "epoll")) {
+					usage();
+					return -1;
+				}
+				break;
+			case 'j':
+				out.max_inflight = atoi(optarg);
+				break;
+			case 'p':
+				if((out.threads = atoi(optarg)) < 1) {
+					usage();
+					return -1;
+				}
+				break;
+			case 'w':
+				if((interval = atoi(optarg)) < 1) {
+					usage();
+					return -1;
+				}
+				break;
+			case 'q':
+				if((quota = atoi(optarg)) < 1) {
+					usage();
+					return -1;
+				}
+				break;
+			default:
+				usage();
+				return -1;
 		}
 	}
-	if(i == len) {
-		return E_NOJSON;
+	if(cache_dir) {
+		cache.dir = cache_dir;
+		out.cache = &cache;
 	}
-	return json_len;
-}
-/*****************************************************************************/
-int extract_trips(const nx_json *jsmap, trip **trips) {
-	int len;
-	const nx_json *js_trip_list = nx_json_get(jsmap, "TripList");
-	const nx_json *js_trip_array = nx_json_get(js_trip_list, "Trip");
-	if(js_trip_array->type == NX_JSON_ARRAY) {
-		len = js_trip_array->length;
-		*trips = malloc(sizeof(trip)*len);
-		int i;
-		for(i = 0; i < len; i++) {
-			const nx_json *js_trip = nx_json_item(js_trip_array, i);
-			extract_trip(js_trip, &(*trips)[i]);
+	/* The io_uring loop sends every query once, without the scheduler */
+	if(quota && out.uring) {
+		fprintf(stderr, "tsl: -q does not work with -e uring\n");
+		return -1;
+	}
+	if(serve) {
+		sched_init(&sched, quota);
+		config.sched = out.sched = &sched;
+		if((retval = catch_signals()) >= 0) {
+			retval = run_server(server_path, &config, out.max_inflight, &cache,
+					out.metrics, retval);
 		}
-	} else {
-		len = 1;
-		*trips = malloc(sizeof(trip));
-		extract_trip(js_trip_array, &(*trips)[0]);
+		tsl_output_free(&out);
+		return retval;
 	}
-	return len;
-}
-/*****************************************************************************/
-int extract_trip(const nx_json *js_trip, trip *new_trip) {
-	int len;
-	const nx_json *js_edge_list = nx_json_get(js_trip, "LegList");
-	const nx_json *js_edge_array = nx_json_get(js_edge_list, "Leg");
-	new_trip->dur = strdup(nx_json_get(js_trip, "dur")->text_value);
-	if(js_edge_array->type == NX_JSON_ARRAY) {
-		len = js_edge_array->length;
-		new_trip->edges = malloc(sizeof(edge)*len);
-		int i;
-		for(i = 0; i < len; i++) {
-			const nx_json *js_edge = nx_json_item(js_edge_array, i);
-			extract_edge(js_edge, &(new_trip->edges[i]));
+	if(gtfs_dir) {
+		if(!tt_path) {
+			usage();
+			return -1;
 		}
-	} else {
-		len = 1;
-		new_trip->edges = malloc(sizeof(edge));
-		extract_edge(js_edge_array, &(new_trip->edges[0]));
+		if((retval = timetable_import(gtfs_dir, tt_path))) {
+			fprintf(stderr, "tsl: %s: can not import the feed\n", gtfs_dir);
+		}
+		return retval;
 	}
-	new_trip->edges_len = len;
-	return len;
-}
-/*****************************************************************************/
-int extract_edge(const nx_json *js_edge, edge *new_edge) {
-	new_edge->type = strdup(nx_json_get(js_edge, "name")->text_value);
-	const nx_json *js_origin_station = nx_json_get(js_edge, "Origin");
-	const nx_json *js_dest_station = nx_json_get(js_edge, "Destination");
-	extract_station(js_origin_station, &(new_edge->origin));
-	extract_station(js_dest_station, &(new_edge->dest));
-	return 0;
-}
-/*****************************************************************************/
-int extract_station(const nx_json *js_station, station *new_station) {
-	const nx_json *js_name = nx_json_get(js_station, "name");
-	const nx_json *js_time = nx_json_get(js_station, "time");
-	new_station->name = strdup(js_name->text_value);
-	new_station->time = strdup(js_time->text_value);
-	return 0;
-}
-/*****************************************************************************/
-int print_trips(trip *trips, int num_trips) {
-	int i, j/*, max, len*/;
-/*	for(i = 0; i < num_trips; i++) {
-		for(j = 0; j < trips[i].edges_len; j++) {
-			if((len = strlen(trips[i].edges[j].origin.name)) > max) {
-				max = len;
-			}
-			if((len = strlen(trips[i].edges[j].destination.name)) > max) {
-				max = len;
-			}
+	if(site_list) {
+		if(!site_path) {
+			usage();
+			return -1;
 		}
-	}*/
-	for(i = 0; i < num_trips; i++) {
-		printf("(%s min)\n", trips[i].dur);
-		for(j = 0; j < trips[i].edges_len; j++) {
-			station origin = trips[i].edges[j].origin;
-			station destination = trips[i].edges[j].dest;
-
-			int origin_len = strlen(origin.name),
-				destination_len = strlen(destination.name);
-
-			printf("  [%s : %s] ---{%s}---> [%s : %s]\n",
-							origin.name, origin.time,
-							trips[i].edges[j].type,
-							destination.name, destination.time);
+		if((retval = site_import(site_list, site_path)) < 0) {
+			fprintf(stderr, "tsl: %s: can not import the sites\n", site_list);
 		}
+		return retval < 0 ? retval : 0;
 	}
-	return 0;
-}
-/*****************************************************************************/
-int free_trips(trip *trips, int num_trips) {
-	int i;
-	for(i = 0; i < num_trips; i++) {
-		free_trip(trips[i]);
+	if(site_path && !(out.sites = site_open(site_path))) {
+		fprintf(stderr, "tsl: %s: not a site index\n", site_path);
+		return E_STATION;
 	}
-	free(trips);
-	return E_SUCCESS;
-}
-/*****************************************************************************/
-int free_trip(trip tr) {
-	int i;
-	for(i = 0; i < tr.edges_len; i++) {
-		free_edge(tr.edges[i]);
+	if(complete) {
+		/* Type-ahead, one "<name>\t<id>" per line */
+		if(!out.sites) {
+			usage();
+			return -1;
+		}
+		retval = tsl_complete(&out, complete);
+		tsl_output_free(&out);
+		return retval < 0 ? retval : 0;
 	}
-	free(tr.edges);
-	return E_SUCCESS;
-}
-/*****************************************************************************/
-int free_edge(edge ed) {
-	free_station(ed.origin);
-	free_station(ed.dest);
-	return E_SUCCESS;
-}
-/*****************************************************************************/
-int free_station(station st) {
-	free(st.name);
-	free(st.time);
-	return E_SUCCESS;
+	if(tt_path && !(out.tt = timetable_open(tt_path))) {
+		fprintf(stderr, "tsl: %s: not a timetable\n", tt_path);
+		tsl_output_free(&out);
+		return E_TIMETABLE;
+	}
+	sched_init(&sched, quota);
+	config.sched = out.sched = &sched;
+	tsl_client_init(&client, &config, out.cache);
+	client.conn.timing = &out.timing;
+	/* A server or a timetable answers once, -w only watches the planner */
+	if(batch_path) {
+		retval = tsl_ask_file(&out, &client, batch_path);
+	} else if(argc - optind < 2) {
+		usage();
+		retval = -1;
+	} else if(interval && !out.server && !out.tt) {
+		if((retval = catch_signals()) >= 0) {
+			retval = tsl_follow(&out, &client, argv[optind], argv[optind+1],
+					interval, retval);
+		}
+	} else {
+		retval = tsl_ask(&out, &client, argv[optind], argv[optind+1]);
+	}
+	/* Free memory */
+	tsl_output_free(&out);
+	tsl_client_free(&client);
+
+	return retval < 0 ? retval : 0;
 }
-/*****************************************************************************/
@@ -5,6 +5,8 @@
 *     Last Modified       :     [2016-06-16 14:23]                            *
 *     Description         :     tsl finds info on SL departures and arrivals. *
 ******************************************************************************/
+#ifndef TSL_H
+#define TSL_H
 #include <sys/socket.h>         // socket, connect
 #include <netinet/in.h>         // struct sockaddr_in, struct sockaddr
 #include <string.h>             // strlen, memmove, strdup
@@ -13,12 +15,15 @@
 #include <arpa/inet.h>          // inet_addr
 #include <unistd.h>             // read, write, close
 #include "nxjson/nxjson.h"      // json parser
-//#include <netdb.h>            // struct hostent, gethostbyname
+#include "http.h"               // tsl_conn, tsl_buf
+#include "scheduler.h"          // tsl_sched
 /*****************************************************************************/
-/* Connection */
-#define SL_IP "194.68.78.66" 	// IP of server
+/* Connection, SL_IP may be defined at compile time to test against a local
+ * server instead of the one HOST_NAME resolves to */
 #define HOST_NAME "api.sl.se" 	// Name of server
+#ifndef PORT
 #define PORT 80 				// Port to connect
+#endif
 /* HTTP GET request */
 #define FORMAT "json" 			// Requested format, either json or xml
 #define API_KEY "<your API key>"// Authentication
@@ -27,7 +32,7 @@
 #define DEST_ID "Universitetet" // Default target station
 /* Buffers */
 #define MESSAGE_SIZE 2000 		// Size of buffer storing http get request
-#define RESPONSE_SIZE 200000 	// Size of buffer storing response
+#define RESPONSE_SIZE 200000 	// Initial size of buffer storing response
 /*****************************************************************************/
 /* Error numbers */
 enum tsl_error {
@@ -37,17 +42,25 @@ enum tsl_error {
 	E_SEND = -3,				// Something went wrong when sending request.
 	E_RECEIVE = -4, 			// Error when receiving data.
 	E_RESPONSE = -5,			// Response could not fit in buffer.
-	E_NOJSON = -6				// No json string found in response.
+	E_NOJSON = -6,				// No json string found in response.
+	E_PROTOCOL = -7,			// Response is not valid http.
+	E_STATUS = -8,				// Server answered with an error status.
+	E_CACHE = -9,				// Cache entry could not be stored.
+	E_TIMETABLE = -10,			// Timetable could not be read or written.
+	E_STATION = -11,			// Station name could not be resolved.
+	E_RESOLVE = -12,			// Server name could not be resolved.
+	E_BREAKER = -13				// Server failed too often to be asked now.
 };
 /******************************************************************************
 * Struct: station                                                             *
 * ---------------                                                             *
 *   Stores data of an arrival at a station.                                   *
 *                                                                             *
-*   name: Name of the station.                                                *
+*   name: Name of the station, interned and not freed with the station.       *
 *   time: Time which the train arrives at the station.                        *
+*   id: Id of the interned name, see station_intern.                          *
 ******************************************************************************/
-typedef struct station {char *name; char *time;} station;
+typedef struct station {const char *name; char *time; int id;} station;
 /******************************************************************************
 * Struct: edge                                                                *
 * ------------                                                                *
@@ -69,38 +82,110 @@ typedef struct edge {char *type; station origin; station dest;} edge;
 ******************************************************************************/
 typedef struct trip {char *dur; int edges_len; edge *edges;} trip;
 /******************************************************************************
+* Struct: tsl_config                                                          *
+* ------------------                                                          *
+*   Where the travel planner is and how it is asked. Strings are not copied.  *
+*                                                                             *
+*   server: Name or address connected to.                                     *
+*   port: Port of the server.                                                 *
+*   host: Name of the server, sent in every request.                          *
+*   key: API key.                                                             *
+*   dns: Where server is resolved.                                            *
+*   sched: Scheduler the requests go through, shared, NULL for none.          *
+******************************************************************************/
+typedef struct tsl_config {
+	const char *server; int port;
+	const char *host; const char *key;
+	dns_config dns;
+	tsl_sched *sched;
+} tsl_config;
+/******************************************************************************
 * Function: main                                                              *
 * --------------                                                              *
 *   Main function of the program.                                             *
 *                                                                             *
 *   Input parameters:                                                         *
-*     Required: <Origin> <Destination>                                        *
+*     Required: <Origin> <Destination>, -b, -G, -N or -k                      *
 *     Optional:                                                               *
+*       -b <file>: Look up one "<Origin> <Destination>" pair per line of      *
+*                  file, or of stdin when file is "-", concurrently.          *
+*       -j <n>: Number of batch queries in flight at once.                    *
+*       -e <engine>: Event loop of the batch, epoll (default) or uring,       *
+*                    which sends every query once, without the scheduler.     *
+*       -c <dir>: Cache responses in dir and answer from it when possible.    *
+*       -t <ttl>: Seconds a cached response is fresh.                         *
+*       -s <stale>: Seconds past the ttl a cached response is still printed   *
+*                   while it is refreshed in the background.                  *
+*       -D <socket>: Run as a server answering queries on a Unix socket,      *
+*                    results are kept in memory for the ttl.                  *
+*       -d <socket>: Ask a running server instead of going to the network.    *
+*       -o <order>: Print trips by departure (dep), arrival (arr),            *
+*                   duration (dur) or number of legs (legs).                  *
+*       -a <time>: Only print trips leaving at HH:MM today or later, or       *
+*                  ones that have not left yet when time is "now".            *
+*       -r <time>: Only print trips arriving by HH:MM today.                  *
+*       -g <file>: Find journeys in a timetable instead of going to the       *
+*                  network, leaving after -a or now.                          *
+*       -G <dir>: Import the GTFS feed in dir into the timetable of -g.       *
+*       -p <n>: Threads searching the timetable for a batch, one per CPU by   *
+*               default.                                                      *
+*       -n <file>: Resolve names to sites of an index before they are asked,  *
+*                  by name, the only name starting with it, or the only       *
+*                  closest name, with case and accents ignored.               *
+*       -N <list>: Import a site list, "<id>;<name>" per line, into the       *
+*                  index of -n.                                               *
+*       -k <text>: Print the sites of -n matching text typed so far.          *
+*       -f <format>: Print results as text (default), json with one trip per  *
+*                    line, or bin with one trip_record per query.             *
+*       -S: Time every stage of every query and print p50, p90 and p99 of     *
+*           each to stderr at exit, or with "!stats" of a server.             *
+*       -q <n>: Requests per minute the API key allows. Requests wait for     *
+*               their turn, interactive ones before batches and refreshes.    *
+*               Not with -e uring.                                            *
+*       -w <seconds>: Ask a single query again that often until interrupted,  *
+*                     printing the trips added (+), removed (-) or changed    *
+*                     (~) since the last answer. The server is asked to only  *
+*                     answer in full when the response changed.               *
+*     TSL_API_KEY in the environment replaces the API_KEY built in.           *
+*     TSL_HOSTS and TSL_NAMESERVER replace the hosts file and the name        *
+*     servers the server name is resolved with.                               *
 ******************************************************************************/
 int main(int argc, char *argv[]);
 /******************************************************************************
-* Function: get_request                                                       *
-* ---------------------                                                       *
-*   Sends a http GET request to the SL server to determine the travel path.   *
+* Function: tsl_config_init                                                   *
+* -------------------------                                                   *
+*   Sets a configuration to HOST_NAME, or SL_IP when it is defined, PORT and  *
+*   API_KEY, resolved with the hosts file and name servers of the system.     *
+*                                                                             *
+*   config: Pointer to the configuration.                                     *
+******************************************************************************/
+void tsl_config_init(tsl_config *config);
+/******************************************************************************
+* Function: format_request                                                    *
+* ------------------------                                                    *
+*   Formats the http GET request for a travel path.                           *
 *                                                                             *
-*   js: Pointer to buffer where response is stored.                           *
+*   request: Buffer of MESSAGE_SIZE bytes where the request is stored.        *
+*   config: Server and key the request is for.                                *
 *   origin: Station where travel starts.                                      *
 *   dest: Station where travel ends.                                          *
 *                                                                             *
-*   Returns: The number of bytes received.                                    *
-*            E_CONNECT when connect fails.                                    *
-*            E_RECEIVE when recv fails.                                       *
+*   Returns: The length of the request.                                       *
+*            E_SEND when the request does not fit in the buffer.              *
 ******************************************************************************/
-int get_request(char **js, char *origin, char *dest);
+int format_request(char *request, const tsl_config *config,
+		const char *origin, const char *dest);
 /******************************************************************************
 * Function: extract_js                                                        *
 * --------------------                                                        *
-*   Extracts json code from a string.                                         *
+*   Extracts json code from a string by narrowing it to the part between the  *
+*   first '{' and the last '}'. Nothing is moved or copied.                   *
 *                                                                             *
-*   js: Pointer to buffer where input and output string are stored.           *
+*   js: Pointer to the string, moved forward to the first '{'.                *
 *   len: Length of the input string.                                          *
 *                                                                             *
 *   Returns: The size of the json string.                                     *
+*            E_NOJSON when no json is found.                                  *
 ******************************************************************************/
 int extract_js(char **js, int len);
 /******************************************************************************
@@ -145,6 +230,7 @@ int extract_edge(const nx_json *js_edge, edge *new_edge);
 *   trip: Pointer to struct where station data is stored.                     *
 *                                                                             *
 *   Returns: E_SUCCESS if successful.                                         *
+*            E_UNKNOWN when memory runs out.                                  *
 ******************************************************************************/
 int extract_station(const nx_json *js_station, station *new_station);
 /******************************************************************************
@@ -156,6 +242,8 @@ int extract_station(const nx_json *js_station, station *new_station);
 *   num_trips: Size of the trips array.                                       *
 *                                                                             *
 *   Returns: E_SUCCESS if successful.                                         *
+*            E_SEND when stdout can not be written.                           *
+*            E_UNKNOWN when memory runs out.                                  *
 ******************************************************************************/
 int print_trips(trip *trips, int num_trips);
 /******************************************************************************
@@ -196,3 +284,4 @@ int free_edge(edge ed);
 ******************************************************************************/
 int free_station(station st);
 /*****************************************************************************/
+#endif /* TSL_H */
@@ -0,0 +1,475 @@
+/******************************************************************************
+*     File Name           :     uring.c                                       *
+*     Description         :     Runs many queries concurrently on io_uring.   *
+******************************************************************************/
+#ifdef TSL_URING
+#include <errno.h>              // errno, ECANCELED
+#include <stdint.h>             // uint64_t, uintptr_t
+#include <sys/mman.h>           // mmap, munmap
+#include <sys/syscall.h>        // SYS_io_uring_setup, SYS_io_uring_enter
+#include <sys/uio.h>            // struct iovec
+#include <linux/io_uring.h>     // io_uring_params, io_uring_sqe, io_uring_cqe
+#include "uring.h"
+/*****************************************************************************/
+#define URING_READ 16384 		// Size of the registered buffer of a slot
+#define URING_ENTRIES 4096 		// Largest submission queue asked for
+#define URING_CHAIN 3 			// Entries of one exchange: connect, send, recv
+#define URING_OP_BITS 2 		// Low bits of the user data holding the op
+/* Operations */
+enum {
+	OP_CONNECT,
+	OP_SEND,
+	OP_RECV
+};
+/*****************************************************************************/
+typedef struct ring {
+	int fd;						// The io_uring instance.
+	unsigned entries;			// Size of the submission queue.
+	unsigned tail;				// Submission tail including unpublished entries.
+	unsigned queued;			// Entries not yet handed to the kernel.
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;	// Submission queue entries.
+	struct io_uring_cqe *cqes;	// Completion queue entries.
+	void *sq_map, *cq_map;		// Mapped rings, the same when shared.
+	size_t sq_map_len, cq_map_len;
+} ring;
+/*****************************************************************************/
+typedef struct slot {
+	tsl_conn conn;				// Kept-alive connection of the slot.
+	int index;					// Query being served, -1 when idle.
+	int reused;					// Request went out on a kept-alive socket.
+	int tried;					// Addresses that failed to connect.
+	int sent;					// Bytes of the request written.
+	int request_len;			// Length of the request.
+	int pending;				// Operations submitted and not completed.
+	int error;					// First error of the submitted operations.
+	int received;				// Result of the last receive.
+	int direct;					// Last receive went straight into the body.
+	char *raw;					// Registered buffer for bytes outside the body.
+	char request[MESSAGE_SIZE];	// The http GET request.
+	tsl_buf body;				// Decoded body, reused by every query.
+	http_parser parser;			// Parser of the response.
+	tsl_timing timing;			// Timing of the query.
+} slot;
+/*****************************************************************************/
+typedef struct batch {
+	ring ring;					// The io_uring instance.
+	slot *slots;				// In-flight slots.
+	int fixed;					// Receive buffers are registered.
+	const query *queries;		// Queries to send.
+	int num_queries;			// Number of queries.
+	int next;					// Next query to send.
+	int failed;					// Number of failed queries.
+	batch_fn done;				// Result callback.
+	void *arg;					// Argument of the callback.
+	const tsl_config *config;	// Server and key of the requests.
+	dns_answer addrs;			// Addresses of the server.
+	int resolved;				// E_SUCCESS, or why there are no addresses.
+	int addr;					// Address connected to first, the last that worked.
+} batch;
+/*****************************************************************************/
+static void slot_next(batch *b, slot *s);
+/*****************************************************************************/
+static void ring_free(ring *r) {
+	if(r->sqes != MAP_FAILED) {
+		munmap(r->sqes, r->entries*sizeof(struct io_uring_sqe));
+	}
+	if(r->cq_map != MAP_FAILED && r->cq_map != r->sq_map) {
+		munmap(r->cq_map, r->cq_map_len);
+	}
+	if(r->sq_map != MAP_FAILED) {
+		munmap(r->sq_map, r->sq_map_len);
+	}
+	if(r->fd >= 0) {
+		close(r->fd);
+	}
+}
+/*****************************************************************************/
+static int ring_init(ring *r, unsigned entries) {
+	struct io_uring_params p;
+	char *sq, *cq;
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(*r));
+	r->sq_map = r->cq_map = r->sqes = MAP_FAILED;
+	if((r->fd = syscall(SYS_io_uring_setup, entries, &p)) < 0) {
+		return E_UNKNOWN;
+	}
+	r->entries = p.sq_entries;
+	r->sq_map_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	r->cq_map_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(r->cq_map_len > r->sq_map_len) {
+			r->sq_map_len = r->cq_map_len;
+		}
+		r->cq_map_len = r->sq_map_len;
+	}
+	r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if(r->sq_map == MAP_FAILED) {
+		ring_free(r);
+		return E_UNKNOWN;
+	}
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_map = r->sq_map;
+	} else {
+		r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	}
+	r->sqes = mmap(NULL, p.sq_entries*sizeof(struct io_uring_sqe),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+			IORING_OFF_SQES);
+	if(r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+		ring_free(r);
+		return E_UNKNOWN;
+	}
+	sq = r->sq_map;
+	cq = r->cq_map;
+	r->sq_head = (unsigned*)(sq+p.sq_off.head);
+	r->sq_tail = (unsigned*)(sq+p.sq_off.tail);
+	r->sq_mask = (unsigned*)(sq+p.sq_off.ring_mask);
+	r->sq_array = (unsigned*)(sq+p.sq_off.array);
+	r->cq_head = (unsigned*)(cq+p.cq_off.head);
+	r->cq_tail = (unsigned*)(cq+p.cq_off.tail);
+	r->cq_mask = (unsigned*)(cq+p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*)(cq+p.cq_off.cqes);
+	r->tail = *r->sq_tail;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int ring_enter(ring *r, unsigned wait) {
+	/* Hands every queued entry to the kernel, waiting for at least wait
+	 * completions in the same system call */
+	int n;
+	__atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+	n = syscall(SYS_io_uring_enter, r->fd, r->queued, wait,
+			wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if(n < 0) {
+		return -1;
+	}
+	r->queued -= n;
+	return n;
+}
+/*****************************************************************************/
+static int ring_reserve(ring *r, unsigned n) {
+	/* Entries of a linked chain have to be queued back to back */
+	if(r->tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) + n > r->entries
+			&& ring_enter(r, 0) < 0) {
+		return -1;
+	}
+	return r->tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) + n
+			> r->entries ? -1 : 0;
+}
+/*****************************************************************************/
+static struct io_uring_sqe *queue(batch *b, slot *s, int op, int opcode) {
+	/* Space must have been reserved with ring_reserve */
+	ring *r = &b->ring;
+	unsigned i = r->tail++ & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = s->conn.fd;
+	sqe->user_data = (uint64_t)(s - b->slots) << URING_OP_BITS | op;
+	r->sq_array[i] = i;
+	r->queued++;
+	s->pending++;
+	return sqe;
+}
+/*****************************************************************************/
+static int slot_submit(batch *b, slot *s, int connect) {
+	/* Queues the rest of the exchange as one linked chain: the connect,
+	 * the part of the request not sent yet and one receive */
+	struct io_uring_sqe *sqe;
+	char *dst;
+	int space = http_parser_space(&s->parser, &dst);
+	if(space < 0) {
+		return space;
+	}
+	if(ring_reserve(&b->ring, URING_CHAIN)) {
+		return E_SEND;
+	}
+	s->error = E_SUCCESS;
+	if(connect) {
+		sqe = queue(b, s, OP_CONNECT, IORING_OP_CONNECT);
+		sqe->addr = (uintptr_t)&b->addrs.addrs[s->conn.addr].u.sa;
+		sqe->off = b->addrs.addrs[s->conn.addr].len;
+		sqe->flags = IOSQE_IO_LINK;
+	}
+	if(s->sent < s->request_len) {
+		sqe = queue(b, s, OP_SEND, IORING_OP_SEND);
+		sqe->addr = (uintptr_t)(s->request+s->sent);
+		sqe->len = s->request_len-s->sent;
+		sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+		sqe->flags = IOSQE_IO_LINK;
+	}
+	/* Known body bytes go straight into the body like in slot_receive of
+	 * the epoll loop, everything else through the registered buffer */
+	s->direct = space > 0;
+	if(s->direct) {
+		sqe = queue(b, s, OP_RECV, IORING_OP_RECV);
+		sqe->addr = (uintptr_t)dst;
+		sqe->len = space;
+	} else if(b->fixed) {
+		sqe = queue(b, s, OP_RECV, IORING_OP_READ_FIXED);
+		sqe->addr = (uintptr_t)s->raw;
+		sqe->len = URING_READ;
+		sqe->buf_index = s - b->slots;
+	} else {
+		sqe = queue(b, s, OP_RECV, IORING_OP_RECV);
+		sqe->addr = (uintptr_t)s->raw;
+		sqe->len = URING_READ;
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int slot_start(batch *b, slot *s) {
+	/* Sends the request of the slot, connecting first if needed to the
+	 * address that worked last, or to the one after that which failed */
+	int retval;
+	s->sent = 0;
+	s->reused = s->conn.fd >= 0;
+	http_parser_init(&s->parser, &s->body);
+	if(!s->reused && b->resolved) {
+		return b->resolved;
+	}
+	if(!s->reused) {
+		s->conn.addr = (s->tried ? s->conn.addr+1 : b->addr) % b->addrs.len;
+		s->conn.fd = socket(b->addrs.addrs[s->conn.addr].u.sa.sa_family,
+				SOCK_STREAM, 0);
+		if(s->conn.fd < 0) {
+			return E_CONNECT;
+		}
+	}
+	if((retval = slot_submit(b, s, !s->reused)) < 0) {
+		conn_close(&s->conn);
+	}
+	return retval;
+}
+/*****************************************************************************/
+static void slot_finish(batch *b, slot *s, int retval) {
+	const query *q = &b->queries[s->index];
+	http_parser_free(&s->parser);
+	if(retval < 0 || s->parser.close) {
+		conn_close(&s->conn);
+	}
+	if(retval >= 0) {
+		s->conn.requests++;
+		s->conn.status = s->parser.status;
+		if(s->parser.status/100 != 2) {
+			retval = E_STATUS;
+		}
+		timing_lap(&s->timing, STAGE_BODY);
+	}
+	if(retval < 0) {
+		b->failed++;
+	}
+	s->timing.bytes_in += s->parser.received;
+	s->timing.body_bytes = s->body.len;
+	b->done(b->arg, q, retval < 0 ? NULL : s->body.data, retval, &s->timing);
+	slot_next(b, s);
+}
+/*****************************************************************************/
+static void slot_fail(batch *b, slot *s, int retval) {
+	/* A failed connect moves on to the next address */
+	while(retval == E_CONNECT && !s->reused && ++s->tried < b->addrs.len) {
+		http_parser_free(&s->parser);
+		conn_close(&s->conn);
+		if((retval = slot_start(b, s)) == E_SUCCESS) {
+			return;
+		}
+	}
+	/* A kept-alive socket may have been closed by the server while idle,
+	 * that shows up as nothing received and is retried once */
+	if(s->reused && !s->parser.received
+			&& (retval == E_SEND || retval == E_RECEIVE)) {
+		http_parser_free(&s->parser);
+		conn_close(&s->conn);
+		if((retval = slot_start(b, s)) == E_SUCCESS) {
+			return;
+		}
+	}
+	slot_finish(b, s, retval);
+}
+/*****************************************************************************/
+static void slot_next(batch *b, slot *s) {
+	const query *q;
+	int retval;
+	while(b->next < b->num_queries) {
+		s->index = b->next++;
+		s->tried = 0;
+		q = &b->queries[s->index];
+		timing_begin(&s->timing);
+		if((s->request_len = format_request(s->request, b->config,
+				q->origin, q->dest)) < 0) {
+			retval = s->request_len;
+		} else if((retval = slot_start(b, s)) == E_SUCCESS) {
+			return;
+		}
+		b->failed++;
+		b->done(b->arg, q, NULL, retval, &s->timing);
+	}
+	/* Nothing left to send, so the connection is not needed any more */
+	s->index = -1;
+	conn_close(&s->conn);
+}
+/*****************************************************************************/
+static void slot_settle(batch *b, slot *s) {
+	/* Every operation of the chain has completed. A short send breaks the
+	 * chain and cancels the receive, the rest of it is simply resubmitted */
+	int retval = 0;
+	if(s->error) {
+		slot_fail(b, s, s->error);
+		return;
+	}
+	if(s->received > 0 && !s->parser.received) {
+		timing_lap(&s->timing, STAGE_FIRST_BYTE);
+	}
+	if(s->received == -ECANCELED) {
+		retval = 0;
+	} else if(s->received < 0) {
+		retval = E_RECEIVE;
+	} else if(s->received == 0) {
+		retval = http_parser_eof(&s->parser);
+	} else if(s->direct) {
+		retval = http_parser_commit(&s->parser, s->received);
+	} else {
+		retval = http_parser_feed(&s->parser, s->raw, s->received);
+	}
+	if(retval == 0) {
+		retval = slot_submit(b, s, 0);
+	} else if(retval > 0) {
+		slot_finish(b, s, s->body.len);
+		return;
+	}
+	if(retval < 0) {
+		slot_fail(b, s, retval);
+	}
+}
+/*****************************************************************************/
+static void slot_complete(batch *b, slot *s, int op, int res) {
+	switch(op) {
+		case OP_CONNECT:
+			if(res < 0 && !s->error) {
+				s->error = E_CONNECT;
+			} else if(res >= 0) {
+				b->addr = s->conn.addr;
+				s->tried = 0;
+				timing_lap(&s->timing, STAGE_CONNECT);
+			}
+			break;
+		case OP_SEND:
+			if(res >= 0) {
+				s->sent += res;
+			} else if(res != -ECANCELED && !s->error) {
+				s->error = E_SEND;
+			}
+			break;
+		case OP_RECV:
+			s->received = res;
+			break;
+	}
+	if(--s->pending == 0) {
+		slot_settle(b, s);
+	}
+}
+/*****************************************************************************/
+static void reap(batch *b) {
+	ring *r = &b->ring;
+	unsigned head = *r->cq_head;
+	struct io_uring_cqe *cqe;
+	uint64_t data;
+	int res;
+	while(head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &r->cqes[head & *r->cq_mask];
+		data = cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+		slot_complete(b, &b->slots[data >> URING_OP_BITS],
+				data & ((1 << URING_OP_BITS)-1), res);
+	}
+}
+/*****************************************************************************/
+int run_batch_uring(const query *queries, int num_queries,
+		const tsl_config *config, int max_inflight, batch_fn done, void *arg) {
+	batch b = {.queries = queries, .num_queries = num_queries,
+			.done = done, .arg = arg, .config = config};
+	struct iovec *iov;
+	char *raw;
+	int i, busy;
+
+	if(num_queries <= 0) {
+		return 0;
+	}
+	if(max_inflight < 1) {
+		max_inflight = 1;
+	}
+	if(max_inflight > num_queries) {
+		max_inflight = num_queries;
+	}
+	if(max_inflight > URING_ENTRIES/URING_CHAIN) {
+		max_inflight = URING_ENTRIES/URING_CHAIN;
+	}
+	if(ring_init(&b.ring, max_inflight*URING_CHAIN)) {
+		return E_UNKNOWN;
+	}
+	b.slots = calloc(max_inflight, sizeof(slot));
+	raw = malloc((size_t)max_inflight*URING_READ);
+	iov = malloc(max_inflight*sizeof(struct iovec));
+	if(!b.slots || !raw || !iov) {
+		free(b.slots);
+		free(raw);
+		free(iov);
+		ring_free(&b.ring);
+		return E_UNKNOWN;
+	}
+	for(i = 0; i < max_inflight; i++) {
+		iov[i].iov_base = b.slots[i].raw = raw+(size_t)i*URING_READ;
+		iov[i].iov_len = URING_READ;
+	}
+	/* Without registered buffers the same buffers are read into as usual */
+	b.fixed = !syscall(SYS_io_uring_register, b.ring.fd,
+			IORING_REGISTER_BUFFERS, iov, max_inflight);
+	free(iov);
+
+	/* The ring has no place for a lookup, so the server is resolved before
+	 * anything is in flight, from the cache when it can */
+	b.resolved = dns_resolve(config->server, config->port, &config->dns,
+			&b.addrs);
+	for(i = 0; i < max_inflight; i++) {
+		conn_init(&b.slots[i].conn, config->server, config->port,
+				&config->dns);
+		buf_init(&b.slots[i].body);
+		slot_next(&b, &b.slots[i]);
+	}
+	while(1) {
+		for(busy = 0, i = 0; i < max_inflight; i++) {
+			busy += b.slots[i].index >= 0;
+		}
+		if(!busy) {
+			break;
+		}
+		if(ring_enter(&b.ring, 1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			b.failed += busy + b.num_queries - b.next;
+			break;
+		}
+		reap(&b);
+	}
+
+	/* Closing the ring cancels whatever is still in flight */
+	ring_free(&b.ring);
+	for(i = 0; i < max_inflight; i++) {
+		if(b.slots[i].index >= 0) {
+			http_parser_free(&b.slots[i].parser);
+		}
+		conn_close(&b.slots[i].conn);
+		buf_free(&b.slots[i].body);
+	}
+	free(b.slots);
+	free(raw);
+	return b.failed;
+}
+/*****************************************************************************/
+#endif /* TSL_URING */
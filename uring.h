@@ -0,0 +1,30 @@
+/******************************************************************************
+*     File Name           :     uring.h                                       *
+*     Description         :     Runs many queries concurrently on io_uring.   *
+******************************************************************************/
+#ifndef URING_H
+#define URING_H
+#include "batch.h"              // query, batch_fn
+/******************************************************************************
+* Function: run_batch_uring                                                   *
+* -------------------------                                                   *
+*   Same as run_batch, but connects, sends and receives through an io_uring   *
+*   instance. The operations of every in-flight query are queued and          *
+*   submitted together with a single system call per round, and responses     *
+*   are read into buffers registered with the kernel once up front.           *
+*   Only built when TSL_URING is defined.                                     *
+*                                                                             *
+*   queries: Array of queries.                                                *
+*   num_queries: Number of queries in the array.                              *
+*   config: Server and key the queries go to, copied.                         *
+*   max_inflight: Largest number of concurrent connections.                   *
+*   done: Called with the result of every query.                              *
+*   arg: Passed on to done.                                                   *
+*                                                                             *
+*   Returns: Number of queries that failed.                                   *
+*            E_UNKNOWN when the ring can not be set up.                       *
+******************************************************************************/
+int run_batch_uring(const query *queries, int num_queries,
+		const tsl_config *config, int max_inflight, batch_fn done, void *arg);
+/*****************************************************************************/
+#endif /* URING_H */
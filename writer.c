@@ -0,0 +1,292 @@
+/******************************************************************************
+*     File Name           :     writer.c                                      *
+*     Description         :     Buffered output of trips as text, NDJSON or   *
+*                                 binary records.                             *
+******************************************************************************/
+#include <errno.h>              // errno, EINTR
+#include "writer.h"
+#include "station.h"            // station_count
+/*****************************************************************************/
+#define JSON_ESCAPE 6 			// Longest escape of a byte, "\u001f"
+#define JSON_INT 11 			// Longest int, "-2147483648"
+/*****************************************************************************/
+/* Marks of the enum trip_change */
+static const char *text_marks[] = {"", "+ ", "- ", "~ "};
+static const char *json_marks[] = {"", ",\"change\":\"added\"",
+		",\"change\":\"removed\"", ",\"change\":\"changed\""};
+/*****************************************************************************/
+int writer_init(tsl_writer *w, int fd, int format) {
+	buf_init(&w->buf);
+	w->fd = fd;
+	w->format = format;
+	w->headers = 0;
+	w->change = TRIP_SAME;
+	w->offs = NULL;
+	w->offs_len = 0;
+	w->bytes = 0;
+	return buf_reserve(&w->buf, WRITER_SIZE-1) ? E_UNKNOWN : E_SUCCESS;
+}
+/*****************************************************************************/
+void writer_free(tsl_writer *w) {
+	buf_free(&w->buf);
+	free(w->offs);
+	w->offs = NULL;
+	w->offs_len = 0;
+}
+/*****************************************************************************/
+int writer_flush(tsl_writer *w) {
+	int off = 0, n;
+	if(w->fd < 0) {
+		return E_SUCCESS;
+	}
+	while(off < w->buf.len) {
+		if((n = write(w->fd, w->buf.data+off, w->buf.len-off)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			w->buf.len = 0;
+			return E_SEND;
+		}
+		off += n;
+	}
+	w->buf.len = 0;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static char *reserve(tsl_writer *w, int n) {
+	/* A writer with a file is written out rather than grown, so only a
+	 * piece larger than the whole buffer makes it grow */
+	if(w->fd >= 0 && w->buf.len+n >= w->buf.cap && writer_flush(w)) {
+		return NULL;
+	}
+	if(buf_reserve(&w->buf, n)) {
+		return NULL;
+	}
+	return w->buf.data+w->buf.len;
+}
+/*****************************************************************************/
+static int commit(tsl_writer *w, const char *end) {
+	w->bytes += end - (w->buf.data+w->buf.len);
+	w->buf.len = end - w->buf.data;
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static char *put(char *p, const char *s, int len) {
+	memcpy(p, s, len);
+	return p+len;
+}
+#define PUT(p, lit) put(p, lit, sizeof(lit)-1)
+#define PUT_SLICE(p, strings, s) put(p, (strings)+(s).off, (s).len)
+/*****************************************************************************/
+static char *put_int(char *p, int n) {
+	char digits[JSON_INT];
+	unsigned u = n < 0 ? -(unsigned)n : (unsigned)n;
+	int i = 0;
+	if(n < 0) {
+		*p++ = '-';
+	}
+	do {
+		digits[i++] = '0' + u%10;
+	} while(u /= 10);
+	while(i) {
+		*p++ = digits[--i];
+	}
+	return p;
+}
+/*****************************************************************************/
+static char *put_json(char *p, const char *s, int len) {
+	/* Quoted, with only what json requires escaped. Bytes above 0x7f are
+	 * UTF-8 and copied as they are */
+	static const char hex[] = "0123456789abcdef";
+	int i;
+	*p++ = '"';
+	for(i = 0; i < len; i++) {
+		unsigned char c = s[i];
+		if(c == '"' || c == '\\') {
+			*p++ = '\\';
+			*p++ = c;
+		} else if(c < 0x20) {
+			p = PUT(p, "\\u00");
+			*p++ = hex[c >> 4];
+			*p++ = hex[c & 0xf];
+		} else {
+			*p++ = c;
+		}
+	}
+	*p++ = '"';
+	return p;
+}
+/*****************************************************************************/
+int writer_put(tsl_writer *w, const char *data, int len) {
+	char *p = reserve(w, len);
+	if(!p) {
+		return w->fd >= 0 ? E_SEND : E_UNKNOWN;
+	}
+	return commit(w, put(p, data, len));
+}
+/*****************************************************************************/
+static int write_text(tsl_writer *w, const char *origin, const char *dest,
+		const char *strings, const trip_ref *trips, const edge_ref *edges,
+		const int *selected, int status) {
+	/* Each line is sized first, so it is copied without further checks */
+	int i, j, n, origin_len = strlen(origin), dest_len = strlen(dest);
+	char *p;
+	if(w->headers) {
+		if(!(p = reserve(w, origin_len+dest_len+5))) {
+			return E_SEND;
+		}
+		p = put(p, origin, origin_len);
+		p = PUT(p, " -> ");
+		p = put(p, dest, dest_len);
+		*p++ = '\n';
+		commit(w, p);
+	}
+	for(i = 0; i < status; i++) {
+		const trip_ref *tr = &trips[selected ? selected[i] : i];
+		if(!(p = reserve(w, tr->dur.len+9))) {
+			return E_SEND;
+		}
+		p = put(p, text_marks[w->change], strlen(text_marks[w->change]));
+		*p++ = '(';
+		p = PUT_SLICE(p, strings, tr->dur);
+		p = PUT(p, " min)\n");
+		commit(w, p);
+		for(j = 0; j < tr->edges_len; j++) {
+			const edge_ref *ed = &edges[tr->edges_off + j];
+			n = ed->origin.name.len + ed->origin.time.len + ed->type.len
+					+ ed->dest.name.len + ed->dest.time.len + 28;
+			if(!(p = reserve(w, n))) {
+				return E_SEND;
+			}
+			p = PUT(p, "  [");
+			p = PUT_SLICE(p, strings, ed->origin.name);
+			p = PUT(p, " : ");
+			p = PUT_SLICE(p, strings, ed->origin.time);
+			p = PUT(p, "] ---{");
+			p = PUT_SLICE(p, strings, ed->type);
+			p = PUT(p, "}---> [");
+			p = PUT_SLICE(p, strings, ed->dest.name);
+			p = PUT(p, " : ");
+			p = PUT_SLICE(p, strings, ed->dest.time);
+			p = PUT(p, "]\n");
+			commit(w, p);
+		}
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int write_ndjson(tsl_writer *w, const char *origin, const char *dest,
+		const char *strings, const trip_ref *trips, const edge_ref *edges,
+		const int *selected, int status) {
+	/* Every line repeats the query, so lines can be filtered on their own.
+	 * Strings are sized as if every byte needed the longest escape */
+	int i, j, n, origin_len = strlen(origin), dest_len = strlen(dest);
+	char *p;
+	for(i = 0; i < (status < 0 ? 1 : status); i++) {
+		const trip_ref *tr = status < 0 ? NULL
+				: &trips[selected ? selected[i] : i];
+		n = (origin_len+dest_len)*JSON_ESCAPE + JSON_INT + 84;
+		if(!(p = reserve(w, n))) {
+			return E_SEND;
+		}
+		p = PUT(p, "{\"origin\":");
+		p = put_json(p, origin, origin_len);
+		p = PUT(p, ",\"dest\":");
+		p = put_json(p, dest, dest_len);
+		if(!tr) {
+			p = PUT(p, ",\"error\":");
+			p = put_int(p, status);
+			p = PUT(p, "}\n");
+			return commit(w, p);
+		}
+		p = put(p, json_marks[w->change], strlen(json_marks[w->change]));
+		p = PUT(p, ",\"dur\":");
+		p = tr->minutes < 0 ? PUT(p, "null") : put_int(p, tr->minutes);
+		p = PUT(p, ",\"legs\":[");
+		commit(w, p);
+		for(j = 0; j < tr->edges_len; j++) {
+			const edge_ref *ed = &edges[tr->edges_off + j];
+			n = (ed->type.len + ed->origin.name.len + ed->origin.time.len
+					+ ed->dest.name.len + ed->dest.time.len)*JSON_ESCAPE + 80;
+			if(!(p = reserve(w, n))) {
+				return E_SEND;
+			}
+			if(j) {
+				*p++ = ',';
+			}
+			p = PUT(p, "{\"type\":");
+			p = put_json(p, strings+ed->type.off, ed->type.len);
+			p = PUT(p, ",\"origin\":");
+			p = put_json(p, strings+ed->origin.name.off, ed->origin.name.len);
+			p = PUT(p, ",\"depart\":");
+			p = put_json(p, strings+ed->origin.time.off, ed->origin.time.len);
+			p = PUT(p, ",\"dest\":");
+			p = put_json(p, strings+ed->dest.name.off, ed->dest.name.len);
+			p = PUT(p, ",\"arrive\":");
+			p = put_json(p, strings+ed->dest.time.off, ed->dest.time.len);
+			*p++ = '}';
+			commit(w, p);
+		}
+		if(!(p = reserve(w, 3))) {
+			return E_SEND;
+		}
+		commit(w, PUT(p, "]}\n"));
+	}
+	return E_SUCCESS;
+}
+/*****************************************************************************/
+static int write_binary(tsl_writer *w, const char *origin, const char *dest,
+		const char *strings, const trip_ref *trips, const edge_ref *edges,
+		const int *selected, int status) {
+	/* The block is sized by a dry run and then packed straight into the
+	 * buffer, so the record is written once */
+	trip_record *r;
+	int *offs, size = 0, count = station_count();
+	int origin_len = strlen(origin), dest_len = strlen(dest);
+	char *p;
+	if(count+1 > w->offs_len) {
+		metrics_alloc(1);
+		if(!(offs = realloc(w->offs, sizeof(int)*(count+1)))) {
+			return E_UNKNOWN;
+		}
+		w->offs = offs;
+		w->offs_len = count+1;
+	}
+	if(status >= 0) {
+		size = WRITER_ALIGN(pack_selection(NULL, w->offs, count, strings,
+				trips, edges, selected, status));
+	}
+	size += sizeof(trip_record) + WRITER_ALIGN(origin_len+dest_len+2);
+	if(!(p = reserve(w, size))) {
+		return E_SEND;
+	}
+	memset(p, 0, size);
+	r = (trip_record*)p;
+	r->size = size;
+	r->status = status;
+	r->origin_len = origin_len;
+	r->dest_len = dest_len;
+	memcpy(TRIP_RECORD_ORIGIN(r), origin, origin_len);
+	memcpy(TRIP_RECORD_DEST(r), dest, dest_len);
+	if(status >= 0) {
+		pack_selection(TRIP_RECORD_BLOCK(r), w->offs, count, strings, trips,
+				edges, selected, status);
+	}
+	return commit(w, p+size);
+}
+/*****************************************************************************/
+int writer_result(tsl_writer *w, const char *origin, const char *dest,
+		const char *strings, const trip_ref *trips, const edge_ref *edges,
+		const int *selected, int status) {
+	int retval = w->format == WRITE_NDJSON
+			? write_ndjson(w, origin, dest, strings, trips, edges, selected,
+				status)
+			: w->format == WRITE_BINARY
+			? write_binary(w, origin, dest, strings, trips, edges, selected,
+				status)
+			: write_text(w, origin, dest, strings, trips, edges, selected,
+				status);
+	/* Without a file the only way to fail is to run out of memory */
+	return retval && w->fd < 0 ? E_UNKNOWN : retval;
+}
+/*****************************************************************************/
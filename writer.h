@@ -0,0 +1,134 @@
+/******************************************************************************
+*     File Name           :     writer.h                                      *
+*     Description         :     Buffered output of trips as text, NDJSON or   *
+*                                 binary records.                             *
+******************************************************************************/
+#ifndef WRITER_H
+#define WRITER_H
+#include "triplist.h"           // trip_ref, edge_ref, trip_block
+/*****************************************************************************/
+#define WRITER_SIZE 65536 		// Bytes buffered before they are written
+#define WRITER_ALIGN(n) (((n)+3) & ~3)	// Records start on int boundaries
+/*****************************************************************************/
+/* Formats of results */
+enum writer_format {
+	WRITE_TEXT,					// As printed by print_selection.
+	WRITE_NDJSON,				// One json object per trip and line.
+	WRITE_BINARY				// One trip_record per query.
+};
+/******************************************************************************
+* Struct: tsl_writer                                                          *
+* ------------------                                                          *
+*   Output formatted by hand into one buffer, which is written out with       *
+*   write when the next piece does not fit. Once the buffer and the scratch   *
+*   space have grown to fit the largest result nothing is allocated.          *
+*                                                                             *
+*   buf: Bytes not written yet.                                               *
+*   fd: Where they are written, -1 to keep everything in buf.                 *
+*   format: An enum writer_format.                                            *
+*   headers: Text results start with a "<origin> -> <dest>" line.             *
+*   change: An enum trip_change the trips are marked with, in text by a       *
+*           "+ ", "- " or "~ " before the duration and in NDJSON by a         *
+*           "change" field, TRIP_SAME for no mark.                            *
+*   offs: Scratch space of pack_selection.                                    *
+*   offs_len: Number of ints in offs.                                         *
+*   bytes: Bytes appended since writer_init.                                  *
+******************************************************************************/
+typedef struct tsl_writer {
+	tsl_buf buf;
+	int fd; int format; int headers; int change;
+	int *offs; int offs_len;
+	long bytes;
+} tsl_writer;
+/******************************************************************************
+* Struct: trip_record                                                         *
+* -------------------                                                         *
+*   Result of one query in the binary format: this header, the names of the   *
+*   query '\0' terminated and padded to WRITER_ALIGN, and when it succeeded   *
+*   the trips as a trip_block. The block is the one the cache stores, in the  *
+*   byte order of the machine, and is read with the TRIP_BLOCK macros.        *
+*                                                                             *
+*   size: Bytes of the whole record, a multiple of 4.                         *
+*   status: Number of trips, or an error number.                              *
+*   origin_len: Length of the origin.                                         *
+*   dest_len: Length of the destination.                                      *
+******************************************************************************/
+typedef struct trip_record {
+	int size; int status;
+	int origin_len; int dest_len;
+} trip_record;
+#define TRIP_RECORD_ORIGIN(r) ((char*)((r)+1))
+#define TRIP_RECORD_DEST(r) (TRIP_RECORD_ORIGIN(r)+(r)->origin_len+1)
+#define TRIP_RECORD_BLOCK(r) ((trip_block*)(TRIP_RECORD_ORIGIN(r) \
+		+ WRITER_ALIGN((r)->origin_len+(r)->dest_len+2)))
+/******************************************************************************
+* Function: writer_init                                                       *
+* ---------------------                                                       *
+*   Initializes a writer with a buffer of WRITER_SIZE bytes.                  *
+*                                                                             *
+*   w: Pointer to the writer.                                                 *
+*   fd: File descriptor results are written to, -1 to keep them in memory.    *
+*   format: An enum writer_format.                                            *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int writer_init(tsl_writer *w, int fd, int format);
+/******************************************************************************
+* Function: writer_free                                                       *
+* ---------------------                                                       *
+*   Frees the buffers of a writer. Bytes not flushed are lost.                *
+*                                                                             *
+*   w: Pointer to the writer.                                                 *
+******************************************************************************/
+void writer_free(tsl_writer *w);
+/******************************************************************************
+* Function: writer_flush                                                      *
+* ----------------------                                                      *
+*   Writes out the buffered bytes. A writer kept in memory is left alone.     *
+*                                                                             *
+*   w: Pointer to the writer.                                                 *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_SEND when the bytes can not be written, they are dropped.      *
+******************************************************************************/
+int writer_flush(tsl_writer *w);
+/******************************************************************************
+* Function: writer_put                                                        *
+* --------------------                                                        *
+*   Appends bytes as they are, such as results formatted by another writer.   *
+*                                                                             *
+*   w: Pointer to the writer.                                                 *
+*   data: The bytes.                                                          *
+*   len: Number of bytes.                                                     *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_SEND when earlier bytes can not be written.                    *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int writer_put(tsl_writer *w, const char *data, int len);
+/******************************************************************************
+* Function: writer_result                                                     *
+* -----------------------                                                     *
+*   Appends the result of a query in the format of the writer. A failed       *
+*   query is a header alone in text, an "error" object in NDJSON and a        *
+*   record without a block in binary.                                         *
+*                                                                             *
+*   w: Pointer to the writer.                                                 *
+*   origin: Station where travel starts.                                      *
+*   dest: Station where travel ends.                                          *
+*   strings: Json string of a triplist, or the pool of a trip_block.          *
+*   trips: Array of trips.                                                    *
+*   edges: Array of edges of the trips.                                       *
+*   selected: Indexes of the trips to write, NULL for the first ones.         *
+*   status: Number of trips to write, or the error number of the query.       *
+*                                                                             *
+*   Returns: E_SUCCESS if successful.                                         *
+*            E_SEND when earlier bytes can not be written.                    *
+*            E_UNKNOWN when memory runs out.                                  *
+******************************************************************************/
+int writer_result(tsl_writer *w, const char *origin, const char *dest,
+		const char *strings, const trip_ref *trips, const edge_ref *edges,
+		const int *selected, int status);
+/*****************************************************************************/
+#endif /* WRITER_H */